@@ -1,8 +1,222 @@
 #ifndef MSF_I2C_H_
 #define MSF_I2C_H_
 
-void init_i2c(void);
-uint8_t i2c_send(uint8_t, uint8_t*, uint8_t);
-uint8_t i2c_read(uint8_t, uint8_t*, uint8_t);
+#include <stdint.h>
+#ifdef I2C_RING
+#include "i2c_ring.h"
+#endif
 
-#endif /* MSF_I2C_H_ */
\ No newline at end of file
+// MSF_SAMD11_I2C.c is polled only, the device pack defines the part
+#if !defined(I2C_SAMD11) && (defined(__SAMD11C14A__) || defined(__SAMD11D14AM__) || defined(__SAMD11D14AS__) || defined(__SAMD11D14AU__))
+#define I2C_SAMD11
+#endif
+
+// Transaction status codes
+#define I2C_STATUS_OK		0	// Transaction completed
+#define I2C_STATUS_PENDING	1	// Transaction queued or on the bus
+#define I2C_STATUS_BUSY		2	// Driver already owns a transaction
+#define I2C_STATUS_NACK		3	// Address or data byte not acknowledged
+#define I2C_STATUS_BUSERR	4	// Misplaced START/STOP seen on the bus
+#define I2C_STATUS_ARBLOST	5	// Another master won arbitration
+#define I2C_STATUS_TIMEOUT	6	// Bus or peripheral stopped responding
+#define I2C_STATUS_INVALID	7	// Request does not fit the driver, nothing was sent
+#define I2C_STATUS_PEC		8	// SMBus PEC or block count check failed, see i2c_smbus.c
+
+// Bus speed modes, CTRLA.SPEED
+#define I2C_SPEED_FAST		0	// Standard and Fast mode, up to 400KHz
+#define I2C_SPEED_FASTPLUS	1	// Fast mode plus, up to 1MHz
+#define I2C_SPEED_HIGH		2	// High speed mode, up to 3.4MHz
+
+/*
+	Baud register values, usable in #if and as constants for i2c_set_speed
+	fSCL = fGCLK / (10 + 2 * BAUD + fGCLK * Trise)
+	fSCL = fGCLK / (2 + 2 * HSBAUD) in high speed mode, master code goes out at 400KHz
+	Both round up, so SCL lands at or below scl. I2C_BAUD_CYCLES gives the
+	resulting SCL period in GCLK cycles for checking that in #if.
+*/
+#define I2C_DIV_CEIL(a, b)					(((a) + (b) - 1) / (b))
+#define I2C_TRISE_CYCLES(gclk, trise_ns)	(((gclk) * 1ULL * (trise_ns)) / 1000000000ULL)
+#define I2C_BAUD_VALUE(gclk, scl, trise_ns)	((I2C_DIV_CEIL(gclk, scl) - 10 - I2C_TRISE_CYCLES(gclk, trise_ns) + 1) / 2)
+#define I2C_HSBAUD_VALUE(gclk, scl)			((I2C_DIV_CEIL(gclk, scl) - 2 + 1) / 2)
+#define I2C_BAUD_CYCLES(gclk, baud, trise_ns)	(10 + (2 * (baud)) + I2C_TRISE_CYCLES(gclk, trise_ns))
+#define I2C_HSBAUD_CYCLES(hsbaud)			(2 + (2 * (hsbaud)))
+#define I2C_SPEED_FOR(scl)					(((scl) > 1000000UL) ? I2C_SPEED_HIGH : (((scl) > 400000UL) ? I2C_SPEED_FASTPLUS : I2C_SPEED_FAST))
+#define I2C_BAUD_REG(gclk, scl, trise_ns)	(((scl) > 1000000UL) ? \
+	(I2C_BAUD_VALUE(gclk, 400000UL, trise_ns) | (I2C_HSBAUD_VALUE(gclk, scl) << 16)) : \
+	I2C_BAUD_VALUE(gclk, scl, trise_ns))
+
+typedef struct i2c_transaction i2c_transaction_t;
+
+/**
+	@brief Asynchronous transaction descriptor
+	@details Write phase runs first. If rlen is non zero the bus is turned
+	around with a repeated start and rlen bytes are read. Descriptor must stay
+	valid until status leaves I2C_STATUS_PENDING.
+*/
+struct i2c_transaction
+{
+	uint8_t addr;							// 7 bit I2C address
+	uint8_t *wdata;							// Data to write
+	uint16_t wlen;							// Number of bytes to write
+	uint8_t *rdata;							// Array to store read data
+	uint16_t rlen;							// Number of bytes to read
+	volatile uint8_t status;				// I2C_STATUS_*
+	void (*callback)(i2c_transaction_t *);	// Completion callback, runs in interrupt context, may be 0
+	void *context;							// Free for caller use
+};
+
+/**
+	@brief Scatter-gather segment
+	@details One piece of a vectored transfer, see i2c_sendv and i2c_readv.
+	Segments are walked in place, zero length segments are skipped.
+*/
+typedef struct
+{
+	uint8_t *data;
+	uint16_t len;
+} i2c_iovec_t;
+
+/**
+	@brief Bus recovery bookkeeping, see i2c_recover
+*/
+typedef struct
+{
+	uint16_t count;		// Recoveries run since power up
+	uint8_t clocks;		// SCL pulses the last recovery needed before SDA was released
+	uint32_t latency;	// I2C_STATS_NOW ticks the last recovery took, from the call to BUSSTATE IDLE, 0 without I2C_STATS
+} i2c_recovery_t;
+
+#ifdef I2C_STATS
+#ifndef I2C_STATS_BINS
+#define I2C_STATS_BINS		24		// Enough for the 24 bit SysTick
+#endif
+
+/**
+	@brief Bus performance counters, see i2c_stats
+	@details Built only with I2C_STATS defined. Latency is in I2C_STATS_NOW
+	ticks from the call that started the transaction to its STOP, bin n holds
+	transactions that took 2^n to 2^(n+1)-1 ticks. Counters wrap.
+*/
+typedef struct
+{
+	uint32_t transactions;				// Transactions finished, any result
+	uint32_t bytes;						// Payload bytes of transactions that finished OK
+	uint16_t nacks;
+	uint16_t arblost;
+	uint16_t timeouts;
+	uint16_t buserr;
+	uint16_t resets;					// Bus recoveries run
+	uint16_t arb_retries;				// Lost arbitrations re-issued, arblost counts the ones that gave up
+	uint32_t arb_wait_max;				// Longest wait for the bus to go idle after a lost arbitration, polled calls
+	uint32_t arb_wait_total;			// Sum of those waits
+	uint16_t latency[I2C_STATS_BINS];	// log2 latency histogram
+} i2c_stats_t;
+#endif
+
+#ifdef I2C_LINUX
+#ifndef I2C_LINUX_BATCH
+#define I2C_LINUX_BATCH		21		// Submitted transactions per I2C_RDWR, two messages each within the kernel's 42
+#endif
+
+/**
+	@brief I2C bus handle, Linux i2c-dev backend
+	@details One per /dev/i2c-N adapter, see i2c_linux.c. Fill adapter with
+	I2C_BUS_INIT, init_i2c opens it. Only one thread may use a bus.
+*/
+typedef struct
+{
+	uint8_t adapter;						// N of /dev/i2c-N
+	int fd;									// Adapter file, -1 until init_i2c opens it
+	unsigned long funcs;					// I2C_FUNCS bits of the adapter
+	uint32_t syscalls;						// ioctl calls made on the adapter, wraps
+	// Driver state
+	i2c_transaction_t *pending[I2C_LINUX_BATCH];	// Submitted transactions, run by the next i2c_isr
+	uint8_t count;							// Transactions in pending
+	i2c_recovery_t recovery;				// Stays zero, the kernel adapter driver recovers the bus
+#ifdef I2C_STATS
+	i2c_stats_t stats;						// See i2c_stats
+	uint32_t stamp;							// I2C_STATS_NOW when the transaction started
+#endif
+} i2c_bus_t;
+
+#define I2C_BUS_INIT(n) \
+	{ .adapter = (n), .fd = -1 }
+#else
+/**
+	@brief I2C bus handle
+	@details One per SERCOM used as a master. Fill the board fields with
+	I2C_BUS_INIT, driver state starts zeroed. Build with I2C_SINGLE_BUS set to
+	the register block of the only bus (e.g. SERCOM0_REGS, SERCOM0 on older
+	packs) and register access resolves at compile time.
+*/
+typedef struct
+{
+	uint8_t sercom;							// SERCOM instance number
+	uint8_t gclk;							// Generic clock generator feeding the core clock
+	uint8_t sda;							// PA pin number of SDA, PAD[0]
+	uint8_t scl;							// PA pin number of SCL, PAD[1]
+	uint8_t pmux;							// Peripheral function of the pins
+	uint8_t speed;							// I2C_SPEED_* mode
+	uint32_t baud;							// BAUD register value
+	// Driver state
+	i2c_transaction_t * volatile active;	// Submitted transaction on the bus
+	uint16_t index;							// Bytes moved in the current phase
+	volatile uint8_t dma_mode;				// DMA transfer on the bus
+	uint32_t hs;							// ADDR.HS bit when in high speed mode
+	uint8_t arb_tries;						// Re-issues left for the submitted transaction after lost arbitration
+	i2c_recovery_t recovery;				// See i2c_recover
+#ifdef I2C_STATS
+	i2c_stats_t stats;						// See i2c_stats
+	uint32_t stamp;							// I2C_STATS_NOW when the transaction started
+#endif
+#ifdef I2C_RING
+	i2c_ring_t *ring;						// Completion records of submitted transactions, may be 0
+#endif
+#ifdef I2C_SMBUS
+	uint8_t smbus;							// I2C_SMBUS_* flags for the polled call in progress
+	uint8_t pec;							// CRC-8 of every byte on the bus since i2c_smbus.c cleared it
+#endif
+} i2c_bus_t;
+
+#define I2C_BUS_INIT(n, gen, sda_pin, scl_pin, mux, gclk_hz, scl_hz, trise_ns) \
+	{ .sercom = (n), .gclk = (gen), .sda = (sda_pin), .scl = (scl_pin), .pmux = (mux), \
+	  .speed = I2C_SPEED_FOR(scl_hz), .baud = I2C_BAUD_REG(gclk_hz, scl_hz, trise_ns) }
+#endif
+
+// Presence map filled by i2c_scan, one bit per 7 bit address
+#define I2C_SCAN_MAP_SIZE			16
+#define I2C_SCAN_PRESENT(map, addr)	(((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+// Default bus, board settings at the top of the driver
+extern i2c_bus_t i2c_bus0;
+
+void init_i2c(i2c_bus_t*);
+uint8_t i2c_send(i2c_bus_t*, uint8_t, uint8_t*, uint16_t);
+uint8_t i2c_read(i2c_bus_t*, uint8_t, uint8_t*, uint16_t);
+uint8_t i2c_write_read(i2c_bus_t*, uint8_t, uint8_t*, uint16_t, uint8_t*, uint16_t);
+uint8_t i2c_sendv(i2c_bus_t*, uint8_t, const i2c_iovec_t*, uint8_t);
+uint8_t i2c_readv(i2c_bus_t*, uint8_t, const i2c_iovec_t*, uint8_t);
+uint8_t i2c_set_speed(i2c_bus_t*, uint8_t, uint32_t);
+uint8_t i2c_recover(i2c_bus_t*);
+void i2c_recovery_stats(i2c_bus_t*, i2c_recovery_t*);
+uint8_t i2c_scan(i2c_bus_t*, const uint8_t*, uint8_t, uint8_t*);
+
+#ifdef I2C_STATS
+// Performance counters
+void i2c_stats(i2c_bus_t*, i2c_stats_t*, uint8_t);
+#endif
+
+#ifndef I2C_SAMD11
+// Interrupt engine, not in MSF_SAMD11_I2C.c
+uint8_t i2c_submit(i2c_bus_t*, i2c_transaction_t*);
+uint8_t i2c_busy(i2c_bus_t*);
+void i2c_isr(i2c_bus_t*);	// Call from SERCOMn_Handler, or the main loop on Linux
+
+// DMA transfers, build with I2C_DMA defined
+uint8_t i2c_send_dma(i2c_bus_t*, i2c_transaction_t*);
+uint8_t i2c_read_dma(i2c_bus_t*, i2c_transaction_t*);
+uint8_t i2c_send_dmav(i2c_bus_t*, i2c_transaction_t*, const i2c_iovec_t*, uint8_t);
+uint8_t i2c_read_dmav(i2c_bus_t*, i2c_transaction_t*, const i2c_iovec_t*, uint8_t);
+#endif
+
+#endif /* MSF_I2C_H_ */
@@ -9,128 +9,889 @@
 #include <sam.h>
 #include "MSF_I2C.h"
 
-/*
-	create a function to check for SB and MB intflags
-	this function should timeout correctly
+#ifndef I2C_SAMD11
+#error "Build MSF_SAMD11_I2C.c for a SAMD11 part or with I2C_SAMD11 defined, so MSF_I2C.h leaves out i2c_submit and DMA"
+#endif
+
+#ifndef I2C_GCLK_HZ
+#define I2C_GCLK_HZ			8000000UL	//GCLK0 feeding SERCOM0 core
+#endif
+#ifndef I2C_SCL_HZ
+#define I2C_SCL_HZ			400000UL
+#endif
+#ifndef I2C_TRISE_NS
+#define I2C_TRISE_NS		0
+#endif
+#define I2C_FS_HZ			((I2C_SCL_HZ > 1000000UL) ? 400000UL : I2C_SCL_HZ)	//Standard, fast or fast plus SCL, the master code rate in high speed mode
+#if (I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS) < 1) || (I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS) > 255)
+#error "I2C_SCL_HZ too fast or too slow for I2C_GCLK_HZ"
+#endif
+#if (I2C_BAUD_CYCLES(I2C_GCLK_HZ, I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS), I2C_TRISE_NS) * I2C_FS_HZ) < I2C_GCLK_HZ
+#error "BAUD would run SCL above I2C_SCL_HZ"
+#endif
+#if (I2C_SCL_HZ > 3400000UL) || ((I2C_SCL_HZ > 1000000UL) && ((I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ) < 1) || (I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ) > 255)))
+#error "I2C_SCL_HZ out of range for high speed mode"
+#endif
+#if (I2C_SCL_HZ > 1000000UL) && ((I2C_HSBAUD_CYCLES(I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ)) * I2C_SCL_HZ) < I2C_GCLK_HZ)
+#error "HSBAUD would run SCL above I2C_SCL_HZ"
+#endif
+
+#ifndef I2C_TIMEOUT
+#define I2C_TIMEOUT			20000	//Poll loops before a wait gives up
+#endif
+#ifndef I2C_SCAN_TIMEOUT
+#define I2C_SCAN_TIMEOUT	500		//Poll loops for an i2c_scan probe, about 200uS at 8MHz
+#endif
+#ifndef I2C_ARB_RETRIES
+#define I2C_ARB_RETRIES		3		//Re-issues after a lost arbitration before I2C_STATUS_ARBLOST is returned
+#endif
+#ifndef I2C_ARB_TIMEOUT
+#define I2C_ARB_TIMEOUT		50000	//Poll loops waiting for the winning master's STOP, about 20mS at 8MHz
+#endif
+#ifndef I2C_RECOVERY_DELAY
+#define I2C_RECOVERY_DELAY	8		//Loops per half SCL period while bit banging, about 100KHz at 8MHz
+#endif
+#ifndef I2C_SDA_PIN
+#define I2C_SDA_PIN			14		//PA14, SERCOM0 PAD0
+#endif
+#ifndef I2C_SCL_PIN
+#define I2C_SCL_PIN			15		//PA15, SERCOM0 PAD1
+#endif
+
+#ifdef I2C_STATS
+#ifndef I2C_STATS_NOW
+#define I2C_STATS_NOW()					(SysTick->VAL)		//Free running SysTick, LOAD = 0xFFFFFF
+#endif
+#ifndef I2C_STATS_ELAPSED
+#define I2C_STATS_ELAPSED(start, now)	(((start) - (now)) & 0xFFFFFFUL)	//SysTick counts down
+#endif
+#define I2C_STATS_START(bus)				((bus)->stamp = I2C_STATS_NOW())
+#define I2C_STATS_END(bus, result, bytes)	i2c_stats_record((bus), (result), (bytes))
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes);
+#else
+#define I2C_STATS_START(bus)
+#define I2C_STATS_END(bus, result, bytes)	((void)(bytes))
+#endif
+
+#ifdef I2C_TRACE
+#include "i2c_trace.h"
+#define I2C_TRACE_EVENT(bus, type, data)	i2c_trace_event((bus)->sercom, (type), (data))
+#define I2C_TRACE_RESULT(bus, result)		i2c_trace_result((bus)->sercom, (result))
+#define I2C_TRACE_ADDR(bus, hw, byte)		i2c_trace_addr((bus), (hw), (byte))
+static void i2c_trace_addr(i2c_bus_t *bus, Sercom *hw, uint8_t byte);
+#else
+#define I2C_TRACE_EVENT(bus, type, data)
+#define I2C_TRACE_RESULT(bus, result)
+#define I2C_TRACE_ADDR(bus, hw, byte)
+#endif
+
+#ifdef I2C_SMBUS
+#include "i2c_smbus.h"
+#define I2C_PEC(bus, byte)	((bus)->pec = I2C_PEC_UPDATE((bus)->pec, (byte)))
+#else
+#define I2C_PEC(bus, byte)
+#endif
+
+#ifdef I2C_SINGLE_BUS
+#define I2C_HW(bus)	((void)(bus), I2C_SINGLE_BUS)
+#else
+//SERCOM register blocks by instance number
+static Sercom * const i2c_sercom[SERCOM_INST_NUM] =
+{
+#ifdef SERCOM0
+	SERCOM0,
+#endif
+#ifdef SERCOM1
+	SERCOM1,
+#endif
+#ifdef SERCOM2
+	SERCOM2,
+#endif
+};
+#define I2C_HW(bus)	(i2c_sercom[(bus)->sercom])
+#endif
+
+i2c_bus_t i2c_bus0 = I2C_BUS_INIT(0, 0, I2C_SDA_PIN, I2C_SCL_PIN, 0x2, I2C_GCLK_HZ, I2C_SCL_HZ, I2C_TRISE_NS);
+
+static uint8_t i2c_wait_sync(Sercom *hw, uint32_t mask);
+
+/**
+	@brief I2C Pin Mux
+	@details Hand SDA and SCL to the SERCOM with a single WRCONFIG write per pin
+	@param[in] bus I2C bus handle
 */
+static void i2c_pin_mux(i2c_bus_t *bus)
+{
+	uint8_t pins[2] = { bus->sda, bus->scl };
+	
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		//WRCONFIG reaches 16 pins at a time, HWSEL picks the upper half
+		PORT->Group[0].WRCONFIG.reg =
+			(PORT_WRCONFIG_WRPINCFG | PORT_WRCONFIG_WRPMUX | PORT_WRCONFIG_PMUX(bus->pmux) | PORT_WRCONFIG_PMUXEN |
+			((pins[i] > 15) ? PORT_WRCONFIG_HWSEL : 0) | PORT_WRCONFIG_PINMASK(1UL << (pins[i] & 0xF)));
+	}
+}
 
 /**
 	@brief Init I2C
 	@details Function to initialize I2C bus on device.
+	@param[in] bus I2C bus handle
 */
-void init_i2c(void)
+void init_i2c(i2c_bus_t *bus)
 {
+	Sercom *hw = I2C_HW(bus);
+	
 	//PM
-	PM->APBCMASK.reg |= PM_APBCMASK_SERCOM0;
+	PM->APBCMASK.reg |= (PM_APBCMASK_SERCOM0 << bus->sercom);
 	
 	//GCLK
 	GCLK->CLKCTRL.reg =
-	(GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_ID_SERCOM0_CORE | GCLK_CLKCTRL_GEN_GCLK0);
+	(GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_ID(GCLK_CLKCTRL_ID_SERCOM0_CORE + bus->sercom) | GCLK_CLKCTRL_GEN(bus->gclk));
 	
-	//Master Mode with 400KHz speed
-	SERCOM0->I2CM.CTRLA.reg = (SERCOM_I2CM_CTRLA_MODE_I2C_MASTER | SERCOM_I2CM_CTRLA_SPEED(0));
+	//Master Mode
+	hw->I2CM.CTRLA.reg = (SERCOM_I2CM_CTRLA_MODE_I2C_MASTER | SERCOM_I2CM_CTRLA_SPEED(bus->speed));
+	hw->I2CM.CTRLA.bit.LOWTOUTEN = 1;
 	
-	//Set baud rate, Should be 400KHz at 8MHz GCLK
-	SERCOM0->I2CM.BAUD.bit.BAUD = 5;
-	SERCOM0->I2CM.BAUD.bit.BAUDLOW = 5;
+	//Set baud rate, BAUD 5 is 400KHz at 8MHz GCLK
+	hw->I2CM.BAUD.reg = bus->baud;
+	bus->hs = (bus->speed == I2C_SPEED_HIGH) ? SERCOM_I2CM_ADDR_HS : 0;
 	
 	//Enable Smart Mode
-	SERCOM0->I2CM.CTRLB.reg = (SERCOM_I2CM_CTRLB_SMEN);
+	hw->I2CM.CTRLB.reg = (SERCOM_I2CM_CTRLB_SMEN);
 	
 	//IO lines
-	PORT->Group[0].WRCONFIG.reg = 
-		(PORT_WRCONFIG_WRPINCFG | PORT_WRCONFIG_WRPMUX | PORT_WRCONFIG_PMUX(0x2) | PORT_WRCONFIG_PMUXEN | PORT_PA14 | PORT_PA15);
+	i2c_pin_mux(bus);
 	
 	//Enable I2C
-	while(SERCOM0->I2CM.SYNCBUSY.bit.ENABLE);
-	SERCOM0->I2CM.CTRLA.bit.ENABLE = 1;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE);
+	hw->I2CM.CTRLA.bit.ENABLE = 1;
 	
 	//Force Idle Bus State
-	while(SERCOM0->I2CM.SYNCBUSY.bit.SYSOP);
-	SERCOM0->I2CM.STATUS.bit.BUSSTATE = 0x1;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+	hw->I2CM.STATUS.bit.BUSSTATE = 0x1;
 	
 	//Enable interrupts for master on bus and slave on bus
-	//SERCOM0->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB | SERCOM_I2CM_INTENSET_SB;
+	//hw->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB | SERCOM_I2CM_INTENSET_SB;
 }
 
 /**
-	@brief I2C Send
-	@details Send array of bytes to I2C device
+	@brief I2C Wait Sync
+	@details Bounded wait for SYNCBUSY bits to clear
+	@param[in] hw SERCOM registers
+	@param[in] mask SYNCBUSY bits to wait on
+	@returns I2C_STATUS_OK or I2C_STATUS_TIMEOUT
+*/
+static uint8_t i2c_wait_sync(Sercom *hw, uint32_t mask)
+{
+	uint32_t timeout = I2C_TIMEOUT;
+	
+	while(hw->I2CM.SYNCBUSY.reg & mask)
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_TIMEOUT;
+		}
+	}
+	
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Set Speed
+	@details Switch bus speed between transactions
+	@param[in] bus I2C bus handle
+	@param[in] speed I2C_SPEED_* mode, see I2C_SPEED_FOR
+	@param[in] baud BAUD register value, see I2C_BAUD_REG
+	@returns I2C_STATUS_OK or I2C_STATUS_TIMEOUT
+*/
+uint8_t i2c_set_speed(i2c_bus_t *bus, uint8_t speed, uint32_t baud)
+{
+	Sercom *hw = I2C_HW(bus);
+	
+	//SPEED and BAUD are enable protected
+	hw->I2CM.CTRLA.bit.ENABLE = 0;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE);
+	hw->I2CM.CTRLA.bit.SPEED = speed;
+	hw->I2CM.BAUD.reg = baud;
+	bus->speed = speed;
+	bus->baud = baud;
+	bus->hs = (speed == I2C_SPEED_HIGH) ? SERCOM_I2CM_ADDR_HS : 0;
+	
+	hw->I2CM.CTRLA.bit.ENABLE = 1;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE);
+	if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP) != I2C_STATUS_OK)
+	{
+		return I2C_STATUS_TIMEOUT;
+	}
+	hw->I2CM.STATUS.bit.BUSSTATE = 0x1;
+	
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Wait Flag
+	@details Bounded wait for MB/SB, then decode STATUS for the byte that just finished
+	@param[in] hw SERCOM registers
+	@param[in] flags INTFLAG bits to wait on
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK, I2C_STATUS_ARBLOST, I2C_STATUS_BUSERR or I2C_STATUS_TIMEOUT
+*/
+static uint8_t i2c_wait_flag(Sercom *hw, uint8_t flags)
+{
+	uint32_t timeout = I2C_TIMEOUT;
+	
+	while(!(hw->I2CM.INTFLAG.reg & flags))
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_TIMEOUT;
+		}
+	}
+	
+	//A bus error while owning the bus sets ARBLOST too, it needs a recovery rather than a re-issue
+	if (hw->I2CM.STATUS.bit.BUSERR)
+	{
+		return I2C_STATUS_BUSERR;
+	}
+	if (hw->I2CM.STATUS.bit.ARBLOST)
+	{
+		return I2C_STATUS_ARBLOST;
+	}
+	if (hw->I2CM.STATUS.bit.RXNACK)
+	{
+		return I2C_STATUS_NACK;
+	}
+	
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Recovery Delay
+	@details Half SCL period while bit banging
+*/
+static void i2c_recovery_delay(void)
+{
+	for (volatile uint16_t i = I2C_RECOVERY_DELAY; i; i--);
+}
+
+#ifdef I2C_TRACE
+/**
+	@brief I2C Trace Address
+	@details Record the START, or RESTART if the bus is already owned, and
+	the address byte about to be written to ADDR
+	@param[in] bus I2C bus handle
+	@param[in] hw SERCOM registers
+	@param[in] byte Address byte with the R/W bit
+*/
+static void i2c_trace_addr(i2c_bus_t *bus, Sercom *hw, uint8_t byte)
+{
+	i2c_trace_event(bus->sercom, (hw->I2CM.STATUS.bit.BUSSTATE == 0x2) ? I2C_TRACE_RESTART : I2C_TRACE_START, 0);
+	i2c_trace_event(bus->sercom, I2C_TRACE_TX, byte);
+}
+#endif
+
+/**
+	@brief I2C Recover
+	@details Free a bus held by a stuck peripheral. Clocks SCL up to 9 times
+	until SDA is released, bit bangs a STOP and forces the bus state to IDLE.
+	@param[in] bus I2C bus handle
+	@returns I2C_STATUS_OK if SDA was released, I2C_STATUS_BUSERR otherwise
+*/
+uint8_t i2c_recover(i2c_bus_t *bus)
+{
+	Sercom *hw = I2C_HW(bus);
+	uint32_t sda = (1UL << bus->sda);
+	uint32_t scl = (1UL << bus->scl);
+	uint8_t clocks = 0;
+#ifdef I2C_STATS
+	uint32_t start = I2C_STATS_NOW();
+#endif
+	
+	//Controller off, pins become open drain GPIO: DIR set drives low, DIR clear releases
+	hw->I2CM.CTRLA.bit.ENABLE = 0;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE);
+	PORT->Group[0].OUTCLR.reg = (sda | scl);
+	PORT->Group[0].DIRCLR.reg = (sda | scl);
+	PORT->Group[0].PINCFG[bus->sda].reg = PORT_PINCFG_INEN;
+	PORT->Group[0].PINCFG[bus->scl].reg = PORT_PINCFG_INEN;
+	i2c_recovery_delay();
+	
+	//Clock out whatever the peripheral thinks it is still sending
+	while (!(PORT->Group[0].IN.reg & sda) && (clocks < 9))
+	{
+		PORT->Group[0].DIRSET.reg = scl;
+		i2c_recovery_delay();
+		PORT->Group[0].DIRCLR.reg = scl;
+		i2c_recovery_delay();
+		clocks++;
+	}
+	
+	//STOP, SDA rising while SCL is high
+	PORT->Group[0].DIRSET.reg = scl;
+	i2c_recovery_delay();
+	PORT->Group[0].DIRSET.reg = sda;
+	i2c_recovery_delay();
+	PORT->Group[0].DIRCLR.reg = scl;
+	i2c_recovery_delay();
+	PORT->Group[0].DIRCLR.reg = sda;
+	i2c_recovery_delay();
+	
+	//IO lines back to the SERCOM, force idle bus state
+	i2c_pin_mux(bus);
+	hw->I2CM.CTRLA.bit.ENABLE = 1;
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+	hw->I2CM.STATUS.bit.BUSSTATE = 0x1;
+	
+	bus->recovery.count++;
+	bus->recovery.clocks = clocks;
+	I2C_TRACE_EVENT(bus, I2C_TRACE_RESET, clocks);
+#ifdef I2C_STATS
+	bus->recovery.latency = I2C_STATS_ELAPSED(start, I2C_STATS_NOW());
+	bus->stats.resets++;
+#endif
+	
+	return (PORT->Group[0].IN.reg & sda) ? I2C_STATUS_OK : I2C_STATUS_BUSERR;
+}
+
+/**
+	@brief I2C Recovery Stats
+	@param[in] bus I2C bus handle
+	@param[out] stats Number of recoveries run, SCL pulses and time the last one needed
+*/
+void i2c_recovery_stats(i2c_bus_t *bus, i2c_recovery_t *stats)
+{
+	*stats = bus->recovery;
+}
+
+/**
+	@brief I2C Arbitration Wait
+	@details The controller lets go of SDA and SCL as soon as it loses
+	arbitration, so there is nothing to recover. Wait for the winning
+	master's STOP to bring BUSSTATE back to IDLE before trying again.
+	@param[in] bus I2C bus handle
+	@returns I2C_STATUS_OK once the bus is idle, I2C_STATUS_ARBLOST if the other master held it past I2C_ARB_TIMEOUT
+*/
+static uint8_t i2c_arb_wait(i2c_bus_t *bus)
+{
+	Sercom *hw = I2C_HW(bus);
+	uint32_t timeout = I2C_ARB_TIMEOUT;
+#ifdef I2C_STATS
+	uint32_t lost = I2C_STATS_NOW();
+	uint32_t ticks;
+#endif
+	
+	while (hw->I2CM.STATUS.bit.BUSSTATE != 0x1)
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_ARBLOST;
+		}
+	}
+	
+#ifdef I2C_STATS
+	ticks = I2C_STATS_ELAPSED(lost, I2C_STATS_NOW());
+	bus->stats.arb_retries++;
+	bus->stats.arb_wait_total += ticks;
+	if (ticks > bus->stats.arb_wait_max)
+	{
+		bus->stats.arb_wait_max = ticks;
+	}
+#endif
+	
+	return I2C_STATUS_OK;
+}
+
+#ifdef I2C_STATS
+/**
+	@brief I2C Stats Record
+	@details Count a finished transaction and file its latency
+	@param[in] bus I2C bus handle
+	@param[in] result I2C_STATUS_* the transaction ended with
+	@param[in] bytes Payload bytes, counted only when result is I2C_STATUS_OK
+*/
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes)
+{
+	i2c_stats_t *stats = &bus->stats;
+	uint32_t ticks = I2C_STATS_ELAPSED(bus->stamp, I2C_STATS_NOW());
+	uint8_t bin = 0;
+	
+	stats->transactions++;
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+			stats->bytes += bytes;
+			break;
+		case I2C_STATUS_NACK:
+			stats->nacks++;
+			break;
+		case I2C_STATUS_ARBLOST:
+			stats->arblost++;
+			break;
+		case I2C_STATUS_TIMEOUT:
+			stats->timeouts++;
+			break;
+		default:
+			stats->buserr++;
+			break;
+	}
+	
+	//log2 bucket, the last bin also takes everything longer
+	while ((ticks >>= 1) && (bin < (I2C_STATS_BINS - 1)))
+	{
+		bin++;
+	}
+	stats->latency[bin]++;
+}
+
+/**
+	@brief I2C Stats
+	@details Consistent copy of the bus counters, taken with interrupts masked
+	@param[in] bus I2C bus handle
+	@param[out] stats Counters since power up or the last clear
+	@param[in] clear Non zero to zero the counters after the copy
+*/
+void i2c_stats(i2c_bus_t *bus, i2c_stats_t *stats, uint8_t clear)
+{
+	uint32_t primask = __get_PRIMASK();
+	
+	__disable_irq();
+	*stats = bus->stats;
+	if (clear)
+	{
+		bus->stats = (i2c_stats_t){ 0 };
+	}
+	__set_PRIMASK(primask);
+}
+#endif
+
+/**
+	@brief I2C End
+	@details Close a polled transaction according to how it went
+	@param[in] bus I2C bus handle
+	@param[in] result I2C_STATUS_* of the transaction so far
+	@param[in] bytes Payload bytes of the transaction, for I2C_STATS
+	@returns result
+*/
+static uint8_t i2c_end(i2c_bus_t *bus, uint8_t result, uint32_t bytes)
+{
+	Sercom *hw = I2C_HW(bus);
+	
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+		case I2C_STATUS_NACK:
+			//Still own the bus, release it
+			if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP) == I2C_STATUS_OK)
+			{
+				hw->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
+				I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+				break;
+			}
+			result = I2C_STATUS_TIMEOUT;
+			// fall through
+		case I2C_STATUS_TIMEOUT:
+		case I2C_STATUS_BUSERR:
+			i2c_recover(bus);
+			break;
+		default:
+			//Lost arbitration, the other master owns the bus
+			break;
+	}
+	
+	I2C_STATS_END(bus, result, bytes);
+	
+	return result;
+}
+
+/**
+	@brief I2C Segment Total
+	@param[in] iov Segments
+	@param[in] count Number of segments
+	@returns Bytes across all segments
+*/
+static uint32_t i2c_iov_total(const i2c_iovec_t *iov, uint8_t count)
+{
+	uint32_t total = 0;
+	
+	while (count--)
+	{
+		total += (iov++)->len;
+	}
+	
+	return total;
+}
+
+/**
+	@brief I2C Write Phase
+	@details Address device and send each segment in turn, leaving the bus
+	owned so the caller can issue a STOP or a repeated start.
+	@param[in] bus I2C bus handle
 	@param[in] i2caddr 7 bit I2C address
-	@param[in] data Data to write to I2C bus
-	@param[in] size Length of the array to write
-	@returns Number of bytes written
+	@param[in] iov Segments to write
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or the error that stopped the transfer
 */
-uint8_t i2c_send(uint8_t i2caddr, uint8_t *data, uint8_t size)
+static uint8_t i2c_write_phase(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
 {
+	Sercom *hw = I2C_HW(bus);
+	uint8_t result;
+	uint8_t *data;
+	uint16_t size;
+	
 	// Set bus to ACK received data
-	SERCOM0->I2CM.CTRLB.reg &= ~SERCOM_I2CM_CTRLB_ACKACT;
+	hw->I2CM.CTRLB.reg &= ~SERCOM_I2CM_CTRLB_ACKACT;
 	
 	//Load write address
-	while(SERCOM0->I2CM.SYNCBUSY.bit.SYSOP);
-	SERCOM0->I2CM.ADDR.reg = ((i2caddr << 1) | 0);
+	result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+	if (result == I2C_STATUS_OK)
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)(i2caddr << 1));
+		I2C_PEC(bus, (uint8_t)(i2caddr << 1));
+		hw->I2CM.ADDR.reg = (((i2caddr << 1) | 0) | bus->hs);
+		result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB);
+	}
+	I2C_TRACE_RESULT(bus, result);
 	
-	while(!(SERCOM0->I2CM.INTFLAG.bit.MB));
-	SERCOM0->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_MB;	
+	//Send each segment in place
+	while ((result == I2C_STATUS_OK) && count--)
+	{
+		data = iov->data;
+		size = iov->len;
+		iov++;
+		
+		while ((result == I2C_STATUS_OK) && size--)
+		{
+			result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+			if (result == I2C_STATUS_OK)
+			{
+				I2C_TRACE_EVENT(bus, I2C_TRACE_TX, *data);
+				I2C_PEC(bus, *data);
+				hw->I2CM.DATA.reg = *data++;
+				result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB);
+			}
+			I2C_TRACE_RESULT(bus, result);
+		}
+	}
 	
-	uint8_t result = 0;
-	for (int i = 0; i < size; i++)
+#ifdef I2C_SMBUS
+	//SMBus PEC closes a write with no read after it, worked out as the bytes went out
+	if ((result == I2C_STATUS_OK) && (bus->smbus & I2C_SMBUS_PEC_TX))
 	{
-		while(SERCOM0->I2CM.SYNCBUSY.bit.SYSOP);
-		SERCOM0->I2CM.DATA.reg = (uint8_t)*data;
-		while(!(SERCOM0->I2CM.INTFLAG.bit.MB));
-		SERCOM0->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_MB;
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+		if (result == I2C_STATUS_OK)
+		{
+			I2C_TRACE_EVENT(bus, I2C_TRACE_TX, bus->pec);
+			hw->I2CM.DATA.reg = bus->pec;
+			result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB);
+		}
+		I2C_TRACE_RESULT(bus, result);
+	}
+#endif
+	
+	return result;
+}
+
+/**
+	@brief I2C Read Phase
+	@details Address device for reading and fill each segment in turn,
+	leaving the bus owned so the caller can issue a STOP.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] iov Segments to fill
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or the error that stopped the transfer
+*/
+static uint8_t i2c_read_phase(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	Sercom *hw = I2C_HW(bus);
+	uint32_t left = i2c_iov_total(iov, count);
+	uint8_t *data = 0;
+	uint16_t size = 0;
+	uint8_t result;
+	
+	//Set controller to ACK reads
+	hw->I2CM.CTRLB.reg &= ~SERCOM_I2CM_CTRLB_ACKACT;
+	
+	//Load read address, a NACK shows up as MB instead of SB
+	result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+	if (result == I2C_STATUS_OK)
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)((i2caddr << 1) | 1));
+		I2C_PEC(bus, (uint8_t)((i2caddr << 1) | 1));
+		hw->I2CM.ADDR.reg = (((i2caddr << 1) | 1) | bus->hs);
+		result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB | SERCOM_I2CM_INTFLAG_SB);
+	}
+	I2C_TRACE_RESULT(bus, result);
+	
+	while ((result == I2C_STATUS_OK) && left)
+	{
+		//Next non empty segment
+		while (!size)
+		{
+			data = iov->data;
+			size = iov->len;
+			iov++;
+		}
+		
+		//NACK the last byte read to end request
+		if (left == 1)
+		{
+			hw->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_ACKACT;
+		}
+		
+		*data = hw->I2CM.DATA.reg;
+		I2C_TRACE_EVENT(bus, I2C_TRACE_RX, *data);
+		I2C_TRACE_EVENT(bus, (left == 1) ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+		I2C_PEC(bus, *data);
+#ifdef I2C_SMBUS
+		if (bus->smbus & I2C_SMBUS_BLOCK)
+		{
+			bus->smbus &= ~I2C_SMBUS_BLOCK;
+			left = i2c_smbus_block_left(bus->smbus, *data, left);
+		}
+#endif
 		data++;
-		result++;
+		size--;
+		if (--left)
+		{
+			result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_SB);
+			if (result != I2C_STATUS_OK)
+			{
+				I2C_TRACE_RESULT(bus, result);
+			}
+		}
 	}
-	while(SERCOM0->I2CM.SYNCBUSY.bit.SYSOP);
-	SERCOM0->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
 	
 	return result;
 }
 
+/**
+	@brief I2C Transfer
+	@details Run the write phase, the read phase after a repeated start, or
+	both, as one polled transaction. A lost arbitration is re-issued from the
+	first byte as soon as the bus is idle again, up to I2C_ARB_RETRIES times.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] wiov Segments to write, 0 for a read only transaction
+	@param[in] wcount Number of write segments
+	@param[out] riov Segments to read, 0 for a write only transaction
+	@param[in] rcount Number of read segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for a read of 0 bytes or error code, bus is recovered after timeouts and bus errors
+*/
+static uint8_t i2c_transfer(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *wiov, uint8_t wcount, const i2c_iovec_t *riov, uint8_t rcount)
+{
+	uint8_t tries = I2C_ARB_RETRIES;
+	uint8_t result;
+#ifdef I2C_SMBUS
+	uint8_t smbus = bus->smbus;
+#endif
+	
+	//A read address goes out with ACKACT set to ACK, with no byte to NACK the target would keep driving SDA
+	if (riov && !i2c_iov_total(riov, rcount))
+	{
+		return I2C_STATUS_INVALID;
+	}
+	
+	I2C_STATS_START(bus);
+	for (;;)
+	{
+		result = I2C_STATUS_OK;
+		if (wiov)
+		{
+			result = i2c_write_phase(bus, i2caddr, wiov, wcount);
+		}
+		
+		//Bus is still ours, loading the read address issues a repeated start
+		if ((result == I2C_STATUS_OK) && riov)
+		{
+			result = i2c_read_phase(bus, i2caddr, riov, rcount);
+		}
+		
+		if ((result != I2C_STATUS_ARBLOST) || !tries--)
+		{
+			break;
+		}
+		result = i2c_arb_wait(bus);
+		if (result != I2C_STATUS_OK)
+		{
+			break;
+		}
+#ifdef I2C_SMBUS
+		bus->smbus = smbus;
+		bus->pec = 0;
+#endif
+	}
+	
+	return i2c_end(bus, result, i2c_iov_total(wiov, wcount) + i2c_iov_total(riov, rcount));
+}
+
+/**
+	@brief I2C Send
+	@details Send array of bytes to I2C device
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] data Data to write to I2C bus
+	@param[in] size Length of the array to write
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_send(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t size)
+{
+	i2c_iovec_t seg = { data, size };
+	
+	return i2c_transfer(bus, i2caddr, &seg, 1, 0, 0);
+}
+
 /**
 	@brief I2C Read
 	@details Reads data from I2C device
+	@param[in] bus I2C bus handle
 	@param[in] i2caddr 7 bit I2C address
 	@param[out] data Array to store read data
 	@param[in] size Number of bytes to read from i2c device
-	@returns Number of bytes read
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for 0 bytes or error code, bus is recovered after timeouts and bus errors
 */
-uint8_t i2c_read(uint8_t i2caddr, uint8_t *data, uint8_t size)
+uint8_t i2c_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t size)
 {
-	uint8_t result = 0;
-	SERCOM0->I2CM.ADDR.reg = ((i2caddr << 1) | 1);
+	i2c_iovec_t seg = { data, size };
 	
-	//Wait for byte to arrive from peripheral
-	while(!(SERCOM0->I2CM.INTFLAG.reg & SERCOM_I2CM_INTFLAG_SB));
+	return i2c_transfer(bus, i2caddr, 0, 0, &seg, 1);
+}
+
+/**
+	@brief I2C Write Read
+	@details Write bytes then read bytes from I2C device with a repeated start between them
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] wdata Data to write to I2C bus, usually a register address
+	@param[in] wsize Length of the array to write
+	@param[out] rdata Array to store read data
+	@param[in] rsize Number of bytes to read from i2c device
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_write_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *wdata, uint16_t wsize, uint8_t *rdata, uint16_t rsize)
+{
+	i2c_iovec_t wseg = { wdata, wsize };
+	i2c_iovec_t rseg = { rdata, rsize };
 	
-	//If NACK'd put in stop state and fail out
-	if (SERCOM0->I2CM.STATUS.reg & SERCOM_I2CM_STATUS_RXNACK)
+	return i2c_transfer(bus, i2caddr, &wseg, 1, rsize ? &rseg : 0, rsize ? 1 : 0);
+}
+
+/**
+	@brief I2C Send Vector
+	@details Send several buffers as one write, for example a register
+	address header in front of a payload held elsewhere, without staging
+	them in a single array.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] iov Segments to write in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_sendv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	return i2c_transfer(bus, i2caddr, iov, count, 0, 0);
+}
+
+/**
+	@brief I2C Read Vector
+	@details Read one stream of bytes into several buffers, only the last
+	byte of the last segment is NACK'd.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] iov Segments to fill in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for 0 bytes or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_readv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	return i2c_transfer(bus, i2caddr, 0, 0, iov, count);
+}
+
+/**
+	@brief I2C Scan
+	@details Probe each address with a Smart Mode quick command: START, write
+	address, STOP, no data and no retries. MB sets as soon as the address is
+	answered, so an absent device costs one address time and a short
+	I2C_SCAN_TIMEOUT instead of a recovery.
+	@param[in] bus I2C bus handle
+	@param[in] addrs 7 bit addresses to probe, 0 for the whole 0x08 to 0x77 range
+	@param[in] count Number of addresses in addrs
+	@param[out] map I2C_SCAN_MAP_SIZE bytes, bit (addr & 7) of map[addr >> 3] set for each device that ACKed
+	@returns I2C_STATUS_OK or the error that stopped the scan
+*/
+uint8_t i2c_scan(i2c_bus_t *bus, const uint8_t *addrs, uint8_t count, uint8_t *map)
+{
+	Sercom *hw = I2C_HW(bus);
+	uint8_t result = I2C_STATUS_OK;
+	uint32_t timeout;
+	uint16_t status;
+	uint8_t addr;
+	
+	for (uint8_t i = 0; i < I2C_SCAN_MAP_SIZE; i++)
 	{
-		SERCOM0->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
-		return result;
+		map[i] = 0;
+	}
+	if (!addrs)
+	{
+		count = 0x78 - 0x08;
 	}
 	
-	//Set controller to ACK reads
-	SERCOM0->I2CM.CTRLB.reg &= ~SERCOM_I2CM_CTRLB_ACKACT;
-	
-	for (uint8_t i = 0; i < (size - 1); i++)
+	hw->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_QCEN;
+	for (uint8_t i = 0; (result == I2C_STATUS_OK) && (i < count); i++)
 	{
-		*data = SERCOM0->I2CM.DATA.reg;
-		data++;
-		result++;
-		while(!(SERCOM0->I2CM.INTFLAG.reg & SERCOM_I2CM_INTFLAG_SB));
+		addr = addrs ? (addrs[i] & 0x7F) : (uint8_t)(0x08 + i);
+	
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+		if (result != I2C_STATUS_OK)
+		{
+			break;
+		}
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)(addr << 1));
+		hw->I2CM.ADDR.reg = ((addr << 1) | bus->hs);
+	
+		timeout = I2C_SCAN_TIMEOUT;
+		while (!(hw->I2CM.INTFLAG.bit.MB) && --timeout);
+		if (!timeout)
+		{
+			result = I2C_STATUS_TIMEOUT;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+	
+		status = hw->I2CM.STATUS.reg;
+		if (status & SERCOM_I2CM_STATUS_BUSERR)
+		{
+			result = I2C_STATUS_BUSERR;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+		if (status & SERCOM_I2CM_STATUS_ARBLOST)
+		{
+			result = I2C_STATUS_ARBLOST;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+		if (!(status & SERCOM_I2CM_STATUS_RXNACK))
+		{
+			map[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+		}
+		I2C_TRACE_RESULT(bus, (status & SERCOM_I2CM_STATUS_RXNACK) ? I2C_STATUS_NACK : I2C_STATUS_OK);
+	
+		//Quick command leaves the bus owned either way
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP);
+		if (result == I2C_STATUS_OK)
+		{
+			hw->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+		}
 	}
+	hw->I2CM.CTRLB.reg &= ~SERCOM_I2CM_CTRLB_QCEN;
 	
-	if (size)
+	if ((result == I2C_STATUS_TIMEOUT) || (result == I2C_STATUS_BUSERR))
 	{
-		//NACK the last byte read to end request, idle bus.
-		SERCOM0->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_ACKACT;
-		SERCOM0->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
-		*data = SERCOM0->I2CM.DATA.reg;
-		result++;
+		i2c_recover(bus);
 	}
 	
 	return result;
-}
+}
\ No newline at end of file
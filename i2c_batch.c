@@ -0,0 +1,163 @@
+/**
+* @file i2c_batch.c
+* @brief MSF I2C Library, register write coalescing.
+* @note Bursts go out through i2c_sendv on SAMD and i2c_write_burst on PIC
+* (built with XC8).
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_batch.h"
+
+#ifdef __XC8
+#include "i2crxtx.h"
+
+/**
+	@brief Batch Burst
+	@details One transaction writing len registers from reg
+	@param[in] batch Device batch
+	@param[in] reg First register address
+	@param[in] data Register values
+	@param[in] len Number of registers
+	@returns I2C_STATUS_OK or I2C_STATUS_NACK if the retries ran out
+*/
+static uint8_t i2c_batch_burst(i2c_batch_t *batch, uint8_t reg, uint8_t *data, uint8_t len)
+{
+	return i2c_write_burst(batch->addr, reg, data, len) ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+#else
+#include "MSF_I2C.h"
+
+/**
+	@brief Batch Burst
+	@details One transaction writing len registers from reg
+	@param[in] batch Device batch
+	@param[in] reg First register address
+	@param[in] data Register values
+	@param[in] len Number of registers
+	@returns I2C_STATUS_OK or error code from i2c_sendv
+*/
+static uint8_t i2c_batch_burst(i2c_batch_t *batch, uint8_t reg, uint8_t *data, uint8_t len)
+{
+	i2c_iovec_t frame[2] = { { &reg, 1 }, { data, len } };
+
+	return i2c_sendv((i2c_bus_t *)batch->bus, batch->addr, frame, 2);
+}
+#endif
+
+/**
+	@brief Batch Begin
+	@details Drop anything queued and start a new batch
+	@param[in] batch Device batch
+*/
+void i2c_batch_begin(i2c_batch_t *batch)
+{
+	batch->count = 0;
+}
+
+/**
+	@brief Batch Write
+	@details Queue a register write. A full batch is committed first so any
+	number of writes can be queued. If that commit fails, this write is not
+	queued and what the commit left unsent stays queued.
+	@param[in] batch Device batch
+	@param[in] reg Register address
+	@param[in] val Value to write
+	@returns I2C_STATUS_OK or error code from the commit of a full batch
+*/
+uint8_t i2c_batch_write(i2c_batch_t *batch, uint8_t reg, uint8_t val)
+{
+	uint8_t result;
+
+	if (batch->count == batch->size)
+	{
+		result = i2c_batch_commit(batch);
+		if (result != I2C_STATUS_OK)
+		{
+			return result;
+		}
+	}
+
+	batch->entries[batch->count].reg = reg;
+	batch->entries[batch->count].val = val;
+	batch->count++;
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief Batch Sort
+	@details Stable insertion sort by register, so writes to the same
+	register keep their queue order
+	@param[in] batch Device batch
+*/
+static void i2c_batch_sort(i2c_batch_t *batch)
+{
+	i2c_batch_entry_t *entries = batch->entries;
+	i2c_batch_entry_t entry;
+	uint8_t i, j;
+
+	for (i = 1; i < batch->count; i++)
+	{
+		entry = entries[i];
+		for (j = i; j && (entries[j - 1].reg > entry.reg); j--)
+		{
+			entries[j] = entries[j - 1];
+		}
+		entries[j] = entry;
+	}
+}
+
+/**
+	@brief Batch Commit
+	@details Sort the queue, merge runs of consecutive registers into
+	auto-increment bursts of up to I2C_BATCH_BURST bytes and write them.
+	Every queued write is sent, a second write to a register starts a new
+	burst. Runs end at register 0xFF rather than wrap to 0x00. Sorting
+	reorders writes, use I2C_BATCH_KEEP_ORDER or separate batches where the
+	device cares about order.
+	@param[in] batch Device batch
+	@returns I2C_STATUS_OK with the batch empty, or the error that stopped
+	the commit with the failed burst and everything after it still queued
+*/
+uint8_t i2c_batch_commit(i2c_batch_t *batch)
+{
+	uint8_t data[I2C_BATCH_BURST];
+	uint8_t result = I2C_STATUS_OK;
+	uint8_t first = 0;
+	uint8_t i = 0;
+	uint8_t len;
+	uint8_t reg;
+
+	if (!(batch->flags & I2C_BATCH_KEEP_ORDER))
+	{
+		i2c_batch_sort(batch);
+	}
+
+	while ((result == I2C_STATUS_OK) && (i < batch->count))
+	{
+		first = i;
+		reg = batch->entries[i].reg;
+		len = 0;
+		do
+		{
+			data[len++] = batch->entries[i++].val;
+		} while (!(batch->flags & I2C_BATCH_NO_AUTOINC) && (len < I2C_BATCH_BURST) && (i < batch->count) &&
+			(batch->entries[i].reg == reg + len));		// int compare, 0xFF + 1 matches no register
+
+		result = i2c_batch_burst(batch, reg, data, len);
+	}
+
+	if (result != I2C_STATUS_OK)
+	{
+		// Keep the failed burst and the rest for the next commit
+		for (i = first; i < batch->count; i++)
+		{
+			batch->entries[i - first] = batch->entries[i];
+		}
+		batch->count = (uint8_t)(batch->count - first);
+		return result;
+	}
+
+	batch->count = 0;
+	return result;
+}
@@ -0,0 +1,44 @@
+#ifndef I2C_BATCH_H_
+#define I2C_BATCH_H_
+
+#include <stdint.h>
+
+#ifndef I2C_BATCH_BURST
+#define I2C_BATCH_BURST		16		// Most data bytes merged into one transaction
+#endif
+
+// Device flags
+#define I2C_BATCH_NO_AUTOINC	0x01	// Device does not step its register pointer, one write per register
+#define I2C_BATCH_KEEP_ORDER	0x02	// Commit in queue order, only runs queued back to back are merged
+
+/**
+	@brief Queued register write
+*/
+typedef struct
+{
+	uint8_t reg;
+	uint8_t val;
+} i2c_batch_entry_t;
+
+/**
+	@brief Register write batch of one device
+	@details entries points at a caller owned array, see I2C_BATCH_INIT
+*/
+typedef struct
+{
+	void *bus;					// i2c_bus_t * on SAMD, unused on PIC
+	uint8_t addr;				// Device address in the form the driver takes, 7 bit on SAMD, 8 bit write address on PIC
+	uint8_t flags;				// I2C_BATCH_* device flags
+	i2c_batch_entry_t *entries;	// Queue storage
+	uint8_t size;				// Entries that fit
+	uint8_t count;				// Entries queued
+} i2c_batch_t;
+
+#define I2C_BATCH_INIT(bus, addr, flags, entries) \
+	{ (bus), (addr), (flags), (entries), (sizeof(entries) / sizeof((entries)[0])), 0 }
+
+void i2c_batch_begin(i2c_batch_t*);
+uint8_t i2c_batch_write(i2c_batch_t*, uint8_t, uint8_t);
+uint8_t i2c_batch_commit(i2c_batch_t*);
+
+#endif /* I2C_BATCH_H_ */
@@ -0,0 +1,239 @@
+/**
+* @file i2c_cache.c
+* @brief MSF I2C Library, shadow register cache.
+* @note Sits on top of i2c_send/i2c_write_read on SAMD and
+* send_i2c_data/get_i2c_data_pointer on PIC (built with XC8).
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_cache.h"
+
+#ifdef __XC8
+#include "i2crxtx.h"
+
+/**
+	@brief Cache Bus Write
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[in] val Value to write
+	@returns I2C_STATUS_OK or I2C_STATUS_NACK if the retries ran out
+*/
+static uint8_t i2c_cache_bus_write(i2c_cache_t *cache, uint8_t reg, uint8_t val)
+{
+	return send_i2c_data(cache->addr, reg, val) ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+
+/**
+	@brief Cache Bus Read
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[out] val Value read
+	@returns I2C_STATUS_OK or I2C_STATUS_NACK if the retries ran out
+*/
+static uint8_t i2c_cache_bus_read(i2c_cache_t *cache, uint8_t reg, uint8_t *val)
+{
+	I2C_RESULT result = get_i2c_data_pointer(cache->addr, reg);
+
+	*val = result.data;
+	return result.tx_chk ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+#else
+#include "MSF_I2C.h"
+
+/**
+	@brief Cache Bus Write
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[in] val Value to write
+	@returns I2C_STATUS_OK or error code from i2c_send
+*/
+static uint8_t i2c_cache_bus_write(i2c_cache_t *cache, uint8_t reg, uint8_t val)
+{
+	uint8_t data[2] = { reg, val };
+
+	return i2c_send((i2c_bus_t *)cache->bus, cache->addr, data, 2);
+}
+
+/**
+	@brief Cache Bus Read
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[out] val Value read
+	@returns I2C_STATUS_OK or error code from i2c_write_read
+*/
+static uint8_t i2c_cache_bus_read(i2c_cache_t *cache, uint8_t reg, uint8_t *val)
+{
+	return i2c_write_read((i2c_bus_t *)cache->bus, cache->addr, &reg, 1, val, 1);
+}
+#endif
+
+/**
+	@brief Cache Slot
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@returns Index of reg in the shadow arrays, or count if reg is not cached
+*/
+static uint8_t i2c_cache_slot(i2c_cache_t *cache, uint8_t reg)
+{
+	uint8_t slot = (uint8_t)(reg - cache->base);
+
+	return (slot < cache->count) ? slot : cache->count;
+}
+
+/**
+	@brief Cache Write
+	@details Writes that match the shadow are dropped. Otherwise write
+	through sends the value at once and write back marks it dirty.
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[in] val Value to write
+	@returns I2C_STATUS_OK or error code from the driver
+*/
+uint8_t i2c_cache_write(i2c_cache_t *cache, uint8_t reg, uint8_t val)
+{
+	uint8_t slot = i2c_cache_slot(cache, reg);
+	uint8_t result;
+
+	if (slot == cache->count)
+	{
+		return i2c_cache_bus_write(cache, reg, val);
+	}
+
+	if ((cache->flags[slot] & I2C_CACHE_VALID) && (cache->shadow[slot] == val))
+	{
+		cache->hits++;
+		return I2C_STATUS_OK;
+	}
+
+	cache->shadow[slot] = val;
+	if (cache->mode == I2C_CACHE_WRITE_BACK)
+	{
+		cache->flags[slot] |= (I2C_CACHE_VALID | I2C_CACHE_DIRTY);
+		cache->hits++;
+		return I2C_STATUS_OK;
+	}
+
+	cache->misses++;
+	result = i2c_cache_bus_write(cache, reg, val);
+	if (result == I2C_STATUS_OK)
+	{
+		cache->flags[slot] |= I2C_CACHE_VALID;
+	}
+	else
+	{
+		//Device state unknown, read it back next time
+		cache->flags[slot] &= (uint8_t)~I2C_CACHE_VALID;
+	}
+
+	return result;
+}
+
+/**
+	@brief Cache Read
+	@details Static and dirty registers with a valid shadow come from RAM,
+	everything else is read from the device and refreshes the shadow.
+	@param[in] cache Device cache
+	@param[in] reg Register address
+	@param[out] val Register value
+	@returns I2C_STATUS_OK or error code from the driver
+*/
+uint8_t i2c_cache_read(i2c_cache_t *cache, uint8_t reg, uint8_t *val)
+{
+	uint8_t slot = i2c_cache_slot(cache, reg);
+	uint8_t result;
+
+	if (slot == cache->count)
+	{
+		return i2c_cache_bus_read(cache, reg, val);
+	}
+
+	if ((cache->flags[slot] & I2C_CACHE_VALID) && (cache->flags[slot] & (I2C_CACHE_STATIC | I2C_CACHE_DIRTY)))
+	{
+		cache->hits++;
+		*val = cache->shadow[slot];
+		return I2C_STATUS_OK;
+	}
+
+	cache->misses++;
+	result = i2c_cache_bus_read(cache, reg, val);
+	if (result == I2C_STATUS_OK)
+	{
+		cache->shadow[slot] = *val;
+		cache->flags[slot] |= I2C_CACHE_VALID;
+	}
+
+	return result;
+}
+
+/**
+	@brief Cache Static
+	@details Mark registers the device never changes on its own (ID,
+	configuration) so reads after the first come from RAM.
+	@param[in] cache Device cache
+	@param[in] reg First register address
+	@param[in] count Number of registers
+*/
+void i2c_cache_static(i2c_cache_t *cache, uint8_t reg, uint8_t count)
+{
+	uint8_t slot;
+
+	while (count--)
+	{
+		slot = i2c_cache_slot(cache, reg++);
+		if (slot != cache->count)
+		{
+			cache->flags[slot] |= I2C_CACHE_STATIC;
+		}
+	}
+}
+
+/**
+	@brief Cache Invalidate
+	@details Forget shadow values, e.g. after a device reset. Dirty values
+	that were not flushed are lost.
+	@param[in] cache Device cache
+	@param[in] reg First register address
+	@param[in] count Number of registers
+*/
+void i2c_cache_invalidate(i2c_cache_t *cache, uint8_t reg, uint8_t count)
+{
+	uint8_t slot;
+
+	while (count--)
+	{
+		slot = i2c_cache_slot(cache, reg++);
+		if (slot != cache->count)
+		{
+			cache->flags[slot] &= (uint8_t)~(I2C_CACHE_VALID | I2C_CACHE_DIRTY);
+		}
+	}
+}
+
+/**
+	@brief Cache Flush
+	@details Write every dirty register to the device, lowest address first
+	@param[in] cache Device cache
+	@returns I2C_STATUS_OK or the error that stopped the flush, unwritten registers stay dirty
+*/
+uint8_t i2c_cache_flush(i2c_cache_t *cache)
+{
+	uint8_t result;
+
+	for (uint8_t slot = 0; slot < cache->count; slot++)
+	{
+		if (!(cache->flags[slot] & I2C_CACHE_DIRTY))
+		{
+			continue;
+		}
+
+		cache->misses++;
+		result = i2c_cache_bus_write(cache, (uint8_t)(cache->base + slot), cache->shadow[slot]);
+		if (result != I2C_STATUS_OK)
+		{
+			return result;
+		}
+		cache->flags[slot] &= (uint8_t)~I2C_CACHE_DIRTY;
+	}
+
+	return I2C_STATUS_OK;
+}
@@ -0,0 +1,52 @@
+#ifndef I2C_CACHE_H_
+#define I2C_CACHE_H_
+
+#include <stdint.h>
+
+// Cache modes
+#define I2C_CACHE_WRITE_THROUGH	0	// Every changed value goes straight to the device
+#define I2C_CACHE_WRITE_BACK	1	// Changed values wait in RAM for i2c_cache_flush
+
+// Per register flags
+#define I2C_CACHE_VALID			0x01	// Shadow holds the device value
+#define I2C_CACHE_DIRTY			0x02	// Shadow is newer than the device, write back only
+#define I2C_CACHE_STATIC		0x04	// Device never changes it on its own, reads come from RAM
+
+/**
+	@brief Shadow register cache of one device
+	@details Covers count registers from base, 1 to 255 and not past
+	register 0xFF. shadow and flags point at count byte arrays owned by the
+	caller, flags start zeroed. Registers outside the window go straight to
+	the bus.
+*/
+typedef struct
+{
+	void *bus;				// i2c_bus_t * on SAMD, unused on PIC
+	uint8_t addr;			// Device address in the form the driver takes, 7 bit on SAMD, 8 bit write address on PIC
+	uint8_t mode;			// I2C_CACHE_WRITE_*
+	uint8_t base;			// First cached register
+	uint8_t count;			// Number of cached registers
+	uint8_t *shadow;		// Last known value of each register
+	uint8_t *flags;			// I2C_CACHE_* flags of each register
+	uint16_t hits;			// Accesses served without touching the bus
+	uint16_t misses;		// Accesses that went to the bus
+} i2c_cache_t;
+
+/*
+	count is given, not taken from sizeof(shadow), so a pointer or a 256 byte
+	array can't slip through. A window of 0 registers, of more than the 255
+	the uint8_t count holds, or one running past register 0xFF fails to
+	compile, the array size goes negative.
+*/
+#define I2C_CACHE_COUNT(base, count)	((uint8_t)((count) + (0 * sizeof(char[(((count) >= 1) && ((count) <= 255) && (((base) + (count)) <= 256)) ? 1 : -1]))))
+
+#define I2C_CACHE_INIT(bus, addr, mode, base, count, shadow, flags) \
+	{ (bus), (addr), (mode), (base), I2C_CACHE_COUNT(base, count), (shadow), (flags), 0, 0 }
+
+uint8_t i2c_cache_write(i2c_cache_t*, uint8_t, uint8_t);
+uint8_t i2c_cache_read(i2c_cache_t*, uint8_t, uint8_t*);
+void i2c_cache_static(i2c_cache_t*, uint8_t, uint8_t);
+void i2c_cache_invalidate(i2c_cache_t*, uint8_t, uint8_t);
+uint8_t i2c_cache_flush(i2c_cache_t*);
+
+#endif /* I2C_CACHE_H_ */
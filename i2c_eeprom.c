@@ -0,0 +1,299 @@
+/**
+* @file i2c_eeprom.c
+* @brief MSF I2C Library, page aware 24Cxx EEPROM streaming.
+* @note Writes are split on page boundaries and the write cycle is timed by
+* ACK polling: the part NACKs its address until the cycle is over, so each
+* page waits only as long as that part needs. Uses i2c_sendv/i2c_write_read
+* and i2c_scan on SAMD, the exposed start/write/read/stop calls and i2c_scan
+* on PIC (built with XC8).
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_eeprom.h"
+
+#ifdef __XC8
+#include "i2crxtx.h"
+
+#define I2C_EEPROM_BLOCK(block)	((uint8_t)((block) << 1))	// 8 bit write address
+
+/**
+	@brief EEPROM Probe
+	@details One START, address, STOP
+	@param[in] ee EEPROM
+	@returns I2C_STATUS_OK if the part ACKed, I2C_STATUS_NACK while it is busy,
+	I2C_STATUS_BUSY if the bus is stuck or in use
+*/
+static uint8_t i2c_eeprom_probe(i2c_eeprom_t *ee)
+{
+	uint8_t map[16];
+
+	if (!i2c_scan(&ee->addr, 1, map))
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	return ((map[ee->addr >> 4] >> ((ee->addr >> 1) & 7)) & 1) ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+
+/**
+	@brief EEPROM Bus Write
+	@param[in] ee EEPROM
+	@param[in] dev Device address including block bits
+	@param[in] hdr Memory address bytes
+	@param[in] data Bytes to write
+	@param[in] len Number of bytes, within one page
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK or I2C_STATUS_BUSY if START failed
+*/
+static uint8_t i2c_eeprom_bus_write(i2c_eeprom_t *ee, uint8_t dev, uint8_t *hdr, uint8_t *data, uint16_t len)
+{
+	uint8_t acked;
+
+	if (i2c_start() != I2C_START_OK)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	acked = i2c_write(dev);
+	for (uint8_t i = 0; acked && (i < ee->addr_bytes); i++)
+	{
+		acked = i2c_write(hdr[i]);
+	}
+	while (acked && len--)
+	{
+		acked = i2c_write(*data++);
+	}
+	i2c_stop();
+
+	return acked ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+
+/**
+	@brief EEPROM Bus Read
+	@param[in] ee EEPROM
+	@param[in] dev Device address including block bits
+	@param[in] hdr Memory address bytes
+	@param[out] data Bytes read
+	@param[in] len Number of bytes, non zero
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK or I2C_STATUS_BUSY if START failed
+*/
+static uint8_t i2c_eeprom_bus_read(i2c_eeprom_t *ee, uint8_t dev, uint8_t *hdr, uint8_t *data, uint16_t len)
+{
+	I2C_RESULT byte;
+	uint8_t acked;
+
+	if (i2c_start() != I2C_START_OK)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	acked = i2c_write(dev);
+	for (uint8_t i = 0; acked && (i < ee->addr_bytes); i++)
+	{
+		acked = i2c_write(hdr[i]);
+	}
+	if (acked)
+	{
+		i2c_repStart();
+		acked = i2c_write(dev + 1u);
+	}
+	while (acked && len--)
+	{
+		byte = i2c_read(len != 0);	// ACK all but the last byte
+		*data++ = byte.data;
+		acked = byte.tx_chk;
+	}
+	i2c_stop();
+
+	return acked ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+#else
+#include "MSF_I2C.h"
+
+#define I2C_EEPROM_BLOCK(block)	((uint8_t)(block))	// 7 bit address
+
+/**
+	@brief EEPROM Probe
+	@details Smart Mode quick command, no retries
+	@param[in] ee EEPROM
+	@returns I2C_STATUS_OK if the part ACKed, I2C_STATUS_NACK while it is busy,
+	or the bus error from i2c_scan
+*/
+static uint8_t i2c_eeprom_probe(i2c_eeprom_t *ee)
+{
+	uint8_t map[I2C_SCAN_MAP_SIZE];
+	uint8_t result = i2c_scan((i2c_bus_t *)ee->bus, &ee->addr, 1, map);
+
+	if (result != I2C_STATUS_OK)
+	{
+		return result;
+	}
+
+	return I2C_SCAN_PRESENT(map, ee->addr) ? I2C_STATUS_OK : I2C_STATUS_NACK;
+}
+
+/**
+	@brief EEPROM Bus Write
+	@details Address header and payload go out as two segments, no staging copy
+	@param[in] ee EEPROM
+	@param[in] dev Device address including block bits
+	@param[in] hdr Memory address bytes
+	@param[in] data Bytes to write
+	@param[in] len Number of bytes, within one page
+	@returns I2C_STATUS_OK or error code from i2c_sendv
+*/
+static uint8_t i2c_eeprom_bus_write(i2c_eeprom_t *ee, uint8_t dev, uint8_t *hdr, uint8_t *data, uint16_t len)
+{
+	i2c_iovec_t frame[2] = { { hdr, ee->addr_bytes }, { data, len } };
+
+	return i2c_sendv((i2c_bus_t *)ee->bus, dev, frame, 2);
+}
+
+/**
+	@brief EEPROM Bus Read
+	@param[in] ee EEPROM
+	@param[in] dev Device address including block bits
+	@param[in] hdr Memory address bytes
+	@param[out] data Bytes read
+	@param[in] len Number of bytes, non zero
+	@returns I2C_STATUS_OK or error code from i2c_write_read
+*/
+static uint8_t i2c_eeprom_bus_read(i2c_eeprom_t *ee, uint8_t dev, uint8_t *hdr, uint8_t *data, uint16_t len)
+{
+	return i2c_write_read((i2c_bus_t *)ee->bus, dev, hdr, ee->addr_bytes, data, len);
+}
+#endif
+
+/**
+	@brief EEPROM Address
+	@details Split a memory address into the device address and the address
+	bytes sent after it
+	@param[in] ee EEPROM
+	@param[in] mem Memory address
+	@param[out] hdr addr_bytes bytes, most significant first
+	@returns Device address with the block bits set
+*/
+static uint8_t i2c_eeprom_address(i2c_eeprom_t *ee, uint32_t mem, uint8_t *hdr)
+{
+	if (ee->addr_bytes == 2)
+	{
+		hdr[0] = (uint8_t)(mem >> 8);
+		hdr[1] = (uint8_t)mem;
+	}
+	else
+	{
+		hdr[0] = (uint8_t)mem;
+	}
+
+	return ee->addr | I2C_EEPROM_BLOCK(mem >> (8 * ee->addr_bytes));
+}
+
+/**
+	@brief EEPROM Wait
+	@details ACK poll until the last write cycle is over. Returns at once if
+	no write is outstanding.
+	@param[in] ee EEPROM
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK if the part was still busy after
+	I2C_EEPROM_POLLS probes, or a bus error
+*/
+uint8_t i2c_eeprom_wait(i2c_eeprom_t *ee)
+{
+	uint8_t result;
+	uint16_t polls = 0;
+
+	if (!ee->busy)
+	{
+		return I2C_STATUS_OK;
+	}
+
+	do
+	{
+		result = i2c_eeprom_probe(ee);
+		polls++;
+	} while ((result == I2C_STATUS_NACK) && (polls < I2C_EEPROM_POLLS));
+
+	ee->polls = polls;
+	if (result == I2C_STATUS_OK)
+	{
+		ee->busy = 0;
+	}
+
+	return result;
+}
+
+/**
+	@brief EEPROM Write
+	@details Stream len bytes from mem, one transaction per page. Each page
+	waits for the previous write cycle by ACK polling, the last one is left
+	running and the next call waits for it.
+	@param[in] ee EEPROM
+	@param[in] mem First memory address
+	@param[in] data Bytes to write
+	@param[in] len Number of bytes
+	@returns I2C_STATUS_OK or the error that stopped the stream
+*/
+uint8_t i2c_eeprom_write(i2c_eeprom_t *ee, uint32_t mem, uint8_t *data, uint16_t len)
+{
+	uint8_t result = I2C_STATUS_OK;
+	uint8_t hdr[2];
+	uint16_t chunk;
+	uint8_t dev;
+
+	while ((result == I2C_STATUS_OK) && len)
+	{
+		// Up to the end of the page, the part wraps within a page otherwise
+		chunk = ee->page - (uint16_t)(mem & (ee->page - 1));
+		if (chunk > len)
+		{
+			chunk = len;
+		}
+
+		result = i2c_eeprom_wait(ee);
+		if (result != I2C_STATUS_OK)
+		{
+			break;
+		}
+
+		dev = i2c_eeprom_address(ee, mem, hdr);
+		result = i2c_eeprom_bus_write(ee, dev, hdr, data, chunk);
+		ee->busy = 1;	// A STOP after any data byte may have started a cycle
+
+		mem += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return result;
+}
+
+/**
+	@brief EEPROM Read
+	@details Sequential read of len bytes from mem, split where the block
+	bits in the device address change
+	@param[in] ee EEPROM
+	@param[in] mem First memory address
+	@param[out] data Bytes read
+	@param[in] len Number of bytes
+	@returns I2C_STATUS_OK or the error that stopped the read
+*/
+uint8_t i2c_eeprom_read(i2c_eeprom_t *ee, uint32_t mem, uint8_t *data, uint16_t len)
+{
+	uint32_t block = 1UL << (8 * ee->addr_bytes);
+	uint8_t result = i2c_eeprom_wait(ee);
+	uint8_t hdr[2];
+	uint16_t chunk;
+	uint8_t dev;
+
+	while ((result == I2C_STATUS_OK) && len)
+	{
+		chunk = (block - (mem & (block - 1)) < len) ? (uint16_t)(block - (mem & (block - 1))) : len;
+
+		dev = i2c_eeprom_address(ee, mem, hdr);
+		result = i2c_eeprom_bus_read(ee, dev, hdr, data, chunk);
+
+		mem += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return result;
+}
@@ -0,0 +1,33 @@
+#ifndef I2C_EEPROM_H_
+#define I2C_EEPROM_H_
+
+#include <stdint.h>
+
+#ifndef I2C_EEPROM_POLLS
+#define I2C_EEPROM_POLLS	1000	// Address probes before a write cycle counts as stuck, about 30mS at 400KHz
+#endif
+
+/**
+	@brief 24Cxx style EEPROM
+	@details Memory address bits above the addr_bytes sent after the device
+	address go into the low bits of the device address, as on the 24C04 to
+	24C16 and 24C1024.
+*/
+typedef struct
+{
+	void *bus;				// i2c_bus_t * on SAMD, unused on PIC
+	uint8_t addr;			// Device address in the form the driver takes, 7 bit on SAMD, 8 bit write address on PIC
+	uint8_t addr_bytes;		// Memory address bytes, 1 up to the 24C16, 2 from the 24C32
+	uint16_t page;			// Write page size, a power of two
+	uint8_t busy;			// Write cycle may still be running, cleared by i2c_eeprom_wait
+	uint16_t polls;			// Probes the last write cycle took
+} i2c_eeprom_t;
+
+#define I2C_EEPROM_INIT(bus, addr, addr_bytes, page) \
+	{ (bus), (addr), (addr_bytes), (page), 0, 0 }
+
+uint8_t i2c_eeprom_wait(i2c_eeprom_t*);
+uint8_t i2c_eeprom_write(i2c_eeprom_t*, uint32_t, uint8_t*, uint16_t);
+uint8_t i2c_eeprom_read(i2c_eeprom_t*, uint32_t, uint8_t*, uint16_t);
+
+#endif /* I2C_EEPROM_H_ */
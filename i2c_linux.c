@@ -0,0 +1,589 @@
+/**
+* @file i2c_linux.c
+* @brief MSF I2C Library, Linux i2c-dev backend.
+* @note Build with I2C_LINUX defined, for the application as well since it
+* changes i2c_bus_t. Each call is one ioctl(I2C_RDWR) holding one i2c_msg
+* per phase, so a register read costs one syscall where write() then read()
+* costs two and drops the repeated start. Transactions handed to i2c_submit
+* wait in the bus until the next i2c_isr, which sends up to I2C_LINUX_BATCH
+* of them in a single ioctl. A plain write ends its ioctl.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "MSF_I2C.h"
+
+#ifndef I2C_LINUX_ADAPTER
+#define I2C_LINUX_ADAPTER	1		// /dev/i2c-1, the header bus on most SBCs
+#endif
+#ifndef I2C_LINUX_STAGE
+#define I2C_LINUX_STAGE		256		// Bytes i2c_sendv and i2c_readv gather into one message
+#endif
+
+// Adapter access, override both to run against an in-process fake adapter
+#ifndef I2C_LINUX_OPEN
+#define I2C_LINUX_OPEN(path)			open((path), O_RDWR)
+#endif
+#ifndef I2C_LINUX_IOCTL
+#define I2C_LINUX_IOCTL(fd, req, arg)	ioctl((fd), (req), (arg))
+#endif
+
+#ifdef I2C_STATS
+#ifndef I2C_STATS_NOW
+#define I2C_STATS_NOW()					i2c_linux_us()
+#endif
+#ifndef I2C_STATS_ELAPSED
+#define I2C_STATS_ELAPSED(start, now)	((uint32_t)((now) - (start)))
+#endif
+#define I2C_STATS_START(bus)				((bus)->stamp = I2C_STATS_NOW())
+#define I2C_STATS_END(bus, result, bytes)	i2c_stats_record((bus), (result), (bytes))
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes);
+#else
+#define I2C_STATS_START(bus)
+#define I2C_STATS_END(bus, result, bytes)	((void)(bytes))
+#endif
+
+// Which phases i2c_linux_transfer runs
+#define I2C_LINUX_WRITE		0x01
+#define I2C_LINUX_READ		0x02
+
+i2c_bus_t i2c_bus0 = I2C_BUS_INIT(I2C_LINUX_ADAPTER);
+
+#ifdef I2C_STATS
+/**
+	@brief I2C Linux Microseconds
+	@returns CLOCK_MONOTONIC in microseconds, wraps every 71 minutes
+*/
+static uint32_t i2c_linux_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(((uint64_t)ts.tv_sec * 1000000u) + (ts.tv_nsec / 1000));
+}
+#endif
+
+/**
+	@brief I2C Init
+	@details Open /dev/i2c-N and read what the adapter supports. Adapters
+	without plain I2C transfers, i2c-stub among them, stay open but every
+	transfer returns I2C_STATUS_INVALID.
+	@param[in] bus I2C bus handle
+*/
+void init_i2c(i2c_bus_t *bus)
+{
+	char path[20];
+
+	snprintf(path, sizeof(path), "/dev/i2c-%u", bus->adapter);
+	bus->fd = I2C_LINUX_OPEN(path);
+	bus->funcs = 0;
+	bus->count = 0;
+	if (bus->fd >= 0)
+	{
+		bus->syscalls++;
+		if (I2C_LINUX_IOCTL(bus->fd, I2C_FUNCS, &bus->funcs) < 0)
+		{
+			bus->funcs = 0;
+		}
+	}
+}
+
+/**
+	@brief I2C Linux Status
+	@details Map an errno from the adapter driver, see the kernel's
+	Documentation/i2c/fault-codes
+	@param[in] err errno after a failed ioctl
+	@returns I2C_STATUS_* code
+*/
+static uint8_t i2c_linux_status(int err)
+{
+	switch (err)
+	{
+		case ENXIO:			// Address not acknowledged
+		case EREMOTEIO:		// Data byte not acknowledged, most adapter drivers
+			return I2C_STATUS_NACK;
+		case EAGAIN:		// Lost arbitration
+			return I2C_STATUS_ARBLOST;
+		case ETIMEDOUT:
+			return I2C_STATUS_TIMEOUT;
+		case EINVAL:
+		case EOPNOTSUPP:
+			return I2C_STATUS_INVALID;
+		default:
+			return I2C_STATUS_BUSERR;
+	}
+}
+
+/**
+	@brief I2C Linux Read Write
+	@details One combined transaction, messages are joined by repeated
+	starts and the adapter sends a single STOP after the last one
+	@param[in] bus I2C bus handle
+	@param[in] msgs Messages in bus order
+	@param[in] count Number of messages
+	@returns I2C_STATUS_OK or error code
+*/
+static uint8_t i2c_linux_rdwr(i2c_bus_t *bus, struct i2c_msg *msgs, uint32_t count)
+{
+	struct i2c_rdwr_ioctl_data rdwr = { msgs, count };
+
+	if ((bus->fd < 0) || !(bus->funcs & I2C_FUNC_I2C))
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	bus->syscalls++;
+	if (I2C_LINUX_IOCTL(bus->fd, I2C_RDWR, &rdwr) < 0)
+	{
+		return i2c_linux_status(errno);
+	}
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Linux Transfer
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] phases I2C_LINUX_WRITE, I2C_LINUX_READ or both
+	@param[in] wdata Data to write
+	@param[in] wlen Length of the array to write
+	@param[out] rdata Array to store read data
+	@param[in] rlen Number of bytes to read
+	@returns I2C_STATUS_OK or error code
+*/
+static uint8_t i2c_linux_transfer(i2c_bus_t *bus, uint8_t i2caddr, uint8_t phases, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen)
+{
+	struct i2c_msg msgs[2];
+	uint32_t count = 0;
+	uint8_t result;
+
+	if (phases & I2C_LINUX_WRITE)
+	{
+		msgs[count++] = (struct i2c_msg){ .addr = i2caddr, .flags = 0, .len = wlen, .buf = wdata };
+	}
+	if (phases & I2C_LINUX_READ)
+	{
+		msgs[count++] = (struct i2c_msg){ .addr = i2caddr, .flags = I2C_M_RD, .len = rlen, .buf = rdata };
+	}
+
+	I2C_STATS_START(bus);
+	result = i2c_linux_rdwr(bus, msgs, count);
+	I2C_STATS_END(bus, result, (uint32_t)wlen + rlen);
+
+	return result;
+}
+
+/**
+	@brief I2C Send
+	@details Send array of bytes to I2C device
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] data Data to write to I2C bus
+	@param[in] len Length of the array to write
+	@returns I2C_STATUS_OK or error code
+*/
+uint8_t i2c_send(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t len)
+{
+	return i2c_linux_transfer(bus, i2caddr, I2C_LINUX_WRITE, data, len, 0, 0);
+}
+
+/**
+	@brief I2C Read
+	@details Reads data from I2C device
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] data Array to store read data
+	@param[in] len Number of bytes to read from i2c device
+	@returns I2C_STATUS_OK or error code
+*/
+uint8_t i2c_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t len)
+{
+	return i2c_linux_transfer(bus, i2caddr, I2C_LINUX_READ, 0, 0, data, len);
+}
+
+/**
+	@brief I2C Write Read
+	@details Write bytes then read bytes from I2C device with a repeated
+	start between them, both phases in one ioctl
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] wdata Data to write to I2C bus, usually a register address
+	@param[in] wlen Length of the array to write
+	@param[out] rdata Array to store read data
+	@param[in] rlen Number of bytes to read from i2c device
+	@returns I2C_STATUS_OK or error code
+*/
+uint8_t i2c_write_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen)
+{
+	return i2c_linux_transfer(bus, i2caddr, rlen ? (I2C_LINUX_WRITE | I2C_LINUX_READ) : I2C_LINUX_WRITE, wdata, wlen, rdata, rlen);
+}
+
+/**
+	@brief I2C Send Vector
+	@details Gather the segments into one message, a message per segment
+	would put a START and address in front of each.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] iov Segments to write in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID past I2C_LINUX_STAGE bytes or error code
+*/
+uint8_t i2c_sendv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	uint8_t stage[I2C_LINUX_STAGE];
+	uint32_t len = 0;
+
+	while (count--)
+	{
+		if ((len + iov->len) > sizeof(stage))
+		{
+			return I2C_STATUS_INVALID;
+		}
+		memcpy(&stage[len], iov->data, iov->len);
+		len += iov->len;
+		iov++;
+	}
+
+	return i2c_linux_transfer(bus, i2caddr, I2C_LINUX_WRITE, stage, (uint16_t)len, 0, 0);
+}
+
+/**
+	@brief I2C Read Vector
+	@details Read one message and scatter it across the segments
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] iov Segments to fill in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID past I2C_LINUX_STAGE bytes or error code
+*/
+uint8_t i2c_readv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	uint8_t stage[I2C_LINUX_STAGE];
+	uint32_t len = 0;
+	uint8_t result;
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		len += iov[i].len;
+	}
+	if (len > sizeof(stage))
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	result = i2c_linux_transfer(bus, i2caddr, I2C_LINUX_READ, 0, 0, stage, (uint16_t)len);
+	if (result == I2C_STATUS_OK)
+	{
+		len = 0;
+		for (uint8_t i = 0; i < count; i++)
+		{
+			memcpy(iov[i].data, &stage[len], iov[i].len);
+			len += iov[i].len;
+		}
+	}
+
+	return result;
+}
+
+/**
+	@brief I2C Set Speed
+	@details The clock of a Linux adapter comes from the device tree or ACPI
+	@returns I2C_STATUS_INVALID
+*/
+uint8_t i2c_set_speed(i2c_bus_t *bus, uint8_t speed, uint32_t baud)
+{
+	(void)bus;
+	(void)speed;
+	(void)baud;
+
+	return I2C_STATUS_INVALID;
+}
+
+/**
+	@brief I2C Recover
+	@details Bus recovery belongs to the kernel adapter driver
+	@returns I2C_STATUS_INVALID
+*/
+uint8_t i2c_recover(i2c_bus_t *bus)
+{
+	(void)bus;
+
+	return I2C_STATUS_INVALID;
+}
+
+/**
+	@brief I2C Recovery Stats
+	@param[in] bus I2C bus handle
+	@param[out] stats Always zero on Linux
+*/
+void i2c_recovery_stats(i2c_bus_t *bus, i2c_recovery_t *stats)
+{
+	*stats = bus->recovery;
+}
+
+/**
+	@brief I2C Scan
+	@details Probe each address with a zero length write, one ioctl each.
+	The adapter needs to support quick commands.
+	@param[in] bus I2C bus handle
+	@param[in] addrs 7 bit addresses to probe, 0 for the whole 0x08 to 0x77 range
+	@param[in] count Number of addresses in addrs
+	@param[out] map I2C_SCAN_MAP_SIZE bytes, bit (addr & 7) of map[addr >> 3] set for each device that ACKed
+	@returns I2C_STATUS_OK, I2C_STATUS_BUSY if transactions are waiting for i2c_isr or the error that stopped the scan
+*/
+uint8_t i2c_scan(i2c_bus_t *bus, const uint8_t *addrs, uint8_t count, uint8_t *map)
+{
+	struct i2c_msg msg = { .flags = 0, .len = 0, .buf = 0 };
+	uint8_t result = I2C_STATUS_OK;
+	uint8_t addr;
+
+	if (bus->count)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	memset(map, 0, I2C_SCAN_MAP_SIZE);
+	if (!addrs)
+	{
+		count = 0x78 - 0x08;
+	}
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		addr = addrs ? (addrs[i] & 0x7F) : (uint8_t)(0x08 + i);
+		msg.addr = addr;
+
+		result = i2c_linux_rdwr(bus, &msg, 1);
+		if (result == I2C_STATUS_OK)
+		{
+			map[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+		}
+		else if (result != I2C_STATUS_NACK)
+		{
+			return result;
+		}
+	}
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Submit
+	@details Queue a transaction for the next i2c_isr and return at once.
+	Read only transactions skip the write phase, as on SAMD.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor
+	@returns I2C_STATUS_PENDING if queued, I2C_STATUS_BUSY if I2C_LINUX_BATCH are already waiting
+*/
+uint8_t i2c_submit(i2c_bus_t *bus, i2c_transaction_t *xfer)
+{
+	if (bus->count == I2C_LINUX_BATCH)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	xfer->status = I2C_STATUS_PENDING;
+	bus->pending[bus->count++] = xfer;
+
+	return I2C_STATUS_PENDING;
+}
+
+/**
+	@brief I2C Busy
+	@param[in] bus I2C bus handle
+	@returns 1 while submitted transactions are waiting for i2c_isr
+*/
+uint8_t i2c_busy(i2c_bus_t *bus)
+{
+	return (bus->count != 0);
+}
+
+/**
+	@brief I2C Linux Write Only
+	@param[in] xfer Transaction descriptor
+	@returns 1 if the transaction is a plain write, the kind a device acts on at its STOP
+*/
+static uint8_t i2c_linux_write_only(const i2c_transaction_t *xfer)
+{
+	return (xfer->rlen == 0);
+}
+
+/**
+	@brief I2C Linux Messages
+	@details Read only transactions skip the write phase, as on SAMD
+	@param[in] xfer Transaction descriptor
+	@param[out] msgs Room for two messages
+	@returns Messages filled in
+*/
+static uint32_t i2c_linux_msgs(i2c_transaction_t *xfer, struct i2c_msg *msgs)
+{
+	uint32_t n = 0;
+
+	if (xfer->wlen || !xfer->rlen)
+	{
+		msgs[n++] = (struct i2c_msg){ .addr = xfer->addr, .flags = 0, .len = xfer->wlen, .buf = xfer->wdata };
+	}
+	if (xfer->rlen)
+	{
+		msgs[n++] = (struct i2c_msg){ .addr = xfer->addr, .flags = I2C_M_RD, .len = xfer->rlen, .buf = xfer->rdata };
+	}
+
+	return n;
+}
+
+/**
+	@brief I2C Linux Group
+	@details Send submitted transactions in one ioctl(I2C_RDWR) and set the
+	status of each. Only the last one may be a plain write. When the ioctl
+	fails the kernel does not say which message stopped it, and the reads
+	ahead of that message have already been on the bus. Running them again
+	to find the failure would repeat reads with side effects, such as a FIFO
+	pop or a status register that clears on read, so every transaction in
+	the ioctl gets its error and nothing is sent again. Whether to retry is
+	up to the caller, which knows which of its reads are safe to repeat.
+	@param[in] bus I2C bus handle
+	@param[in,out] xfers Transactions in bus order
+	@param[in] count Number of transactions, 1 to I2C_LINUX_BATCH
+*/
+static void i2c_linux_group(i2c_bus_t *bus, i2c_transaction_t **xfers, uint8_t count)
+{
+	struct i2c_msg msgs[2 * I2C_LINUX_BATCH];
+	uint32_t n = 0;
+	uint8_t result;
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		i2c_transaction_t *xfer = xfers[i];
+
+		n += i2c_linux_msgs(xfer, &msgs[n]);
+		if ((bus->funcs & I2C_FUNC_PROTOCOL_MANGLING) && ((i + 1) < count))
+		{
+			msgs[n - 1].flags |= I2C_M_STOP;
+		}
+	}
+
+	result = i2c_linux_rdwr(bus, msgs, n);
+	for (uint8_t i = 0; i < count; i++)
+	{
+		xfers[i]->status = result;
+	}
+}
+
+/**
+	@brief I2C Interrupt
+	@details Run the submitted transactions, then report them in submit
+	order. Call from the main loop. Transactions share an ioctl(I2C_RDWR)
+	joined by repeated starts, or by STOPs if the adapter offers protocol
+	mangling. A plain write always ends its ioctl, so the device sees a real
+	STOP and starts acting on it, for example an EEPROM write cycle, and a
+	failed ioctl never has a write ahead of the failure. A failed ioctl
+	fails every transaction in it, see i2c_linux_group.
+	@param[in] bus I2C bus handle
+*/
+void i2c_isr(i2c_bus_t *bus)
+{
+	i2c_transaction_t *batch[I2C_LINUX_BATCH];
+	uint8_t count = bus->count;
+	uint8_t first = 0;
+	uint8_t last;
+
+	if (!count)
+	{
+		return;
+	}
+
+	// Callbacks may submit the next batch
+	memcpy(batch, bus->pending, count * sizeof(batch[0]));
+	bus->count = 0;
+
+	I2C_STATS_START(bus);
+	while (first < count)
+	{
+		last = first;
+		while (((last + 1) < count) && !i2c_linux_write_only(batch[last]))
+		{
+			last++;
+		}
+		i2c_linux_group(bus, &batch[first], (uint8_t)(last - first + 1));
+		first = (uint8_t)(last + 1);
+	}
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		i2c_transaction_t *xfer = batch[i];
+
+		I2C_STATS_END(bus, xfer->status, (uint32_t)xfer->wlen + xfer->rlen);
+		if (xfer->callback)
+		{
+			xfer->callback(xfer);
+		}
+	}
+}
+
+#ifdef I2C_STATS
+/**
+	@brief I2C Stats Record
+	@details Count a finished transaction and file its latency
+	@param[in] bus I2C bus handle
+	@param[in] result I2C_STATUS_* the transaction ended with
+	@param[in] bytes Payload bytes, counted only when result is I2C_STATUS_OK
+*/
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes)
+{
+	i2c_stats_t *stats = &bus->stats;
+	uint32_t ticks = I2C_STATS_ELAPSED(bus->stamp, I2C_STATS_NOW());
+	uint8_t bin = 0;
+
+	stats->transactions++;
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+			stats->bytes += bytes;
+			break;
+		case I2C_STATUS_NACK:
+			stats->nacks++;
+			break;
+		case I2C_STATUS_ARBLOST:
+			stats->arblost++;
+			break;
+		case I2C_STATUS_TIMEOUT:
+			stats->timeouts++;
+			break;
+		default:
+			stats->buserr++;
+			break;
+	}
+
+	// log2 bucket, the last bin also takes everything longer
+	while ((ticks >>= 1) && (bin < (I2C_STATS_BINS - 1)))
+	{
+		bin++;
+	}
+	stats->latency[bin]++;
+}
+
+/**
+	@brief I2C Stats
+	@details Copy of the bus counters, latency is in microseconds
+	@param[in] bus I2C bus handle
+	@param[out] stats Counters since start up or the last clear
+	@param[in] clear Non zero to zero the counters after the copy
+*/
+void i2c_stats(i2c_bus_t *bus, i2c_stats_t *stats, uint8_t clear)
+{
+	*stats = bus->stats;
+	if (clear)
+	{
+		bus->stats = (i2c_stats_t){ 0 };
+	}
+}
+#endif
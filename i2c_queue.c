@@ -0,0 +1,163 @@
+/**
+* @file i2c_queue.c
+* @brief MSF I2C Library, prioritised transaction queue.
+* @note Runs on the interrupt engines, i2c_submit on SAMD and PIC (built
+* with XC8). Do not mix queued and blocking calls on the same bus.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_queue.h"
+
+#ifdef __XC8
+#include <xc.h>
+
+#define I2C_QUEUE_LOCK()		uint8_t gie = GIE; GIE = 0
+#define I2C_QUEUE_UNLOCK()		GIE = gie
+#define I2C_QUEUE_SUBMIT(queue, item)	i2c_submit(&(item)->xfer)
+#else
+#include <sam.h>
+
+#ifdef I2C_SAMD11
+#error "i2c_queue.c runs on i2c_submit, MSF_SAMD11_I2C.c is polled only"
+#endif
+
+#define I2C_QUEUE_LOCK()		uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define I2C_QUEUE_UNLOCK()		__set_PRIMASK(primask)
+#define I2C_QUEUE_SUBMIT(queue, item)	i2c_submit((i2c_bus_t *)(queue)->bus, &(item)->xfer)
+#endif
+
+static void i2c_queue_start(i2c_queue_t *queue);
+
+/**
+	@brief Queue Pop
+	@details Take the first item of the highest priority level that has one
+	@param[in] queue Bus queue
+	@returns Item or 0 if every level is empty
+*/
+static i2c_queue_item_t *i2c_queue_pop(i2c_queue_t *queue)
+{
+	i2c_queue_item_t *item;
+
+	for (uint8_t level = 0; level < I2C_QUEUE_CLASSES; level++)
+	{
+		item = queue->head[level];
+		if (item)
+		{
+			queue->head[level] = item->next;
+			return item;
+		}
+	}
+
+	return 0;
+}
+
+/**
+	@brief Queue Done
+	@details Driver completion callback, hands the result to the item and
+	puts the next item on the bus straight away
+	@param[in] xfer Transaction that finished, first member of its item
+*/
+#ifdef __XC8
+static void i2c_queue_done(I2C_TRANSACTION *xfer)
+#else
+static void i2c_queue_done(i2c_transaction_t *xfer)
+#endif
+{
+	i2c_queue_item_t *item = (i2c_queue_item_t *)xfer;
+	i2c_queue_t *queue = item->queue;
+
+	queue->active = 0;
+	if (item->callback)
+	{
+		item->callback(item);
+	}
+
+	// Transaction boundary, a high priority item posted meanwhile goes first
+	if (!queue->active)
+	{
+		i2c_queue_start(queue);
+	}
+}
+
+/**
+	@brief Queue Start
+	@details Submit items until one is on the bus or the queue is empty.
+	Runs with interrupts masked or from the completion interrupt.
+	@param[in] queue Bus queue
+*/
+static void i2c_queue_start(i2c_queue_t *queue)
+{
+	i2c_queue_item_t *item;
+	uint8_t result;
+
+	while ((item = i2c_queue_pop(queue)) != 0)
+	{
+		queue->active = item;
+		result = I2C_QUEUE_SUBMIT(queue, item);
+		if (result == I2C_STATUS_PENDING)
+		{
+			return;
+		}
+
+		// Never reached the bus, report and move on
+		queue->active = 0;
+		item->xfer.status = result;
+		if (item->callback)
+		{
+			item->callback(item);
+		}
+	}
+}
+
+/**
+	@brief Queue Post
+	@details Add a transaction behind the items of its level that are due
+	no later, and start it at once if the bus is idle. Items without a
+	deadline go to the back of their level.
+	@param[in] queue Bus queue
+	@param[in] item Transaction to run
+	@returns I2C_STATUS_PENDING, the result arrives in item->xfer.status
+*/
+uint8_t i2c_queue_post(i2c_queue_t *queue, i2c_queue_item_t *item)
+{
+	i2c_queue_item_t **link;
+	uint8_t level = (item->priority < I2C_QUEUE_CLASSES) ? item->priority : (I2C_QUEUE_CLASSES - 1);
+
+	item->xfer.status = I2C_STATUS_PENDING;
+	item->xfer.callback = i2c_queue_done;
+	item->queue = queue;
+
+	I2C_QUEUE_LOCK();
+	link = &queue->head[level];
+	while (*link && (!item->timed || ((*link)->timed && ((int16_t)((*link)->deadline - item->deadline) <= 0))))
+	{
+		link = &(*link)->next;
+	}
+	item->next = *link;
+	*link = item;
+
+	if (!queue->active)
+	{
+		i2c_queue_start(queue);
+	}
+	I2C_QUEUE_UNLOCK();
+
+	return I2C_STATUS_PENDING;
+}
+
+/**
+	@brief Queue Busy
+	@param[in] queue Bus queue
+	@returns 1 while an item is on the bus or waiting
+*/
+uint8_t i2c_queue_busy(i2c_queue_t *queue)
+{
+	uint8_t busy = (queue->active != 0);
+
+	for (uint8_t level = 0; level < I2C_QUEUE_CLASSES; level++)
+	{
+		busy |= (queue->head[level] != 0);
+	}
+
+	return busy;
+}
@@ -0,0 +1,56 @@
+#ifndef I2C_QUEUE_H_
+#define I2C_QUEUE_H_
+
+#include <stdint.h>
+#ifdef __XC8
+#include "i2crxtx.h"
+#else
+#include "MSF_I2C.h"
+#endif
+
+// Priority classes, lower runs first
+#define I2C_QUEUE_HIGH		0
+#define I2C_QUEUE_LOW		1
+#ifndef I2C_QUEUE_CLASSES
+#define I2C_QUEUE_CLASSES	2
+#endif
+
+typedef struct i2c_queue i2c_queue_t;
+typedef struct i2c_queue_item i2c_queue_item_t;
+
+/**
+	@brief Queued transaction
+	@details Fill xfer as for i2c_submit, leaving its callback alone, plus
+	priority, and timed and deadline for an item that has one. The item must stay valid until callback runs or
+	xfer.status leaves I2C_STATUS_PENDING.
+*/
+struct i2c_queue_item
+{
+#ifdef __XC8
+	I2C_TRANSACTION xfer;					// Must stay first, the driver callback maps it back to the item
+#else
+	i2c_transaction_t xfer;					// Must stay first, the driver callback maps it back to the item
+#endif
+	uint8_t priority;						// I2C_QUEUE_HIGH .. I2C_QUEUE_CLASSES - 1
+	uint8_t timed;							// Non zero if deadline is set, any tick value including 0 is a deadline
+	uint16_t deadline;						// Caller ticks, earliest runs first within a class
+	void (*callback)(i2c_queue_item_t *);	// Completion callback, runs in interrupt context, may be 0
+	i2c_queue_t *queue;						// Set by i2c_queue_post
+	i2c_queue_item_t *next;					// Set by i2c_queue_post
+};
+
+/**
+	@brief Transaction queue of one bus
+	@details Zero initialise, set bus on SAMD.
+*/
+struct i2c_queue
+{
+	void *bus;										// i2c_bus_t * on SAMD, unused on PIC
+	i2c_queue_item_t *head[I2C_QUEUE_CLASSES];		// Waiting items per class
+	i2c_queue_item_t * volatile active;				// Item on the bus
+};
+
+uint8_t i2c_queue_post(i2c_queue_t*, i2c_queue_item_t*);
+uint8_t i2c_queue_busy(i2c_queue_t*);
+
+#endif /* I2C_QUEUE_H_ */
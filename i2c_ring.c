@@ -0,0 +1,79 @@
+/**
+* @file i2c_ring.c
+* @brief MSF I2C Library, lock free completion ring.
+* @note One producer (driver interrupt) and one consumer (main loop).
+* Each index has a single writer and fits in one byte, so reads and
+* writes of it are atomic on PIC18 and Cortex-M0+ alike.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_ring.h"
+
+#if defined(__XC8)
+// No caches or store buffers, volatile keeps the access order
+#define I2C_RING_BARRIER()
+#elif defined(__arm__)
+#include <sam.h>
+#define I2C_RING_BARRIER()	__DMB()
+#else
+// Host builds, threads may run on different cores
+#define I2C_RING_BARRIER()	__sync_synchronize()
+#endif
+
+/**
+	@brief Ring Push
+	@details Producer side. The record is written before head moves, so the
+	consumer never sees a half written slot.
+	@param[in] ring Completion ring
+	@param[in] record Record to copy in
+	@returns 1 if queued, 0 if the ring was full and the record was dropped
+*/
+uint8_t i2c_ring_push(i2c_ring_t *ring, const i2c_completion_t *record)
+{
+	uint8_t head = ring->head;
+
+	if ((uint8_t)(head - ring->tail) > ring->mask)
+	{
+		ring->dropped++;
+		return 0;
+	}
+
+	// Slot is free once tail has passed it, finish reading tail before writing
+	I2C_RING_BARRIER();
+	ring->slots[head & ring->mask] = *record;
+	I2C_RING_BARRIER();
+	ring->head = (uint8_t)(head + 1);
+
+	return 1;
+}
+
+/**
+	@brief Ring Drain
+	@details Consumer side. Copies out up to max records in order and frees
+	their slots with a single tail update.
+	@param[in] ring Completion ring
+	@param[out] out Array of at least max records
+	@param[in] max Most records to take
+	@returns Number of records copied
+*/
+uint8_t i2c_ring_drain(i2c_ring_t *ring, i2c_completion_t *out, uint8_t max)
+{
+	uint8_t tail = ring->tail;
+	uint8_t count = (uint8_t)(ring->head - tail);
+
+	if (count > max)
+	{
+		count = max;
+	}
+
+	// Read head before the slots it covers
+	I2C_RING_BARRIER();
+	for (uint8_t i = 0; i < count; i++)
+	{
+		out[i] = ring->slots[(uint8_t)(tail + i) & ring->mask];
+	}
+	I2C_RING_BARRIER();
+	ring->tail = (uint8_t)(tail + count);
+
+	return count;
+}
@@ -0,0 +1,46 @@
+#ifndef I2C_RING_H_
+#define I2C_RING_H_
+
+#include <stdint.h>
+
+/**
+	@brief Completion record
+*/
+typedef struct
+{
+	void *tag;			// xfer->context on SAMD, the transaction itself on PIC
+	uint32_t stamp;		// I2C_RING_NOW when the transaction finished
+	uint16_t bytes;		// Payload bytes, 0 unless status is I2C_STATUS_OK
+	uint8_t status;		// I2C_STATUS_*
+} i2c_completion_t;
+
+/**
+	@brief Single producer, single consumer completion ring
+	@details The driver interrupt pushes, the application drains, neither
+	masks interrupts. Indices run free and wrap at 256, so the slot count
+	must be a power of two no larger than 128. Build with I2C_RING defined
+	to have the drivers push into it.
+*/
+typedef struct
+{
+	i2c_completion_t *slots;	// Caller owned storage
+	uint8_t mask;				// Slot count - 1
+	volatile uint8_t head;		// Next slot to fill, written by the producer only
+	volatile uint8_t tail;		// Next slot to drain, written by the consumer only
+	volatile uint16_t dropped;	// Records lost to a full ring, written by the producer only
+} i2c_ring_t;
+
+/*
+	Slot count of an array, a count that is not a power of two from 1 to 128
+	fails to compile, the array size goes negative. A pointer is smaller
+	than a record, so passing one by mistake gives 0 and fails too.
+*/
+#define I2C_RING_SLOTS(slots)	(sizeof(slots) / sizeof((slots)[0]))
+#define I2C_RING_MASK(slots)	((uint8_t)((I2C_RING_SLOTS(slots) - 1) + (0 * sizeof(char[((I2C_RING_SLOTS(slots) >= 1) && (I2C_RING_SLOTS(slots) <= 128) && !(I2C_RING_SLOTS(slots) & (I2C_RING_SLOTS(slots) - 1))) ? 1 : -1]))))
+
+#define I2C_RING_INIT(slots)	{ (slots), I2C_RING_MASK(slots), 0, 0, 0 }
+
+uint8_t i2c_ring_push(i2c_ring_t*, const i2c_completion_t*);
+uint8_t i2c_ring_drain(i2c_ring_t*, i2c_completion_t*, uint8_t);
+
+#endif /* I2C_RING_H_ */
@@ -1,133 +1,1485 @@
 #include <sam.h>
-#include "i2c.h"
+#include "MSF_I2C.h"
 
-/*
-	TODO Create a functions to check forever whiles and time out accordingly.
-	This would allow us to gracefully fail some of this stuff
-	Would be much easier with RTOS and threadsleeping...
-*/
+#ifndef I2C_GCLK_HZ
+#define I2C_GCLK_HZ			48000000UL	// GCLK0 feeding SERCOM0 core
+#endif
+#ifndef I2C_SCL_HZ
+#define I2C_SCL_HZ			400000UL
+#endif
+#ifndef I2C_TRISE_NS
+#define I2C_TRISE_NS		15
+#endif
+#define I2C_FS_HZ			((I2C_SCL_HZ > 1000000UL) ? 400000UL : I2C_SCL_HZ)	// Standard, fast or fast plus SCL, the master code rate in high speed mode
+#if (I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS) < 1) || (I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS) > 255)
+#error "I2C_SCL_HZ too fast or too slow for I2C_GCLK_HZ"
+#endif
+#if (I2C_BAUD_CYCLES(I2C_GCLK_HZ, I2C_BAUD_VALUE(I2C_GCLK_HZ, I2C_FS_HZ, I2C_TRISE_NS), I2C_TRISE_NS) * I2C_FS_HZ) < I2C_GCLK_HZ
+#error "BAUD would run SCL above I2C_SCL_HZ"
+#endif
+#if (I2C_SCL_HZ > 3400000UL) || ((I2C_SCL_HZ > 1000000UL) && ((I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ) < 1) || (I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ) > 255)))
+#error "I2C_SCL_HZ out of range for high speed mode"
+#endif
+#if (I2C_SCL_HZ > 1000000UL) && ((I2C_HSBAUD_CYCLES(I2C_HSBAUD_VALUE(I2C_GCLK_HZ, I2C_SCL_HZ)) * I2C_SCL_HZ) < I2C_GCLK_HZ)
+#error "HSBAUD would run SCL above I2C_SCL_HZ"
+#endif
+
+#ifndef I2C_TIMEOUT
+#define I2C_TIMEOUT			20000	// Poll loops before a wait gives up, about 2mS at 48MHz
+#endif
+#ifndef I2C_SCAN_TIMEOUT
+#define I2C_SCAN_TIMEOUT	2000	// Poll loops for an i2c_scan probe, about 200uS at 48MHz
+#endif
+#ifndef I2C_ARB_RETRIES
+#define I2C_ARB_RETRIES		3		// Re-issues after a lost arbitration before I2C_STATUS_ARBLOST is returned
+#endif
+#ifndef I2C_ARB_TIMEOUT
+#define I2C_ARB_TIMEOUT		200000	// Poll loops waiting for the winning master's STOP, about 20mS at 48MHz
+#endif
+#ifndef I2C_RECOVERY_DELAY
+#define I2C_RECOVERY_DELAY	40		// Loops per half SCL period while bit banging, about 80KHz at 48MHz
+#endif
+#ifndef I2C_SDA_PIN
+#define I2C_SDA_PIN			14		// PA14, SERCOM0 PAD0
+#endif
+#ifndef I2C_SCL_PIN
+#define I2C_SCL_PIN			15		// PA15, SERCOM0 PAD1
+#endif
+
+#ifdef I2C_STATS
+#ifndef I2C_STATS_NOW
+#define I2C_STATS_NOW()					(SysTick->VAL)		// Free running SysTick, LOAD = 0xFFFFFF
+#endif
+#ifndef I2C_STATS_ELAPSED
+#define I2C_STATS_ELAPSED(start, now)	(((start) - (now)) & 0xFFFFFFUL)	// SysTick counts down
+#endif
+#define I2C_STATS_START(bus)				((bus)->stamp = I2C_STATS_NOW())
+#define I2C_STATS_END(bus, result, bytes)	i2c_stats_record((bus), (result), (bytes))
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes);
+#else
+#define I2C_STATS_START(bus)
+#define I2C_STATS_END(bus, result, bytes)	((void)(bytes))
+#endif
+
+#ifdef I2C_TRACE
+#include "i2c_trace.h"
+#define I2C_TRACE_EVENT(bus, type, data)	i2c_trace_event((bus)->sercom, (type), (data))
+#define I2C_TRACE_RESULT(bus, result)		i2c_trace_result((bus)->sercom, (result))
+#define I2C_TRACE_ADDR(bus, hw, byte)		i2c_trace_addr((bus), (hw), (byte))
+static void i2c_trace_addr(i2c_bus_t *bus, sercom_registers_t *hw, uint8_t byte);
+#else
+#define I2C_TRACE_EVENT(bus, type, data)
+#define I2C_TRACE_RESULT(bus, result)
+#define I2C_TRACE_ADDR(bus, hw, byte)
+#endif
+
+#ifdef I2C_SMBUS
+#include "i2c_smbus.h"
+#define I2C_PEC(bus, byte)	((bus)->pec = I2C_PEC_UPDATE((bus)->pec, (byte)))
+#else
+#define I2C_PEC(bus, byte)
+#endif
+
+#if defined(I2C_RING) && !defined(I2C_RING_NOW)
+#define I2C_RING_NOW()	(SysTick->VAL)	// Free running SysTick, LOAD = 0xFFFFFF
+#endif
+
+#ifdef I2C_SINGLE_BUS
+#define I2C_HW(bus)	((void)(bus), I2C_SINGLE_BUS)
+#else
+// SERCOM register blocks by instance number
+static sercom_registers_t * const i2c_sercom[SERCOM_INST_NUM] =
+{
+#ifdef SERCOM0_REGS
+	SERCOM0_REGS,
+#endif
+#ifdef SERCOM1_REGS
+	SERCOM1_REGS,
+#endif
+#ifdef SERCOM2_REGS
+	SERCOM2_REGS,
+#endif
+#ifdef SERCOM3_REGS
+	SERCOM3_REGS,
+#endif
+#ifdef SERCOM4_REGS
+	SERCOM4_REGS,
+#endif
+#ifdef SERCOM5_REGS
+	SERCOM5_REGS,
+#endif
+};
+#define I2C_HW(bus)	(i2c_sercom[(bus)->sercom])
+#endif
+
+i2c_bus_t i2c_bus0 = I2C_BUS_INIT(0, 0, I2C_SDA_PIN, I2C_SCL_PIN, 0x2, I2C_GCLK_HZ, I2C_SCL_HZ, I2C_TRISE_NS);
+
+static uint8_t i2c_wait_sync(sercom_registers_t *hw, uint32_t mask);
+
+#ifdef I2C_DMA
+#include "i2c_target.h"
+
+#ifndef I2C_DMA_CHANNEL
+#define I2C_DMA_CHANNEL	0
+#endif
+#ifndef I2C_DMA_SEGMENTS
+#define I2C_DMA_SEGMENTS	4	// Most non empty segments per i2c_send_dmav/i2c_read_dmav
+#endif
+
+#define I2C_DMA_TX	1
+#define I2C_DMA_RX	2
+
+// DMAC descriptor and writeback sections, driver owns channels 0..I2C_DMA_CHANNEL + SERCOM_INST_NUM - 1
+// SERCOMn uses channel I2C_DMA_CHANNEL + n
+static dmac_descriptor_registers_t i2c_dma_desc[I2C_DMA_CHANNEL + SERCOM_INST_NUM] __attribute__((aligned(16)));
+static dmac_descriptor_registers_t i2c_dma_wb[I2C_DMA_CHANNEL + SERCOM_INST_NUM] __attribute__((aligned(16)));
+static i2c_bus_t *i2c_dma_bus[SERCOM_INST_NUM];	// Buses seen by init_i2c, walked by DMAC_Handler
+// Descriptors linked behind the channel descriptor for segments 2..I2C_DMA_SEGMENTS
+static dmac_descriptor_registers_t i2c_dma_link[SERCOM_INST_NUM][(I2C_DMA_SEGMENTS > 1) ? (I2C_DMA_SEGMENTS - 1) : 1] __attribute__((aligned(16)));
+static void i2c_dma_setup(void);
+#endif
 
 /**
 	@brief Init I2C
 	@details Function to initialize I2C bus on device.
+	@param[in] bus I2C bus handle
 */
-void i2c_init(void)
+void init_i2c(i2c_bus_t *bus)
 {
-	// PM Enable SERCOM0 Clock
-    PM_REGS->PM_APBCMASK |= PM_APBCMASK_SERCOM0(1);
+	sercom_registers_t *hw = I2C_HW(bus);
+	port_group_registers_t *group = &PORT_REGS->GROUP[0];
+	
+	// PM Enable SERCOMn Clock
+    PM_REGS->PM_APBCMASK |= (PM_APBCMASK_SERCOM0(1) << bus->sercom);
+	
+	// Set SERCOMn Core to the bus clock generator
+    GCLK_REGS->GCLK_CLKCTRL = (GCLK_CLKCTRL_CLKEN(1) | GCLK_CLKCTRL_ID(GCLK_CLKCTRL_ID_SERCOM0_CORE_Val + bus->sercom) | GCLK_CLKCTRL_GEN(bus->gclk));
 	
-	// Set SERCOM0 Core to GCLK0
-    GCLK_REGS->GCLK_CLKCTRL = (GCLK_CLKCTRL_CLKEN(1) | GCLK_CLKCTRL_ID_SERCOM0_CORE | GCLK_CLKCTRL_GEN_GCLK0);
+	// Hand SDA and SCL to the SERCOM
+	group->PORT_PMUX[bus->sda >> 1] = ((bus->sda & 1) ? ((group->PORT_PMUX[bus->sda >> 1] & PORT_PMUX_PMUXE_Msk) | PORT_PMUX_PMUXO(bus->pmux)) : ((group->PORT_PMUX[bus->sda >> 1] & PORT_PMUX_PMUXO_Msk) | PORT_PMUX_PMUXE(bus->pmux)));
+	group->PORT_PMUX[bus->scl >> 1] = ((bus->scl & 1) ? ((group->PORT_PMUX[bus->scl >> 1] & PORT_PMUX_PMUXE_Msk) | PORT_PMUX_PMUXO(bus->pmux)) : ((group->PORT_PMUX[bus->scl >> 1] & PORT_PMUX_PMUXO_Msk) | PORT_PMUX_PMUXE(bus->pmux)));
+	group->PORT_PINCFG[bus->sda] = PORT_PINCFG_PMUXEN(1);
+	group->PORT_PINCFG[bus->scl] = PORT_PINCFG_PMUXEN(1);
 	
-	// Controller Mode with 400KHz speed
-    SERCOM0_REGS->I2CM.SERCOM_CTRLA = (SERCOM_I2CM_CTRLA_MODE_I2C_MASTER | SERCOM_I2CM_CTRLA_SPEED_STANDARD_AND_FAST_MODE);
+	// Controller Mode, SCL low timeout bounds interrupt driven transfers
+    hw->I2CM.SERCOM_CTRLA = (SERCOM_I2CM_CTRLA_MODE_I2C_MASTER | SERCOM_I2CM_CTRLA_SPEED(bus->speed) | SERCOM_I2CM_CTRLA_LOWTOUTEN(1));
 	
 	// Set baud rate
-    // 48MHz clock @ BAUD 55 (w/ 15nS Trise) = 397,614.31Hz
-    SERCOM0_REGS->I2CM.SERCOM_BAUD = SERCOM_I2CM_BAUD_BAUD(55);
+    // 48MHz clock, 400KHz (w/ 15nS Trise) = BAUD 55 = 397,614.31Hz
+    hw->I2CM.SERCOM_BAUD = bus->baud;
+	bus->hs = (bus->speed == I2C_SPEED_HIGH) ? SERCOM_I2CM_ADDR_HS(1) : 0;
+	bus->active = 0;
 	
 	// Enable Smart Mode
-    SERCOM0_REGS->I2CM.SERCOM_CTRLB = SERCOM_I2CM_CTRLB_SMEN(1);
+    hw->I2CM.SERCOM_CTRLB = SERCOM_I2CM_CTRLB_SMEN(1);
 	
 	// Enable I2C
-    while(SERCOM0_REGS->I2CM.SERCOM_SYNCBUSY&SERCOM_I2CM_SYNCBUSY_ENABLE(1));
-    SERCOM0_REGS->I2CM.SERCOM_CTRLA|=SERCOM_I2CM_CTRLA_ENABLE(1);
+    i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE(1));
+    hw->I2CM.SERCOM_CTRLA|=SERCOM_I2CM_CTRLA_ENABLE(1);
 	
 	//Force Idle Bus State
-	while(SERCOM0_REGS->I2CM.SERCOM_SYNCBUSY&SERCOM_I2CM_SYNCBUSY_SYSOP(1));
-    SERCOM0_REGS->I2CM.SERCOM_STATUS |= SERCOM_I2CM_STATUS_BUSSTATE(0x1);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+    hw->I2CM.SERCOM_STATUS |= SERCOM_I2CM_STATUS_BUSSTATE(0x1);
 	
-	//Enable interrupts for master on bus and slave on bus
-	//SERCOM0->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB | SERCOM_I2CM_INTENSET_SB;
+	// MB/SB/ERROR sources are enabled per transaction by i2c_submit, SERCOMn IRQs are consecutive
+	NVIC_EnableIRQ((IRQn_Type)(SERCOM0_IRQn + bus->sercom));
+
+#ifdef I2C_DMA
+	i2c_dma_bus[bus->sercom] = bus;
+	i2c_dma_setup();
+	NVIC_EnableIRQ(DMAC_IRQn);
+#endif
 }
 
+#ifdef I2C_DMA
 /**
-	@brief I2C Send
-	@details Send array of bytes to I2C device
+	@brief I2C DMA Setup
+	@details DMAC clocks, descriptor memory and priority level 0, shared by
+	every bus and by i2c_target.c
+*/
+static void i2c_dma_setup(void)
+{
+	PM_REGS->PM_AHBMASK |= PM_AHBMASK_DMAC(1);
+	PM_REGS->PM_APBBMASK |= PM_APBBMASK_DMAC(1);
+	if (!(DMAC_REGS->DMAC_CTRL & DMAC_CTRL_DMAENABLE_Msk))
+	{
+		DMAC_REGS->DMAC_BASEADDR = (uint32_t)i2c_dma_desc;
+		DMAC_REGS->DMAC_WRBADDR = (uint32_t)i2c_dma_wb;
+		DMAC_REGS->DMAC_CTRL = (DMAC_CTRL_DMAENABLE(1) | DMAC_CTRL_LVLEN0(1));
+	}
+}
+
+/**
+	@brief I2C DMA Channel
+	@details Lend the DMA channel of a SERCOM that is not run as a master,
+	for i2c_target.c. The DMAC descriptor memory lives here, so both sides
+	share one BASEADDR. Channel is I2C_DMA_CHANNEL + sercom, DMAC_Handler
+	leaves it alone since init_i2c never saw that SERCOM.
+	@param[in] sercom SERCOM instance number
+	@param[out] link Spare descriptor linked behind the channel descriptor
+	@param[out] wb Writeback slot of the channel
+	@returns Channel descriptor
+*/
+dmac_descriptor_registers_t *i2c_dma_channel(uint8_t sercom, dmac_descriptor_registers_t **link, dmac_descriptor_registers_t **wb)
+{
+	i2c_dma_setup();
+	*link = i2c_dma_link[sercom];
+	*wb = &i2c_dma_wb[I2C_DMA_CHANNEL + sercom];
+
+	return &i2c_dma_desc[I2C_DMA_CHANNEL + sercom];
+}
+#endif
+
+/**
+	@brief I2C Wait Sync
+	@details Bounded wait for SYNCBUSY bits to clear
+	@param[in] hw SERCOM registers
+	@param[in] mask SYNCBUSY bits to wait on
+	@returns I2C_STATUS_OK or I2C_STATUS_TIMEOUT
+*/
+static uint8_t i2c_wait_sync(sercom_registers_t *hw, uint32_t mask)
+{
+	uint32_t timeout = I2C_TIMEOUT;
+
+	while(hw->I2CM.SERCOM_SYNCBUSY & mask)
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_TIMEOUT;
+		}
+	}
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Set Speed
+	@details Switch bus speed between transactions, for example to run a
+	Fm+ device at 1MHz and drop back to 400KHz for slower parts.
+	@param[in] bus I2C bus handle
+	@param[in] speed I2C_SPEED_* mode, see I2C_SPEED_FOR
+	@param[in] baud BAUD register value, see I2C_BAUD_REG
+	@returns I2C_STATUS_OK, I2C_STATUS_BUSY if a transaction is active or I2C_STATUS_TIMEOUT
+*/
+uint8_t i2c_set_speed(i2c_bus_t *bus, uint8_t speed, uint32_t baud)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+
+	if (bus->active)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	// SPEED and BAUD are enable protected
+	hw->I2CM.SERCOM_CTRLA &= ~SERCOM_I2CM_CTRLA_ENABLE(1);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE(1));
+	hw->I2CM.SERCOM_CTRLA = ((hw->I2CM.SERCOM_CTRLA & ~SERCOM_I2CM_CTRLA_SPEED_Msk) | SERCOM_I2CM_CTRLA_SPEED(speed));
+	hw->I2CM.SERCOM_BAUD = baud;
+	bus->speed = speed;
+	bus->baud = baud;
+	bus->hs = (speed == I2C_SPEED_HIGH) ? SERCOM_I2CM_ADDR_HS(1) : 0;
+
+	hw->I2CM.SERCOM_CTRLA |= SERCOM_I2CM_CTRLA_ENABLE(1);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE(1));
+	if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) != I2C_STATUS_OK)
+	{
+		return I2C_STATUS_TIMEOUT;
+	}
+	hw->I2CM.SERCOM_STATUS |= SERCOM_I2CM_STATUS_BUSSTATE(0x1);
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Wait Flag
+	@details Bounded wait for MB/SB, then decode STATUS for the byte that just finished
+	@param[in] hw SERCOM registers
+	@param[in] flags INTFLAG bits to wait on
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK, I2C_STATUS_ARBLOST, I2C_STATUS_BUSERR or I2C_STATUS_TIMEOUT
+*/
+static uint8_t i2c_wait_flag(sercom_registers_t *hw, uint8_t flags)
+{
+	uint32_t timeout = I2C_TIMEOUT;
+	uint16_t status;
+
+	while(!(hw->I2CM.SERCOM_INTFLAG & flags))
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_TIMEOUT;
+		}
+	}
+
+	// A bus error while owning the bus sets ARBLOST too, it needs a recovery rather than a re-issue
+	status = hw->I2CM.SERCOM_STATUS;
+	if (status & SERCOM_I2CM_STATUS_BUSERR(1))
+	{
+		return I2C_STATUS_BUSERR;
+	}
+	if (status & SERCOM_I2CM_STATUS_ARBLOST(1))
+	{
+		return I2C_STATUS_ARBLOST;
+	}
+	if (status & SERCOM_I2CM_STATUS_RXNACK(1))
+	{
+		return I2C_STATUS_NACK;
+	}
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief I2C Recovery Delay
+	@details Half SCL period while bit banging
+*/
+static void i2c_recovery_delay(void)
+{
+	for (volatile uint16_t i = I2C_RECOVERY_DELAY; i; i--);
+}
+
+#ifdef I2C_TRACE
+/**
+	@brief I2C Trace Address
+	@details Record the START, or RESTART if the bus is already owned, and
+	the address byte about to be written to ADDR
+	@param[in] bus I2C bus handle
+	@param[in] hw SERCOM registers
+	@param[in] byte Address byte with the R/W bit
+*/
+static void i2c_trace_addr(i2c_bus_t *bus, sercom_registers_t *hw, uint8_t byte)
+{
+	uint8_t owner = ((hw->I2CM.SERCOM_STATUS & SERCOM_I2CM_STATUS_BUSSTATE_Msk) == SERCOM_I2CM_STATUS_BUSSTATE(2));
+
+	i2c_trace_event(bus->sercom, owner ? I2C_TRACE_RESTART : I2C_TRACE_START, 0);
+	i2c_trace_event(bus->sercom, I2C_TRACE_TX, byte);
+}
+#endif
+
+/**
+	@brief I2C Recover
+	@details Free a bus held by a stuck peripheral. Hands the pins to PORT,
+	clocks SCL up to 9 times until SDA is released, bit bangs a STOP and
+	brings the controller back with BUSSTATE forced to IDLE.
+	@param[in] bus I2C bus handle
+	@returns I2C_STATUS_OK if SDA was released, I2C_STATUS_BUSERR otherwise
+*/
+uint8_t i2c_recover(i2c_bus_t *bus)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	port_group_registers_t *group = &PORT_REGS->GROUP[0];
+	uint32_t sda = (1UL << bus->sda);
+	uint32_t scl = (1UL << bus->scl);
+	uint8_t sda_cfg = group->PORT_PINCFG[bus->sda];
+	uint8_t scl_cfg = group->PORT_PINCFG[bus->scl];
+	uint8_t clocks = 0;
+#ifdef I2C_STATS
+	uint32_t start = I2C_STATS_NOW();
+#endif
+
+	// Controller off, pins become open drain GPIO: OUT low, DIR set drives low, DIR clear releases
+	hw->I2CM.SERCOM_CTRLA &= ~SERCOM_I2CM_CTRLA_ENABLE(1);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE(1));
+	group->PORT_OUTCLR = (sda | scl);
+	group->PORT_DIRCLR = (sda | scl);
+	group->PORT_PINCFG[bus->sda] = PORT_PINCFG_INEN(1);
+	group->PORT_PINCFG[bus->scl] = PORT_PINCFG_INEN(1);
+	i2c_recovery_delay();
+
+	// Clock out whatever the peripheral thinks it is still sending
+	while (!(group->PORT_IN & sda) && (clocks < 9))
+	{
+		group->PORT_DIRSET = scl;
+		i2c_recovery_delay();
+		group->PORT_DIRCLR = scl;
+		i2c_recovery_delay();
+		clocks++;
+	}
+
+	// STOP, SDA rising while SCL is high
+	group->PORT_DIRSET = scl;
+	i2c_recovery_delay();
+	group->PORT_DIRSET = sda;
+	i2c_recovery_delay();
+	group->PORT_DIRCLR = scl;
+	i2c_recovery_delay();
+	group->PORT_DIRCLR = sda;
+	i2c_recovery_delay();
+
+	// Hand pins back to the SERCOM and force idle bus state
+	group->PORT_PINCFG[bus->sda] = sda_cfg;
+	group->PORT_PINCFG[bus->scl] = scl_cfg;
+	hw->I2CM.SERCOM_CTRLA |= SERCOM_I2CM_CTRLA_ENABLE(1);
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_ENABLE(1));
+	i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+	hw->I2CM.SERCOM_STATUS |= SERCOM_I2CM_STATUS_BUSSTATE(0x1);
+
+	bus->recovery.count++;
+	bus->recovery.clocks = clocks;
+	I2C_TRACE_EVENT(bus, I2C_TRACE_RESET, clocks);
+#ifdef I2C_STATS
+	bus->recovery.latency = I2C_STATS_ELAPSED(start, I2C_STATS_NOW());
+	bus->stats.resets++;
+#endif
+
+	return (group->PORT_IN & sda) ? I2C_STATUS_OK : I2C_STATUS_BUSERR;
+}
+
+/**
+	@brief I2C Recovery Stats
+	@param[in] bus I2C bus handle
+	@param[out] stats Number of recoveries run, SCL pulses and time the last one needed
+*/
+void i2c_recovery_stats(i2c_bus_t *bus, i2c_recovery_t *stats)
+{
+	*stats = bus->recovery;
+}
+
+/**
+	@brief I2C Arbitration Wait
+	@details The controller lets go of SDA and SCL as soon as it loses
+	arbitration, so there is nothing to recover. Wait for the winning
+	master's STOP to bring BUSSTATE back to IDLE before trying again.
+	@param[in] bus I2C bus handle
+	@returns I2C_STATUS_OK once the bus is idle, I2C_STATUS_ARBLOST if the other master held it past I2C_ARB_TIMEOUT
+*/
+static uint8_t i2c_arb_wait(i2c_bus_t *bus)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	uint32_t timeout = I2C_ARB_TIMEOUT;
+#ifdef I2C_STATS
+	uint32_t lost = I2C_STATS_NOW();
+	uint32_t ticks;
+#endif
+
+	while ((hw->I2CM.SERCOM_STATUS & SERCOM_I2CM_STATUS_BUSSTATE_Msk) != SERCOM_I2CM_STATUS_BUSSTATE(1))
+	{
+		if (!--timeout)
+		{
+			return I2C_STATUS_ARBLOST;
+		}
+	}
+
+#ifdef I2C_STATS
+	ticks = I2C_STATS_ELAPSED(lost, I2C_STATS_NOW());
+	bus->stats.arb_retries++;
+	bus->stats.arb_wait_total += ticks;
+	if (ticks > bus->stats.arb_wait_max)
+	{
+		bus->stats.arb_wait_max = ticks;
+	}
+#endif
+
+	return I2C_STATUS_OK;
+}
+
+#ifdef I2C_STATS
+/**
+	@brief I2C Stats Record
+	@details Count a finished transaction and file its latency
+	@param[in] bus I2C bus handle
+	@param[in] result I2C_STATUS_* the transaction ended with
+	@param[in] bytes Payload bytes, counted only when result is I2C_STATUS_OK
+*/
+static void i2c_stats_record(i2c_bus_t *bus, uint8_t result, uint32_t bytes)
+{
+	i2c_stats_t *stats = &bus->stats;
+	uint32_t ticks = I2C_STATS_ELAPSED(bus->stamp, I2C_STATS_NOW());
+	uint8_t bin = 0;
+
+	stats->transactions++;
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+			stats->bytes += bytes;
+			break;
+		case I2C_STATUS_NACK:
+			stats->nacks++;
+			break;
+		case I2C_STATUS_ARBLOST:
+			stats->arblost++;
+			break;
+		case I2C_STATUS_TIMEOUT:
+			stats->timeouts++;
+			break;
+		default:
+			stats->buserr++;
+			break;
+	}
+
+	// log2 bucket, the last bin also takes everything longer
+	while ((ticks >>= 1) && (bin < (I2C_STATS_BINS - 1)))
+	{
+		bin++;
+	}
+	stats->latency[bin]++;
+}
+
+/**
+	@brief I2C Stats
+	@details Consistent copy of the bus counters, taken with interrupts masked
+	@param[in] bus I2C bus handle
+	@param[out] stats Counters since power up or the last clear
+	@param[in] clear Non zero to zero the counters after the copy
+*/
+void i2c_stats(i2c_bus_t *bus, i2c_stats_t *stats, uint8_t clear)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	*stats = bus->stats;
+	if (clear)
+	{
+		bus->stats = (i2c_stats_t){ 0 };
+	}
+	__set_PRIMASK(primask);
+}
+#endif
+
+/**
+	@brief I2C End
+	@details Close a polled transaction according to how it went
+	@param[in] bus I2C bus handle
+	@param[in] result I2C_STATUS_* of the transaction so far
+	@param[in] bytes Payload bytes of the transaction, for I2C_STATS
+	@returns result
+*/
+static uint8_t i2c_end(i2c_bus_t *bus, uint8_t result, uint32_t bytes)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+		case I2C_STATUS_NACK:
+			// Still own the bus, release it
+			if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) == I2C_STATUS_OK)
+			{
+				hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+				I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+				break;
+			}
+			result = I2C_STATUS_TIMEOUT;
+			// fall through
+		case I2C_STATUS_TIMEOUT:
+		case I2C_STATUS_BUSERR:
+			i2c_recover(bus);
+			break;
+		default:
+			// Lost arbitration, the other master owns the bus
+			break;
+	}
+
+	I2C_STATS_END(bus, result, bytes);
+
+	return result;
+}
+
+/**
+	@brief I2C Segment Total
+	@param[in] iov Segments
+	@param[in] count Number of segments
+	@returns Bytes across all segments
+*/
+static uint32_t i2c_iov_total(const i2c_iovec_t *iov, uint8_t count)
+{
+	uint32_t total = 0;
+
+	while (count--)
+	{
+		total += (iov++)->len;
+	}
+
+	return total;
+}
+
+/**
+	@brief I2C Write Phase
+	@details Address device and send each segment in turn, leaving the bus
+	owned so the caller can issue a STOP or a repeated start.
+	@param[in] bus I2C bus handle
 	@param[in] i2caddr 7 bit I2C address
-	@param[in] data Data to write to I2C bus
-	@param[in] len Length of the array to write
-	@returns Number of bytes written
+	@param[in] iov Segments to write
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or the error that stopped the transfer
 */
-uint8_t i2c_send(uint8_t i2caddr, uint8_t *data, uint8_t len)
+static uint8_t i2c_write_phase(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
 {
+	sercom_registers_t *hw = I2C_HW(bus);
+	uint8_t result;
+	uint8_t *data;
+	uint16_t len;
+
 	// Set bus to ACK received data
-    SERCOM0_REGS->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
-	
-	// Send write address
-    while(SERCOM0_REGS->I2CM.SERCOM_SYNCBUSY&SERCOM_I2CM_SYNCBUSY_SYSOP(1));
-    SERCOM0_REGS->I2CM.SERCOM_ADDR = ((i2caddr << 1) | 0);
-	
-    // Wait for controller to transmit byte before moving on
-    while(!(SERCOM0_REGS->I2CM.SERCOM_INTFLAG & SERCOM_I2CM_INTFLAG_MB(1)));
-    SERCOM0_REGS->I2CM.SERCOM_INTFLAG = SERCOM_I2CM_INTFLAG_MB(1);  // Clear Flag
-	
-    // Send data
-	uint8_t result = 0;
-	for (int i = 0; i < len; i++)
-	{
-		while(SERCOM0_REGS->I2CM.SERCOM_SYNCBUSY&SERCOM_I2CM_SYNCBUSY_SYSOP(1));
-        SERCOM0_REGS->I2CM.SERCOM_DATA = (uint8_t)*data;    // Send current byte of data
-		while(!(SERCOM0_REGS->I2CM.SERCOM_INTFLAG & SERCOM_I2CM_INTFLAG_MB(1)));    // Wait for controller transmit
-		SERCOM0_REGS->I2CM.SERCOM_INTFLAG = SERCOM_I2CM_INTFLAG_MB(1);  // Clear Flag
+	hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
+
+	// Send write address, wait for controller to transmit it
+	result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+	if (result == I2C_STATUS_OK)
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)(i2caddr << 1));
+		I2C_PEC(bus, (uint8_t)(i2caddr << 1));
+		hw->I2CM.SERCOM_ADDR = (((i2caddr << 1) | 0) | bus->hs);
+		result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB(1));
+	}
+	I2C_TRACE_RESULT(bus, result);
+
+	// Send data, straight from each segment
+	while ((result == I2C_STATUS_OK) && count--)
+	{
+		data = iov->data;
+		len = iov->len;
+		iov++;
+
+		while ((result == I2C_STATUS_OK) && len--)
+		{
+			result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+			if (result == I2C_STATUS_OK)
+			{
+				I2C_TRACE_EVENT(bus, I2C_TRACE_TX, *data);
+				I2C_PEC(bus, *data);
+				hw->I2CM.SERCOM_DATA = *data++;	// Writing DATA clears MB
+				result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB(1));
+			}
+			I2C_TRACE_RESULT(bus, result);
+		}
+	}
+
+#ifdef I2C_SMBUS
+	// SMBus PEC closes a write with no read after it, worked out as the bytes went out
+	if ((result == I2C_STATUS_OK) && (bus->smbus & I2C_SMBUS_PEC_TX))
+	{
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+		if (result == I2C_STATUS_OK)
+		{
+			I2C_TRACE_EVENT(bus, I2C_TRACE_TX, bus->pec);
+			hw->I2CM.SERCOM_DATA = bus->pec;
+			result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB(1));
+		}
+		I2C_TRACE_RESULT(bus, result);
+	}
+#endif
+
+	return result;
+}
+
+/**
+	@brief I2C Read Phase
+	@details Address device for reading and fill each segment in turn,
+	leaving the bus owned so the caller can issue a STOP.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] iov Segments to fill
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or the error that stopped the transfer
+*/
+static uint8_t i2c_read_phase(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	uint32_t left = i2c_iov_total(iov, count);
+	uint8_t *data = 0;
+	uint16_t len = 0;
+	uint8_t result;
+
+	// Set controller to ACK after each read of the DATA register
+	hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
+
+	// Load read address, NACK shows up as MB instead of SB
+	result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+	if (result == I2C_STATUS_OK)
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)((i2caddr << 1) | 1));
+		I2C_PEC(bus, (uint8_t)((i2caddr << 1) | 1));
+		hw->I2CM.SERCOM_ADDR = (((i2caddr << 1) | 1) | bus->hs);
+		result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_MB(1) | SERCOM_I2CM_INTFLAG_SB(1));
+	}
+	I2C_TRACE_RESULT(bus, result);
+
+	while ((result == I2C_STATUS_OK) && left)
+	{
+		// Next non empty segment
+		while (!len)
+		{
+			data = iov->data;
+			len = iov->len;
+			iov++;
+		}
+
+		// Have controller NACK the last byte read to signal end of request
+		if (left == 1)
+		{
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_ACKACT(1);
+		}
+
+		// Smart mode sends ACKACT when DATA is read
+		*data = hw->I2CM.SERCOM_DATA;
+		I2C_TRACE_EVENT(bus, I2C_TRACE_RX, *data);
+		I2C_TRACE_EVENT(bus, (left == 1) ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+		I2C_PEC(bus, *data);
+#ifdef I2C_SMBUS
+		if (bus->smbus & I2C_SMBUS_BLOCK)
+		{
+			bus->smbus &= ~I2C_SMBUS_BLOCK;
+			left = i2c_smbus_block_left(bus->smbus, *data, left);
+		}
+#endif
 		data++;
-		result++;
+		len--;
+		if (--left)
+		{
+			result = i2c_wait_flag(hw, SERCOM_I2CM_INTFLAG_SB(1));
+			if (result != I2C_STATUS_OK)
+			{
+				I2C_TRACE_RESULT(bus, result);
+			}
+		}
 	}
 
-	while(SERCOM0_REGS->I2CM.SERCOM_SYNCBUSY&SERCOM_I2CM_SYNCBUSY_SYSOP(1));
-    SERCOM0_REGS->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
-	
 	return result;
 }
 
+/**
+	@brief I2C Transfer
+	@details Run the write phase, the read phase after a repeated start, or
+	both, as one polled transaction. A lost arbitration is re-issued from the
+	first byte as soon as the bus is idle again, up to I2C_ARB_RETRIES times.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] wiov Segments to write, 0 for a read only transaction
+	@param[in] wcount Number of write segments
+	@param[out] riov Segments to read, 0 for a write only transaction
+	@param[in] rcount Number of read segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for a read of 0 bytes or error code, bus is recovered after timeouts and bus errors
+*/
+static uint8_t i2c_transfer(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *wiov, uint8_t wcount, const i2c_iovec_t *riov, uint8_t rcount)
+{
+	uint8_t tries = I2C_ARB_RETRIES;
+	uint8_t result;
+#ifdef I2C_SMBUS
+	uint8_t smbus = bus->smbus;
+#endif
+
+	// The read address goes out with ACKACT set to ACK, a read with no byte to NACK would leave the target driving SDA
+	if (riov && !i2c_iov_total(riov, rcount))
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	I2C_STATS_START(bus);
+	for (;;)
+	{
+		result = I2C_STATUS_OK;
+		if (wiov)
+		{
+			result = i2c_write_phase(bus, i2caddr, wiov, wcount);
+		}
+		if ((result == I2C_STATUS_OK) && riov)
+		{
+			result = i2c_read_phase(bus, i2caddr, riov, rcount);
+		}
+
+		if ((result != I2C_STATUS_ARBLOST) || !tries--)
+		{
+			break;
+		}
+		result = i2c_arb_wait(bus);
+		if (result != I2C_STATUS_OK)
+		{
+			break;
+		}
+#ifdef I2C_SMBUS
+		bus->smbus = smbus;
+		bus->pec = 0;
+#endif
+	}
+
+	return i2c_end(bus, result, i2c_iov_total(wiov, wcount) + i2c_iov_total(riov, rcount));
+}
+
+/**
+	@brief I2C Send
+	@details Send array of bytes to I2C device
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] data Data to write to I2C bus
+	@param[in] len Length of the array to write
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_send(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t len)
+{
+	i2c_iovec_t seg = { data, len };
+
+	return i2c_transfer(bus, i2caddr, &seg, 1, 0, 0);
+}
+
 /**
 	@brief I2C Read
 	@details Reads data from I2C device
+	@param[in] bus I2C bus handle
 	@param[in] i2caddr 7 bit I2C address
 	@param[out] data Array to store read data
 	@param[in] len Number of bytes to read from i2c device
-	@returns Number of bytes read
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for 0 bytes or error code, bus is recovered after timeouts and bus errors
 */
-uint8_t i2c_read(uint8_t i2caddr, uint8_t *data, uint8_t len)
+uint8_t i2c_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *data, uint16_t len)
 {
-	uint8_t result = 0;
+	i2c_iovec_t seg = { data, len };
 
-	// Load read address into register
-	SERCOM0_REGS->I2CM.SERCOM_ADDR = ((i2caddr << 1) | 1);
-	
-	// Wait for peripheral response
-	while(!(SERCOM0_REGS->I2CM.SERCOM_INTFLAG & SERCOM_I2CM_INTFLAG_SB(1)));
-	// No need to manually clear, with smart mode enabled this will clear when we read the data or write to CTRLB CMD
-	
-	//If NACK'd put in stop state and fail out
-	if (SERCOM0_REGS->I2CM.SERCOM_STATUS & SERCOM_I2CM_STATUS_RXNACK(1))
+	return i2c_transfer(bus, i2caddr, 0, 0, &seg, 1);
+}
+
+/**
+	@brief I2C Write Read
+	@details Write bytes then read bytes from I2C device in one transaction.
+	Loading the read address while the bus is still owned issues a repeated
+	start, so the STOP + bus free + START between phases is skipped.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] wdata Data to write to I2C bus, usually a register address
+	@param[in] wlen Length of the array to write
+	@param[out] rdata Array to store read data
+	@param[in] rlen Number of bytes to read from i2c device
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_write_read(i2c_bus_t *bus, uint8_t i2caddr, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen)
+{
+	i2c_iovec_t wseg = { wdata, wlen };
+	i2c_iovec_t rseg = { rdata, rlen };
+
+	return i2c_transfer(bus, i2caddr, &wseg, 1, rlen ? &rseg : 0, rlen ? 1 : 0);
+}
+
+/**
+	@brief I2C Send Vector
+	@details Send several buffers as one write, for example a register
+	address header in front of a payload held elsewhere, without staging
+	them in a single array.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[in] iov Segments to write in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_sendv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	return i2c_transfer(bus, i2caddr, iov, count, 0, 0);
+}
+
+/**
+	@brief I2C Read Vector
+	@details Read one stream of bytes into several buffers, only the last
+	byte of the last segment is NACK'd.
+	@param[in] bus I2C bus handle
+	@param[in] i2caddr 7 bit I2C address
+	@param[out] iov Segments to fill in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for 0 bytes or error code, bus is recovered after timeouts and bus errors
+*/
+uint8_t i2c_readv(i2c_bus_t *bus, uint8_t i2caddr, const i2c_iovec_t *iov, uint8_t count)
+{
+	return i2c_transfer(bus, i2caddr, 0, 0, iov, count);
+}
+
+/**
+	@brief I2C Scan
+	@details Probe each address with a Smart Mode quick command: START, write
+	address, STOP, no data and no retries. MB sets as soon as the address is
+	answered, so an absent device costs one address time and a short
+	I2C_SCAN_TIMEOUT instead of a recovery.
+	@param[in] bus I2C bus handle
+	@param[in] addrs 7 bit addresses to probe, 0 for the whole 0x08 to 0x77 range
+	@param[in] count Number of addresses in addrs
+	@param[out] map I2C_SCAN_MAP_SIZE bytes, bit (addr & 7) of map[addr >> 3] set for each device that ACKed
+	@returns I2C_STATUS_OK, I2C_STATUS_BUSY if a transaction is active or the error that stopped the scan
+*/
+uint8_t i2c_scan(i2c_bus_t *bus, const uint8_t *addrs, uint8_t count, uint8_t *map)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	uint8_t result = I2C_STATUS_OK;
+	uint32_t timeout;
+	uint16_t status;
+	uint8_t addr;
+
+	if (bus->active)
 	{
-		SERCOM0_REGS->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
-		return result;
+		return I2C_STATUS_BUSY;
 	}
-	
-	// Set controller to ACK after each read of the DATA register
-	SERCOM0_REGS->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
-	
-	// Read Data of LEN, except last byte
-	for (uint8_t i = 0; i < (len - 1); i++)
+
+	for (uint8_t i = 0; i < I2C_SCAN_MAP_SIZE; i++)
 	{
-		// Store read data and increment pointer
-		*data = SERCOM0_REGS->I2CM.SERCOM_DATA;
-		data++;
-		result++;
+		map[i] = 0;
+	}
+	if (!addrs)
+	{
+		count = 0x78 - 0x08;
+	}
+
+	hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_QCEN(1);
+	for (uint8_t i = 0; (result == I2C_STATUS_OK) && (i < count); i++)
+	{
+		addr = addrs ? (addrs[i] & 0x7F) : (uint8_t)(0x08 + i);
+
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+		if (result != I2C_STATUS_OK)
+		{
+			break;
+		}
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)(addr << 1));
+		hw->I2CM.SERCOM_ADDR = ((addr << 1) | bus->hs);
+
+		timeout = I2C_SCAN_TIMEOUT;
+		while (!(hw->I2CM.SERCOM_INTFLAG & SERCOM_I2CM_INTFLAG_MB(1)) && --timeout);
+		if (!timeout)
+		{
+			result = I2C_STATUS_TIMEOUT;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+
+		status = hw->I2CM.SERCOM_STATUS;
+		if (status & SERCOM_I2CM_STATUS_BUSERR(1))
+		{
+			result = I2C_STATUS_BUSERR;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+		if (status & SERCOM_I2CM_STATUS_ARBLOST(1))
+		{
+			result = I2C_STATUS_ARBLOST;
+			I2C_TRACE_RESULT(bus, result);
+			break;
+		}
+		if (!(status & SERCOM_I2CM_STATUS_RXNACK(1)))
+		{
+			map[addr >> 3] |= (uint8_t)(1 << (addr & 7));
+		}
+		I2C_TRACE_RESULT(bus, (status & SERCOM_I2CM_STATUS_RXNACK(1)) ? I2C_STATUS_NACK : I2C_STATUS_OK);
 
-		// Wait for response from peripheral
-		while(!(SERCOM0_REGS->I2CM.SERCOM_INTFLAG & SERCOM_I2CM_INTFLAG_SB(1)));
+		// Quick command leaves the bus owned either way
+		result = i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+		if (result == I2C_STATUS_OK)
+		{
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+		}
 	}
-	
-	// Have controller NACK the last byte read to signal end of request
-	if (len)
+	hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_QCEN(1);
+
+	if ((result == I2C_STATUS_TIMEOUT) || (result == I2C_STATUS_BUSERR))
 	{
-		SERCOM0_REGS->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_ACKACT(1);
-		*data = SERCOM0_REGS->I2CM.SERCOM_DATA;
-		result++;
+		i2c_recover(bus);
 	}
-	
+
 	return result;
 }
+
+/**
+	@brief I2C Finish
+	@details Release the interrupt engine and report the result of the transaction
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction that just ended
+	@param[in] status I2C_STATUS_* result
+*/
+static void i2c_finish(i2c_bus_t *bus, i2c_transaction_t *xfer, uint8_t status)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+
+	hw->I2CM.SERCOM_INTENCLR = (SERCOM_I2CM_INTENCLR_MB(1) | SERCOM_I2CM_INTENCLR_SB(1) | SERCOM_I2CM_INTENCLR_ERROR(1));
+#ifdef I2C_DMA
+	if (bus->dma_mode)
+	{
+		DMAC_REGS->DMAC_CHID = I2C_DMA_CHANNEL + bus->sercom;
+		DMAC_REGS->DMAC_CHCTRLA &= ~DMAC_CHCTRLA_ENABLE(1);
+		bus->dma_mode = 0;
+	}
+#endif
+	bus->active = 0;
+	xfer->status = status;
+	I2C_STATS_END(bus, status, (uint32_t)xfer->wlen + xfer->rlen);
+#ifdef I2C_RING
+	if (bus->ring)
+	{
+		i2c_completion_t record = { .tag = xfer->context, .stamp = I2C_RING_NOW(), .status = status };
+		uint32_t bytes = (uint32_t)xfer->wlen + xfer->rlen;
+
+		record.bytes = (status != I2C_STATUS_OK) ? 0 : ((bytes > 0xFFFF) ? 0xFFFF : (uint16_t)bytes);
+		i2c_ring_push(bus->ring, &record);
+	}
+#endif
+
+	// Engine is free again, callback may chain the next transaction
+	if (xfer->callback)
+	{
+		xfer->callback(xfer);
+	}
+}
+
+/**
+	@brief I2C Submit Address
+	@details Load the first address of a submitted transaction. If the bus
+	is busy the controller holds the START until it goes idle.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor
+*/
+static void i2c_submit_addr(i2c_bus_t *bus, i2c_transaction_t *xfer)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+
+	// Read only transactions skip the write phase entirely
+	if (xfer->wlen || !xfer->rlen)
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)(xfer->addr << 1));
+		hw->I2CM.SERCOM_ADDR = (((xfer->addr << 1) | 0) | bus->hs);
+	}
+	else
+	{
+		I2C_TRACE_ADDR(bus, hw, (uint8_t)((xfer->addr << 1) | 1));
+		hw->I2CM.SERCOM_ADDR = (((xfer->addr << 1) | 1) | bus->hs);
+	}
+}
+
+/**
+	@brief I2C Submit
+	@details Start a transaction and return immediately. i2c_isr moves every
+	byte, the CPU is only needed once per MB/SB interrupt.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active
+*/
+uint8_t i2c_submit(i2c_bus_t *bus, i2c_transaction_t *xfer)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+
+	if (bus->active)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	xfer->status = I2C_STATUS_PENDING;
+	bus->index = 0;
+	bus->arb_tries = I2C_ARB_RETRIES;
+	bus->active = xfer;
+	I2C_STATS_START(bus);
+
+	// Set bus to ACK received data
+	hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
+	if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) != I2C_STATUS_OK)
+	{
+		bus->active = 0;
+		xfer->status = I2C_STATUS_TIMEOUT;
+		I2C_STATS_END(bus, I2C_STATUS_TIMEOUT, 0);
+		I2C_TRACE_RESULT(bus, I2C_STATUS_TIMEOUT);
+		return I2C_STATUS_TIMEOUT;
+	}
+	hw->I2CM.SERCOM_INTENSET = (SERCOM_I2CM_INTENSET_MB(1) | SERCOM_I2CM_INTENSET_SB(1) | SERCOM_I2CM_INTENSET_ERROR(1));
+	i2c_submit_addr(bus, xfer);
+
+	return I2C_STATUS_PENDING;
+}
+
+/**
+	@brief I2C Busy
+	@param[in] bus I2C bus handle
+	@returns 1 while a submitted transaction is still on the bus
+*/
+uint8_t i2c_busy(i2c_bus_t *bus)
+{
+	return (bus->active != 0);
+}
+
+/**
+	@brief I2C Interrupt
+	@details Advances the active transaction one byte per MB/SB interrupt.
+	Call from the SERCOMn_Handler of every bus, e.g. i2c_isr(&i2c_bus0).
+	@param[in] bus I2C bus handle
+*/
+void i2c_isr(i2c_bus_t *bus)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	i2c_transaction_t *xfer = bus->active;
+	uint8_t flags = hw->I2CM.SERCOM_INTFLAG;
+	uint16_t status = hw->I2CM.SERCOM_STATUS;
+
+	if (!xfer)
+	{
+		hw->I2CM.SERCOM_INTENCLR = (SERCOM_I2CM_INTENCLR_MB(1) | SERCOM_I2CM_INTENCLR_SB(1) | SERCOM_I2CM_INTENCLR_ERROR(1));
+		return;
+	}
+
+	// Bus error or lost arbitration, controller has already released the bus
+	if ((flags & SERCOM_I2CM_INTFLAG_ERROR(1)) || (status & SERCOM_I2CM_STATUS_ARBLOST(1)))
+	{
+		uint8_t result = I2C_STATUS_BUSERR;
+
+		hw->I2CM.SERCOM_INTFLAG = (SERCOM_I2CM_INTFLAG_ERROR(1) | SERCOM_I2CM_INTFLAG_MB(1) | SERCOM_I2CM_INTFLAG_SB(1));
+		if ((status & SERCOM_I2CM_STATUS_ARBLOST(1)) && !(status & SERCOM_I2CM_STATUS_BUSERR(1)))
+		{
+			result = I2C_STATUS_ARBLOST;
+		}
+		else if (status & SERCOM_I2CM_STATUS_LOWTOUT(1))
+		{
+			// SCL held low past the hardware timeout, caller should i2c_recover
+			result = I2C_STATUS_TIMEOUT;
+		}
+		else if (status & SERCOM_I2CM_STATUS_LENERR(1))
+		{
+			// Auto length transfer NACK'd early, we still own the bus
+			i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			result = I2C_STATUS_NACK;
+		}
+		I2C_TRACE_RESULT(bus, result);
+		if ((result == I2C_STATUS_ARBLOST) && !bus->dma_mode && bus->arb_tries &&
+			(i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) == I2C_STATUS_OK))
+		{
+			// Start over, the controller waits for the winner's STOP before the START
+			bus->arb_tries--;
+			bus->index = 0;
+			hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
+#ifdef I2C_STATS
+			bus->stats.arb_retries++;
+#endif
+			i2c_submit_addr(bus, xfer);
+			return;
+		}
+		if (result == I2C_STATUS_NACK)
+		{
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+		}
+		i2c_finish(bus, xfer, result);
+		return;
+	}
+
+	if (flags & SERCOM_I2CM_INTFLAG_MB(1))
+	{
+		// Address or data byte was NACK'd, stop and fail out
+		if (status & SERCOM_I2CM_STATUS_RXNACK(1))
+		{
+			i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_NACK, 0);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+			i2c_finish(bus, xfer, I2C_STATUS_NACK);
+			return;
+		}
+		I2C_TRACE_EVENT(bus, I2C_TRACE_ACK, 0);
+
+#ifdef I2C_DMA
+		if (bus->dma_mode)
+		{
+			// Last DMA byte acknowledged, auto length already issued the STOP
+			hw->I2CM.SERCOM_INTFLAG = SERCOM_I2CM_INTFLAG_MB(1);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+			i2c_finish(bus, xfer, I2C_STATUS_OK);
+			return;
+		}
+#endif
+
+		if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) != I2C_STATUS_OK)
+		{
+			I2C_TRACE_RESULT(bus, I2C_STATUS_TIMEOUT);
+			i2c_finish(bus, xfer, I2C_STATUS_TIMEOUT);
+			return;
+		}
+		if (bus->index < xfer->wlen)
+		{
+			// Send next byte, writing DATA clears MB
+			I2C_TRACE_EVENT(bus, I2C_TRACE_TX, xfer->wdata[bus->index]);
+			hw->I2CM.SERCOM_DATA = xfer->wdata[bus->index++];
+		}
+		else if (xfer->rlen)
+		{
+			// Write phase done, repeated start into the read phase
+			bus->index = 0;
+			I2C_TRACE_ADDR(bus, hw, (uint8_t)((xfer->addr << 1) | 1));
+			hw->I2CM.SERCOM_ADDR = (((xfer->addr << 1) | 1) | bus->hs);
+		}
+		else
+		{
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+			i2c_finish(bus, xfer, I2C_STATUS_OK);
+		}
+	}
+	else if (flags & SERCOM_I2CM_INTFLAG_SB(1))
+	{
+		if (!bus->index)
+		{
+			// First byte in, so the read address was ACK'd
+			I2C_TRACE_EVENT(bus, I2C_TRACE_ACK, 0);
+		}
+		if (bus->index == (xfer->rlen - 1))
+		{
+			// NACK the last byte read to end request, idle bus.
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_ACKACT(1);
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			xfer->rdata[bus->index] = hw->I2CM.SERCOM_DATA;
+			I2C_TRACE_EVENT(bus, I2C_TRACE_RX, xfer->rdata[bus->index]);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_NACK, 0);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+			i2c_finish(bus, xfer, I2C_STATUS_OK);
+		}
+		else
+		{
+			// Smart mode ACKs and starts the next byte when DATA is read
+			xfer->rdata[bus->index] = hw->I2CM.SERCOM_DATA;
+			I2C_TRACE_EVENT(bus, I2C_TRACE_RX, xfer->rdata[bus->index]);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_ACK, 0);
+			bus->index++;
+		}
+	}
+}
+
+#ifdef I2C_DMA
+/**
+	@brief I2C DMA Start
+	@details Arm the bus DMA channel on its SERCOM trigger and load the address
+	with ADDR.LENEN so the controller ACKs, NACKs and STOPs on its own. Each
+	non empty segment gets a block descriptor, chained through DESCADDR, so
+	the DMAC walks them in place with one completion interrupt at the end.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor reported through the callback
+	@param[in] rw 0 to write, 1 to read
+	@param[in] iov Segments to move
+	@param[in] count Number of segments
+	@param[in] len Bytes across all segments, 1 to 255
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active,
+	I2C_STATUS_INVALID if there are more than I2C_DMA_SEGMENTS non empty segments
+*/
+static uint8_t i2c_dma_start(i2c_bus_t *bus, i2c_transaction_t *xfer, uint8_t rw, const i2c_iovec_t *iov, uint8_t count, uint8_t len)
+{
+	sercom_registers_t *hw = I2C_HW(bus);
+	uint8_t channel = I2C_DMA_CHANNEL + bus->sercom;
+	dmac_descriptor_registers_t *desc = &i2c_dma_desc[channel];
+	dmac_descriptor_registers_t *link = i2c_dma_link[bus->sercom];
+	uint8_t blocks = 0;
+
+	if (bus->active)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	// One block per segment, the incrementing side points at the end of its buffer
+	for (; count; count--, iov++)
+	{
+		if (!iov->len)
+		{
+			continue;
+		}
+		if (blocks == I2C_DMA_SEGMENTS)
+		{
+			return I2C_STATUS_INVALID;
+		}
+		if (blocks)
+		{
+			desc->DMAC_DESCADDR = (uint32_t)link;
+			desc = link++;
+		}
+		blocks++;
+
+		desc->DMAC_BTCNT = iov->len;
+		if (rw)
+		{
+			desc->DMAC_BTCTRL = (DMAC_BTCTRL_VALID(1) | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_DSTINC(1));
+			desc->DMAC_SRCADDR = (uint32_t)&hw->I2CM.SERCOM_DATA;
+			desc->DMAC_DSTADDR = (uint32_t)(iov->data + iov->len);
+		}
+		else
+		{
+			desc->DMAC_BTCTRL = (DMAC_BTCTRL_VALID(1) | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC(1));
+			desc->DMAC_SRCADDR = (uint32_t)(iov->data + iov->len);
+			desc->DMAC_DSTADDR = (uint32_t)&hw->I2CM.SERCOM_DATA;
+		}
+	}
+	desc->DMAC_DESCADDR = 0;
+
+	xfer->status = I2C_STATUS_PENDING;
+	bus->active = xfer;
+	bus->dma_mode = rw ? I2C_DMA_RX : I2C_DMA_TX;
+	I2C_STATS_START(bus);
+
+	// SERCOMn RX/TX trigger pairs follow SERCOM0's
+	DMAC_REGS->DMAC_CHID = channel;
+	DMAC_REGS->DMAC_CHCTRLB = (DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC((rw ? SERCOM0_DMAC_ID_RX : SERCOM0_DMAC_ID_TX) + (2 * bus->sercom)));
+	DMAC_REGS->DMAC_CHINTFLAG = (DMAC_CHINTFLAG_TCMPL(1) | DMAC_CHINTFLAG_TERR(1));
+	DMAC_REGS->DMAC_CHINTENSET = (DMAC_CHINTENSET_TCMPL(1) | DMAC_CHINTENSET_TERR(1));
+	DMAC_REGS->DMAC_CHCTRLA = DMAC_CHCTRLA_ENABLE(1);
+
+	// Only errors interrupt the CPU until the DMAC reports completion
+	hw->I2CM.SERCOM_CTRLB &= ~SERCOM_I2CM_CTRLB_ACKACT(1);
+	hw->I2CM.SERCOM_INTENSET = SERCOM_I2CM_INTENSET_ERROR(1);
+
+	if (i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1)) != I2C_STATUS_OK)
+	{
+		i2c_finish(bus, xfer, I2C_STATUS_TIMEOUT);
+		return I2C_STATUS_TIMEOUT;
+	}
+	I2C_TRACE_ADDR(bus, hw, (uint8_t)((xfer->addr << 1) | rw));
+	hw->I2CM.SERCOM_ADDR = (((xfer->addr << 1) | rw) | bus->hs | SERCOM_I2CM_ADDR_LENEN(1) | SERCOM_I2CM_ADDR_LEN(len));
+
+	return I2C_STATUS_PENDING;
+}
+
+/**
+	@brief I2C Send DMA
+	@details Write wdata/wlen of the transaction with the DMAC, one completion interrupt per buffer
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor, rdata/rlen are ignored
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active,
+	I2C_STATUS_INVALID past the 255 byte ADDR.LEN limit
+*/
+uint8_t i2c_send_dma(i2c_bus_t *bus, i2c_transaction_t *xfer)
+{
+	i2c_iovec_t seg = { xfer->wdata, xfer->wlen };
+
+	if (!xfer->wlen)
+	{
+		return i2c_submit(bus, xfer);
+	}
+	if (xfer->wlen > 0xFF)
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	return i2c_dma_start(bus, xfer, 0, &seg, 1, (uint8_t)xfer->wlen);
+}
+
+/**
+	@brief I2C Read DMA
+	@details Read rdata/rlen of the transaction with the DMAC, one completion interrupt per buffer
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor, wdata/wlen are ignored
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active,
+	I2C_STATUS_INVALID past the 255 byte ADDR.LEN limit
+*/
+uint8_t i2c_read_dma(i2c_bus_t *bus, i2c_transaction_t *xfer)
+{
+	i2c_iovec_t seg = { xfer->rdata, xfer->rlen };
+
+	if (!xfer->rlen)
+	{
+		return i2c_submit(bus, xfer);
+	}
+	if (xfer->rlen > 0xFF)
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	return i2c_dma_start(bus, xfer, 1, &seg, 1, (uint8_t)xfer->rlen);
+}
+
+/**
+	@brief I2C Send DMA Vector
+	@details Write several buffers as one DMA transfer over linked
+	descriptors. Sets wlen to the total and rlen to 0, the segments must
+	stay valid until the transaction finishes.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor, addr/callback/context are used
+	@param[in] iov Segments to write in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active,
+	I2C_STATUS_INVALID past 255 bytes or I2C_DMA_SEGMENTS segments
+*/
+uint8_t i2c_send_dmav(i2c_bus_t *bus, i2c_transaction_t *xfer, const i2c_iovec_t *iov, uint8_t count)
+{
+	uint32_t len = i2c_iov_total(iov, count);
+
+	if (len > 0xFF)
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	xfer->wlen = (uint16_t)len;
+	xfer->rlen = 0;
+	if (!len)
+	{
+		return i2c_submit(bus, xfer);
+	}
+
+	return i2c_dma_start(bus, xfer, 0, iov, count, (uint8_t)len);
+}
+
+/**
+	@brief I2C Read DMA Vector
+	@details Read one stream of bytes into several buffers over linked
+	descriptors. Sets rlen to the total and wlen to 0, the segments must
+	stay valid until the transaction finishes.
+	@param[in] bus I2C bus handle
+	@param[in] xfer Transaction descriptor, addr/callback/context are used
+	@param[out] iov Segments to fill in order
+	@param[in] count Number of segments
+	@returns I2C_STATUS_PENDING if started, I2C_STATUS_BUSY if a transaction is already active,
+	I2C_STATUS_INVALID past 255 bytes or I2C_DMA_SEGMENTS segments
+*/
+uint8_t i2c_read_dmav(i2c_bus_t *bus, i2c_transaction_t *xfer, const i2c_iovec_t *iov, uint8_t count)
+{
+	uint32_t len = i2c_iov_total(iov, count);
+
+	if (len > 0xFF)
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	xfer->rlen = (uint16_t)len;
+	xfer->wlen = 0;
+	if (!len)
+	{
+		return i2c_submit(bus, xfer);
+	}
+
+	return i2c_dma_start(bus, xfer, 1, iov, count, (uint8_t)len);
+}
+
+/**
+	@brief DMAC Interrupt
+	@details Block transfer complete or bus error on an I2C channel.
+*/
+void DMAC_Handler(void)
+{
+	i2c_bus_t *bus;
+	sercom_registers_t *hw;
+	uint8_t flags;
+	uint8_t n;
+
+	for (n = 0; n < SERCOM_INST_NUM; n++)
+	{
+		bus = i2c_dma_bus[n];
+		if (!bus)
+		{
+			continue;
+		}
+
+		hw = I2C_HW(bus);
+		DMAC_REGS->DMAC_CHID = I2C_DMA_CHANNEL + n;
+		flags = DMAC_REGS->DMAC_CHINTFLAG;
+		DMAC_REGS->DMAC_CHINTFLAG = flags;
+
+		if (!bus->active || !bus->dma_mode)
+		{
+			continue;
+		}
+
+		if (flags & DMAC_CHINTFLAG_TERR(1))
+		{
+			i2c_wait_sync(hw, SERCOM_I2CM_SYNCBUSY_SYSOP(1));
+			hw->I2CM.SERCOM_CTRLB |= SERCOM_I2CM_CTRLB_CMD(3);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_BUSERR, 0);
+			I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+			i2c_finish(bus, bus->active, I2C_STATUS_BUSERR);
+		}
+		else if (flags & DMAC_CHINTFLAG_TCMPL(1))
+		{
+			if (bus->dma_mode == I2C_DMA_RX)
+			{
+				// LEN reached, controller NACK'd the last byte and sent STOP
+				I2C_TRACE_EVENT(bus, I2C_TRACE_STOP, 0);
+				i2c_finish(bus, bus->active, I2C_STATUS_OK);
+			}
+			else
+			{
+				// Last byte is still shifting out, finish on its MB
+				hw->I2CM.SERCOM_INTENSET = SERCOM_I2CM_INTENSET_MB(1);
+			}
+		}
+	}
+}
+#endif
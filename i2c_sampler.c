@@ -0,0 +1,225 @@
+/**
+* @file i2c_sampler.c
+* @brief MSF I2C Library, timer driven periodic sampling.
+* @note A timer interrupt posts due reads to an i2c_queue, completions land
+* in double buffered snapshots. SAMD uses a TC in match frequency mode, PIC
+* uses Timer2 as set up by MCC.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_sampler.h"
+
+#ifdef __XC8
+#include <xc.h>
+
+#ifndef I2C_SAMPLER_NOW
+#define I2C_SAMPLER_NOW()				TMR1						// Free running Timer1
+#endif
+#ifndef I2C_SAMPLER_ELAPSED
+#define I2C_SAMPLER_ELAPSED(start, now)	((uint16_t)((now) - (start)))
+#endif
+#else
+#include <sam.h>
+
+#ifdef I2C_SAMD11
+#error "i2c_sampler.c runs on i2c_submit, MSF_SAMD11_I2C.c is polled only"
+#endif
+
+// No default, the TCs and their clock IDs differ between parts, e.g. TC3 on a SAMD21:
+// I2C_SAMPLER_TC=TC3_REGS I2C_SAMPLER_TC_IRQn=TC3_IRQn I2C_SAMPLER_TC_GCLK_ID=GCLK_CLKCTRL_ID_TCC2_TC3 I2C_SAMPLER_TC_APBC=PM_APBCMASK_TC3(1)
+#if !defined(I2C_SAMPLER_TC) || !defined(I2C_SAMPLER_TC_IRQn) || !defined(I2C_SAMPLER_TC_GCLK_ID) || !defined(I2C_SAMPLER_TC_APBC)
+#error "Define I2C_SAMPLER_TC, I2C_SAMPLER_TC_IRQn, I2C_SAMPLER_TC_GCLK_ID and I2C_SAMPLER_TC_APBC for the sampler's TC"
+#endif
+#ifndef I2C_SAMPLER_NOW
+#define I2C_SAMPLER_NOW()				(SysTick->VAL)				// Free running SysTick, LOAD = 0xFFFFFF
+#endif
+#ifndef I2C_SAMPLER_ELAPSED
+#define I2C_SAMPLER_ELAPSED(start, now)	(((start) - (now)) & 0xFFFFFFUL)	// SysTick counts down
+#endif
+#ifndef I2C_TIMEOUT
+#define I2C_TIMEOUT				20000	// Poll loops before a wait gives up
+#endif
+#endif
+
+static i2c_queue_t *i2c_sampler_queue;
+static i2c_sample_t *i2c_sampler_head;
+
+/**
+	@brief Sampler Init
+	@param[in] queue Queue of the bus the sensors are on
+*/
+void i2c_sampler_init(i2c_queue_t *queue)
+{
+	i2c_sampler_queue = queue;
+	i2c_sampler_head = 0;
+}
+
+/**
+	@brief Sampler Done
+	@details Queue completion, flips the finished buffer to the front and
+	tracks the interval between samples
+	@param[in] item Finished read, first member of its sample
+*/
+static void i2c_sampler_done(i2c_queue_item_t *item)
+{
+	i2c_sample_t *sample = (i2c_sample_t *)item;
+	uint32_t now = I2C_SAMPLER_NOW();
+	uint32_t interval;
+
+	if (item->xfer.status != I2C_STATUS_OK)
+	{
+		sample->errors++;
+		return;
+	}
+
+	if (sample->seq)
+	{
+		interval = I2C_SAMPLER_ELAPSED(sample->stamp, now);
+		if (interval < sample->interval_min)
+		{
+			sample->interval_min = interval;
+		}
+		if (interval > sample->interval_max)
+		{
+			sample->interval_max = interval;
+		}
+	}
+	sample->stamp = now;
+
+	// Publish, readers check seq around their copy
+	sample->front ^= 1;
+	if (!++sample->seq)
+	{
+		sample->seq = 1;
+	}
+}
+
+/**
+	@brief Sampler Add
+	@details Register a range read. Call before the timer starts or with
+	its interrupt masked.
+	@param[in] sample Sample storage, must stay valid
+	@param[in] addr Device address in the form the driver takes
+	@param[in] reg First register
+	@param[in] len Bytes per sample, up to I2C_SAMPLE_MAX
+	@param[in] period Sampler ticks between reads
+	@param[in] priority I2C_QUEUE_* class of the reads
+*/
+void i2c_sampler_add(i2c_sample_t *sample, uint8_t addr, uint8_t reg, uint8_t len, uint16_t period, uint8_t priority)
+{
+	*sample = (i2c_sample_t){ 0 };
+#ifdef __XC8
+	sample->item.xfer.i2caddr = addr;
+#else
+	sample->item.xfer.addr = addr;
+#endif
+	sample->item.xfer.wdata = &sample->reg;
+	sample->item.xfer.wlen = 1;
+	sample->item.xfer.rlen = (len < I2C_SAMPLE_MAX) ? len : I2C_SAMPLE_MAX;
+	sample->item.priority = priority;
+	sample->item.callback = i2c_sampler_done;
+	sample->reg = reg;
+	sample->len = sample->item.xfer.rlen;
+	sample->period = period ? period : 1;
+	sample->countdown = sample->period;
+	sample->interval_min = UINT32_MAX;
+
+	sample->next = i2c_sampler_head;
+	i2c_sampler_head = sample;
+}
+
+/**
+	@brief Sample Latest
+	@details Copy the newest complete sample without touching the bus
+	@param[in] sample Registered sample
+	@param[out] data len bytes of register data
+	@returns Sequence number of the copy, 0 if nothing has been sampled yet
+*/
+uint16_t i2c_sample_latest(i2c_sample_t *sample, uint8_t *data)
+{
+	uint16_t seq;
+	uint8_t *src;
+
+	do
+	{
+		seq = sample->seq;
+		src = sample->buf[sample->front];
+		for (uint8_t i = 0; i < sample->len; i++)
+		{
+			data[i] = src[i];
+		}
+	} while (seq != sample->seq);
+
+	return seq;
+}
+
+/**
+	@brief Sampler Tick
+	@details Post every read that is due into its back buffer
+*/
+void i2c_sampler_isr(void)
+{
+	i2c_sample_t *sample;
+
+#ifdef __XC8
+	if (!TMR2IF)
+	{
+		return;
+	}
+	TMR2IF = 0;
+#else
+	I2C_SAMPLER_TC->COUNT16.TC_INTFLAG = TC_INTFLAG_MC0(1);
+#endif
+
+	for (sample = i2c_sampler_head; sample; sample = sample->next)
+	{
+		if (--sample->countdown)
+		{
+			continue;
+		}
+		sample->countdown = sample->period;
+
+		if (sample->item.xfer.status == I2C_STATUS_PENDING)
+		{
+			sample->overruns++;
+			continue;
+		}
+
+		sample->item.xfer.rdata = sample->buf[sample->front ^ 1];
+		i2c_queue_post(i2c_sampler_queue, &sample->item);
+	}
+}
+
+#ifndef __XC8
+/**
+	@brief Sampler Timer
+	@details Run the sampler TC from GCLK0 in match frequency mode, using
+	the smallest prescaler that fits the tick in 16 bits. Forward the TC
+	interrupt to i2c_sampler_isr.
+	@param[in] gclk_hz GCLK0 frequency
+	@param[in] tick_hz Sampler ticks per second
+*/
+void i2c_sampler_timer(uint32_t gclk_hz, uint32_t tick_hz)
+{
+	static const uint8_t shift[8] = { 0, 1, 2, 3, 4, 6, 8, 10 };	// DIV1 .. DIV1024
+	uint32_t top = gclk_hz / tick_hz;
+	uint32_t timeout = I2C_TIMEOUT;
+	uint8_t prescaler = 0;
+
+	while ((prescaler < 7) && ((top >> shift[prescaler]) > 0x10000UL))
+	{
+		prescaler++;
+	}
+
+	PM_REGS->PM_APBCMASK |= I2C_SAMPLER_TC_APBC;
+	GCLK_REGS->GCLK_CLKCTRL = (GCLK_CLKCTRL_CLKEN(1) | I2C_SAMPLER_TC_GCLK_ID | GCLK_CLKCTRL_GEN_GCLK0);
+
+	I2C_SAMPLER_TC->COUNT16.TC_CTRLA = (TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER(prescaler));
+	I2C_SAMPLER_TC->COUNT16.TC_CC[0] = (uint16_t)((top >> shift[prescaler]) - 1);
+	I2C_SAMPLER_TC->COUNT16.TC_INTENSET = TC_INTENSET_MC0(1);
+	while ((I2C_SAMPLER_TC->COUNT16.TC_STATUS & TC_STATUS_SYNCBUSY(1)) && --timeout);
+	I2C_SAMPLER_TC->COUNT16.TC_CTRLA |= TC_CTRLA_ENABLE(1);
+
+	NVIC_EnableIRQ(I2C_SAMPLER_TC_IRQn);
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef I2C_SAMPLER_H_
+#define I2C_SAMPLER_H_
+
+#include <stdint.h>
+#include "i2c_queue.h"
+
+#ifndef I2C_SAMPLE_MAX
+#define I2C_SAMPLE_MAX		6		// Most bytes per sample, a 3 axis 16 bit reading
+#endif
+
+typedef struct i2c_sample i2c_sample_t;
+
+/**
+	@brief Periodic register range read
+	@details Filled by i2c_sampler_add. Samples land in the back buffer and
+	flip to the front once complete, read them with i2c_sample_latest.
+	Interval figures are in I2C_SAMPLER_NOW units between completed samples,
+	jitter is interval_max - interval_min.
+*/
+struct i2c_sample
+{
+	i2c_queue_item_t item;				// Must stay first
+	uint8_t reg;						// First register
+	uint8_t len;						// Bytes per sample
+	uint16_t period;					// Sampler ticks between reads
+	uint16_t countdown;					// Ticks to the next read
+	uint8_t buf[2][I2C_SAMPLE_MAX];		// Front and back buffer
+	volatile uint8_t front;				// Buffer holding the latest sample
+	volatile uint16_t seq;				// Samples completed, 0 = none yet
+	uint32_t stamp;						// I2C_SAMPLER_NOW of the last completion
+	uint32_t interval_min;
+	uint32_t interval_max;
+	uint16_t overruns;					// Reads skipped because the last one was still queued
+	uint16_t errors;					// Reads that failed, the front buffer is kept
+	i2c_sample_t *next;
+};
+
+void i2c_sampler_init(i2c_queue_t*);
+void i2c_sampler_add(i2c_sample_t*, uint8_t, uint8_t, uint8_t, uint16_t, uint8_t);
+uint16_t i2c_sample_latest(i2c_sample_t*, uint8_t*);
+void i2c_sampler_isr(void);		// Call from the timer interrupt, TCn_Handler on SAMD or on TMR2IF on PIC
+#ifndef __XC8
+void i2c_sampler_timer(uint32_t, uint32_t);
+#endif
+
+#endif /* I2C_SAMPLER_H_ */
@@ -0,0 +1,369 @@
+/**
+* @file i2c_smbus.c
+* @brief MSF I2C Library, SMBus block transfers and process calls with PEC.
+* @note The PEC is worked out byte by byte as the bytes go onto or come off
+* the bus: inside the SAMD polled phases (built with I2C_SMBUS) and inside the
+* start/write/read/stop loop on PIC (built with XC8). A received PEC is
+* checked by running the CRC over it too, a good packet leaves 0. Reads
+* that fail the check are retried I2C_SMBUS_RETRIES times.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_smbus.h"
+
+#ifdef I2C_PEC_NIBBLE
+// CRC of each high nibble, the first 16 entries of the full table
+static const uint8_t i2c_pec_nibble[16] =
+{
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+	0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+/**
+	@brief PEC Update
+	@details Nibble table, two lookups per byte
+	@param[in] crc CRC so far, 0 at the START
+	@param[in] byte Next byte on the bus
+	@returns New CRC
+*/
+uint8_t i2c_pec_update(uint8_t crc, uint8_t byte)
+{
+	crc ^= byte;
+	crc = (uint8_t)(crc << 4) ^ i2c_pec_nibble[crc >> 4];
+	crc = (uint8_t)(crc << 4) ^ i2c_pec_nibble[crc >> 4];
+
+	return crc;
+}
+#else
+// CRC of each byte value
+const uint8_t i2c_pec_table[256] =
+{
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+	0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+	0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+	0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+	0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+	0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+	0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+	0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+	0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+	0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+	0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+	0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+	0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+	0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+	0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+	0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+/**
+	@brief PEC Update
+	@details Byte table, one lookup per byte. The drivers use the
+	I2C_PEC_UPDATE macro instead.
+	@param[in] crc CRC so far, 0 at the START
+	@param[in] byte Next byte on the bus
+	@returns New CRC
+*/
+uint8_t i2c_pec_update(uint8_t crc, uint8_t byte)
+{
+	return i2c_pec_table[crc ^ byte];
+}
+#endif
+
+/**
+	@brief SMBus Block Left
+	@details Bytes still to read once the count byte of a block read is in,
+	counting the count byte itself. Called by the drivers, the count byte is
+	always ACK'd so at least one more byte is read.
+	@param[in] flags I2C_SMBUS_* flags of the call
+	@param[in] count Count byte just read
+	@param[in] left Room left in the buffer, counting the count byte
+	@returns New number of bytes left, counting the count byte
+*/
+uint32_t i2c_smbus_block_left(uint8_t flags, uint8_t count, uint32_t left)
+{
+	uint32_t more = count + ((flags & I2C_SMBUS_PEC_RX) ? 1u : 0u);
+
+	if (!more)
+	{
+		more = 1;
+	}
+	if (more > left - 1)
+	{
+		more = left - 1;
+	}
+
+	return more + 1;
+}
+
+#ifdef __XC8
+#include "i2crxtx.h"
+
+/**
+	@brief SMBus Transfer
+	@details START, address, write bytes, then either the PEC and STOP or a
+	repeated start and the read, with the CRC run over each byte in turn.
+	@param[in] dev SMBus device
+	@param[in] flags I2C_SMBUS_* flags
+	@param[in] wdata Bytes to write
+	@param[in] wlen Number of bytes to write
+	@param[out] rdata Bytes read
+	@param[in] rlen Bytes to read, or room for a block read
+	@returns I2C_STATUS_OK, I2C_STATUS_NACK, I2C_STATUS_PEC or I2C_STATUS_BUSY if START failed
+*/
+static uint8_t i2c_smbus_transfer(i2c_smbus_t *dev, uint8_t flags, uint8_t *wdata, uint8_t wlen, uint8_t *rdata, uint8_t rlen)
+{
+	I2C_RESULT byte;
+	uint8_t crc;
+	uint8_t acked;
+
+	if (i2c_start() != I2C_START_OK)
+	{
+		return I2C_STATUS_BUSY;
+	}
+
+	crc = I2C_PEC_UPDATE(0, dev->addr);
+	acked = i2c_write(dev->addr);
+	for (uint8_t i = 0; acked && (i < wlen); i++)
+	{
+		crc = I2C_PEC_UPDATE(crc, wdata[i]);
+		acked = i2c_write(wdata[i]);
+	}
+	if (acked && (flags & I2C_SMBUS_PEC_TX))
+	{
+		acked = i2c_write(crc);
+	}
+
+	if (acked && rlen)
+	{
+		i2c_repStart();
+		crc = I2C_PEC_UPDATE(crc, dev->addr + 1u);
+		acked = i2c_write(dev->addr + 1u);
+		for (uint8_t i = 0; acked && (i < rlen); i++)
+		{
+			byte = i2c_read((i + 1u) < rlen);	// ACK all but the last byte
+			rdata[i] = byte.data;
+			crc = I2C_PEC_UPDATE(crc, byte.data);
+			acked = byte.tx_chk;
+			if (!i && (flags & I2C_SMBUS_BLOCK))
+			{
+				rlen = (uint8_t)i2c_smbus_block_left(flags, byte.data, rlen);
+			}
+		}
+	}
+	i2c_stop();
+
+	if (!acked)
+	{
+		return I2C_STATUS_NACK;
+	}
+
+	return ((flags & I2C_SMBUS_PEC_RX) && crc) ? I2C_STATUS_PEC : I2C_STATUS_OK;
+}
+#else
+#include "MSF_I2C.h"
+
+#ifndef I2C_SMBUS
+#error "Build the SAMD driver and i2c_smbus.c with I2C_SMBUS defined"
+#endif
+
+/**
+	@brief SMBus Transfer
+	@details The driver runs the CRC over each byte and sends or reads the
+	PEC and block count as told by bus->smbus
+	@param[in] dev SMBus device
+	@param[in] flags I2C_SMBUS_* flags
+	@param[in] wdata Bytes to write
+	@param[in] wlen Number of bytes to write
+	@param[out] rdata Bytes read
+	@param[in] rlen Bytes to read, or room for a block read
+	@returns I2C_STATUS_OK, I2C_STATUS_PEC or error code from the driver
+*/
+static uint8_t i2c_smbus_transfer(i2c_smbus_t *dev, uint8_t flags, uint8_t *wdata, uint8_t wlen, uint8_t *rdata, uint8_t rlen)
+{
+	i2c_bus_t *bus = (i2c_bus_t *)dev->bus;
+	uint8_t result;
+
+	bus->pec = 0;
+	bus->smbus = flags;
+	if (rlen)
+	{
+		result = i2c_write_read(bus, dev->addr, wdata, wlen, rdata, rlen);
+	}
+	else
+	{
+		result = i2c_send(bus, dev->addr, wdata, wlen);
+	}
+	bus->smbus = 0;
+
+	if ((result == I2C_STATUS_OK) && (flags & I2C_SMBUS_PEC_RX) && bus->pec)
+	{
+		result = I2C_STATUS_PEC;
+	}
+
+	return result;
+}
+#endif
+
+/**
+	@brief SMBus Run
+	@details One transfer, retried while a read fails its checks
+	@param[in] dev SMBus device
+	@param[in] wdata Bytes to write, command code first
+	@param[in] wlen Number of bytes to write
+	@param[out] rdata Bytes read, the count byte first for a block read
+	@param[in] rlen Bytes to read without the PEC, or room for a block read, 0 to only write
+	@param[in] block Non zero for a block read
+	@returns I2C_STATUS_OK, I2C_STATUS_PEC or the bus error
+*/
+static uint8_t i2c_smbus_run(i2c_smbus_t *dev, uint8_t *wdata, uint8_t wlen, uint8_t *rdata, uint8_t rlen, uint8_t block)
+{
+	uint8_t flags = block ? I2C_SMBUS_BLOCK : 0;
+	uint8_t tries = 0;
+	uint8_t result;
+
+	if (dev->pec)
+	{
+		flags |= rlen ? I2C_SMBUS_PEC_RX : I2C_SMBUS_PEC_TX;
+		if (rlen)
+		{
+			rlen++;
+		}
+	}
+
+	do
+	{
+		result = i2c_smbus_transfer(dev, flags, wdata, wlen, rdata, rlen);
+		if ((result == I2C_STATUS_OK) && block && ((rdata[0] == 0) || (rdata[0] > I2C_SMBUS_BLOCK_MAX)))
+		{
+			result = I2C_STATUS_PEC;	// Count byte out of range, or cut short by the buffer
+		}
+		if (result == I2C_STATUS_PEC)
+		{
+			dev->pec_errors++;
+		}
+	} while ((result == I2C_STATUS_PEC) && (tries++ < I2C_SMBUS_RETRIES));
+
+	return result;
+}
+
+/**
+	@brief SMBus Block Write
+	@details Command code, byte count, count bytes, then the PEC if on
+	@param[in] dev SMBus device
+	@param[in] cmd Command code
+	@param[in] data Bytes to write
+	@param[in] count Number of bytes, 1 to I2C_SMBUS_BLOCK_MAX
+	@returns I2C_STATUS_OK, I2C_STATUS_INVALID for a count out of range or error code, a PEC the device rejects shows up as I2C_STATUS_NACK
+*/
+uint8_t i2c_smbus_block_write(i2c_smbus_t *dev, uint8_t cmd, uint8_t *data, uint8_t count)
+{
+	uint8_t frame[2 + I2C_SMBUS_BLOCK_MAX];
+
+	if (!count || (count > I2C_SMBUS_BLOCK_MAX))
+	{
+		return I2C_STATUS_INVALID;
+	}
+	frame[0] = cmd;
+	frame[1] = count;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		frame[2 + i] = data[i];
+	}
+
+	return i2c_smbus_run(dev, frame, (uint8_t)(count + 2u), 0, 0, 0);
+}
+
+/**
+	@brief SMBus Block Read
+	@details Command code, repeated start, then the device sends the count
+	and that many bytes, then the PEC if on
+	@param[in] dev SMBus device
+	@param[in] cmd Command code
+	@param[out] data I2C_SMBUS_BLOCK_MAX bytes
+	@param[out] count Bytes the device sent
+	@returns I2C_STATUS_OK, I2C_STATUS_PEC if the PEC or count was still bad after the retries, or the bus error
+*/
+uint8_t i2c_smbus_block_read(i2c_smbus_t *dev, uint8_t cmd, uint8_t *data, uint8_t *count)
+{
+	uint8_t block[1 + I2C_SMBUS_BLOCK_MAX + 1];
+	uint8_t result = i2c_smbus_run(dev, &cmd, 1, block, 1 + I2C_SMBUS_BLOCK_MAX, 1);
+
+	*count = 0;
+	if (result == I2C_STATUS_OK)
+	{
+		*count = block[0];
+		for (uint8_t i = 0; i < block[0]; i++)
+		{
+			data[i] = block[1 + i];
+		}
+	}
+
+	return result;
+}
+
+/**
+	@brief SMBus Process Call
+	@details Command code and a word out, repeated start, a word back
+	@param[in] dev SMBus device
+	@param[in] cmd Command code
+	@param[in] in Word to send, low byte first
+	@param[out] out Word returned
+	@returns I2C_STATUS_OK, I2C_STATUS_PEC or the bus error
+*/
+uint8_t i2c_smbus_process_call(i2c_smbus_t *dev, uint8_t cmd, uint16_t in, uint16_t *out)
+{
+	uint8_t frame[3] = { cmd, (uint8_t)in, (uint8_t)(in >> 8) };
+	uint8_t word[3];
+	uint8_t result = i2c_smbus_run(dev, frame, 3, word, 2, 0);
+
+	if (result == I2C_STATUS_OK)
+	{
+		*out = (uint16_t)(word[0] | (word[1] << 8));
+	}
+
+	return result;
+}
+
+/**
+	@brief SMBus Block Process Call
+	@details Block write and block read in one transaction, joined by a
+	repeated start
+	@param[in] dev SMBus device
+	@param[in] cmd Command code
+	@param[in] wdata Bytes to write
+	@param[in] wcount Number of bytes to write, 1 to I2C_SMBUS_BLOCK_MAX
+	@param[out] rdata I2C_SMBUS_BLOCK_MAX bytes
+	@param[out] rcount Bytes the device sent
+	@returns I2C_STATUS_OK, I2C_STATUS_PEC, I2C_STATUS_INVALID for a wcount out of range or the bus error
+*/
+uint8_t i2c_smbus_block_process_call(i2c_smbus_t *dev, uint8_t cmd, uint8_t *wdata, uint8_t wcount, uint8_t *rdata, uint8_t *rcount)
+{
+	uint8_t frame[2 + I2C_SMBUS_BLOCK_MAX];
+	uint8_t block[1 + I2C_SMBUS_BLOCK_MAX + 1];
+	uint8_t result;
+
+	*rcount = 0;
+	if (!wcount || (wcount > I2C_SMBUS_BLOCK_MAX))
+	{
+		return I2C_STATUS_INVALID;
+	}
+	frame[0] = cmd;
+	frame[1] = wcount;
+	for (uint8_t i = 0; i < wcount; i++)
+	{
+		frame[2 + i] = wdata[i];
+	}
+
+	result = i2c_smbus_run(dev, frame, (uint8_t)(wcount + 2u), block, 1 + I2C_SMBUS_BLOCK_MAX, 1);
+	if (result == I2C_STATUS_OK)
+	{
+		*rcount = block[0];
+		for (uint8_t i = 0; i < block[0]; i++)
+		{
+			rdata[i] = block[1 + i];
+		}
+	}
+
+	return result;
+}
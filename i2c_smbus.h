@@ -0,0 +1,47 @@
+#ifndef I2C_SMBUS_H_
+#define I2C_SMBUS_H_
+
+#include <stdint.h>
+
+#ifndef I2C_SMBUS_RETRIES
+#define I2C_SMBUS_RETRIES	2		// Extra attempts after a PEC mismatch on a read
+#endif
+#define I2C_SMBUS_BLOCK_MAX	32		// Bytes in an SMBus block
+
+// Driver flags, i2c_bus_t.smbus on SAMD, set per call by i2c_smbus.c
+#define I2C_SMBUS_PEC_TX	0x01	// Send the PEC after the write phase
+#define I2C_SMBUS_PEC_RX	0x02	// The read ends with a PEC byte
+#define I2C_SMBUS_BLOCK		0x04	// First byte read is the count of bytes that follow
+
+// CRC-8, x^8 + x^2 + x + 1, one byte at a time. The 256 byte table is the
+// default, I2C_PEC_NIBBLE trades it for 16 bytes and two lookups per byte.
+#ifdef I2C_PEC_NIBBLE
+#define I2C_PEC_UPDATE(crc, byte)	i2c_pec_update((crc), (byte))
+#else
+extern const uint8_t i2c_pec_table[256];
+#define I2C_PEC_UPDATE(crc, byte)	(i2c_pec_table[(uint8_t)((crc) ^ (byte))])
+#endif
+
+/**
+	@brief SMBus device
+	@details pec turns on Packet Error Checking for every call on this device.
+*/
+typedef struct
+{
+	void *bus;				// i2c_bus_t * on SAMD, unused on PIC
+	uint8_t addr;			// Device address in the form the driver takes, 7 bit on SAMD, 8 bit write address on PIC
+	uint8_t pec;			// Non zero to send and check PEC
+	uint16_t pec_errors;	// Reads that failed the PEC or block count check, retries included
+} i2c_smbus_t;
+
+#define I2C_SMBUS_INIT(bus, addr, pec) \
+	{ (bus), (addr), (pec), 0 }
+
+uint8_t i2c_pec_update(uint8_t, uint8_t);
+uint32_t i2c_smbus_block_left(uint8_t, uint8_t, uint32_t);
+uint8_t i2c_smbus_block_write(i2c_smbus_t*, uint8_t, uint8_t*, uint8_t);
+uint8_t i2c_smbus_block_read(i2c_smbus_t*, uint8_t, uint8_t*, uint8_t*);
+uint8_t i2c_smbus_process_call(i2c_smbus_t*, uint8_t, uint16_t, uint16_t*);
+uint8_t i2c_smbus_block_process_call(i2c_smbus_t*, uint8_t, uint8_t*, uint8_t, uint8_t*, uint8_t*);
+
+#endif /* I2C_SMBUS_H_ */
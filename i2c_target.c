@@ -0,0 +1,333 @@
+/**
+* @file i2c_target.c
+* @brief MSF I2C Library, SERCOM I2C target (slave) with an in place register map.
+* @note Interrupt driven, Smart Mode ACKs each byte as DATA is touched. Built
+* with I2C_DMA, reads are fed to DATA by the SERCOM's DMA channel straight out
+* of the map, so a master reading a block only waits on the DMAC per byte
+* instead of an interrupt. Writes and the pointer bytes go through
+* i2c_target_isr, which applies the read only spans.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <sam.h>
+#include "i2c_target.h"
+
+#ifdef I2C_DMA
+#ifndef I2C_DMA_CHANNEL
+#define I2C_DMA_CHANNEL	0		// Must match i2c_samd.c
+#endif
+#endif
+
+// CTRLB.CMD actions
+#define I2C_TARGET_CMD_WAIT		2	// Drop the rest of the transfer, wait for START
+#define I2C_TARGET_CMD_ACK		3	// Send ACKACT, continue
+
+// SERCOM register blocks by instance number
+static sercom_registers_t * const i2c_target_sercom[SERCOM_INST_NUM] =
+{
+#ifdef SERCOM0_REGS
+	SERCOM0_REGS,
+#endif
+#ifdef SERCOM1_REGS
+	SERCOM1_REGS,
+#endif
+#ifdef SERCOM2_REGS
+	SERCOM2_REGS,
+#endif
+#ifdef SERCOM3_REGS
+	SERCOM3_REGS,
+#endif
+#ifdef SERCOM4_REGS
+	SERCOM4_REGS,
+#endif
+#ifdef SERCOM5_REGS
+	SERCOM5_REGS,
+#endif
+};
+#define I2C_TARGET_HW(t)	(i2c_target_sercom[(t)->sercom])
+
+/**
+	@brief Target Init
+	@details Clock, pins, own address and Smart Mode, then listen. Call
+	i2c_target_isr from the SERCOMn_Handler.
+	@param[in] t Target
+	@returns I2C_STATUS_OK, or I2C_STATUS_INVALID for an empty map or ptr_bytes other than 1 or 2
+*/
+uint8_t i2c_target_init(i2c_target_t *t)
+{
+	sercom_registers_t *hw = I2C_TARGET_HW(t);
+	port_group_registers_t *group = &PORT_REGS->GROUP[0];
+
+	// The pointer is reduced modulo size
+	if (!t->map || !t->size || !t->ptr_bytes || (t->ptr_bytes > 2))
+	{
+		return I2C_STATUS_INVALID;
+	}
+
+	// PM Enable SERCOMn Clock
+	PM_REGS->PM_APBCMASK |= (PM_APBCMASK_SERCOM0(1) << t->sercom);
+
+	// Set SERCOMn Core to the clock generator
+	GCLK_REGS->GCLK_CLKCTRL = (GCLK_CLKCTRL_CLKEN(1) | GCLK_CLKCTRL_ID(GCLK_CLKCTRL_ID_SERCOM0_CORE_Val + t->sercom) | GCLK_CLKCTRL_GEN(t->gclk));
+
+	// Hand SDA and SCL to the SERCOM
+	group->PORT_PMUX[t->sda >> 1] = ((t->sda & 1) ? ((group->PORT_PMUX[t->sda >> 1] & PORT_PMUX_PMUXE_Msk) | PORT_PMUX_PMUXO(t->pmux)) : ((group->PORT_PMUX[t->sda >> 1] & PORT_PMUX_PMUXO_Msk) | PORT_PMUX_PMUXE(t->pmux)));
+	group->PORT_PMUX[t->scl >> 1] = ((t->scl & 1) ? ((group->PORT_PMUX[t->scl >> 1] & PORT_PMUX_PMUXE_Msk) | PORT_PMUX_PMUXO(t->pmux)) : ((group->PORT_PMUX[t->scl >> 1] & PORT_PMUX_PMUXO_Msk) | PORT_PMUX_PMUXE(t->pmux)));
+	group->PORT_PINCFG[t->sda] = PORT_PINCFG_PMUXEN(1);
+	group->PORT_PINCFG[t->scl] = PORT_PINCFG_PMUXEN(1);
+
+	// Target Mode, SDA hold 50-100nS above 400KHz (the low phase is 500nS at 1MHz), 300-600nS below
+	hw->I2CS.SERCOM_CTRLA = (SERCOM_I2CS_CTRLA_MODE_I2C_SLAVE | SERCOM_I2CS_CTRLA_SPEED(t->speed) |
+		SERCOM_I2CS_CTRLA_SDAHOLD((t->speed == I2C_SPEED_FAST) ? 2 : 1));
+
+	// Smart Mode, ACK on DATA access, ADDR compare with no mask
+	hw->I2CS.SERCOM_CTRLB = SERCOM_I2CS_CTRLB_SMEN(1);
+	hw->I2CS.SERCOM_ADDR = SERCOM_I2CS_ADDR_ADDR(t->addr);
+
+	t->ptr = 0;
+	t->busy = 0;
+	t->expect = 0;
+	t->dma = 0;
+
+	// Enable I2C
+	while (hw->I2CS.SERCOM_SYNCBUSY & SERCOM_I2CS_SYNCBUSY_ENABLE(1));
+	hw->I2CS.SERCOM_CTRLA |= SERCOM_I2CS_CTRLA_ENABLE(1);
+	while (hw->I2CS.SERCOM_SYNCBUSY & SERCOM_I2CS_SYNCBUSY_ENABLE(1));
+
+	hw->I2CS.SERCOM_INTENSET = (SERCOM_I2CS_INTENSET_AMATCH(1) | SERCOM_I2CS_INTENSET_DRDY(1) | SERCOM_I2CS_INTENSET_PREC(1) | SERCOM_I2CS_INTENSET_ERROR(1));
+	NVIC_EnableIRQ((IRQn_Type)(SERCOM0_IRQn + t->sercom));
+
+	return I2C_STATUS_OK;
+}
+
+/**
+	@brief Target Writable
+	@param[in] t Target
+	@param[in] reg Register
+	@returns 0 if reg is in a read only span
+*/
+static uint8_t i2c_target_writable(i2c_target_t *t, uint16_t reg)
+{
+	for (uint8_t i = 0; i < t->readonly_count; i++)
+	{
+		if ((reg >= t->readonly[i].first) && (reg <= t->readonly[i].last))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+#ifdef I2C_DMA
+/**
+	@brief Target DMA Start
+	@details Feed DATA from map[ptr] with the SERCOM TX trigger. The channel
+	descriptor runs to the end of the map and links to a second one covering
+	the whole map that links to itself, so the pointer wraps with no
+	interrupt and the channel never completes. DRDY is masked meanwhile.
+	@param[in] t Target
+	@param[in] hw SERCOM registers
+*/
+static void i2c_target_dma_start(i2c_target_t *t, sercom_registers_t *hw)
+{
+	dmac_descriptor_registers_t *link;
+	dmac_descriptor_registers_t *wb;
+	dmac_descriptor_registers_t *desc = i2c_dma_channel(t->sercom, &link, &wb);
+
+	// Incrementing side points at the end of the block
+	desc->DMAC_BTCTRL = (DMAC_BTCTRL_VALID(1) | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC(1));
+	desc->DMAC_BTCNT = t->size - t->ptr;
+	desc->DMAC_SRCADDR = (uint32_t)(t->map + t->size);
+	desc->DMAC_DSTADDR = (uint32_t)&hw->I2CS.SERCOM_DATA;
+	desc->DMAC_DESCADDR = (uint32_t)link;
+	link->DMAC_BTCTRL = desc->DMAC_BTCTRL;
+	link->DMAC_BTCNT = t->size;
+	link->DMAC_SRCADDR = desc->DMAC_SRCADDR;
+	link->DMAC_DSTADDR = desc->DMAC_DSTADDR;
+	link->DMAC_DESCADDR = (uint32_t)link;
+
+	// Reads back as no progress if the master never clocks a byte
+	wb->DMAC_BTCNT = desc->DMAC_BTCNT;
+
+	hw->I2CS.SERCOM_INTENCLR = SERCOM_I2CS_INTENSET_DRDY(1);
+	DMAC_REGS->DMAC_CHID = I2C_DMA_CHANNEL + t->sercom;
+	DMAC_REGS->DMAC_CHCTRLB = (DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC(SERCOM0_DMAC_ID_TX + (2 * t->sercom)));
+	DMAC_REGS->DMAC_CHINTENCLR = (DMAC_CHINTENSET_TCMPL(1) | DMAC_CHINTENSET_TERR(1));
+	DMAC_REGS->DMAC_CHCTRLA = DMAC_CHCTRLA_ENABLE(1);
+	t->dma = 1;
+}
+
+/**
+	@brief Target DMA Stop
+	@details Halt the channel and move the pointer past the bytes it loaded.
+	Both descriptors end at the end of the map, so the remaining count in the
+	writeback gives the position whichever one was active.
+	@param[in] t Target
+	@param[in] hw SERCOM registers
+	@param[in] status STATUS at the end of the read
+*/
+static void i2c_target_dma_stop(i2c_target_t *t, sercom_registers_t *hw, uint16_t status)
+{
+	dmac_descriptor_registers_t *link;
+	dmac_descriptor_registers_t *wb;
+	uint16_t pos;
+
+	i2c_dma_channel(t->sercom, &link, &wb);
+	DMAC_REGS->DMAC_CHID = I2C_DMA_CHANNEL + t->sercom;
+	DMAC_REGS->DMAC_CHCTRLA &= ~DMAC_CHCTRLA_ENABLE(1);
+	while (DMAC_REGS->DMAC_CHCTRLA & DMAC_CHCTRLA_ENABLE(1));
+
+	pos = t->size - wb->DMAC_BTCNT;
+	if (pos >= t->size)
+	{
+		pos = 0;
+	}
+
+	// The DRDY after the master's NACK triggers one more load that is never sent
+	if ((status & SERCOM_I2CS_STATUS_RXNACK(1)) && (pos != t->ptr))
+	{
+		pos = pos ? (pos - 1) : (t->size - 1);
+	}
+
+	t->ptr = pos;
+	t->dma = 0;
+	hw->I2CS.SERCOM_INTENSET = SERCOM_I2CS_INTENSET_DRDY(1);
+}
+#endif
+
+/**
+	@brief Target End
+	@details Close the read or write phase on STOP or repeated start. A
+	pointer cut short by the master is dropped and ptr keeps its old value.
+	@param[in] t Target
+	@param[in] hw SERCOM registers
+	@param[in] status STATUS at the end of the phase
+*/
+static void i2c_target_end(i2c_target_t *t, sercom_registers_t *hw, uint16_t status)
+{
+	if (!t->busy)
+	{
+		return;
+	}
+
+#ifdef I2C_DMA
+	if (t->dma)
+	{
+		i2c_target_dma_stop(t, hw, status);
+	}
+#else
+	(void)hw;
+	(void)status;
+#endif
+
+	if (t->wcount && t->on_write)
+	{
+		t->on_write(t, t->wfirst, t->wcount);
+	}
+	t->expect = 0;
+	t->wcount = 0;
+	t->busy = 0;
+}
+
+/**
+	@brief Target Interrupt
+	@details Call from the SERCOMn_Handler of the target, e.g.
+	i2c_target_isr(&target). Address match picks the direction, each DRDY
+	moves one byte between DATA and the map, STOP closes the transaction.
+	@param[in] t Target
+*/
+void i2c_target_isr(i2c_target_t *t)
+{
+	sercom_registers_t *hw = I2C_TARGET_HW(t);
+	uint8_t flags = hw->I2CS.SERCOM_INTFLAG & hw->I2CS.SERCOM_INTENSET;
+	uint16_t status = hw->I2CS.SERCOM_STATUS;
+	uint8_t byte;
+
+	if (flags & SERCOM_I2CS_INTFLAG_ERROR(1))
+	{
+		// Bus error or collision, the SERCOM has already let go of the bus
+		hw->I2CS.SERCOM_INTFLAG = SERCOM_I2CS_INTFLAG_ERROR(1);
+		hw->I2CS.SERCOM_STATUS = (SERCOM_I2CS_STATUS_BUSERR(1) | SERCOM_I2CS_STATUS_COLL(1));
+		t->errors++;
+		i2c_target_end(t, hw, status);
+	}
+
+	if (flags & SERCOM_I2CS_INTFLAG_PREC(1))
+	{
+		hw->I2CS.SERCOM_INTFLAG = SERCOM_I2CS_INTFLAG_PREC(1);
+		i2c_target_end(t, hw, status);
+	}
+
+	if (flags & SERCOM_I2CS_INTFLAG_AMATCH(1))
+	{
+		// A repeated start closes the phase before it, typically the pointer write
+		i2c_target_end(t, hw, status);
+		t->busy = 1;
+		t->transactions++;
+
+		if (status & SERCOM_I2CS_STATUS_DIR(1))
+		{
+			t->sent = 0;
+#ifdef I2C_DMA
+			i2c_target_dma_start(t, hw);
+#endif
+		}
+		else
+		{
+			t->expect = t->ptr_bytes;
+			t->wcount = 0;
+		}
+
+		// ACK the address, clears AMATCH, SCL was held only for this
+		hw->I2CS.SERCOM_CTRLB = ((hw->I2CS.SERCOM_CTRLB & ~(SERCOM_I2CS_CTRLB_ACKACT(1) | SERCOM_I2CS_CTRLB_CMD_Msk)) | SERCOM_I2CS_CTRLB_CMD(I2C_TARGET_CMD_ACK));
+		return;
+	}
+
+	if (!(flags & SERCOM_I2CS_INTFLAG_DRDY(1)))
+	{
+		return;
+	}
+
+	if (status & SERCOM_I2CS_STATUS_DIR(1))
+	{
+		if ((status & SERCOM_I2CS_STATUS_RXNACK(1)) && t->sent)
+		{
+			// Master NACK'd the last byte, wait for its STOP or repeated start
+			hw->I2CS.SERCOM_CTRLB = ((hw->I2CS.SERCOM_CTRLB & ~SERCOM_I2CS_CTRLB_CMD_Msk) | SERCOM_I2CS_CTRLB_CMD(I2C_TARGET_CMD_WAIT));
+			return;
+		}
+
+		// Writing DATA clears DRDY
+		hw->I2CS.SERCOM_DATA = t->map[t->ptr];
+		t->ptr = ((t->ptr + 1u) == t->size) ? 0 : (t->ptr + 1u);
+		t->sent++;
+	}
+	else
+	{
+		// Smart Mode ACKs when DATA is read
+		byte = hw->I2CS.SERCOM_DATA;
+
+		if (t->expect)
+		{
+			// Built up in wfirst and reduced per byte, ptr only moves once the pointer is whole
+			t->wfirst = (uint16_t)((((t->expect == t->ptr_bytes) ? 0UL : ((uint32_t)t->wfirst << 8)) | byte) % t->size);
+			if (!--t->expect)
+			{
+				t->ptr = t->wfirst;
+			}
+			return;
+		}
+
+		if (i2c_target_writable(t, t->ptr))
+		{
+			t->map[t->ptr] = byte;
+		}
+		else
+		{
+			t->ro_drops++;
+		}
+		t->ptr = ((t->ptr + 1u) == t->size) ? 0 : (t->ptr + 1u);
+		t->wcount++;
+	}
+}
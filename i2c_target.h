@@ -0,0 +1,67 @@
+#ifndef I2C_TARGET_H_
+#define I2C_TARGET_H_
+
+#include <stdint.h>
+#include "MSF_I2C.h"
+
+/**
+	@brief Read only span of the register map, first to last inclusive
+*/
+typedef struct
+{
+	uint16_t first;
+	uint16_t last;
+} i2c_target_range_t;
+
+typedef struct i2c_target i2c_target_t;
+
+/**
+	@brief I2C target (slave) on a SERCOM
+	@details The master writes 1 or ptr_bytes pointer bytes, most significant
+	first, then data stored from the pointer on. Reads are served from the
+	pointer on. The pointer auto increments and wraps at size. Fill the board
+	and map fields with I2C_TARGET_INIT, driver state starts zeroed.
+*/
+struct i2c_target
+{
+	uint8_t sercom;								// SERCOM instance number
+	uint8_t gclk;								// Generic clock generator feeding the core clock
+	uint8_t sda;								// PA pin number of SDA, PAD[0]
+	uint8_t scl;								// PA pin number of SCL, PAD[1]
+	uint8_t pmux;								// Peripheral function of the pins
+	uint8_t speed;								// I2C_SPEED_* mode, sets SDA hold time
+	uint8_t addr;								// Own 7 bit address
+	uint8_t ptr_bytes;							// Register pointer bytes, 1 or 2
+	uint8_t *map;								// Register map, read in place
+	uint16_t size;								// Bytes in map
+	const i2c_target_range_t *readonly;			// Spans the master can not write, may be 0
+	uint8_t readonly_count;
+	void (*on_write)(i2c_target_t *, uint16_t, uint16_t);	// First register and bytes written, at STOP or repeated start, interrupt context, may be 0
+	void *context;								// Free for caller use
+	// Driver state
+	volatile uint16_t ptr;						// Register pointer
+	volatile uint8_t busy;						// Addressed, between address match and STOP
+	uint8_t expect;								// Pointer bytes still to come
+	uint8_t dma;								// Read served by DMA
+	uint16_t sent;								// Bytes loaded in the current read
+	uint16_t wfirst;							// First register written in the current write, pointer so far while expect is set
+	uint16_t wcount;							// Data bytes received in the current write
+	uint32_t transactions;						// Address matches, reads and writes
+	uint16_t ro_drops;							// Bytes ACK'd but not stored, read only span
+	uint16_t errors;							// Bus errors and collisions
+};
+
+#define I2C_TARGET_INIT(n, gen, sda_pin, scl_pin, mux, own_addr, regs, regs_size, pointer_bytes) \
+	{ .sercom = (n), .gclk = (gen), .sda = (sda_pin), .scl = (scl_pin), .pmux = (mux), \
+	  .speed = I2C_SPEED_FASTPLUS, .addr = (own_addr), .ptr_bytes = (pointer_bytes), \
+	  .map = (regs), .size = (regs_size) }
+
+uint8_t i2c_target_init(i2c_target_t*);
+void i2c_target_isr(i2c_target_t*);
+
+#if defined(I2C_DMA) && defined(DMAC_REGS)
+// Provided by i2c_samd.c, which owns the DMAC descriptor memory
+dmac_descriptor_registers_t *i2c_dma_channel(uint8_t, dmac_descriptor_registers_t**, dmac_descriptor_registers_t**);
+#endif
+
+#endif /* I2C_TARGET_H_ */
@@ -0,0 +1,179 @@
+/**
+* @file i2c_trace.c
+* @brief MSF I2C Library, bus event trace recorder.
+* @note Flight recorder ring of the last I2C_TRACE_SIZE bus events, fed by
+* the drivers when built with I2C_TRACE defined. Dump it with
+* i2c_trace_dump and decode it on a PC with tools/i2ctrace.c.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include "i2c_trace.h"
+
+#ifdef __XC8
+#include <xc.h>
+#include "i2crxtx.h"
+
+#ifndef I2C_TRACE_NOW
+#define I2C_TRACE_NOW()					TMR1				// Free running Timer1
+#define I2C_TRACE_ELAPSED(then, now)	((uint16_t)((now) - (then)))	// 16 bits, never sees a wrap
+#endif
+
+#define I2C_TRACE_LOCK()	uint8_t gie = GIE; GIE = 0
+#define I2C_TRACE_UNLOCK()	GIE = gie
+#else
+#include <sam.h>
+#include "MSF_I2C.h"
+
+#ifndef I2C_TRACE_NOW
+#ifndef I2C_TRACE_SHIFT
+#define I2C_TRACE_SHIFT		4		// 3MHz stamps at 48MHz, 16 bits wrap every 21mS
+#endif
+#define I2C_TRACE_NOW()					(SysTick->VAL >> I2C_TRACE_SHIFT)	// Free running SysTick, LOAD = 0xFFFFFF
+#define I2C_TRACE_ELAPSED(then, now)	(((then) - (now)) & (0xFFFFFFUL >> I2C_TRACE_SHIFT))	// SysTick counts down
+#define I2C_TRACE_FLAGS		I2C_TRACE_DOWN
+#endif
+
+#define I2C_TRACE_LOCK()	uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define I2C_TRACE_UNLOCK()	__set_PRIMASK(primask)
+#endif
+
+// An own I2C_TRACE_NOW counts up at the timer_hz given to i2c_trace_dump,
+// define these as well when it does not
+#ifndef I2C_TRACE_SHIFT
+#define I2C_TRACE_SHIFT		0
+#endif
+#ifndef I2C_TRACE_ELAPSED
+#define I2C_TRACE_ELAPSED(then, now)	((uint32_t)((now) - (then)))
+#endif
+#ifndef I2C_TRACE_FLAGS
+#define I2C_TRACE_FLAGS		0
+#endif
+
+#if (I2C_TRACE_SIZE & (I2C_TRACE_SIZE - 1)) || (I2C_TRACE_SIZE > 0x8000)
+#error "I2C_TRACE_SIZE must be a power of two no larger than 32768"
+#endif
+
+static i2c_trace_entry_t i2c_trace_buf[I2C_TRACE_SIZE];
+static uint16_t i2c_trace_head;		// Events recorded, wraps
+static uint8_t i2c_trace_full;		// Ring has wrapped since the last clear
+static uint32_t i2c_trace_last;		// I2C_TRACE_NOW of the newest event
+
+/**
+	@brief Trace Put
+	@details Store one entry at the head, interrupts already masked
+	@param[in] bus Bus number, 0 to 15
+	@param[in] type I2C_TRACE_* event
+	@param[in] data Event data
+	@param[in] stamp Low 16 bits of I2C_TRACE_NOW
+*/
+static void i2c_trace_put(uint8_t bus, uint8_t type, uint8_t data, uint16_t stamp)
+{
+	i2c_trace_entry_t *entry = &i2c_trace_buf[i2c_trace_head & (I2C_TRACE_SIZE - 1)];
+
+	entry->stamp = stamp;
+	entry->type = (uint8_t)((bus << 4) | type);
+	entry->data = data;
+	if (!(uint16_t)(++i2c_trace_head & (I2C_TRACE_SIZE - 1)))
+	{
+		i2c_trace_full = 1;
+	}
+}
+
+/**
+	@brief Trace Event
+	@details Record one event, overwriting the oldest once the ring is full.
+	An I2C_TRACE_WRAP goes in front of it when the 16 bit stamp has wrapped
+	since the event before. Safe from interrupt and main loop context alike.
+	@param[in] bus Bus number, 0 to 15
+	@param[in] type I2C_TRACE_* event
+	@param[in] data Byte, SCL pulses or 0
+*/
+void i2c_trace_event(uint8_t bus, uint8_t type, uint8_t data)
+{
+	uint32_t now;
+	uint32_t wraps;
+
+	I2C_TRACE_LOCK();
+	now = (uint32_t)I2C_TRACE_NOW();
+	wraps = (uint32_t)I2C_TRACE_ELAPSED(i2c_trace_last, now) >> 16;
+	i2c_trace_last = now;
+	if (wraps && (i2c_trace_head || i2c_trace_full))
+	{
+		i2c_trace_put(bus, I2C_TRACE_WRAP, (uint8_t)((wraps > 255) ? 255 : wraps), (uint16_t)now);
+	}
+	i2c_trace_put(bus, type, data, (uint16_t)now);
+	I2C_TRACE_UNLOCK();
+}
+
+/**
+	@brief Trace Result
+	@details Record the outcome of a wait on the bus
+	@param[in] bus Bus number, 0 to 15
+	@param[in] result I2C_STATUS_* code, OK traces as ACK
+*/
+void i2c_trace_result(uint8_t bus, uint8_t result)
+{
+	switch (result)
+	{
+		case I2C_STATUS_OK:
+			i2c_trace_event(bus, I2C_TRACE_ACK, 0);
+			break;
+		case I2C_STATUS_NACK:
+			i2c_trace_event(bus, I2C_TRACE_NACK, 0);
+			break;
+		case I2C_STATUS_ARBLOST:
+			i2c_trace_event(bus, I2C_TRACE_ARBLOST, 0);
+			break;
+		case I2C_STATUS_BUSERR:
+			i2c_trace_event(bus, I2C_TRACE_BUSERR, 0);
+			break;
+		case I2C_STATUS_TIMEOUT:
+			i2c_trace_event(bus, I2C_TRACE_TIMEOUT, 0);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+	@brief Trace Dump
+	@details Copy the recorded events out, oldest first, with a header for
+	tools/i2ctrace.c. Interrupts are masked for the copy.
+	@param[out] hdr Dump header
+	@param[out] out Array of at least max entries
+	@param[in] max Most entries to copy, the newest are kept
+	@param[in] timer_hz Clock of the I2C_TRACE_NOW timer, e.g. the core clock for SysTick
+	@param[in] clear Non zero to empty the ring after the copy
+	@returns Number of entries copied
+*/
+uint16_t i2c_trace_dump(i2c_trace_header_t *hdr, i2c_trace_entry_t *out, uint16_t max, uint32_t timer_hz, uint8_t clear)
+{
+	uint16_t count;
+	uint16_t first;
+
+	I2C_TRACE_LOCK();
+	count = i2c_trace_full ? I2C_TRACE_SIZE : i2c_trace_head;
+	if (count > max)
+	{
+		count = max;
+	}
+	first = (uint16_t)(i2c_trace_head - count);
+	for (uint16_t i = 0; i < count; i++)
+	{
+		out[i] = i2c_trace_buf[(uint16_t)(first + i) & (I2C_TRACE_SIZE - 1)];
+	}
+	if (clear)
+	{
+		i2c_trace_head = 0;
+		i2c_trace_full = 0;
+	}
+	I2C_TRACE_UNLOCK();
+
+	hdr->magic = I2C_TRACE_MAGIC;
+	hdr->tick_hz = timer_hz >> I2C_TRACE_SHIFT;
+	hdr->count = count;
+	hdr->version = I2C_TRACE_VERSION;
+	hdr->flags = I2C_TRACE_FLAGS;
+
+	return count;
+}
@@ -0,0 +1,61 @@
+#ifndef I2C_TRACE_H_
+#define I2C_TRACE_H_
+
+#include <stdint.h>
+
+#ifndef I2C_TRACE_SIZE
+#define I2C_TRACE_SIZE		64		// Events kept, a power of two, 4 bytes each
+#endif
+
+// Event types, low nibble of i2c_trace_entry_t.type. The first TX after a
+// START or RESTART is the address byte with the R/W bit.
+#define I2C_TRACE_START		1
+#define I2C_TRACE_RESTART	2
+#define I2C_TRACE_STOP		3
+#define I2C_TRACE_TX		4		// data = byte written
+#define I2C_TRACE_RX		5		// data = byte read
+#define I2C_TRACE_ACK		6		// Ninth bit of the last byte was ACK
+#define I2C_TRACE_NACK		7		// Ninth bit of the last byte was NACK
+#define I2C_TRACE_TIMEOUT	8
+#define I2C_TRACE_ARBLOST	9
+#define I2C_TRACE_BUSERR	10
+#define I2C_TRACE_RESET		11		// Bus recovery or reset_i2c, data = SCL pulses when known
+#define I2C_TRACE_WRAP		12		// data = 16 bit stamp wraps before the next event, 255 = at least
+
+/**
+	@brief Trace event
+	@details type holds the event in the low nibble and the bus (SERCOM
+	number, 0 on PIC) in the high nibble. stamp is the low 16 bits of
+	I2C_TRACE_NOW. A gap of a whole wrap or more is logged as I2C_TRACE_WRAP
+	with the same stamp as the event after it.
+*/
+typedef struct
+{
+	uint16_t stamp;
+	uint8_t type;
+	uint8_t data;
+} i2c_trace_entry_t;
+
+#define I2C_TRACE_MAGIC		0x54433249UL	// "I2CT" in little endian memory
+#define I2C_TRACE_VERSION	1
+#define I2C_TRACE_DOWN		0x01			// Stamps count down, SysTick
+
+/**
+	@brief Trace dump header
+	@details Written in front of the entries by i2c_trace_dump. Both targets
+	are little endian, tools/i2ctrace.c reads the pair straight from a file.
+*/
+typedef struct
+{
+	uint32_t magic;			// I2C_TRACE_MAGIC
+	uint32_t tick_hz;		// Stamp ticks per second
+	uint16_t count;			// Entries that follow, oldest first
+	uint8_t version;		// I2C_TRACE_VERSION
+	uint8_t flags;			// I2C_TRACE_DOWN
+} i2c_trace_header_t;
+
+void i2c_trace_event(uint8_t, uint8_t, uint8_t);
+void i2c_trace_result(uint8_t, uint8_t);
+uint16_t i2c_trace_dump(i2c_trace_header_t*, i2c_trace_entry_t*, uint16_t, uint32_t, uint8_t);
+
+#endif /* I2C_TRACE_H_ */
@@ -17,6 +17,137 @@
 #include "i2crxtx.h"
 #include "mcc_generated_files/mcc.h"
 
+//----------------------------------------------------------------------------//
+// Bus Speed
+//----------------------------------------------------------------------------//
+// Define I2C_SCL_HZ (100000UL standard, 400000UL fast, 1000000UL fast plus)
+// to work SSPADD out from _XTAL_FREQ, boards without it keep SSPADD = 150
+#ifdef I2C_SCL_HZ
+#ifndef I2C_TRISE_NS
+#define I2C_TRISE_NS    100             // SCL rise time, pull-up against bus capacitance
+#endif
+#define I2C_SSPADD      I2C_SSPADD_VALUE(_XTAL_FREQ, I2C_SCL_HZ, I2C_TRISE_NS)
+#if (I2C_SSPADD < 3) || (I2C_SSPADD > 255)
+#error "I2C_SCL_HZ out of range for _XTAL_FREQ, SSPADD must be 3 to 255"
+#endif
+#if (I2C_SSPADD_CLOCKS(_XTAL_FREQ, I2C_SSPADD, I2C_TRISE_NS) * I2C_SCL_HZ) < _XTAL_FREQ
+#error "SSPADD would run SCL above I2C_SCL_HZ"
+#endif
+#else
+#define I2C_SSPADD      150             // FOSC/604
+#endif
+
+//----------------------------------------------------------------------------//
+// Retry Policy
+//----------------------------------------------------------------------------//
+#ifndef I2C_RETRIES
+#define I2C_RETRIES         10      // Attempts per polled transaction
+#endif
+#ifndef I2C_BACKOFF_US
+#define I2C_BACKOFF_US      20      // Wait after the first failed attempt, doubles each retry
+#endif
+#ifndef I2C_BACKOFF_MAX
+#define I2C_BACKOFF_MAX     5       // Doublings before the wait stops growing, 20uS << 5 = 640uS
+#endif
+#ifndef I2C_HEALTH_SLOTS
+#define I2C_HEALTH_SLOTS    8       // Failing addresses tracked at once
+#endif
+#ifndef I2C_HEALTH_TRIP
+#define I2C_HEALTH_TRIP     2       // Failed transactions in a row before the breaker opens
+#endif
+#ifndef I2C_HEALTH_PROBE
+#define I2C_HEALTH_PROBE    50      // Calls short circuited between single attempt probes
+#endif
+
+static I2C_HEALTH i2c_health_table[I2C_HEALTH_SLOTS];
+
+//----------------------------------------------------------------------------//
+// Multi-Master
+//----------------------------------------------------------------------------//
+#ifndef I2C_ARB_WAIT
+#define I2C_ARB_WAIT        50000   // Polls for another master's STOP, as i2c_waitForIdle
+#endif
+
+static unsigned char i2c_arb_flag;      // Arbitration lost since the last attempt, skip the backoff
+
+//----------------------------------------------------------------------------//
+// Bus Scan
+//----------------------------------------------------------------------------//
+#ifndef I2C_SCAN_WAIT
+#define I2C_SCAN_WAIT       500     // Idle polls per scan step, i2c_waitForIdle allows 50000
+#endif
+
+//----------------------------------------------------------------------------//
+// Interrupt State Machine
+//----------------------------------------------------------------------------//
+#ifndef I2C_POLL_STALL
+#define I2C_POLL_STALL      50000   // i2c_poll calls without progress before reset_i2c, as i2c_waitForIdle
+#endif
+#ifndef I2C_ARB_RETRIES
+#define I2C_ARB_RETRIES     3       // i2c_poll re-issues after a lost arbitration
+#endif
+#define I2C_SM_IDLE     0
+#define I2C_SM_START    1       // SEN issued
+#define I2C_SM_ADDR_W   2       // Write address in SSPBUF
+#define I2C_SM_WRITE    3       // Data byte in SSPBUF
+#define I2C_SM_RESTART  4       // RSEN issued
+#define I2C_SM_ADDR_R   5       // Read address in SSPBUF
+#define I2C_SM_RECEIVE  6       // RCEN issued
+#define I2C_SM_ACK      7       // ACKEN issued
+#define I2C_SM_STOP     8       // PEN issued
+#define I2C_SM_ARB      9       // Lost arbitration, i2c_poll waits for the winner's STOP
+
+static I2C_TRANSACTION * volatile i2c_sm_xfer = 0;
+static volatile unsigned char i2c_sm_state = I2C_SM_IDLE;
+static unsigned int i2c_sm_index;
+static unsigned char i2c_sm_result;
+static unsigned int i2c_poll_stall;     // i2c_poll calls since the MSSP last finished a step
+static unsigned char i2c_sm_arb;        // Re-issues left for the polled transaction
+#ifdef I2C_RING
+#ifndef I2C_RING_NOW
+#define I2C_RING_NOW()  TMR1            // Free running Timer1
+#endif
+static i2c_ring_t *i2c_sm_ring;
+#endif
+
+//----------------------------------------------------------------------------//
+// Performance Counters
+//----------------------------------------------------------------------------//
+#ifdef I2C_STATS
+#ifndef I2C_STATS_NOW
+#define I2C_STATS_NOW()     TMR1            // Free running Timer1, set up by the application
+#endif
+
+static I2C_STATS_DATA i2c_stats_data;
+static unsigned int i2c_stats_stamp;        // Polled transaction start
+static unsigned int i2c_sm_stamp;           // Interrupt driven transaction start
+static unsigned int i2c_arb_stamp;          // i2c_poll lost arbitration
+static void i2c_stats_record(unsigned int, unsigned int);
+static void i2c_stats_arb(unsigned int);
+
+#define I2C_STATS_COUNT(field)          (i2c_stats_data.field++)
+#define I2C_STATS_RETRY(retry)          do { if (retry) {i2c_stats_data.retries++;} } while (0)
+#define I2C_STATS_START(stamp)          ((stamp) = I2C_STATS_NOW())
+#define I2C_STATS_END(stamp, bytes)     i2c_stats_record((stamp), (bytes))
+#define I2C_STATS_ARB(stamp)            i2c_stats_arb(stamp)
+#else
+#define I2C_STATS_COUNT(field)
+#define I2C_STATS_RETRY(retry)
+#define I2C_STATS_START(stamp)
+#define I2C_STATS_END(stamp, bytes)
+#define I2C_STATS_ARB(stamp)
+#endif
+
+//----------------------------------------------------------------------------//
+// Bus Trace
+//----------------------------------------------------------------------------//
+#ifdef I2C_TRACE
+#include "i2c_trace.h"
+#define I2C_TRACE_EVENT(type, data)     i2c_trace_event(0, (type), (data))
+#else
+#define I2C_TRACE_EVENT(type, data)
+#endif
+
 //----------------------------------------------------------------------------//
 // Local Function Prototypes
 //----------------------------------------------------------------------------//
@@ -37,9 +168,13 @@ void i2c_init()
   SSPCON1 = 0b00101000;     //SSPEN and I2C master mode, clock = FOSC/(4 * (SSPxADD + 1))
   SSPCON2 = 0;
 
-  SSPADD  = 150;
+  SSPADD  = I2C_SSPADD;
   
+#if defined(I2C_SCL_HZ) && (I2C_SCL_HZ > 100000UL) && (I2C_SCL_HZ <= 400000UL)
+  SSPSTAT = 0b00000000;     //Slew rate control for fast mode. disable SMBus inputs
+#else
   SSPSTAT = 0b10000000;     //Disable slew rate. disable SMBus inputs
+#endif
 
   //CKE     = 1;             // Data transmitted on falling edge of SCK
   //SMP     = 1;             // disable slew rate control
@@ -47,6 +182,164 @@ void i2c_init()
   BCLIF   = 0;             // clear bus collision flag
 }
 //-----------------------------------------------------------------------------
+// Function name:  i2c_health
+//-----------------------------------------------------------------------------
+//  Returns the health slot tracking i2caddr.
+//  Returns 0 if the device has not failed since it last answered.
+//-----------------------------------------------------------------------------
+I2C_HEALTH *i2c_health(unsigned char i2caddr)
+{
+    unsigned char i;
+
+    for (i = 0; i < I2C_HEALTH_SLOTS; i++)
+    {
+        if (i2c_health_table[i].fails && (i2c_health_table[i].i2caddr == i2caddr))
+        {
+            return &i2c_health_table[i];
+        }
+    }
+
+    return 0;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_health_clear
+//-----------------------------------------------------------------------------
+//  Closes the breaker for i2caddr, e.g. after a device is plugged back in.
+//-----------------------------------------------------------------------------
+void i2c_health_clear(unsigned char i2caddr)
+{
+    I2C_HEALTH *slot = i2c_health(i2caddr);
+
+    if (slot)
+    {
+        slot->fails = 0;
+    }
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_policy_begin
+//-----------------------------------------------------------------------------
+//  Returns how many attempts a polled transaction to i2caddr may make.
+//  Returns 0 while the breaker is open, so a dead device costs no bus time.
+//  The caller then fails at once, without i2c_policy_end or I2C_STATS_END,
+//  so the skipped call is neither a failure nor a transaction.
+//  Every I2C_HEALTH_PROBE calls one attempt goes through to probe it back.
+//-----------------------------------------------------------------------------
+static unsigned char i2c_policy_begin(unsigned char i2caddr)
+{
+    I2C_HEALTH *slot = i2c_health(i2caddr);
+
+    i2c_arb_flag = 0;
+
+    if (!slot || (slot->fails < I2C_HEALTH_TRIP))
+    {
+        return I2C_RETRIES;
+    }
+
+    if (slot->skip)
+    {
+        slot->skip--;
+        return 0;
+    }
+
+    slot->skip = I2C_HEALTH_PROBE;
+    return 1;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_policy_end
+//-----------------------------------------------------------------------------
+//  Records the outcome of a polled transaction.  A device that answers
+//  leaves the table, a failing one takes a free slot or one from a device
+//  that has failed less.
+//-----------------------------------------------------------------------------
+static void i2c_policy_end(unsigned char i2caddr, unsigned char ok)
+{
+    I2C_HEALTH *slot = i2c_health(i2caddr);
+    unsigned char i;
+
+    if (ok)
+    {
+        if (slot)
+        {
+            slot->fails = 0;
+        }
+        return;
+    }
+
+    if (!slot)
+    {
+        slot = &i2c_health_table[0];
+        for (i = 1; i < I2C_HEALTH_SLOTS; i++)
+        {
+            if (i2c_health_table[i].fails < slot->fails)
+            {
+                slot = &i2c_health_table[i];
+            }
+        }
+        slot->i2caddr = i2caddr;
+        slot->fails = 0;
+    }
+
+    if (slot->fails < 255)
+    {
+        slot->fails++;
+    }
+    if (slot->fails == I2C_HEALTH_TRIP)
+    {
+        slot->skip = I2C_HEALTH_PROBE;
+    }
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_backoff
+//-----------------------------------------------------------------------------
+//  Waits before the next attempt, I2C_BACKOFF_US after the first failure and
+//  twice as long after each one that follows.  Returns at once when retry
+//  is 0 as no attempt follows, or when the attempt lost arbitration.
+//-----------------------------------------------------------------------------
+static void i2c_backoff(unsigned char retry)
+{
+    unsigned char shift;
+    unsigned int wait;
+
+    if (i2c_arb_flag)               // Lost arbitration and the bus is free again, go at once
+    {
+        i2c_arb_flag = 0;
+        return;
+    }
+    if (!retry || (retry >= I2C_RETRIES))
+    {
+        return;
+    }
+
+    shift = (unsigned char)(I2C_RETRIES - retry - 1u);
+    if (shift > I2C_BACKOFF_MAX)
+    {
+        shift = I2C_BACKOFF_MAX;
+    }
+
+    wait = 1u << shift;
+    while (wait--)
+    {
+        __delay_us(I2C_BACKOFF_US);
+        CLRWDT();
+    }
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_set_speed
+//-----------------------------------------------------------------------------
+//  Switches the bus clock between transactions, use I2C_SSPADD_VALUE to get
+//  sspadd for a given FOSC and SCL at compile time.
+//  Returns 1 if the new clock was applied.
+//  Returns 0 if the bus is not idle.
+//-----------------------------------------------------------------------------
+unsigned char i2c_set_speed(unsigned char sspadd)
+{
+  if(i2c_busy() || !i2c_waitForIdle())
+    {return 0;}
+
+  SSPADD = sspadd;
+  return 1;
+}
+//-----------------------------------------------------------------------------
 // Function Name:  i2c_waitForIdle()
 //-----------------------------------------------------------------------------
 // Changes:
@@ -71,6 +364,8 @@ unsigned char i2c_waitForIdle(void)
 
   if(i2c_wait == 50000)     // Idle timeout
     {
+      I2C_STATS_COUNT(timeouts);
+      I2C_TRACE_EVENT(I2C_TRACE_TIMEOUT, 0);
       i2c_fail++;
       if(i2c_fail >= 3)
        {
@@ -91,6 +386,8 @@ void reset_i2c(void)  // Force the I2C to reset.  Temporary fix until real probl
 {
   unsigned int reset_i;
 
+  I2C_STATS_COUNT(resets);
+  I2C_TRACE_EVENT(I2C_TRACE_RESET, 9);
   SSPEN = 0;
   SSPCON2 = 0;
   SDA_TRIS = 0;
@@ -124,21 +421,75 @@ void reset_i2c(void)  // Force the I2C to reset.  Temporary fix until real probl
   PEN = 1;
 }
 //-----------------------------------------------------------------------------
-// Function name:  i2c_start
+// Function name:  i2c_arb_wait
 //-----------------------------------------------------------------------------
-//  Returns 1 if start initiated.
-//  Returns 0 is bus is not idle.
+//  Waits for another master's STOP, START is set from its START until then.
+//  Returns 1 once the bus is free.
+//  Returns 0 if it stayed busy for I2C_ARB_WAIT polls.
 //-----------------------------------------------------------------------------
-unsigned char i2c_start(void)
+static unsigned char i2c_arb_wait(void)
 {
-  if(i2c_waitForIdle() && !START)       // Bus Idle, Start not received last
+  unsigned int wait = 0;
+
+  while(START)
     {
-      SEN = 1;                          // Initiate START conditon.
-      __delay_us(10);
-      return 1;
+      if(++wait >= I2C_ARB_WAIT)
+        {return 0;}
+      CLRWDT();
     }
-  else
+  return 1;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_arb_lost
+//-----------------------------------------------------------------------------
+//  Handles a bus collision.  The MSSP lets go of SDA and SCL and goes idle
+//  by itself when another master wins, so no STOP is sent and nothing is
+//  reset, that would wreck the winner's transfer.  Waits for its STOP so
+//  the retry loop can go again without a backoff.
+//  Returns 1 if arbitration was lost.
+//  Returns 0 if BCLIF is clear.
+//-----------------------------------------------------------------------------
+static unsigned char i2c_arb_lost(void)
+{
+#ifdef I2C_STATS
+  unsigned int stamp;
+#endif
+
+  if(!BCLIF)
     {return 0;}
+
+  I2C_STATS_START(stamp);
+  BCLIF = 0;
+  I2C_STATS_COUNT(arblost);
+  I2C_TRACE_EVENT(I2C_TRACE_ARBLOST, 0);
+  if(i2c_arb_wait())
+    {
+      i2c_arb_flag = 1;
+      I2C_STATS_ARB(stamp);
+    }
+  return 1;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_start
+//-----------------------------------------------------------------------------
+//  Returns I2C_START_OK if start initiated.
+//  Returns I2C_START_FAIL if the MSSP is not idle.
+//  Returns I2C_START_BUSY if another master's transfer outlasted
+//  I2C_ARB_WAIT polls.  The bus is fine, so the caller must not reset it.
+//-----------------------------------------------------------------------------
+unsigned char i2c_start(void)
+{
+  i2c_arb_lost();                       // Collision nobody picked up
+
+  if(!i2c_waitForIdle())
+    {return I2C_START_FAIL;}
+
+  if(!i2c_arb_wait())                   // Start received last, not ours
+    {return I2C_START_BUSY;}
+
+  SEN = 1;                              // Initiate START conditon.
+  I2C_TRACE_EVENT(I2C_TRACE_START, 0);
+  return I2C_START_OK;
 }
 //-----------------------------------------------------------------------------
 // Function name:  i2c_repStart
@@ -148,10 +499,10 @@ unsigned char i2c_start(void)
 //-----------------------------------------------------------------------------
 unsigned char i2c_repStart(void)
 {
-  if(i2c_waitForIdle())       // Bus Idle, Start not received last
+  if(!BCLIF && i2c_waitForIdle())       // Still own the bus, MSSP idle
     {
       RSEN = 1;                          // Initiate RESTART conditon.
-      __delay_us(10);
+      I2C_TRACE_EVENT(I2C_TRACE_RESTART, 0);
       return 1;
     }
   else{return 0;}
@@ -159,13 +510,16 @@ unsigned char i2c_repStart(void)
 //-----------------------------------------------------------------------------
 unsigned char i2c_write(unsigned char i2cWriteData)
 {
-  unsigned char temp_chk = 0;
-
-  if(i2c_waitForIdle())           // Wait for the idle condition
+  if(!BCLIF && i2c_waitForIdle())     // START won and MSSP idle
     {
-      __delay_us(10);                // wait 10 uS
+      I2C_TRACE_EVENT(I2C_TRACE_TX, i2cWriteData);
       SSPBUF = i2cWriteData;     // Load SSPBUF with i2cWriteData (the value to be transmitted)
-      temp_chk = i2c_waitForIdle(); // Wait for the idle condition
+      i2c_waitForIdle();         // Wait for the idle condition
+      if(BCLIF)                  // Lost arbitration on this byte, i2c_stop handles it
+        {return 0;}
+      I2C_TRACE_EVENT(ACKSTAT ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+      if(ACKSTAT)
+        {I2C_STATS_COUNT(nacks);}
       return (!ACKSTAT);         // ACKSTAT returns '0' if transmission is acknowledged
     }
   else
@@ -179,9 +533,10 @@ I2C_RESULT i2c_read(unsigned char ack)
   temp_read.data = 0;
   temp_read.tx_chk = 0;
 
-  temp_read.tx_chk = i2c_waitForIdle();   // Wait for the idle condition
+  if(BCLIF)                     // Lost the bus earlier, i2c_stop handles it
+    {return(temp_read);}
 
-  __delay_us(10);                  // wait 10 uS
+  temp_read.tx_chk = i2c_waitForIdle();   // Wait for the idle condition
 
   RCEN = 1;                    // Enable receive mode
 
@@ -196,6 +551,8 @@ I2C_RESULT i2c_read(unsigned char ack)
     {ACKDT = 1;}               // otherwise transmit a Not Acknowledge
 
   ACKEN = 1;                   // send acknowledge sequence
+  I2C_TRACE_EVENT(I2C_TRACE_RX, temp_read.data);
+  I2C_TRACE_EVENT(ack ? I2C_TRACE_ACK : I2C_TRACE_NACK, 0);
 
   return(temp_read);            // return the value read from SSPBUF
 
@@ -203,22 +560,31 @@ I2C_RESULT i2c_read(unsigned char ack)
 //-----------------------------------------------------------------------------
 void i2c_stop(void)
 {
-  if(i2c_waitForIdle())	    // Wait for the idle condition
+  unsigned char idle = i2c_waitForIdle();   // Wait for the idle condition
+
+  if(i2c_arb_lost())        // Another master owns the bus and sends its own STOP
+    {return;}
+
+  if(idle)
     {
-      __delay_us(10);          // wait 10 uS
       PEN = 1;             // Initiate STOP condition
+      I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
     }
 }
 //-----------------------------------------------------------------------------
 I2C_RESULT get_i2c_data(unsigned char i2caddr)
 {
-  unsigned char output = 0;
   I2C_RESULT temp_get;
 
   temp_get.data = 0;
   temp_get.tx_chk = 0;
+  if(!i2c_policy_begin(i2caddr))   // Written off, fail without touching the bus or the counters
+    {
+      return temp_get;
+    }
+  I2C_STATS_START(i2c_stats_stamp);
 
-  if(i2c_start())           // Bus idle and start initiated
+  if(i2c_start() == I2C_START_OK)   // Bus idle and start initiated
     {
       if(i2c_write(i2caddr + 1u))
         {
@@ -226,10 +592,11 @@ I2C_RESULT get_i2c_data(unsigned char i2caddr)
         }
       else                  // No Ack.  Retry
         {
+          I2C_STATS_COUNT(retries);
           i2c_stop();       // Stop bus and wait
           __delay_us(75);
 
-          if(i2c_start())   // Bus idle and start initiated
+          if(i2c_start() == I2C_START_OK)   // Bus idle and start initiated
             {
               if(i2c_write(i2caddr + 1u))
                 {
@@ -241,20 +608,29 @@ I2C_RESULT get_i2c_data(unsigned char i2caddr)
       i2c_stop();
     }
 
+  i2c_policy_end(i2caddr, temp_get.tx_chk);
+  I2C_STATS_END(i2c_stats_stamp, temp_get.tx_chk);
   return temp_get;            // data
 }
 //-----------------------------------------------------------------------------
 I2C_RESULT get_i2c_data_pointer(unsigned char i2caddr, unsigned char address) 
 {
     I2C_RESULT temp_get;
-    unsigned char retry = 10;
+    unsigned char retry = i2c_policy_begin(i2caddr);
+    unsigned char start;
 
     temp_get.data = 0;
     temp_get.tx_chk = 0;
 
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return temp_get;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
     while (retry) 
     {
-        if (i2c_start()) 
+        start = i2c_start();
+        if (start == I2C_START_OK) 
         {
             if (i2c_write(i2caddr)) 
             {
@@ -269,7 +645,7 @@ I2C_RESULT get_i2c_data_pointer(unsigned char i2caddr, unsigned char address)
             }
             i2c_stop();
         } 
-        else 
+        else if (start == I2C_START_FAIL)   // Stuck, not beaten by another master
         {
             reset_i2c();
         }
@@ -277,6 +653,8 @@ I2C_RESULT get_i2c_data_pointer(unsigned char i2caddr, unsigned char address)
         if (!temp_get.tx_chk) 
         {
             retry--;
+            I2C_STATS_RETRY(retry);
+            i2c_backoff(retry);
         } 
         else 
         {
@@ -284,17 +662,26 @@ I2C_RESULT get_i2c_data_pointer(unsigned char i2caddr, unsigned char address)
         }
     }
 
+    i2c_policy_end(i2caddr, temp_get.tx_chk);
+    I2C_STATS_END(i2c_stats_stamp, temp_get.tx_chk ? 2u : 0u);
     return temp_get;
 }
 //-----------------------------------------------------------------------------
 unsigned char send_i2c_data(unsigned char i2caddr, unsigned char registeraddr, unsigned char data)
 {
     unsigned char acked = 0;
-    unsigned char retry = 10;
+    unsigned char retry = i2c_policy_begin(i2caddr);
+    unsigned char start;
 
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return acked;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
     while (retry)
     {
-        if (i2c_start())
+        start = i2c_start();
+        if (start == I2C_START_OK)
         {
             if (i2c_write(i2caddr))
             {
@@ -306,12 +693,14 @@ unsigned char send_i2c_data(unsigned char i2caddr, unsigned char registeraddr, u
 
             i2c_stop();
         }
-        else {reset_i2c();}
+        else if (start == I2C_START_FAIL) {reset_i2c();}   // Stuck, not beaten by another master
 
-        if(!acked) {retry--;}
+        if(!acked) {retry--; I2C_STATS_RETRY(retry); i2c_backoff(retry);}
         else {retry=0;}
     }
 
+    i2c_policy_end(i2caddr, acked);
+    I2C_STATS_END(i2c_stats_stamp, acked ? 3u : 0u);
     return acked;
 }
 //-----------------------------------------------------------------------------
@@ -319,7 +708,8 @@ I2C_RESULT_2BYTE get_i2c_data_2byte(unsigned char i2caddr)
 {
     I2C_RESULT temp_get;
     I2C_RESULT_2BYTE full_get;
-    unsigned char retry = 10;
+    unsigned char retry = i2c_policy_begin(i2caddr);
+    unsigned char start;
 
     temp_get.data = 0;
     temp_get.tx_chk = 0;
@@ -328,9 +718,15 @@ I2C_RESULT_2BYTE get_i2c_data_2byte(unsigned char i2caddr)
     full_get.data1 = 0;
     full_get.tx_chk = 0;
 
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return full_get;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
     while (retry)
     {
-        if (i2c_start()) {
+        start = i2c_start();
+        if (start == I2C_START_OK) {
             if (i2c_write(i2caddr + 1u)) {
                 temp_get = i2c_read(1);
                 if (temp_get.tx_chk) {
@@ -343,17 +739,21 @@ I2C_RESULT_2BYTE get_i2c_data_2byte(unsigned char i2caddr)
                 }
             }
             i2c_stop();
-        } else {
+        } else if (start == I2C_START_FAIL) {
             reset_i2c();
         }
 
         if (!full_get.tx_chk) {
             retry--;
+            I2C_STATS_RETRY(retry);
+            i2c_backoff(retry);
         } else {
             retry = 0;
         }
     }
 
+    i2c_policy_end(i2caddr, full_get.tx_chk);
+    I2C_STATS_END(i2c_stats_stamp, full_get.tx_chk ? 2u : 0u);
     return full_get;
 }
 //-----------------------------------------------------------------------------
@@ -361,7 +761,8 @@ I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char i2caddr, unsigned char
 {
     I2C_RESULT temp_get;
     I2C_RESULT_2BYTE full_get;
-    unsigned char retry = 10;
+    unsigned char retry = i2c_policy_begin(i2caddr);
+    unsigned char start;
 
     temp_get.data = 0;
     temp_get.tx_chk = 0;
@@ -370,9 +771,15 @@ I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char i2caddr, unsigned char
     full_get.data1 = 0;
     full_get.tx_chk = 0;
 
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return full_get;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
     while (retry) 
     {
-        if (i2c_start()) 
+        start = i2c_start();
+        if (start == I2C_START_OK) 
         {
             if (i2c_write(i2caddr)) 
             {
@@ -397,7 +804,7 @@ I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char i2caddr, unsigned char
             }
             i2c_stop();
         } 
-        else 
+        else if (start == I2C_START_FAIL)   // Stuck, not beaten by another master
         {
             reset_i2c();
         }
@@ -405,6 +812,8 @@ I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char i2caddr, unsigned char
         if (!full_get.tx_chk) 
         {
             retry--;
+            I2C_STATS_RETRY(retry);
+            i2c_backoff(retry);
         } 
         else 
         {
@@ -412,6 +821,594 @@ I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char i2caddr, unsigned char
         }
     }
 
+    i2c_policy_end(i2caddr, full_get.tx_chk);
+    I2C_STATS_END(i2c_stats_stamp, full_get.tx_chk ? 3u : 0u);
     return full_get;
 }
+//-----------------------------------------------------------------------------
+// Function name:  i2c_read_burst
+//-----------------------------------------------------------------------------
+//  Reads len bytes starting at register address in one transaction, relying
+//  on the device to auto-increment its register pointer.
+//  Returns 1 if all bytes were read.
+//  Returns 0 if the device never answered within the retries, or len is 0.
+//-----------------------------------------------------------------------------
+unsigned char i2c_read_burst(unsigned char i2caddr, unsigned char address, unsigned char *buf, unsigned int len)
+{
+    I2C_RESULT temp_get;
+    unsigned char retry;
+    unsigned char start;
+    unsigned char done = 0;
+    unsigned int i;
+
+    if (!len)                   // Nothing to read, leave the bus alone
+    {
+        return 0;
+    }
+    retry = i2c_policy_begin(i2caddr);
 
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return done;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
+    while (retry)
+    {
+        start = i2c_start();
+        if (start == I2C_START_OK)
+        {
+            if (i2c_write(i2caddr))
+            {
+                if (i2c_write(address))
+                {
+                    i2c_repStart();
+                    if (i2c_write(i2caddr + 1u))
+                    {
+                        for (i = 0; i < len; i++)
+                        {
+                            temp_get = i2c_read(i < (len - 1u));   // ACK all but the last byte
+                            if (!temp_get.tx_chk)
+                            {
+                                break;
+                            }
+                            buf[i] = temp_get.data;
+                        }
+                        done = (i == len);
+                    }
+                }
+            }
+            i2c_stop();
+        }
+        else if (start == I2C_START_FAIL)   // Stuck, not beaten by another master
+        {
+            reset_i2c();
+        }
+
+        if (!done)
+        {
+            retry--;
+            I2C_STATS_RETRY(retry);
+            i2c_backoff(retry);
+        }
+        else
+        {
+            retry = 0;
+        }
+    }
+
+    i2c_policy_end(i2caddr, done);
+    I2C_STATS_END(i2c_stats_stamp, done ? len + 1u : 0u);
+    return done;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_write_burst
+//-----------------------------------------------------------------------------
+//  Writes len bytes starting at register address in one transaction.
+//  Returns 1 if every byte was acknowledged.
+//  Returns 0 if the device never took the whole block within the retries,
+//  or len is 0.
+//-----------------------------------------------------------------------------
+unsigned char i2c_write_burst(unsigned char i2caddr, unsigned char address, unsigned char *buf, unsigned int len)
+{
+    unsigned char acked = 0;
+    unsigned char retry;
+    unsigned char start;
+    unsigned int i;
+
+    if (!len)                   // Nothing to write, leave the bus alone
+    {
+        return 0;
+    }
+    retry = i2c_policy_begin(i2caddr);
+
+    if (!retry)                 // Breaker open, fail without touching the bus or the counters
+    {
+        return acked;
+    }
+    I2C_STATS_START(i2c_stats_stamp);
+    while (retry)
+    {
+        start = i2c_start();
+        if (start == I2C_START_OK)
+        {
+            if (i2c_write(i2caddr))
+            {
+                if (i2c_write(address))
+                {
+                    for (i = 0; i < len; i++)
+                    {
+                        if (!i2c_write(buf[i]))
+                        {
+                            break;
+                        }
+                    }
+                    acked = (i == len);
+                }
+            }
+
+            i2c_stop();
+        }
+        else if (start == I2C_START_FAIL) {reset_i2c();}   // Stuck, not beaten by another master
+
+        if(!acked) {retry--; I2C_STATS_RETRY(retry); i2c_backoff(retry);}
+        else {retry=0;}
+    }
+
+    i2c_policy_end(i2caddr, acked);
+    I2C_STATS_END(i2c_stats_stamp, acked ? len + 1u : 0u);
+    return acked;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_scan_wait
+//-----------------------------------------------------------------------------
+//  Short idle wait for the scan, no reset_i2c.
+//  Returns 1 when the MSSP is idle, 0 on timeout.
+//-----------------------------------------------------------------------------
+static unsigned char i2c_scan_wait(void)
+{
+    unsigned int wait = I2C_SCAN_WAIT;
+
+    while((SSPCON2 & 0x1F) || RW)
+    {
+        if(!--wait)
+          {return 0;}
+        CLRWDT();
+    }
+    return 1;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_scan
+//-----------------------------------------------------------------------------
+//  Probes each address with START, write address, STOP.  No data, no
+//  retries and no circuit breaker, so an absent device costs one address
+//  time.  Bit (addr >> 1) & 7 of map[addr >> 4] is set for each 8 bit write
+//  address that ACKed, map must hold 16 bytes.
+//  addrs lists 8 bit write addresses, 0 scans 0x10 to 0xEE.
+//  Returns 1 if the scan ran to the end.
+//  Returns 0 if the bus was busy or stuck, map holds what was found so far.
+//-----------------------------------------------------------------------------
+unsigned char i2c_scan(const unsigned char *addrs, unsigned char count, unsigned char *map)
+{
+    unsigned char addr;
+    unsigned char i;
+
+    for(i = 0; i < 16; i++)
+      {map[i] = 0;}
+    if(!addrs)
+      {count = 0x78 - 0x08;}
+
+    if(i2c_busy() || !i2c_waitForIdle() || !i2c_arb_wait())   // Another master's transfer is not ours to reset
+      {return 0;}
+
+    for(i = 0; i < count; i++)
+    {
+        addr = addrs ? (addrs[i] & 0xFE) : (unsigned char)((0x08 + i) << 1);
+
+        BCLIF = 0;
+        SEN = 1;
+        I2C_TRACE_EVENT(I2C_TRACE_START, 0);
+        if(!i2c_scan_wait() || BCLIF)
+          {break;}
+
+        I2C_TRACE_EVENT(I2C_TRACE_TX, addr);
+        SSPBUF = addr;
+        if(!i2c_scan_wait() || BCLIF)
+          {break;}
+        if(!ACKSTAT)
+          {map[addr >> 4] |= (unsigned char)(1 << ((addr >> 1) & 7));}
+        I2C_TRACE_EVENT(ACKSTAT ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+
+        PEN = 1;
+        I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
+        if(!i2c_scan_wait() || BCLIF)
+          {break;}
+    }
+
+    if(i == count)
+      {return 1;}
+
+    I2C_TRACE_EVENT(BCLIF ? I2C_TRACE_ARBLOST : I2C_TRACE_TIMEOUT, 0);
+
+    if(!BCLIF)                      // Stuck rather than beaten by another master
+      {reset_i2c();}
+    BCLIF = 0;
+    return 0;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_sm_finish
+//-----------------------------------------------------------------------------
+//  Releases the state machine and reports the transaction result.
+//-----------------------------------------------------------------------------
+static void i2c_sm_finish(unsigned char result)
+{
+    I2C_TRANSACTION *xfer = i2c_sm_xfer;
+
+    SSPIE = 0;
+    BCLIE = 0;
+    i2c_sm_state = I2C_SM_IDLE;
+    i2c_sm_xfer = 0;
+    xfer->status = result;
+    I2C_STATS_END(i2c_sm_stamp, (result == I2C_STATUS_OK) ? (unsigned int)xfer->wlen + xfer->rlen : 0u);
+#ifdef I2C_RING
+    if (i2c_sm_ring)
+    {
+        i2c_completion_t record;
+
+        record.tag = xfer;
+        record.stamp = I2C_RING_NOW();
+        record.bytes = (result == I2C_STATUS_OK) ? (unsigned int)xfer->wlen + xfer->rlen : 0u;
+        record.status = result;
+        i2c_ring_push(i2c_sm_ring, &record);
+    }
+#endif
+
+    if (xfer->callback)             // State machine is free, callback may chain
+    {
+        xfer->callback(xfer);
+    }
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_sm_begin
+//-----------------------------------------------------------------------------
+//  Loads the state machine and issues SEN.  irq turns on SSPIE/BCLIE so
+//  i2c_isr runs from the interrupt, otherwise i2c_poll has to step it.
+//  Returns I2C_STATUS_PENDING if started.
+//  Returns I2C_STATUS_BUSY if a transaction is active or the bus is not idle.
+//-----------------------------------------------------------------------------
+static unsigned char i2c_sm_begin(I2C_TRANSACTION *xfer, unsigned char irq)
+{
+    if (i2c_sm_state != I2C_SM_IDLE || (((SSPCON2 & 0x1F)<<1) + RW))
+    {
+        return I2C_STATUS_BUSY;
+    }
+
+    xfer->status = I2C_STATUS_PENDING;
+    i2c_sm_xfer = xfer;
+    i2c_sm_index = 0;
+    i2c_sm_result = I2C_STATUS_OK;
+    i2c_sm_state = I2C_SM_START;
+    i2c_poll_stall = 0;
+    i2c_sm_arb = I2C_ARB_RETRIES;
+    I2C_STATS_START(i2c_sm_stamp);
+
+    SSPIF = 0;
+    BCLIF = 0;
+    SSPIE = irq;
+    BCLIE = irq;
+    SEN = 1;                        // Initiate START conditon.
+    I2C_TRACE_EVENT(I2C_TRACE_START, 0);
+
+    return I2C_STATUS_PENDING;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_submit
+//-----------------------------------------------------------------------------
+//  Starts an interrupt driven transaction and returns immediately.  Writes
+//  wlen bytes, then if rlen is set issues a repeated start and reads rlen
+//  bytes.  Every step after SEN is advanced from i2c_isr on SSPIF.
+//  Returns I2C_STATUS_PENDING if started.
+//  Returns I2C_STATUS_BUSY if a transaction is active or the bus is not idle.
+//-----------------------------------------------------------------------------
+unsigned char i2c_submit(I2C_TRANSACTION *xfer)
+{
+    return i2c_sm_begin(xfer, 1);
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_submit_poll
+//-----------------------------------------------------------------------------
+//  Same transaction as i2c_submit with the MSSP interrupts left off, for
+//  builds where the interrupt belongs to other code.  Step it with i2c_poll.
+//-----------------------------------------------------------------------------
+unsigned char i2c_submit_poll(I2C_TRANSACTION *xfer)
+{
+    return i2c_sm_begin(xfer, 0);
+}
+#ifdef I2C_RING
+//-----------------------------------------------------------------------------
+// Function name:  i2c_set_ring
+//-----------------------------------------------------------------------------
+//  Sets the ring i2c_isr pushes completion records into, 0 turns it off.
+//  The application drains it with i2c_ring_drain, no interrupt masking.
+//-----------------------------------------------------------------------------
+void i2c_set_ring(i2c_ring_t *ring)
+{
+    i2c_sm_ring = ring;
+}
+#endif
+//-----------------------------------------------------------------------------
+// Function name:  i2c_busy
+//-----------------------------------------------------------------------------
+//  Returns 1 while a submitted transaction is on the bus.
+//-----------------------------------------------------------------------------
+unsigned char i2c_busy(void)
+{
+    return (i2c_sm_state != I2C_SM_IDLE);
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_poll
+//-----------------------------------------------------------------------------
+//  Call from the main loop after i2c_submit_poll.  If the MSSP finished its
+//  last operation, runs one step of the i2c_isr state machine, otherwise
+//  returns at once.  Never waits on the bus.  After I2C_POLL_STALL calls in
+//  a row with nothing finished the bus is reset and the transaction fails.
+//  A lost arbitration is waited out and re-issued, I2C_ARB_RETRIES times.
+//  Returns xfer->status, I2C_STATUS_PENDING until the STOP completes.
+//-----------------------------------------------------------------------------
+unsigned char i2c_poll(I2C_TRANSACTION *xfer)
+{
+    if (i2c_sm_xfer != xfer)        // Finished, or never started
+    {
+        return xfer->status;
+    }
+
+    if (i2c_sm_state == I2C_SM_ARB) // Lost arbitration, nothing to reset
+    {
+        if (!START)                 // Winner's STOP seen, go again from the top
+        {
+            I2C_STATS_ARB(i2c_arb_stamp);
+            i2c_poll_stall = 0;
+            i2c_sm_index = 0;
+            i2c_sm_result = I2C_STATUS_OK;
+            i2c_sm_state = I2C_SM_START;
+            SSPIF = 0;
+            SEN = 1;
+            I2C_TRACE_EVENT(I2C_TRACE_START, 0);
+        }
+        else if (++i2c_poll_stall >= I2C_POLL_STALL)
+        {
+            i2c_sm_finish(I2C_STATUS_ARBLOST);
+        }
+        return xfer->status;
+    }
+
+    if (SSPIF || BCLIF)
+    {
+        i2c_poll_stall = 0;
+        i2c_isr();
+    }
+    else if (++i2c_poll_stall >= I2C_POLL_STALL)
+    {
+        I2C_STATS_COUNT(timeouts);
+        I2C_TRACE_EVENT(I2C_TRACE_TIMEOUT, 0);
+        reset_i2c();
+        i2c_sm_finish(I2C_STATUS_BUSERR);
+    }
+
+    return xfer->status;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_isr
+//-----------------------------------------------------------------------------
+//  Call from the interrupt routine when SSPIF or BCLIF is set.  Each SSPIF
+//  means the last MSSP operation finished, so the next one is started right
+//  away with no fixed delays.
+//-----------------------------------------------------------------------------
+void i2c_isr(void)
+{
+    I2C_TRANSACTION *xfer = i2c_sm_xfer;
+
+    if (BCLIF)                      // Lost the bus, MSSP is already idle
+    {
+        BCLIF = 0;
+        SSPIF = 0;
+        if (xfer)
+        {
+            I2C_STATS_COUNT(arblost);
+            I2C_TRACE_EVENT(I2C_TRACE_ARBLOST, 0);
+            if (!SSPIE && i2c_sm_arb)  // Polled, i2c_poll re-issues once the bus is free
+            {
+                i2c_sm_arb--;
+                i2c_sm_state = I2C_SM_ARB;
+                I2C_STATS_START(i2c_arb_stamp);
+                return;
+            }
+            i2c_sm_finish(I2C_STATUS_ARBLOST);
+        }
+        return;
+    }
+
+    if (!SSPIF)
+    {
+        return;
+    }
+    SSPIF = 0;
+
+    if (!xfer)
+    {
+        return;
+    }
+
+    switch (i2c_sm_state)
+    {
+        case I2C_SM_START:
+            if (xfer->wlen || !xfer->rlen)
+            {
+                I2C_TRACE_EVENT(I2C_TRACE_TX, xfer->i2caddr);
+                SSPBUF = xfer->i2caddr;
+                i2c_sm_state = I2C_SM_ADDR_W;
+            }
+            else
+            {
+                I2C_TRACE_EVENT(I2C_TRACE_TX, xfer->i2caddr + 1u);
+                SSPBUF = xfer->i2caddr + 1u;
+                i2c_sm_state = I2C_SM_ADDR_R;
+            }
+            break;
+
+        case I2C_SM_ADDR_W:
+        case I2C_SM_WRITE:
+            I2C_TRACE_EVENT(ACKSTAT ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+            if (ACKSTAT)            // No Ack.  Stop and fail out
+            {
+                i2c_sm_result = I2C_STATUS_NACK;
+                I2C_STATS_COUNT(nacks);
+                PEN = 1;
+                I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
+                i2c_sm_state = I2C_SM_STOP;
+            }
+            else if (i2c_sm_index < xfer->wlen)
+            {
+                I2C_TRACE_EVENT(I2C_TRACE_TX, xfer->wdata[i2c_sm_index]);
+                SSPBUF = xfer->wdata[i2c_sm_index++];
+                i2c_sm_state = I2C_SM_WRITE;
+            }
+            else if (xfer->rlen)
+            {
+                RSEN = 1;
+                I2C_TRACE_EVENT(I2C_TRACE_RESTART, 0);
+                i2c_sm_state = I2C_SM_RESTART;
+            }
+            else
+            {
+                PEN = 1;
+                I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
+                i2c_sm_state = I2C_SM_STOP;
+            }
+            break;
+
+        case I2C_SM_RESTART:
+            I2C_TRACE_EVENT(I2C_TRACE_TX, xfer->i2caddr + 1u);
+            SSPBUF = xfer->i2caddr + 1u;
+            i2c_sm_state = I2C_SM_ADDR_R;
+            break;
+
+        case I2C_SM_ADDR_R:
+            I2C_TRACE_EVENT(ACKSTAT ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+            if (ACKSTAT)
+            {
+                i2c_sm_result = I2C_STATUS_NACK;
+                I2C_STATS_COUNT(nacks);
+                PEN = 1;
+                I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
+                i2c_sm_state = I2C_SM_STOP;
+            }
+            else
+            {
+                i2c_sm_index = 0;
+                RCEN = 1;
+                i2c_sm_state = I2C_SM_RECEIVE;
+            }
+            break;
+
+        case I2C_SM_RECEIVE:
+            xfer->rdata[i2c_sm_index++] = SSPBUF;
+            ACKDT = (i2c_sm_index == xfer->rlen);   // NACK the last byte
+            ACKEN = 1;
+            I2C_TRACE_EVENT(I2C_TRACE_RX, xfer->rdata[i2c_sm_index - 1u]);
+            I2C_TRACE_EVENT(ACKDT ? I2C_TRACE_NACK : I2C_TRACE_ACK, 0);
+            i2c_sm_state = I2C_SM_ACK;
+            break;
+
+        case I2C_SM_ACK:
+            if (i2c_sm_index < xfer->rlen)
+            {
+                RCEN = 1;
+                i2c_sm_state = I2C_SM_RECEIVE;
+            }
+            else
+            {
+                PEN = 1;
+                I2C_TRACE_EVENT(I2C_TRACE_STOP, 0);
+                i2c_sm_state = I2C_SM_STOP;
+            }
+            break;
+
+        case I2C_SM_STOP:
+            i2c_sm_finish(i2c_sm_result);
+            break;
+
+        default:
+            break;
+    }
+}
+#ifdef I2C_STATS
+//-----------------------------------------------------------------------------
+// Function name:  i2c_stats_record
+//-----------------------------------------------------------------------------
+//  Counts a finished transaction and files its latency in the log2 histogram.
+//  bytes is 0 for transactions that failed.
+//-----------------------------------------------------------------------------
+static void i2c_stats_record(unsigned int stamp, unsigned int bytes)
+{
+    unsigned int ticks = (unsigned int)(I2C_STATS_NOW() - stamp);
+    unsigned char bin = 0;
+
+    i2c_stats_data.transactions++;
+    i2c_stats_data.bytes += bytes;
+
+    while ((ticks >>= 1) && (bin < (I2C_STATS_BINS - 1)))   // Last bin takes everything longer
+    {
+        bin++;
+    }
+    i2c_stats_data.latency[bin]++;
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_stats_arb
+//-----------------------------------------------------------------------------
+//  Counts a re-issue after lost arbitration and files how long the bus took
+//  to come free, from the loss in stamp to now.
+//-----------------------------------------------------------------------------
+static void i2c_stats_arb(unsigned int stamp)
+{
+    unsigned int ticks = (unsigned int)(I2C_STATS_NOW() - stamp);
+
+    i2c_stats_data.arb_retries++;
+    i2c_stats_data.arb_wait_total += ticks;
+    if (ticks > i2c_stats_data.arb_wait_max)
+    {
+        i2c_stats_data.arb_wait_max = ticks;
+    }
+}
+//-----------------------------------------------------------------------------
+// Function name:  i2c_stats
+//-----------------------------------------------------------------------------
+//  Copies the counters with interrupts held off so i2c_isr can not update
+//  them halfway through.  Zeroes them afterwards if clear is set.
+//-----------------------------------------------------------------------------
+void i2c_stats(I2C_STATS_DATA *stats, unsigned char clear)
+{
+    unsigned char gie = GIE;
+    unsigned char i;
+
+    GIE = 0;
+    *stats = i2c_stats_data;
+    if (clear)
+    {
+        i2c_stats_data.transactions = 0;
+        i2c_stats_data.bytes = 0;
+        i2c_stats_data.nacks = 0;
+        i2c_stats_data.arblost = 0;
+        i2c_stats_data.timeouts = 0;
+        i2c_stats_data.retries = 0;
+        i2c_stats_data.resets = 0;
+        i2c_stats_data.arb_retries = 0;
+        i2c_stats_data.arb_wait_max = 0;
+        i2c_stats_data.arb_wait_total = 0;
+        for (i = 0; i < I2C_STATS_BINS; i++)
+        {
+            i2c_stats_data.latency[i] = 0;
+        }
+    }
+    GIE = gie;
+}
+#endif
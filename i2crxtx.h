@@ -7,6 +7,12 @@
 //   i2c_write - write unsigned char - returns ACK
 //  
 //-----------------------------------------------------------------------------
+#ifndef I2CRXTX_H
+#define I2CRXTX_H
+
+#ifdef I2C_RING
+#include "i2c_ring.h"
+#endif
 
 //----------------------------------------------------------------------------//
 // Type Definitions
@@ -23,17 +29,96 @@ typedef struct
     unsigned char data0;
     unsigned char data1;
   }I2C_RESULT_2BYTE;
+
+  // Interrupt driven transaction, see i2c_submit
+  typedef struct I2C_TRANSACTION
+  {
+    unsigned char i2caddr;          // 8 bit write address, read uses i2caddr + 1
+    unsigned char *wdata;           // Bytes to write
+    unsigned int wlen;
+    unsigned char *rdata;           // Bytes read after the repeated start
+    unsigned int rlen;
+    volatile unsigned char status;  // I2C_STATUS_*
+    void (*callback)(struct I2C_TRANSACTION *);   // Runs in interrupt context, or in i2c_poll, may be 0
+  }I2C_TRANSACTION;
+
+  // Circuit breaker state of a failing device, see i2c_health
+  typedef struct
+  {
+    unsigned char i2caddr;          // 8 bit write address
+    unsigned char fails;            // Failed transactions in a row, 0 = slot free
+    unsigned char skip;             // Calls left to short circuit before the next probe
+  }I2C_HEALTH;
+
+#ifdef I2C_STATS
+#ifndef I2C_STATS_BINS
+#define I2C_STATS_BINS  16              // Enough for the 16 bit Timer1
+#endif
+  // Bus counters, see i2c_stats.  Latency bin n holds transactions that took
+  // 2^n to 2^(n+1)-1 Timer1 ticks.  Counters wrap.
+  typedef struct
+  {
+    unsigned long transactions;     // Transactions finished, any result
+    unsigned long bytes;            // Payload bytes of transactions that finished OK
+    unsigned int nacks;
+    unsigned int arblost;
+    unsigned int timeouts;          // i2c_waitForIdle gave up
+    unsigned int retries;           // Extra attempts taken by the retry loops
+    unsigned int resets;            // reset_i2c runs
+    unsigned int arb_retries;       // Lost arbitrations waited out and re-issued, arblost counts every loss
+    unsigned int arb_wait_max;      // Longest wait for the winner's STOP
+    unsigned long arb_wait_total;   // Sum of those waits
+    unsigned int latency[I2C_STATS_BINS];
+  }I2C_STATS_DATA;
+#endif
+
+//----------------------------------------------------------------------------//
+// Transaction Status, same values as MSF_I2C.h so shared code and ring
+// records decode alike on every target
+//----------------------------------------------------------------------------//
+#define I2C_STATUS_OK       0
+#define I2C_STATUS_PENDING  1
+#define I2C_STATUS_BUSY     2
+#define I2C_STATUS_NACK     3
+#define I2C_STATUS_BUSERR   4
+#define I2C_STATUS_ARBLOST  5
+#define I2C_STATUS_TIMEOUT  6
+#define I2C_STATUS_INVALID  7           // Request does not fit the driver, nothing was sent
+#define I2C_STATUS_PEC      8           // SMBus PEC or block count check failed, see i2c_smbus.c
   
+//----------------------------------------------------------------------------//
+// i2c_start results.  Compare against I2C_START_OK, only I2C_START_FAIL
+// means the MSSP is stuck and reset_i2c may free it.
+//----------------------------------------------------------------------------//
+#define I2C_START_FAIL      0           // MSSP never went idle
+#define I2C_START_OK        1           // START initiated
+#define I2C_START_BUSY      2           // Another master still holds the bus, leave it alone
+
+//----------------------------------------------------------------------------//
+// Bus Speed, clock = FOSC/(4 * (SSPxADD + 1) + FOSC * Trise)
+// The baud generator restarts once SCL is seen high, so the rise time adds
+// to every period.  Rounds up, SCL lands at or below scl.
+//----------------------------------------------------------------------------//
+#define I2C_TRISE_CLOCKS(fosc, trise_ns)      (((fosc) * 1ULL * (trise_ns)) / 1000000000ULL)
+#define I2C_SSPADD_VALUE(fosc, scl, trise_ns) ((((fosc) + (scl) - 1) / (scl) - I2C_TRISE_CLOCKS(fosc, trise_ns) + 3) / 4 - 1)
+#define I2C_SSPADD_CLOCKS(fosc, sspadd, trise_ns) ((4 * ((sspadd) + 1)) + I2C_TRISE_CLOCKS(fosc, trise_ns))
+
 //----------------------------------------------------------------------------//
 // Function Prototypes
 //----------------------------------------------------------------------------//
 void i2c_init(void);
+unsigned char i2c_set_speed(unsigned char);
 I2C_RESULT get_i2c_data(unsigned char);
 I2C_RESULT get_i2c_data_pointer(unsigned char, unsigned char);
 I2C_RESULT_2BYTE get_i2c_data_2byte(unsigned char);
 I2C_RESULT_2BYTE get_i2c_data_2byte_pointer(unsigned char, unsigned char);
 unsigned char send_i2c_data(unsigned char, unsigned char, unsigned char);
+unsigned char i2c_read_burst(unsigned char, unsigned char, unsigned char *, unsigned int);
+unsigned char i2c_write_burst(unsigned char, unsigned char, unsigned char *, unsigned int);
 unsigned char i2c_trans_ret(unsigned char,unsigned char);
+I2C_HEALTH *i2c_health(unsigned char);
+void i2c_health_clear(unsigned char);
+unsigned char i2c_scan(const unsigned char *, unsigned char, unsigned char *);
 unsigned char i2c_trans_pos(unsigned char,unsigned char);
 //void i2c_transmit(unsigned char,unsigned char);
 //void i2c_transmit2(unsigned char,unsigned char,unsigned char);
@@ -43,13 +128,32 @@ unsigned char i2c_trans_pos(unsigned char,unsigned char);
 
 //Function prototypes needed to be exposed for using external device libraries
 unsigned char i2c_start(void);
+unsigned char i2c_repStart(void);
 void i2c_stop(void);
 unsigned char i2c_write(unsigned char);
 I2C_RESULT i2c_read(unsigned char);
 unsigned char i2c_waitForIdle(void);
 void reset_i2c(void);
 
+//Interrupt driven master, call i2c_isr from the interrupt routine on SSPIF/BCLIF
+unsigned char i2c_submit(I2C_TRANSACTION *);
+unsigned char i2c_busy(void);
+void i2c_isr(void);
+
+//Polled master for when the MSSP interrupt is not ours, call i2c_poll from the main loop
+unsigned char i2c_submit_poll(I2C_TRANSACTION *);
+unsigned char i2c_poll(I2C_TRANSACTION *);    //One step if the MSSP is ready, returns xfer->status
+#ifdef I2C_RING
+void i2c_set_ring(i2c_ring_t *);    //i2c_isr pushes a record per finished transaction, 0 to stop
+#endif
+
+#ifdef I2C_STATS
+//Performance counters, Timer1 must be free running for the latency histogram
+void i2c_stats(I2C_STATS_DATA *, unsigned char);
+#endif
+
 //----------------------------------------------------------------------------//
 // Variables
 //----------------------------------------------------------------------------//
 
+#endif /* I2CRXTX_H */
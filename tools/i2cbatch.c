@@ -0,0 +1,111 @@
+/**
+* @file i2cbatch.c
+* @brief MSF I2C Library, i2c_batch test on the register simulator.
+* @note Builds i2c_batch.c over i2c_samd.c against tools/sim/samd at 400KHz,
+* with a 256 register device at 0x50. Checks that a commit merges runs of
+* consecutive registers, that a second write to a register is sent as well
+* and last, that a run queued in order ends at 0xFF instead of wrapping to
+* 0x00, and that a full batch whose commit fails keeps its writes and does
+* not queue the new one. Prints the transactions and bus time of the
+* batch against one transaction per write. Exits non zero on the first
+* wrong result.
+*
+* Build: make -C tools i2cbatch
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim/sim.h"
+#include "../MSF_I2C.h"
+#include "../i2c_batch.h"
+
+#define DEV_ADDR	0x50
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+static i2c_batch_entry_t entries[8];
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	i2c_batch_t batch = I2C_BATCH_INIT(&i2c_bus0, DEV_ADDR, 0, entries);
+	static const uint8_t order[8] = { 0x13, 0x10, 0x12, 0x11, 0x10, 0x30, 0x31, 0x14 };
+	uint64_t start, batch_ns;
+	uint32_t starts, writes, batch_starts;
+
+	sim_init();
+	sim_attach(0, &dev.dev);
+	init_i2c(&i2c_bus0);
+
+	// Out of order, 0x10 twice: 0x10 alone, then 0x10 to 0x14, then 0x30 to 0x31
+	start = sim_now();
+	starts = sim_bus[0].starts;
+	writes = dev.writes;
+	i2c_batch_begin(&batch);
+	for (uint8_t i = 0; i < sizeof(order); i++)
+	{
+		check(i2c_batch_write(&batch, order[i], (uint8_t)(0x40 + i)) == I2C_STATUS_OK, "queue failed");
+	}
+	check(i2c_batch_commit(&batch) == I2C_STATUS_OK, "commit failed");
+	batch_ns = sim_now() - start;
+	batch_starts = sim_bus[0].starts - starts;
+	check(batch.count == 0, "batch not empty after commit");
+	check(batch_starts == 3, "expected three bursts");
+	check(dev.writes - writes == sizeof(order), "a queued write was dropped");
+	check((regs[0x10] == 0x44) && (regs[0x11] == 0x43) && (regs[0x12] == 0x42) && (regs[0x13] == 0x40) &&
+		(regs[0x14] == 0x47) && (regs[0x30] == 0x45) && (regs[0x31] == 0x46), "batch stored wrong data");
+
+	// The same writes one transaction each
+	start = sim_now();
+	for (uint8_t i = 0; i < sizeof(order); i++)
+	{
+		uint8_t out[2] = { order[i], (uint8_t)(0x40 + i) };
+
+		check(i2c_send(&i2c_bus0, DEV_ADDR, out, 2) == I2C_STATUS_OK, "single write failed");
+	}
+	printf("%s: %u writes, batch %u transactions %.1f uS, one per write %.1f uS\n", SIM_NAME, (unsigned)sizeof(order),
+		(unsigned)batch_starts, batch_ns / 1000.0, (sim_now() - start) / 1000.0);
+
+	// In queue order 0xFF then 0x00 are two transactions, not one wrapping burst
+	batch.flags = I2C_BATCH_KEEP_ORDER;
+	starts = sim_bus[0].starts;
+	check((i2c_batch_write(&batch, 0xFE, 1) == I2C_STATUS_OK) && (i2c_batch_write(&batch, 0xFF, 2) == I2C_STATUS_OK) &&
+		(i2c_batch_write(&batch, 0x00, 3) == I2C_STATUS_OK), "queue failed");
+	check(i2c_batch_commit(&batch) == I2C_STATUS_OK, "commit across 0xFF failed");
+	check(sim_bus[0].starts - starts == 2, "run wrapped from 0xFF to 0x00");
+	check((regs[0xFE] == 1) && (regs[0xFF] == 2) && (regs[0x00] == 3), "commit across 0xFF stored wrong data");
+
+	// Full batch to nobody, the ninth write commits, fails and is not queued
+	batch.flags = 0;
+	batch.addr = DEV_ADDR + 1;
+	for (uint8_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++)
+	{
+		check(i2c_batch_write(&batch, (uint8_t)(0x80 + i), (uint8_t)(0x90 + i)) == I2C_STATUS_OK, "queue failed");
+	}
+	check(i2c_batch_write(&batch, 0xA0, 0xAA) == I2C_STATUS_NACK, "failed auto commit not reported");
+	check(batch.count == 8, "failed auto commit lost writes or queued the new one");
+	batch.addr = DEV_ADDR;
+	writes = dev.writes;
+	check(i2c_batch_commit(&batch) == I2C_STATUS_OK, "retried commit failed");
+	check(dev.writes - writes == 8, "retried commit did not send every kept write");
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		check(regs[0x80 + i] == 0x90 + i, "retried commit stored wrong data");
+	}
+	check(regs[0xA0] != 0xAA, "write refused by the failed commit was sent");
+
+	printf("%s: ok\n", SIM_NAME);
+
+	return 0;
+}
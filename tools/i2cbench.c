@@ -0,0 +1,355 @@
+/**
+* @file i2cbench.c
+* @brief MSF I2C Library, syscall and throughput check for the Linux backend.
+* @note Runs the same register read three ways and prints syscalls per
+* transaction and transactions per second for each:
+*   write+read  plain i2c-dev, I2C_SLAVE once then write() and read()
+*   write_read  i2c_write_read, one ioctl(I2C_RDWR) per transaction
+*   batch       I2C_LINUX_BATCH i2c_submit calls sent by one i2c_isr
+* By default it talks to a fake adapter in this process: a 256 register
+* device that checks every message and exits non zero on wrong data, so it
+* runs in CI without hardware. Each fake call also makes one real getppid()
+* syscall, so its rates are software and kernel entry overhead without the
+* bus time. The fake run then checks that a failed batch fails every
+* transaction in it and sends no read or write a second time. With -d it
+* uses /dev/i2c-N, where the bus clock sets the rate.
+* i2c-stub only offers SMBus calls, so it can't take I2C_RDWR.
+*
+* Build: cc -O2 -DI2C_LINUX -o i2cbench tools/i2cbench.c
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define FAKE_FD		1000	// Never a real descriptor in this process
+#define FAKE_REGS	256
+
+static int bench_open(const char *path);
+static int bench_ioctl(int fd, unsigned long req, void *arg);
+
+#define I2C_LINUX_OPEN(path)			bench_open(path)
+#define I2C_LINUX_IOCTL(fd, req, arg)	bench_ioctl((fd), (req), (void *)(arg))
+#include "../i2c_linux.c"
+
+static int real;				// Non zero with -d, hooks pass through
+static uint8_t dev_addr = 0x50;
+static uint8_t fake_regs[FAKE_REGS];
+static uint8_t fake_ptr;
+static uint8_t fake_slave;		// Address set by I2C_SLAVE
+static uint32_t fake_writes;	// Writes carrying data past the register pointer
+static uint32_t fake_reads;		// Read messages
+static uint32_t syscalls;		// write+read mode, the backend counts its own
+
+// Stand in for the cost of entering the kernel
+static void fake_enter(void)
+{
+	syscall(SYS_getppid);
+}
+
+static int bench_open(const char *path)
+{
+	return real ? open(path, O_RDWR) : FAKE_FD;
+}
+
+/**
+	@brief Fake Message
+	@details A register device: a write sets the pointer from its first
+	byte and stores the rest, a read returns from the pointer, both auto
+	increment. Other addresses don't ACK.
+*/
+static int fake_msg(uint16_t addr, uint16_t flags, uint16_t len, uint8_t *buf)
+{
+	if (addr != dev_addr)
+	{
+		errno = ENXIO;
+		return -1;
+	}
+
+	if (flags & I2C_M_RD)
+	{
+		fake_reads++;
+		for (uint16_t i = 0; i < len; i++)
+		{
+			buf[i] = fake_regs[fake_ptr++];
+		}
+	}
+	else if (len)
+	{
+		fake_writes += (len > 1);
+		fake_ptr = buf[0];
+		for (uint16_t i = 1; i < len; i++)
+		{
+			fake_regs[fake_ptr++] = buf[i];
+		}
+	}
+
+	return 0;
+}
+
+static int bench_ioctl(int fd, unsigned long req, void *arg)
+{
+	if (real)
+	{
+		return ioctl(fd, req, arg);
+	}
+
+	fake_enter();
+	switch (req)
+	{
+		case I2C_FUNCS:
+			*(unsigned long *)arg = I2C_FUNC_I2C;
+			return 0;
+		case I2C_SLAVE:
+			fake_slave = (uint8_t)(uintptr_t)arg;
+			return 0;
+		case I2C_RDWR:
+		{
+			struct i2c_rdwr_ioctl_data *rdwr = arg;
+
+			if (rdwr->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+			{
+				errno = EINVAL;
+				return -1;
+			}
+			for (uint32_t i = 0; i < rdwr->nmsgs; i++)
+			{
+				struct i2c_msg *msg = &rdwr->msgs[i];
+
+				if (fake_msg(msg->addr, msg->flags, msg->len, msg->buf) < 0)
+				{
+					return -1;
+				}
+			}
+			return (int)rdwr->nmsgs;
+		}
+		default:
+			errno = ENOTTY;
+			return -1;
+	}
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void bench_check(const char *mode, uint8_t reg, const uint8_t *data, uint8_t len)
+{
+	if (real)
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < len; i++)
+	{
+		if (data[i] != fake_regs[(uint8_t)(reg + i)])
+		{
+			fprintf(stderr, "%s: register 0x%02X read 0x%02X, expected 0x%02X\n", mode, (uint8_t)(reg + i), data[i], fake_regs[(uint8_t)(reg + i)]);
+			exit(1);
+		}
+	}
+}
+
+static void bench_report(const char *mode, uint32_t count, uint32_t calls, double secs)
+{
+	printf("%-12s %10u %10u %8.3f %12.0f\n", mode, count, calls, (double)calls / count, count / secs);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: i2cbench [-n count] [-d adapter] [-a addr] [-r reg] [-l len]\n"
+		"  -n  transactions per mode, default 100000\n"
+		"  -d  use /dev/i2c-N instead of the fake adapter\n"
+		"  -a  7 bit device address, default 0x50\n"
+		"  -r  register to read, default 0\n"
+		"  -l  bytes per read, 1 to 32, default 2\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t count = 100000;
+	unsigned adapter = 0;
+	uint8_t reg = 0, len = 2;
+	uint8_t data[I2C_LINUX_BATCH][32];
+	i2c_transaction_t xfer[I2C_LINUX_BATCH];
+	uint8_t wreg[2];
+	uint32_t done, calls;
+	double start;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:a:r:l:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': count = (uint32_t)strtoul(optarg, 0, 0); break;
+			case 'd': adapter = (unsigned)strtoul(optarg, 0, 0); real = 1; break;
+			case 'a': dev_addr = (uint8_t)strtoul(optarg, 0, 0); break;
+			case 'r': reg = (uint8_t)strtoul(optarg, 0, 0); break;
+			case 'l': len = (uint8_t)strtoul(optarg, 0, 0); break;
+			default: usage();
+		}
+	}
+	if (!count || !len || (len > 32) || (dev_addr > 0x7F))
+	{
+		usage();
+	}
+
+	for (uint32_t i = 0; i < FAKE_REGS; i++)
+	{
+		fake_regs[i] = (uint8_t)(i ^ 0x5A);
+	}
+
+	i2c_bus_t bus = I2C_BUS_INIT((uint8_t)adapter);
+	init_i2c(&bus);
+	if (bus.fd < 0)
+	{
+		fprintf(stderr, "/dev/i2c-%u: %s\n", adapter, strerror(errno));
+		return 1;
+	}
+	if (!(bus.funcs & I2C_FUNC_I2C))
+	{
+		fprintf(stderr, "/dev/i2c-%u: adapter has no plain I2C transfers\n", adapter);
+		return 1;
+	}
+
+	printf("%-12s %10s %10s %8s %12s\n", "mode", "xfers", "syscalls", "per xfer", "xfers/s");
+
+	// Plain i2c-dev, what an application without the backend does
+	syscalls = 1;
+	if (bench_ioctl(bus.fd, I2C_SLAVE, (void *)(uintptr_t)dev_addr) < 0)
+	{
+		fprintf(stderr, "I2C_SLAVE: %s\n", strerror(errno));
+		return 1;
+	}
+	start = bench_now();
+	for (done = 0; done < count; done++)
+	{
+		if (real)
+		{
+			syscalls += 2;
+			if ((write(bus.fd, &reg, 1) != 1) || (read(bus.fd, data[0], len) != len))
+			{
+				fprintf(stderr, "write+read: %s\n", strerror(errno));
+				return 1;
+			}
+		}
+		else
+		{
+			syscalls += 2;
+			fake_enter();
+			fake_msg(fake_slave, 0, 1, &reg);
+			fake_enter();
+			fake_msg(fake_slave, I2C_M_RD, len, data[0]);
+		}
+		bench_check("write+read", reg, data[0], len);
+	}
+	bench_report("write+read", count, syscalls, bench_now() - start);
+
+	// One combined transaction each
+	bus.syscalls = 0;
+	start = bench_now();
+	for (done = 0; done < count; done++)
+	{
+		uint8_t result = i2c_write_read(&bus, dev_addr, &reg, 1, data[0], len);
+
+		if (result != I2C_STATUS_OK)
+		{
+			fprintf(stderr, "write_read: status %u\n", result);
+			return 1;
+		}
+		bench_check("write_read", reg, data[0], len);
+	}
+	bench_report("write_read", count, bus.syscalls, bench_now() - start);
+
+	// Full batches, the last one may be short
+	wreg[0] = reg;
+	bus.syscalls = 0;
+	start = bench_now();
+	for (done = 0; done < count; )
+	{
+		uint32_t n = ((count - done) < I2C_LINUX_BATCH) ? (count - done) : I2C_LINUX_BATCH;
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			xfer[i] = (i2c_transaction_t){ .addr = dev_addr, .wdata = wreg, .wlen = 1, .rdata = data[i], .rlen = len };
+			i2c_submit(&bus, &xfer[i]);
+		}
+		i2c_isr(&bus);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (xfer[i].status != I2C_STATUS_OK)
+			{
+				fprintf(stderr, "batch: status %u\n", xfer[i].status);
+				return 1;
+			}
+			bench_check("batch", reg, data[i], len);
+		}
+		done += n;
+	}
+	calls = bus.syscalls;
+	bench_report("batch", count, calls, bench_now() - start);
+
+	if (!real)
+	{
+		// The fake adapter must refuse other addresses like a real bus
+		if (i2c_write_read(&bus, (uint8_t)(dev_addr ^ 1), &reg, 1, data[0], len) != I2C_STATUS_NACK)
+		{
+			fprintf(stderr, "no NACK from an absent device\n");
+			return 1;
+		}
+
+		// A failed batch fails as a whole, the reads ahead of the failure are not run again
+		uint8_t wpage[2] = { 0x80, 0x11 };
+		uint8_t absent = (uint8_t)(dev_addr ^ 1);
+		const struct { uint8_t addr[3]; uint32_t reads; } cases[] =
+		{
+			{ { dev_addr, absent, dev_addr }, 1 },
+			{ { dev_addr, dev_addr, absent }, 2 },
+		};
+
+		for (uint8_t c = 0; c < 2; c++)
+		{
+			fake_writes = 0;
+			fake_reads = 0;
+			xfer[0] = (i2c_transaction_t){ .addr = cases[c].addr[0], .wdata = wreg, .wlen = 1, .rdata = data[0], .rlen = len };
+			xfer[1] = (i2c_transaction_t){ .addr = cases[c].addr[1], .wdata = wreg, .wlen = 1, .rdata = data[1], .rlen = len };
+			xfer[2] = (i2c_transaction_t){ .addr = cases[c].addr[2], .wdata = wpage, .wlen = 2 };
+			for (uint8_t i = 0; i < 3; i++)
+			{
+				i2c_submit(&bus, &xfer[i]);
+			}
+			i2c_isr(&bus);
+			for (uint8_t i = 0; i < 3; i++)
+			{
+				if (xfer[i].status != I2C_STATUS_NACK)
+				{
+					fprintf(stderr, "failed batch %u: transaction %u status %u, expected NACK\n", c, i, xfer[i].status);
+					return 1;
+				}
+			}
+			if ((fake_reads != cases[c].reads) || fake_writes)
+			{
+				fprintf(stderr, "failed batch %u: %u reads, %u writes on the bus\n", c, fake_reads, fake_writes);
+				return 1;
+			}
+		}
+		printf("failed batches fail every transaction, nothing sent twice\n");
+	}
+
+	return 0;
+}
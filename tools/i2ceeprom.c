@@ -0,0 +1,162 @@
+/**
+* @file i2ceeprom.c
+* @brief MSF I2C Library, i2c_eeprom test and write benchmark on the register simulator.
+* @note Builds i2c_eeprom.c over a driver against the stub headers in tools/sim:
+*   i2ceeprom-samd  i2c_samd.c, 400KHz
+*   i2ceeprom-pic   i2crxtx.c, -D__XC8, SSPADD from i2crxtx.c
+* A 24C256 (64 byte pages, 3mS write cycle) sits at 0x54 and a 24C04
+* (16 byte pages, block bit in the device address) at 0x50. Checks an
+* unaligned multi page write and a read back longer than 255 bytes, that no
+* page wrapped onto itself, and a write across the 24C04 block boundary.
+* Then times three ways to write the 24C256 in simulated bus time:
+*   byte   one byte per transaction, fixed 5mS delay after each
+*   page   one page per transaction, fixed 5mS delay after each
+*   poll   i2c_eeprom_write, ACK polling
+* Exits non zero on the first wrong result.
+*
+* Build: make -C tools i2ceeprom-samd i2ceeprom-pic
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim/sim.h"
+#include "../i2c_eeprom.h"
+#ifdef __XC8
+#include "../i2crxtx.h"
+#define BUS			SIM_PIC_BUS
+#define DEV(addr)	((uint8_t)((addr) << 1))	// i2c_eeprom_t takes the 8 bit write address on PIC
+#define BUS_HANDLE	0
+#else
+#include "../MSF_I2C.h"
+#define BUS			0
+#define DEV(addr)	(addr)
+#define BUS_HANDLE	(&i2c_bus0)
+#endif
+
+#define ROM_ADDR	0x54
+#define ROM_PAGE	64
+#define ROM_CYCLE	3000000UL		// Typical 24C256 write cycle, the datasheet maximum is 5mS
+#define FIXED_DELAY	5000000UL
+#define BLOB		4096
+#define NAIVE		256				// Bytes for the one byte per transaction run, 5mS each
+
+static uint8_t rom_mem[32768];
+static sim_eeprom_t rom_dev = SIM_EEPROM_INIT(ROM_ADDR, rom_mem, sizeof(rom_mem), ROM_PAGE, 2, ROM_CYCLE);
+static uint8_t small_mem[512];
+static sim_eeprom_t small_dev = SIM_EEPROM_INIT(0x50, small_mem, sizeof(small_mem), 16, 1, ROM_CYCLE);
+static uint8_t blob[BLOB], copy[BLOB];
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+// One transaction: 2 byte memory address then data, the way a plain driver would send it
+static uint8_t raw_write(uint16_t mem, uint8_t *data, uint16_t len)
+{
+	uint8_t hdr[2] = { (uint8_t)(mem >> 8), (uint8_t)mem };
+#ifdef __XC8
+	uint8_t acked;
+
+	if (i2c_start() != I2C_START_OK)
+	{
+		return 0;
+	}
+	acked = i2c_write(DEV(ROM_ADDR)) && i2c_write(hdr[0]) && i2c_write(hdr[1]);
+	while (acked && len--)
+	{
+		acked = i2c_write(*data++);
+	}
+	i2c_stop();
+	return acked;
+#else
+	i2c_iovec_t seg[2] = { { hdr, 2 }, { data, len } };
+
+	return i2c_sendv(&i2c_bus0, ROM_ADDR, seg, 2) == I2C_STATUS_OK;
+#endif
+}
+
+static void report(const char *method, uint32_t bytes, uint64_t ns)
+{
+	printf("%s: %-4s %5u bytes  %9.1f mS  %8.0f bytes/s\n", SIM_NAME, method, (unsigned)bytes, ns / 1e6, bytes * 1e9 / ns);
+}
+
+int main(void)
+{
+	i2c_eeprom_t rom = I2C_EEPROM_INIT(BUS_HANDLE, DEV(ROM_ADDR), 2, ROM_PAGE);
+	i2c_eeprom_t small = I2C_EEPROM_INIT(BUS_HANDLE, DEV(0x50), 1, 16);
+	uint64_t start;
+	uint32_t cycles;
+
+	sim_init();
+	sim_attach(BUS, &rom_dev.dev);
+	sim_attach(BUS, &small_dev.dev);
+#ifdef __XC8
+	i2c_init();
+#else
+	init_i2c(&i2c_bus0);
+#endif
+	for (uint32_t i = 0; i < BLOB; i++)
+	{
+		blob[i] = (uint8_t)((i * 131) ^ (i >> 8));
+	}
+
+	// Unaligned start, so the first and last pages are partial
+	check(i2c_eeprom_write(&rom, 0x0123, blob, BLOB) == I2C_STATUS_OK, "blob write failed");
+	check(rom.busy, "last page not left writing");
+	check(i2c_eeprom_read(&rom, 0x0123, copy, BLOB) == I2C_STATUS_OK, "blob read failed");
+	check(!memcmp(copy, blob, BLOB), "blob read back wrong");
+	check(!memcmp(&rom_mem[0x0123], blob, BLOB), "blob stored wrong");
+	check(rom_dev.wrapped == 0, "a page wrapped onto itself");
+	check(rom_dev.cycles == ((0x0123 + BLOB - 1) / ROM_PAGE) - (0x0123 / ROM_PAGE) + 1, "one write cycle per page expected");
+	check(rom_dev.polls > 0, "write cycle never polled");
+	check((rom.polls > 1) && (rom.polls < I2C_EEPROM_POLLS), "poll count out of range");
+
+	// 24C04, the block bit in the device address picks the upper 256 bytes
+	check(i2c_eeprom_write(&small, 0x00F8, blob, 16) == I2C_STATUS_OK, "block boundary write failed");
+	check(i2c_eeprom_read(&small, 0x00F8, copy, 16) == I2C_STATUS_OK, "block boundary read failed");
+	check(!memcmp(copy, blob, 16) && !memcmp(&small_mem[0xF8], blob, 16), "block boundary data wrong");
+	check(small_dev.wrapped == 0, "24C04 page wrapped onto itself");
+
+	// Benchmarks, each from an idle part and finished when its last cycle is over
+	check(i2c_eeprom_wait(&rom) == I2C_STATUS_OK, "part still busy");
+	sim_delay(FIXED_DELAY);
+
+	start = sim_now();
+	for (uint16_t i = 0; i < NAIVE; i++)
+	{
+		check(raw_write(i, &blob[i], 1), "byte write failed");
+		sim_delay(FIXED_DELAY);
+	}
+	report("byte", NAIVE, sim_now() - start);
+	check(!memcmp(rom_mem, blob, NAIVE), "byte writes stored wrong");
+
+	start = sim_now();
+	for (uint16_t i = 0; i < BLOB; i += ROM_PAGE)
+	{
+		check(raw_write(i, &blob[i], ROM_PAGE), "page write failed");
+		sim_delay(FIXED_DELAY);
+	}
+	report("page", BLOB, sim_now() - start);
+	check(!memcmp(rom_mem, blob, BLOB), "page writes stored wrong");
+
+	memset(rom_mem, 0xFF, sizeof(rom_mem));
+	cycles = rom_dev.cycles;
+	start = sim_now();
+	check(i2c_eeprom_write(&rom, 0, blob, BLOB) == I2C_STATUS_OK, "polled write failed");
+	check(i2c_eeprom_wait(&rom) == I2C_STATUS_OK, "polled write did not finish");
+	report("poll", BLOB, sim_now() - start);
+	check(!memcmp(rom_mem, blob, BLOB), "polled writes stored wrong");
+	check(rom_dev.cycles - cycles == BLOB / ROM_PAGE, "polled write cycles wrong");
+
+	printf("%s: ok\n", SIM_NAME);
+
+	return 0;
+}
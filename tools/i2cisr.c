@@ -0,0 +1,182 @@
+/**
+* @file i2cisr.c
+* @brief MSF I2C Library, i2c_submit and i2c_isr test on the register simulator.
+* @note Builds i2c_samd.c against tools/sim/samd with SERCOM0_Handler calling
+* i2c_isr, the way a board wires it. The main loop only calls sim_idle, so
+* every byte is moved by the interrupt. Checks a write then read, a read
+* only and a write only transaction, a second submit while one is on the
+* bus, a NACK'd address, a lost arbitration that is re-issued, and a chain
+* of transactions submitted from their own callbacks. Then prints how much
+* of a 16 byte register read the CPU spent in the driver, against the same
+* read made with polled i2c_write_read. Exits non zero on the first wrong
+* result.
+*
+* Build: make -C tools i2cisr
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sam.h>
+#include "sim/sim.h"
+#include "../MSF_I2C.h"
+
+#define DEV_ADDR	0x50
+#define CHAIN		8
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+static uint8_t done;
+static uint8_t chained;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "i2cisr: %s\n", what);
+		exit(1);
+	}
+}
+
+static void SERCOM0_Handler(void)
+{
+	i2c_isr(&i2c_bus0);
+}
+
+static void complete(i2c_transaction_t *xfer)
+{
+	(void)xfer;
+	done++;
+}
+
+// Submit and sleep until the callback, 1 if it ran once with the bus free
+static uint8_t run(i2c_transaction_t *xfer)
+{
+	done = 0;
+	xfer->callback = complete;
+	if (i2c_submit(&i2c_bus0, xfer) != I2C_STATUS_PENDING)
+	{
+		return 0;
+	}
+	while (!done && sim_idle())
+	{
+	}
+
+	return (done == 1) && !i2c_busy(&i2c_bus0);
+}
+
+// Each callback writes the next register until CHAIN have gone out
+static void chain(i2c_transaction_t *xfer)
+{
+	if (xfer->status != I2C_STATUS_OK)
+	{
+		return;
+	}
+	if (++chained < CHAIN)
+	{
+		xfer->wdata[0]++;
+		xfer->wdata[1]++;
+		check(i2c_submit(&i2c_bus0, xfer) == I2C_STATUS_PENDING, "submit from callback refused");
+	}
+}
+
+int main(void)
+{
+	uint8_t wbuf[2], rbuf[16];
+	i2c_transaction_t xfer;
+	uint64_t start, cpu, bus_ns, accesses;
+	uint32_t irqs;
+
+	sim_init();
+	sim_irq(SERCOM0_IRQn, SERCOM0_Handler);
+	sim_attach(0, &dev.dev);
+	init_i2c(&i2c_bus0);
+	for (unsigned i = 0; i < sizeof(regs); i++)
+	{
+		regs[i] = (uint8_t)(i ^ 0x5A);
+	}
+
+	// Write the pointer, repeated start, read 4
+	wbuf[0] = 0x20;
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.addr = DEV_ADDR;
+	xfer.wdata = wbuf;
+	xfer.wlen = 1;
+	xfer.rdata = rbuf;
+	xfer.rlen = 4;
+	check(run(&xfer), "write then read did not complete");
+	check(xfer.status == I2C_STATUS_OK, "write then read failed");
+	check(!memcmp(rbuf, &regs[0x20], 4), "write then read returned wrong data");
+
+	// Read only carries on from the device pointer
+	xfer.wlen = 0;
+	xfer.rlen = 2;
+	check(run(&xfer), "read only did not complete");
+	check((xfer.status == I2C_STATUS_OK) && !memcmp(rbuf, &regs[0x24], 2), "read only failed");
+
+	// Write only, and a second submit while it is on the bus
+	wbuf[0] = 0x80;
+	wbuf[1] = 0xC3;
+	xfer.wlen = 2;
+	xfer.rlen = 0;
+	xfer.callback = complete;
+	done = 0;
+	check(i2c_submit(&i2c_bus0, &xfer) == I2C_STATUS_PENDING, "write only refused");
+	check(i2c_busy(&i2c_bus0), "bus not busy after submit");
+	check(i2c_submit(&i2c_bus0, &xfer) == I2C_STATUS_BUSY, "second submit accepted");
+	while (!done && sim_idle())
+	{
+	}
+	check((xfer.status == I2C_STATUS_OK) && (regs[0x80] == 0xC3), "write only failed");
+
+	// Nobody at the next address
+	xfer.addr = DEV_ADDR + 1;
+	check(run(&xfer), "NACK'd transaction did not complete");
+	check(xfer.status == I2C_STATUS_NACK, "absent device not reported as NACK");
+	xfer.addr = DEV_ADDR;
+
+	// Lose the address to another master, the ISR goes again after its STOP
+	sim_bus[0].lose = 1;
+	sim_bus[0].hold_ns = 100000;
+	wbuf[1] = 0x3C;
+	check(run(&xfer), "transaction after lost arbitration did not complete");
+	check((xfer.status == I2C_STATUS_OK) && (regs[0x80] == 0x3C), "lost arbitration was not re-issued");
+	check(sim_bus[0].arblost == 1, "arbitration was not lost");
+
+	// Callbacks chain the next transaction from interrupt context
+	wbuf[0] = 0x90;
+	wbuf[1] = 0x01;
+	xfer.callback = chain;
+	chained = 0;
+	check(i2c_submit(&i2c_bus0, &xfer) == I2C_STATUS_PENDING, "chain refused");
+	while (i2c_busy(&i2c_bus0) && sim_idle())
+	{
+	}
+	check(chained == CHAIN, "chain stopped early");
+	for (uint8_t i = 0; i < CHAIN; i++)
+	{
+		check(regs[0x90 + i] == i + 1, "chain wrote wrong data");
+	}
+
+	// CPU cost of a 16 byte register read, submitted against polled
+	wbuf[0] = 0x00;
+	xfer.wlen = 1;
+	xfer.rlen = sizeof(rbuf);
+	start = sim_now();
+	accesses = sim_stats.accesses;
+	irqs = sim_stats.irqs;
+	check(run(&xfer) && (xfer.status == I2C_STATUS_OK), "timed submit failed");
+	bus_ns = sim_now() - start;
+	cpu = ((sim_stats.accesses - accesses) * sim_access_ns) + ((uint64_t)(sim_stats.irqs - irqs) * sim_irq_ns);
+	check(!memcmp(rbuf, regs, sizeof(rbuf)), "timed submit returned wrong data");
+	printf("i2cisr: ok, 16 byte read %.1f uS on the bus, i2c_submit %.1f uS CPU in %u interrupts (%.0f%%)\n",
+		bus_ns / 1000.0, cpu / 1000.0, (unsigned)(sim_stats.irqs - irqs), (100.0 * cpu) / bus_ns);
+
+	start = sim_now();
+	check(i2c_write_read(&i2c_bus0, DEV_ADDR, wbuf, 1, rbuf, sizeof(rbuf)) == I2C_STATUS_OK, "polled read failed");
+	printf("i2cisr: polled i2c_write_read %.1f uS CPU, all of it\n", (sim_now() - start) / 1000.0);
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/**
+* @file i2cpec.c
+* @brief MSF I2C Library, SMBus PEC check and cost per byte on the host.
+* @note Builds i2c_smbus.c twice. i2c_samd.c and sim.c are only linked so
+* its driver calls resolve, the simulator is never started:
+*   i2cpec-table   256 entry table
+*   i2cpec-nibble  -DI2C_PEC_NIBBLE, 16 entry table
+* Checks I2C_PEC_UPDATE against a bit at a time CRC-8 for every CRC and
+* byte, and the SMBus check value of "123456789". Then times the update
+* over a buffer the way the drivers use it, each byte depending on the CRC
+* before it, against the bitwise loop. Host nS per byte only rank the
+* variants, the estimated target cycle counts are in README "SMBus". Exits
+* non zero on a wrong CRC.
+*
+* Build: make -C tools i2cpec-table i2cpec-nibble
+* Usage: i2cpec-table [-n megabytes]
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../i2c_smbus.h"
+
+#define BUF		4096
+
+static uint8_t buf[BUF];
+
+// x^8 + x^2 + x + 1, MSB first, no reflection, init 0
+static uint8_t pec_bitwise(uint8_t crc, uint8_t byte)
+{
+	crc ^= byte;
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		crc = (uint8_t)((crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1));
+	}
+	return crc;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static double time_table(uint32_t passes, uint8_t *crc_out)
+{
+	uint8_t crc = 0;
+	double start = now();
+
+	for (uint32_t p = 0; p < passes; p++)
+	{
+		for (uint32_t i = 0; i < BUF; i++)
+		{
+			crc = I2C_PEC_UPDATE(crc, buf[i]);
+		}
+	}
+	*crc_out = crc;
+	return (now() - start) * 1e9 / ((double)passes * BUF);
+}
+
+static double time_bitwise(uint32_t passes, uint8_t *crc_out)
+{
+	uint8_t crc = 0;
+	double start = now();
+
+	for (uint32_t p = 0; p < passes; p++)
+	{
+		for (uint32_t i = 0; i < BUF; i++)
+		{
+			crc = pec_bitwise(crc, buf[i]);
+		}
+	}
+	*crc_out = crc;
+	return (now() - start) * 1e9 / ((double)passes * BUF);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint8_t check_str[] = "123456789";
+	uint32_t megabytes = 64;
+	uint8_t crc = 0, a, b;
+	double table_ns, bitwise_ns;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		if (opt != 'n')
+		{
+			fprintf(stderr, "usage: i2cpec [-n megabytes]\n");
+			return 2;
+		}
+		megabytes = (uint32_t)strtoul(optarg, 0, 0);
+	}
+
+	for (uint32_t c = 0; c < 256; c++)
+	{
+		for (uint32_t v = 0; v < 256; v++)
+		{
+			if (I2C_PEC_UPDATE((uint8_t)c, (uint8_t)v) != pec_bitwise((uint8_t)c, (uint8_t)v))
+			{
+				fprintf(stderr, "%s: CRC %02X byte %02X wrong\n", SIM_NAME, (unsigned)c, (unsigned)v);
+				return 1;
+			}
+		}
+	}
+	for (uint8_t i = 0; i < sizeof(check_str) - 1; i++)
+	{
+		crc = I2C_PEC_UPDATE(crc, check_str[i]);
+	}
+	if (crc != 0xF4)
+	{
+		fprintf(stderr, "%s: check value %02X, expected F4\n", SIM_NAME, (unsigned)crc);
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < BUF; i++)
+	{
+		buf[i] = (uint8_t)((i * 2654435761u) >> 24);
+	}
+	table_ns = time_table((megabytes << 20) / BUF, &a);
+	bitwise_ns = time_bitwise((megabytes << 20) / BUF, &b);
+	if (a != b)
+	{
+		fprintf(stderr, "%s: buffer CRC %02X, bitwise %02X\n", SIM_NAME, (unsigned)a, (unsigned)b);
+		return 1;
+	}
+
+	printf("%s: ok, %5.2f nS/byte, bitwise loop %5.2f nS/byte, %.1fx faster\n",
+		SIM_NAME, table_ns, bitwise_ns, bitwise_ns / table_ns);
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/**
+* @file i2cpoll.c
+* @brief MSF I2C Library, PIC superloop latency with and without i2c_poll on the register simulator.
+* @note Builds i2crxtx.c with -D__XC8 against tools/sim/pic and runs a main
+* loop that does LOOP_WORK of other work per pass, at 400KHz and 100KHz.
+* For each speed it times what one pass spends in I2C:
+*   blocking  get_i2c_data_pointer on a device that ACKs, and on an absent
+*             address with its retries and backoff
+*   i2c_poll  one call with the MSSP still busy, and the longest call that
+*             ran a step, for the same 1 byte register read started
+*             with i2c_submit_poll
+* and how long the polled read took from submit to done, in loop passes.
+* Checks the data read each way. CPU time is the simulated register
+* accesses, so i2c_poll costs are a lower bound, the instructions between
+* accesses are not counted. Exits non zero on the first wrong result.
+*
+* Build: make -C tools i2cpoll
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim/sim.h"
+#include "../i2crxtx.h"
+
+#define DEV_ADDR	0x50
+#define LOOP_WORK	20000UL			// nS of other work per superloop pass
+#define TRIALS		20
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+static void run(const char *speed, unsigned char sspadd)
+{
+	unsigned char reg, val;
+	I2C_TRANSACTION xfer = { DEV_ADDR << 1, &reg, 1, &val, 1, 0, 0 };
+	I2C_RESULT result;
+	uint64_t start, t, ack_max = 0, absent_ns, busy_min = UINT64_MAX, step_max = 0, done_max = 0;
+	uint32_t passes, passes_max = 0;
+
+	check(i2c_set_speed(sspadd), "speed not applied");
+
+	for (uint8_t n = 0; n < TRIALS; n++)
+	{
+		reg = (unsigned char)(n * 7);
+
+		// Blocking, the whole transaction lands in one pass
+		sim_delay(LOOP_WORK);
+		start = sim_now();
+		result = get_i2c_data_pointer(DEV_ADDR << 1, reg);
+		t = sim_now() - start;
+		check(result.tx_chk && (result.data == regs[reg]), "blocking read failed");
+		ack_max = (t > ack_max) ? t : ack_max;
+
+		// Polled, one step at most per pass
+		sim_delay(LOOP_WORK);
+		start = sim_now();
+		check(i2c_submit_poll(&xfer) == I2C_STATUS_PENDING, "i2c_submit_poll refused");
+		for (passes = 1; ; passes++)
+		{
+			uint64_t call = sim_now();
+			uint64_t accesses = sim_stats.accesses;
+			unsigned char status = i2c_poll(&xfer);
+
+			t = sim_now() - call;
+			if (sim_stats.accesses - accesses <= 2)
+			{
+				busy_min = (t < busy_min) ? t : busy_min;
+			}
+			else
+			{
+				step_max = (t > step_max) ? t : step_max;
+			}
+			if (status != I2C_STATUS_PENDING)
+			{
+				break;
+			}
+			sim_delay(LOOP_WORK);
+		}
+		t = sim_now() - start;
+		check(xfer.status == I2C_STATUS_OK, "polled read failed");
+		check(val == regs[reg], "polled read returned wrong data");
+		done_max = (t > done_max) ? t : done_max;
+		passes_max = (passes > passes_max) ? passes : passes_max;
+	}
+
+	// Nobody there, every retry and backoff inside the one call
+	sim_delay(LOOP_WORK);
+	start = sim_now();
+	result = get_i2c_data_pointer((DEV_ADDR + 1) << 1, 0);
+	absent_ns = sim_now() - start;
+	check(!result.tx_chk, "absent device answered");
+	i2c_health_clear((DEV_ADDR + 1) << 1);
+
+	printf("%s: %-6s get_i2c_data_pointer %6.1f uS, absent device %7.1f uS\n", SIM_NAME, speed, ack_max / 1000.0, absent_ns / 1000.0);
+	printf("%s: %-6s i2c_poll busy %4.2f uS, step up to %4.2f uS, 1 byte read done in %u passes, %6.1f uS\n", SIM_NAME, speed,
+		busy_min / 1000.0, step_max / 1000.0, (unsigned)passes_max, done_max / 1000.0);
+}
+
+int main(void)
+{
+	sim_init();
+	sim_attach(SIM_PIC_BUS, &dev.dev);
+	i2c_init();
+	for (unsigned i = 0; i < sizeof(regs); i++)
+	{
+		regs[i] = (uint8_t)(i * 13 + 1);
+	}
+
+	run("400KHz", I2C_SSPADD_VALUE(SIM_PIC_FOSC, 400000UL, 100));
+	run("100KHz", I2C_SSPADD_VALUE(SIM_PIC_FOSC, 100000UL, 100));
+	printf("%s: ok, %.0f uS of other work per pass\n", SIM_NAME, LOOP_WORK / 1000.0);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/**
+* @file i2cqueue.c
+* @brief MSF I2C Library, i2c_queue priority latency on the register simulator.
+* @note Builds i2c_queue.c over i2c_samd.c against tools/sim/samd with
+* SERCOM0_Handler calling i2c_isr, at 400KHz. Two low priority 32 byte page
+* writes post themselves again from their callbacks, so the bus never goes
+* idle, and a high priority 2 byte register read is posted at pseudo random
+* times in between. Checks every result and the data read, and that no
+* high priority read waited longer than the slot one low priority write
+* takes in the back to back stream, its bus time plus the gap from its
+* STOP to the next START. Prints the worst case and mean wait from post to
+* completion, less the read's own bus time, against the bus time of each
+* transaction on an idle bus. Exits non zero on the first wrong result.
+*
+* Build: make -C tools i2cqueue
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sam.h>
+#include "sim/sim.h"
+#include "../i2c_queue.h"
+
+#define DEV_ADDR	0x50
+#define PAGE		32
+#define LOW_ITEMS	2
+#define HIGH_READS	500
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+static i2c_queue_t queue = { &i2c_bus0 };
+static uint8_t pages[LOW_ITEMS][PAGE + 1];
+static i2c_queue_item_t low[LOW_ITEMS];
+static i2c_queue_item_t high;
+static uint8_t high_reg, high_data[2];
+static uint8_t saturate;
+static uint32_t low_writes;
+static uint64_t done_at;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+static void SERCOM0_Handler(void)
+{
+	i2c_isr(&i2c_bus0);
+}
+
+static void low_done(i2c_queue_item_t *item)
+{
+	check(item->xfer.status == I2C_STATUS_OK, "low priority write failed");
+	low_writes++;
+	done_at = sim_now();
+	if (saturate)
+	{
+		i2c_queue_post(item->queue, item);
+	}
+}
+
+static void high_done(i2c_queue_item_t *item)
+{
+	(void)item;
+	done_at = sim_now();
+}
+
+// Post one item on an idle bus and wait for it, bus time from post to callback
+static uint64_t alone(i2c_queue_item_t *item)
+{
+	uint64_t start = sim_now();
+
+	i2c_queue_post(&queue, item);
+	while (i2c_queue_busy(&queue) && sim_idle())
+	{
+	}
+	check(item->xfer.status == I2C_STATUS_OK, "transaction on an idle bus failed");
+
+	return done_at - start;
+}
+
+int main(void)
+{
+	uint64_t low_ns, high_ns, slot_ns, posted, wait, wait_max = 0, wait_total = 0;
+	uint32_t seed = 1;
+
+	sim_init();
+	sim_irq(SERCOM0_IRQn, SERCOM0_Handler);
+	sim_attach(0, &dev.dev);
+	init_i2c(&i2c_bus0);
+	for (unsigned i = 0; i < sizeof(regs); i++)
+	{
+		regs[i] = (uint8_t)(i ^ 0xA5);
+	}
+
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		pages[i][0] = (uint8_t)(0x80 + (i * PAGE));
+		memset(&pages[i][1], 0x11 * (i + 1), PAGE);
+		low[i].xfer.addr = DEV_ADDR;
+		low[i].xfer.wdata = pages[i];
+		low[i].xfer.wlen = PAGE + 1;
+		low[i].priority = I2C_QUEUE_LOW;
+		low[i].callback = low_done;
+	}
+	high_reg = 0x10;
+	high.xfer.addr = DEV_ADDR;
+	high.xfer.wdata = &high_reg;
+	high.xfer.wlen = 1;
+	high.xfer.rdata = high_data;
+	high.xfer.rlen = sizeof(high_data);
+	high.priority = I2C_QUEUE_HIGH;
+	high.callback = high_done;
+
+	low_ns = alone(&low[0]);
+	high_ns = alone(&high);
+
+	// Low priority writes back to back from here on, each takes a slot of its bus time plus the STOP to START gap
+	saturate = 1;
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		i2c_queue_post(&queue, &low[i]);
+	}
+	while ((low_writes < 4) && sim_idle())
+	{
+	}
+	slot_ns = done_at;
+	while ((low_writes < 12) && sim_idle())
+	{
+	}
+	slot_ns = (done_at - slot_ns) / 8;
+	for (uint16_t n = 0; n < HIGH_READS; n++)
+	{
+		uint64_t at;
+
+		// Anywhere within the next two low priority writes
+		seed = (seed * 1103515245u) + 12345u;
+		at = sim_now() + ((seed >> 8) % (2 * low_ns));
+		while ((sim_now() < at) && sim_idle())
+		{
+		}
+		check(queue.active && (queue.active != &high), "low priority writes stopped");
+
+		posted = sim_now();
+		i2c_queue_post(&queue, &high);
+		while ((high.xfer.status == I2C_STATUS_PENDING) && sim_idle())
+		{
+		}
+		check(high.xfer.status == I2C_STATUS_OK, "high priority read failed");
+		check((high_data[0] == regs[0x10]) && (high_data[1] == regs[0x11]), "high priority read returned wrong data");
+		wait = ((done_at - posted) > high_ns) ? (done_at - posted - high_ns) : 0;
+		wait_total += wait;
+		wait_max = (wait > wait_max) ? wait : wait_max;
+	}
+	saturate = 0;
+	while (i2c_queue_busy(&queue) && sim_idle())
+	{
+	}
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		check(!memcmp(&regs[pages[i][0]], &pages[i][1], PAGE), "low priority write stored wrong data");
+	}
+	check(wait_max <= slot_ns, "high priority read waited longer than one low priority write");
+
+	printf("%s: ok, %u high priority reads among %u low priority writes\n", SIM_NAME, HIGH_READS, (unsigned)low_writes);
+	printf("%s: alone on the bus, 2 byte read %.1f uS, 32 byte write %.1f uS, %.1f uS back to back\n", SIM_NAME,
+		high_ns / 1000.0, low_ns / 1000.0, slot_ns / 1000.0);
+	printf("%s: high priority wait, worst %.1f uS, mean %.1f uS\n", SIM_NAME, wait_max / 1000.0, wait_total / 1000.0 / HIGH_READS);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/**
+* @file i2cring.c
+* @brief MSF I2C Library, completion ring stress test.
+* @note Runs i2c_ring.c with the producer and consumer on two threads, so
+* the host build's __sync_synchronize barriers are what keeps them apart.
+* The producer stands in for the driver interrupt and pushes as fast as it
+* can, each record carrying its sequence number in every field. The
+* consumer drains in batches and checks that records arrive whole and in
+* order. Two passes per ring size:
+*   retry  producer pushes again while the ring is full, nothing may be lost
+*   drop   producer never waits, the way an ISR pushes, every record is
+*          either drained or counted in dropped
+* Exits non zero on the first wrong record.
+*
+* Build: make -C tools i2cring
+* Usage: i2cring [-n records]
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../i2c_ring.h"
+
+typedef struct
+{
+	i2c_ring_t *ring;
+	uint32_t count;		// Records to push
+	uint8_t retry;		// Push again while the ring is full
+	volatile uint8_t finished;
+	uint32_t pushed;
+} producer_t;
+
+static void fail(const char *mode, unsigned slots, const char *what, uint32_t seq)
+{
+	fprintf(stderr, "i2cring: %s, %u slots: %s at record %u\n", mode, slots, what, (unsigned)seq);
+	exit(1);
+}
+
+static void fill(i2c_completion_t *record, uint32_t seq)
+{
+	record->tag = (void *)(uintptr_t)seq;
+	record->stamp = ~seq;
+	record->bytes = (uint16_t)seq;
+	record->status = (uint8_t)(seq >> 16);
+}
+
+static void *produce(void *arg)
+{
+	producer_t *p = arg;
+	i2c_completion_t record;
+
+	for (uint32_t seq = 0; seq < p->count; seq++)
+	{
+		fill(&record, seq);
+		if (i2c_ring_push(p->ring, &record))
+		{
+			p->pushed++;
+		}
+		else if (p->retry)
+		{
+			seq--;
+			sched_yield();
+		}
+	}
+	__sync_synchronize();
+	p->finished = 1;
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void run(unsigned slots, uint32_t count, uint8_t retry)
+{
+	const char *mode = retry ? "retry" : "drop";
+	i2c_completion_t storage[128], out[32];
+	i2c_ring_t ring = { storage, (uint8_t)(slots - 1), 0, 0, 0 };
+	producer_t p = { &ring, count, retry, 0, 0 };
+	pthread_t thread;
+	uint32_t got = 0, next = 0;
+	uint8_t n, last = 0;
+	double start = now();
+
+	if (pthread_create(&thread, 0, produce, &p))
+	{
+		perror("pthread_create");
+		exit(1);
+	}
+	while (!last)
+	{
+		// Producer done before this drain, so the drain sees everything it pushed
+		last = p.finished;
+		__sync_synchronize();
+		if (!(n = i2c_ring_drain(&ring, out, sizeof(out) / sizeof(out[0]))))
+		{
+			sched_yield();
+		}
+		for (; n; n = i2c_ring_drain(&ring, out, sizeof(out) / sizeof(out[0])))
+		{
+			for (uint8_t i = 0; i < n; i++)
+			{
+				i2c_completion_t expect;
+				uint32_t seq = (uint32_t)(uintptr_t)out[i].tag;
+
+				if ((seq < next) || (seq >= count) || (retry && (seq != next)))
+				{
+					fail(mode, slots, "out of order", next);
+				}
+				fill(&expect, seq);
+				if ((out[i].stamp != expect.stamp) || (out[i].bytes != expect.bytes) || (out[i].status != expect.status))
+				{
+					fail(mode, slots, "torn record", seq);
+				}
+				next = seq + 1;
+				got++;
+			}
+		}
+	}
+	pthread_join(thread, 0);
+
+	if (got != p.pushed)
+	{
+		fail(mode, slots, "records lost", got);
+	}
+	// dropped is 16 bits, and in retry mode also counts the pushes that were tried again
+	if (!retry && ((uint16_t)(got + ring.dropped) != (uint16_t)count))
+	{
+		fail(mode, slots, "dropped count wrong", got);
+	}
+	if (retry && (got != count))
+	{
+		fail(mode, slots, "records missing", got);
+	}
+	printf("i2cring: %-5s %3u slots  %9u drained  %9u dropped  %6.1f M records/s\n", mode, slots,
+		(unsigned)got, (unsigned)(count - got), count / ((now() - start) * 1e6));
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned sizes[] = { 1, 2, 8, 32, 128 };
+	uint32_t count = 2000000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		if (opt != 'n')
+		{
+			fprintf(stderr, "usage: i2cring [-n records]\n");
+			return 2;
+		}
+		count = (uint32_t)strtoul(optarg, 0, 0);
+	}
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+	{
+		printf("i2cring: one CPU, threads interleave but never run at once\n");
+	}
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		run(sizes[i], count, 1);
+		run(sizes[i], count, 0);
+	}
+	printf("i2cring: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/**
+* @file i2csampler.c
+* @brief MSF I2C Library, i2c_sampler timer setup and jitter on the register simulator.
+* @note Builds i2c_sampler.c and i2c_queue.c over i2c_samd.c against
+* tools/sim/samd, with the sampler on TC3 as on a SAMD21. TC3 is plain
+* memory: the test checks the clock, prescaler and period i2c_sampler_timer
+* programs, then sim_timer raises TC3_IRQn at that period in its place.
+* A 6 byte register read is sampled every second 1mS tick at high priority, first
+* on a quiet bus, then while two low priority 32 byte page writes post
+* themselves again from their callbacks so the bus never goes idle. Checks
+* the data, that no tick overran or failed, that the quiet bus gives no
+* jitter and that under load the jitter stays within twice the slot one
+* low priority write takes back to back, as each read waits anywhere from
+* none to one slot. Prints the jitter both ways. Exits
+* non zero on the first wrong result.
+*
+* Build: make -C tools i2csampler
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sam.h>
+#include "sim/sim.h"
+#include "../i2c_sampler.h"
+
+#define DEV_ADDR	0x19
+#define SAMPLE_REG	0x28
+#define SAMPLE_LEN	6
+#define TICK_HZ		1000UL
+#define TICKS		2			// Per sample, a read can wait a whole low priority write and still finish before the next
+#define PAGE		32
+#define LOW_ITEMS	2
+#define QUIET		100			// Samples on a quiet bus
+#define LOADED		500			// Samples under low priority writes
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+static i2c_queue_t queue = { &i2c_bus0 };
+static i2c_sample_t accel;
+static uint8_t pages[LOW_ITEMS][PAGE + 1];
+static i2c_queue_item_t low[LOW_ITEMS];
+static uint8_t saturate;
+static uint32_t low_writes;
+static uint64_t done_at;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+static void SERCOM0_Handler(void)
+{
+	i2c_isr(&i2c_bus0);
+}
+
+static void TC3_Handler(void)
+{
+	i2c_sampler_isr();
+}
+
+static void low_done(i2c_queue_item_t *item)
+{
+	check(item->xfer.status == I2C_STATUS_OK, "low priority write failed");
+	low_writes++;
+	done_at = sim_now();
+	if (saturate)
+	{
+		i2c_queue_post(item->queue, item);
+	}
+}
+
+// Timer period i2c_sampler_timer programmed, from CC0 and the prescaler at 48MHz
+static uint64_t tc_period_ns(void)
+{
+	static const uint8_t shift[8] = { 0, 1, 2, 3, 4, 6, 8, 10 };
+	uint8_t prescaler = (uint8_t)((TC3_REGS->COUNT16.TC_CTRLA & TC_CTRLA_PRESCALER_Msk) >> 8);
+
+	return ((uint64_t)(TC3_REGS->COUNT16.TC_CC[0] + 1u) << shift[prescaler]) * 1000000000ULL / sim_cpu_hz;
+}
+
+// Run until seq has moved on by count samples, jitter in SysTick ticks over them
+static uint32_t sample_run(uint16_t count)
+{
+	uint16_t seq = accel.seq;
+	uint8_t data[SAMPLE_LEN];
+
+	// The first interval spans the time the timer was stopped, start counting after it
+	while (accel.seq == seq)
+	{
+		check(sim_idle(), "sampler stopped");
+	}
+	seq = accel.seq;
+	accel.interval_min = UINT32_MAX;
+	accel.interval_max = 0;
+	while ((uint16_t)(accel.seq - seq) < count)
+	{
+		check(sim_idle(), "sampler stopped");
+	}
+	check(i2c_sample_latest(&accel, data) && !memcmp(data, &regs[SAMPLE_REG], SAMPLE_LEN), "sample holds wrong data");
+	check(!accel.overruns && !accel.errors, "sample overran or failed");
+
+	return accel.interval_max - accel.interval_min;
+}
+
+int main(void)
+{
+	uint64_t period_ns, slot_ns;
+	uint32_t quiet, loaded;
+
+	sim_init();
+	sim_irq(SERCOM0_IRQn, SERCOM0_Handler);
+	sim_irq(TC3_IRQn, TC3_Handler);
+	sim_attach(0, &dev.dev);
+	init_i2c(&i2c_bus0);
+	for (unsigned i = 0; i < sizeof(regs); i++)
+	{
+		regs[i] = (uint8_t)(i * 7 + 3);
+	}
+
+	// 10Hz needs DIV256 to fit 16 bits, 1KHz runs undivided
+	i2c_sampler_timer(sim_cpu_hz, 10);
+	check((TC3_REGS->COUNT16.TC_CTRLA & TC_CTRLA_PRESCALER_Msk) == TC_CTRLA_PRESCALER(6), "10Hz prescaler wrong");
+	check(tc_period_ns() == 100000000ULL, "10Hz period wrong");
+	i2c_sampler_timer(sim_cpu_hz, TICK_HZ);
+	check(PM_REGS->PM_APBCMASK & PM_APBCMASK_TC3(1), "TC3 bus clock not enabled");
+	check(GCLK_REGS->GCLK_CLKCTRL == (GCLK_CLKCTRL_CLKEN(1) | GCLK_CLKCTRL_ID_TCC2_TC3 | GCLK_CLKCTRL_GEN_GCLK0), "TC3 GCLK wrong");
+	check(TC3_REGS->COUNT16.TC_CTRLA == (TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER(0) | TC_CTRLA_ENABLE(1)),
+		"TC3 mode wrong");
+	check(TC3_REGS->COUNT16.TC_INTENSET & TC_INTENSET_MC0(1), "TC3 match interrupt not enabled");
+	period_ns = tc_period_ns();
+	check(period_ns == 1000000000ULL / TICK_HZ, "1KHz period wrong");
+
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		pages[i][0] = (uint8_t)(0x80 + (i * PAGE));
+		memset(&pages[i][1], 0x11 * (i + 1), PAGE);
+		low[i].xfer.addr = DEV_ADDR;
+		low[i].xfer.wdata = pages[i];
+		low[i].xfer.wlen = PAGE + 1;
+		low[i].priority = I2C_QUEUE_LOW;
+		low[i].callback = low_done;
+	}
+
+	i2c_sampler_init(&queue);
+	i2c_sampler_add(&accel, DEV_ADDR, SAMPLE_REG, SAMPLE_LEN, TICKS, I2C_QUEUE_HIGH);
+	sim_timer(TC3_IRQn, period_ns);
+	quiet = sample_run(QUIET);
+	check(quiet == 0, "sampling a quiet bus jittered");
+
+	// Back to back low priority writes with the timer stopped, each takes a slot of its bus time plus the STOP to START gap
+	sim_timer(TC3_IRQn, 0);
+	saturate = 1;
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		i2c_queue_post(&queue, &low[i]);
+	}
+	while ((low_writes < 4) && sim_idle())
+	{
+	}
+	slot_ns = done_at;
+	while ((low_writes < 12) && sim_idle())
+	{
+	}
+	slot_ns = (done_at - slot_ns) / 8;
+
+	sim_timer(TC3_IRQn, period_ns);
+	loaded = sample_run(LOADED);
+	// Each read waits 0 to one slot, so one interval is at most a slot either side of the period
+	check(loaded * 1000000000ULL / sim_cpu_hz <= 2 * slot_ns, "sample waited longer than one low priority write");
+
+	saturate = 0;
+	sim_timer(TC3_IRQn, 0);
+	while (i2c_queue_busy(&queue) && sim_idle())
+	{
+	}
+	for (uint8_t i = 0; i < LOW_ITEMS; i++)
+	{
+		check(!memcmp(&regs[pages[i][0]], &pages[i][1], PAGE), "low priority write stored wrong data");
+	}
+
+	printf("%s: ok, %u byte read every %.1f mS, jitter %.2f uS on a quiet bus, %.1f uS under 32 byte writes (%.1f uS slot)\n",
+		SIM_NAME, SAMPLE_LEN, TICKS * period_ns / 1e6, quiet * 1e6 / sim_cpu_hz, loaded * 1e6 / sim_cpu_hz, slot_ns / 1000.0);
+
+	return 0;
+}
@@ -0,0 +1,238 @@
+/**
+* @file i2csim.c
+* @brief MSF I2C Library, polled driver smoke test on the register simulator.
+* @note Builds once per driver against the stub headers in tools/sim:
+*   i2csim-samd    i2c_samd.c with the DFP style sam.h
+*   i2csim-samd11  MSF_SAMD11_I2C.c with the ASF style sam.h
+*   i2csim-pic     i2crxtx.c with xc.h, -D__XC8 -DI2C_STATS
+* Each puts a 256 register device at 0x50, writes a block and reads it
+* back, checks that an absent address NACKs, that a zero length PIC burst
+* stays off the bus, that PIC calls the open breaker short circuits count
+* neither as failures nor in I2C_STATS, and that a scan finds only the
+* device, then loses
+* arbitration once and checks that the driver waits out the other master and
+* goes again. The SAMD builds, with I2C_STATS, then have a target hold SDA
+* low so the START is a bus error, and check that i2c_recover clocks it free
+* and times itself. Exits non zero on the first wrong result, then prints
+* the simulated bus time of one 4 byte register read and of the full scan.
+* The SAMD builds also time that read made as i2c_send then i2c_read,
+* against i2c_write_read with its repeated start. The PIC build times 16
+* registers read and written one per transaction, against one burst.
+*
+* Build: make -C tools i2csim-samd i2csim-samd11 i2csim-pic
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim/sim.h"
+#ifdef __XC8
+#include "../i2crxtx.h"
+#define BUS		SIM_PIC_BUS
+#define I2C_SCAN_MAP_SIZE			16		// Same map as MSF_I2C.h, see i2c_scan in i2crxtx.c
+#define I2C_SCAN_PRESENT(map, addr)	(((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+#else
+#include "../MSF_I2C.h"
+#define BUS		0
+#endif
+
+#define DEV_ADDR	0x50
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+// One call per operation whatever the driver, 1 if it went through
+static uint8_t write_regs(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len)
+{
+#ifdef __XC8
+	return i2c_write_burst((unsigned char)(addr << 1), reg, data, len);
+#else
+	uint8_t buf[33];
+
+	buf[0] = reg;
+	memcpy(&buf[1], data, len);
+	return i2c_send(&i2c_bus0, addr, buf, (uint16_t)(len + 1)) == I2C_STATUS_OK;
+#endif
+}
+
+static uint8_t read_regs(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len)
+{
+#ifdef __XC8
+	return i2c_read_burst((unsigned char)(addr << 1), reg, data, len);
+#else
+	return i2c_write_read(&i2c_bus0, addr, &reg, 1, data, len) == I2C_STATUS_OK;
+#endif
+}
+
+static uint8_t scan(uint8_t *map)
+{
+#ifdef __XC8
+	return i2c_scan(0, 0, map);
+#else
+	return i2c_scan(&i2c_bus0, 0, 0, map) == I2C_STATUS_OK;
+#endif
+}
+
+int main(void)
+{
+	uint8_t out[16], in[16], map[I2C_SCAN_MAP_SIZE];
+	uint64_t start, accesses, scan_ns, absent_ns;
+	uint32_t starts;
+#ifndef __XC8
+	i2c_recovery_t rec;
+	uint8_t reg = 0x10;
+#else
+	uint64_t single_ns;
+	uint32_t bytes, single_bytes;
+	I2C_STATS_DATA before, after;
+	I2C_HEALTH *dead;
+	uint8_t fails, skip;
+#endif
+
+	sim_init();
+#ifdef SIM_CPU_HZ
+	sim_cpu_hz = SIM_CPU_HZ;
+#endif
+	sim_attach(BUS, &dev.dev);
+#ifdef __XC8
+	i2c_init();
+#else
+	init_i2c(&i2c_bus0);
+#endif
+
+	for (uint8_t i = 0; i < sizeof(out); i++)
+	{
+		out[i] = (uint8_t)(0xA5 ^ (i * 7));
+	}
+	check(write_regs(DEV_ADDR, 0x10, out, sizeof(out)), "block write failed");
+	check(!memcmp(&regs[0x10], out, sizeof(out)), "block write stored wrong data");
+	check(read_regs(DEV_ADDR, 0x10, in, sizeof(in)), "block read failed");
+	check(!memcmp(in, out, sizeof(in)), "block read returned wrong data");
+
+	start = sim_now();
+	check(!read_regs(DEV_ADDR + 1, 0x10, in, 1), "absent device answered");
+	absent_ns = sim_now() - start;
+
+#ifdef __XC8
+	// Zero length bursts fail without touching the bus
+	starts = sim_bus[BUS].starts;
+	check(!read_regs(DEV_ADDR, 0x10, in, 0) && !write_regs(DEV_ADDR, 0x10, out, 0), "zero length burst reported done");
+	check(sim_bus[BUS].starts == starts, "zero length burst sent a START");
+
+	// A second failure opens the breaker, the calls it short circuits touch neither the bus nor the counters
+	check(!read_regs(DEV_ADDR + 1, 0x10, in, 1), "absent device answered");
+	dead = i2c_health((DEV_ADDR + 1) << 1);
+	check(dead && dead->skip, "breaker did not open");
+	fails = dead->fails;
+	skip = dead->skip;
+	i2c_stats(&before, 0);
+	starts = sim_bus[BUS].starts;
+	check(!get_i2c_data((DEV_ADDR + 1) << 1).tx_chk, "short circuited read answered");
+	check(!send_i2c_data((DEV_ADDR + 1) << 1, 0x10, 0), "short circuited write answered");
+	check(!read_regs(DEV_ADDR + 1, 0x10, in, 1), "short circuited burst answered");
+	i2c_stats(&after, 0);
+	check(sim_bus[BUS].starts == starts, "short circuited call sent a START");
+	check((dead->fails == fails) && (dead->skip == skip - 3), "short circuited call counted as a failure");
+	check((after.transactions == before.transactions) && (after.retries == before.retries), "short circuited call counted as a transaction");
+	i2c_health_clear((DEV_ADDR + 1) << 1);
+#endif
+
+	start = sim_now();
+	check(scan(map), "scan failed");
+	scan_ns = sim_now() - start;
+	for (uint8_t a = 0x08; a < 0x78; a++)
+	{
+		check(I2C_SCAN_PRESENT(map, a) == (a == DEV_ADDR), "scan map wrong");
+	}
+
+	// Another master wins the next address byte and holds the bus for 200uS
+	sim_bus[BUS].lose = 1;
+	sim_bus[BUS].hold_ns = 200000;
+	out[0] = 0x3C;
+	check(write_regs(DEV_ADDR, 0x40, out, 1), "write after lost arbitration failed");
+	check(sim_bus[BUS].arblost == 1, "arbitration was not lost");
+	check(regs[0x40] == 0x3C, "write after lost arbitration stored wrong data");
+
+#ifndef __XC8
+	// A target keeps SDA low for 5 clocks, the START is a bus error and i2c_recover clocks it free
+	sim_bus[BUS].stuck = 5;
+	out[0] = 0xC3;
+	check(!write_regs(DEV_ADDR, 0x40, out, 1), "write with SDA held low went through");
+	check((sim_bus[BUS].buserrs == 1) && !sim_bus[BUS].stuck, "SDA not released by the recovery");
+	i2c_recovery_stats(&i2c_bus0, &rec);
+	check((rec.count == 1) && (rec.clocks == 5), "recovery count or clocks wrong");
+	check(rec.latency > 0, "recovery latency not timed");
+	check(write_regs(DEV_ADDR, 0x40, out, 1) && (regs[0x40] == 0xC3), "write after recovery failed");
+	printf("%s: recovery %u clocks, %.1f uS from i2c_recover to BUSSTATE IDLE, delay loops not counted\n", SIM_NAME,
+		rec.clocks, rec.latency * 1e6 / sim_cpu_hz);
+#endif
+
+	start = sim_now();
+	accesses = sim_stats.accesses;
+	starts = sim_bus[BUS].starts;
+	check(read_regs(DEV_ADDR, 0x10, in, 4), "timed read failed");
+	printf("%s: ok, 4 byte register read %.1f uS, %llu register accesses, %u starts\n", SIM_NAME,
+		(sim_now() - start) / 1000.0, (unsigned long long)(sim_stats.accesses - accesses),
+		(unsigned)(sim_bus[BUS].starts - starts));
+	printf("%s: scan of 0x08 to 0x77 %.2f mS, %.1f uS per probe, one read of an absent device %.2f mS\n", SIM_NAME,
+		scan_ns / 1e6, scan_ns / 1000.0 / 112, absent_ns / 1e6);
+
+#ifndef __XC8
+	// The same read as a write, STOP and a fresh START, the way it went before i2c_write_read
+	start = sim_now();
+	accesses = sim_stats.accesses;
+	check(i2c_send(&i2c_bus0, DEV_ADDR, &reg, 1) == I2C_STATUS_OK, "pointer write failed");
+	check(i2c_read(&i2c_bus0, DEV_ADDR, out, 4) == I2C_STATUS_OK, "split read failed");
+	check(!memcmp(in, out, 4), "split read returned other data than i2c_write_read");
+	printf("%s: i2c_send then i2c_read of the same 4 bytes %.1f uS, %llu register accesses\n", SIM_NAME,
+		(sim_now() - start) / 1000.0, (unsigned long long)(sim_stats.accesses - accesses));
+#else
+	// A 16 byte block one register per transaction, then as one burst
+	start = sim_now();
+	bytes = sim_bus[BUS].bytes;
+	for (uint8_t i = 0; i < sizeof(in); i++)
+	{
+		I2C_RESULT one = get_i2c_data_pointer(DEV_ADDR << 1, (unsigned char)(0x10 + i));
+
+		check(one.tx_chk && (one.data == regs[0x10 + i]), "single register read failed");
+	}
+	single_ns = sim_now() - start;
+	single_bytes = sim_bus[BUS].bytes - bytes;
+	start = sim_now();
+	bytes = sim_bus[BUS].bytes;
+	check(read_regs(DEV_ADDR, 0x10, in, sizeof(in)) && !memcmp(in, &regs[0x10], sizeof(in)), "burst read failed");
+	printf("%s: 16 register read, one per transaction %.1f uS and %u bytes on the wire, burst %.1f uS and %u bytes\n", SIM_NAME,
+		single_ns / 1000.0, (unsigned)single_bytes, (sim_now() - start) / 1000.0, (unsigned)(sim_bus[BUS].bytes - bytes));
+
+	start = sim_now();
+	bytes = sim_bus[BUS].bytes;
+	for (uint8_t i = 0; i < sizeof(out); i++)
+	{
+		check(send_i2c_data(DEV_ADDR << 1, (unsigned char)(0x60 + i), (unsigned char)~out[i]), "single register write failed");
+	}
+	single_ns = sim_now() - start;
+	single_bytes = sim_bus[BUS].bytes - bytes;
+	for (uint8_t i = 0; i < sizeof(out); i++)
+	{
+		check(regs[0x60 + i] == (uint8_t)~out[i], "single register write stored wrong data");
+	}
+	start = sim_now();
+	bytes = sim_bus[BUS].bytes;
+	check(write_regs(DEV_ADDR, 0x60, out, sizeof(out)) && !memcmp(&regs[0x60], out, sizeof(out)), "burst write failed");
+	printf("%s: 16 register write, one per transaction %.1f uS and %u bytes on the wire, burst %.1f uS and %u bytes\n", SIM_NAME,
+		single_ns / 1000.0, (unsigned)single_bytes, (sim_now() - start) / 1000.0, (unsigned)(sim_bus[BUS].bytes - bytes));
+#endif
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/**
+* @file i2ctarget.c
+* @brief MSF I2C Library, i2c_target test and 1MHz throughput on the register simulator.
+* @note Builds i2c_target.c against tools/sim/samd with SERCOM1_Handler calling
+* i2c_target_isr, and drives it from a simulated remote master at 1MHz.
+* Checks pointer writes, data writes and on_write, a read only span,
+* a read after a repeated start, pointer wrap, and a NACK for another
+* address. Then reads and writes the whole map in one transaction and
+* prints the bus time, how long the target held SCL and the effective rate
+* against the 9 clocks per byte of an unstretched bus. Exits non zero on the
+* first wrong result. Built twice:
+*   i2ctarget      each byte takes a DRDY interrupt
+*   i2ctarget-dma  -DI2C_DMA with i2c_samd.c for the DMAC descriptors, reads
+*                  are fed by the simulated DMAC and SCL may only be held
+*                  for less than the 500nS low phase of each byte
+*
+* Build: make -C tools i2ctarget i2ctarget-dma
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sam.h>
+#include "sim/sim.h"
+#include "../i2c_target.h"
+
+#define SERCOM		1
+#define OWN_ADDR	0x2A
+#define MAP_SIZE	128
+
+static uint8_t regs[MAP_SIZE];
+static const i2c_target_range_t locked[] = { { 0, 3 } };
+static i2c_target_t target = I2C_TARGET_INIT(SERCOM, 0, 16, 17, 0x2, OWN_ADDR, regs, sizeof(regs), 1);
+static uint16_t written_first, written_count;
+static uint8_t writes;
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+static void SERCOM1_Handler(void)
+{
+	i2c_target_isr(&target);
+}
+
+static void on_write(i2c_target_t *t, uint16_t first, uint16_t count)
+{
+	(void)t;
+	written_first = first;
+	written_count = count;
+	writes++;
+}
+
+static void report(const char *what, uint16_t bytes, uint64_t ns, uint64_t stretch)
+{
+	// Address plus data, 9 clocks each, START and STOP about one clock each
+	double ideal = ((bytes + 1) * 9 + 2) * (1e9 / sim_master_hz);
+
+	printf("%s: %-5s %3u bytes  %7.1f uS  stretch %5.2f uS/byte  %6.0f bytes/s  %3.0f%% of an unstretched bus\n",
+		SIM_NAME, what, bytes, ns / 1000.0, stretch / 1000.0 / bytes, bytes * 1e9 / ns, 100.0 * ideal / ns);
+}
+
+int main(void)
+{
+	uint8_t out[MAP_SIZE + 1], in[MAP_SIZE];
+	uint64_t start, stretch;
+	uint32_t beats;
+
+	sim_init();
+	sim_master_hz = 1000000UL;
+	sim_irq(SERCOM1_IRQn, SERCOM1_Handler);
+	target.readonly = locked;
+	target.readonly_count = 1;
+	target.on_write = on_write;
+	for (uint16_t i = 0; i < MAP_SIZE; i++)
+	{
+		regs[i] = (uint8_t)(i * 3);
+	}
+	check(i2c_target_init(&target) == I2C_STATUS_OK, "init failed");
+
+	// Pointer then data, on_write sees the span at the STOP
+	out[0] = 0x10;
+	for (uint8_t i = 1; i <= 8; i++)
+	{
+		out[i] = (uint8_t)(0xA0 + i);
+	}
+	check(sim_master_write(SERCOM, OWN_ADDR, out, 9, 1), "write NACK'd");
+	check(!memcmp(&regs[0x10], &out[1], 8), "write stored wrong data");
+	check((writes == 1) && (written_first == 0x10) && (written_count == 8), "on_write span wrong");
+	check(!target.busy, "still busy after STOP");
+
+	// Read only bytes are ACK'd and dropped
+	out[0] = 0x02;
+	out[1] = 0x55;
+	out[2] = 0x66;
+	out[3] = 0x77;
+	check(sim_master_write(SERCOM, OWN_ADDR, out, 4, 1), "read only write NACK'd");
+	check((regs[2] == 6) && (regs[3] == 9) && (regs[4] == 0x77), "read only span written");
+	check(target.ro_drops == 2, "read only drops not counted");
+
+	// Pointer write, repeated start, read across the end of the map
+	out[0] = MAP_SIZE - 4;
+	check(sim_master_write(SERCOM, OWN_ADDR, out, 1, 0), "pointer write NACK'd");
+	check(sim_master_read(SERCOM, OWN_ADDR, in, 8, 1), "read NACK'd");
+	check(!memcmp(in, &regs[MAP_SIZE - 4], 4) && !memcmp(&in[4], regs, 4), "read did not wrap at the end of the map");
+	check(target.ptr == 4, "pointer wrong after read");
+
+	// Somebody else's address
+	check(!sim_master_write(SERCOM, OWN_ADDR + 1, out, 1, 1), "other address ACK'd");
+
+	// Whole map at 1MHz, one transaction each way
+	out[0] = 0x00;
+	check(sim_master_write(SERCOM, OWN_ADDR, out, 1, 0), "timed pointer write NACK'd");
+	start = sim_now();
+	stretch = sim_bus[SERCOM].stretch_ns;
+	beats = sim_stats.dma_beats;
+	check(sim_master_read(SERCOM, OWN_ADDR, in, MAP_SIZE, 1), "timed read NACK'd");
+	check(!memcmp(in, regs, MAP_SIZE), "timed read returned wrong data");
+	stretch = sim_bus[SERCOM].stretch_ns - stretch;
+	report("read", MAP_SIZE, sim_now() - start, stretch);
+#ifdef I2C_DMA
+	// Loaded inside the SCL low phase the master drives anyway, so never stretched
+	check(sim_stats.dma_beats - beats == MAP_SIZE + 1, "DMAC did not feed the read");
+	check(stretch / MAP_SIZE < 500000000UL / sim_master_hz, "DMA read held SCL past the low phase");
+#else
+	(void)beats;
+#endif
+
+	out[0] = 0x04;
+	for (uint16_t i = 1; i <= MAP_SIZE - 4; i++)
+	{
+		out[i] = (uint8_t)~i;
+	}
+	start = sim_now();
+	stretch = sim_bus[SERCOM].stretch_ns;
+	check(sim_master_write(SERCOM, OWN_ADDR, out, MAP_SIZE - 3, 1), "timed write NACK'd");
+	check(!memcmp(&regs[4], &out[1], MAP_SIZE - 4), "timed write stored wrong data");
+	report("write", MAP_SIZE - 3, sim_now() - start, sim_bus[SERCOM].stretch_ns - stretch);
+
+	printf("%s: ok, %u transactions, %u bus errors\n", SIM_NAME, (unsigned)target.transactions, target.errors);
+
+	return 0;
+}
@@ -0,0 +1,524 @@
+/**
+* @file i2ctrace.c
+* @brief MSF I2C Library, host side decoder for i2c_trace_dump output.
+* @note Reads a file holding an i2c_trace_header_t followed by its entries,
+* as sent up by the firmware, and prints one line per transaction. With -v
+* it also writes a VCD with SCL, SDA and the raw event code per bus, which
+* GTKWave opens directly and sigrok-cli decodes with
+*   sigrok-cli -I vcd -i out.vcd -P i2c:scl=scl_0:sda=sda_0 -A i2c
+* The trace holds events, not samples, so the SCL/SDA edges are laid out
+* from the event stamps: each byte fills the time between its events and
+* conditions take half a stamp tick.
+*
+* Build: cc -O2 -o i2ctrace tools/i2ctrace.c
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC		0x54433249UL
+#define TRACE_VERSION	1
+#define TRACE_DOWN		0x01
+#define TRACE_HDR_SIZE	12
+#define TRACE_ENTRY_SIZE	4
+#define TRACE_BUSES		16
+
+// Event codes, as in i2c_trace.h
+enum
+{
+	EV_START = 1, EV_RESTART, EV_STOP, EV_TX, EV_RX, EV_ACK, EV_NACK,
+	EV_TIMEOUT, EV_ARBLOST, EV_BUSERR, EV_RESET, EV_WRAP
+};
+
+static const char * const ev_name[] =
+{
+	"?", "START", "RESTART", "STOP", "TX", "RX", "ACK", "NACK",
+	"TIMEOUT", "ARBLOST", "BUSERR", "RESET", "WRAP"
+};
+
+typedef struct
+{
+	uint64_t ns;		// Unwrapped time from the first entry
+	uint8_t bus;
+	uint8_t type;
+	uint8_t data;
+} event_t;
+
+typedef struct
+{
+	uint64_t ns;
+	uint32_t seq;		// Keeps changes at the same time in program order
+	uint8_t bus;
+	uint8_t var;		// 0 scl, 1 sda, 2 event
+	uint8_t val;
+} change_t;
+
+typedef struct
+{
+	uint8_t used;
+	uint8_t open;		// Inside START ... STOP
+	uint8_t addr_next;	// Next TX is the address byte
+	uint8_t addr;		// 8 bit address of the first address byte
+	uint8_t result;		// 0 or the first error event
+	uint8_t prev;		// Type of the last event on this bus
+	uint16_t wr;
+	uint16_t rd;
+	uint64_t start;
+	uint64_t last;		// Time of the last event on this bus
+	uint64_t cursor;	// Waveform laid out up to here
+	uint8_t scl;
+	uint8_t sda;
+} bus_state_t;
+
+static change_t *changes;
+static size_t change_count;
+static size_t change_max;
+static uint64_t cond_ns;	// Width of a START, RESTART or STOP step
+
+/**
+	@brief Add Change
+	@param[in] ns Time
+	@param[in] bus Bus number
+	@param[in] var 0 scl, 1 sda, 2 event
+	@param[in] val New value
+*/
+static void add_change(uint64_t ns, uint8_t bus, uint8_t var, uint8_t val)
+{
+	if (change_count == change_max)
+	{
+		change_max = change_max ? change_max * 2 : 1024;
+		changes = realloc(changes, change_max * sizeof(*changes));
+		if (!changes)
+		{
+			fprintf(stderr, "i2ctrace: out of memory\n");
+			exit(1);
+		}
+	}
+	changes[change_count].ns = ns;
+	changes[change_count].seq = (uint32_t)change_count;
+	changes[change_count].bus = bus;
+	changes[change_count].var = var;
+	changes[change_count].val = val;
+	change_count++;
+}
+
+/**
+	@brief Set Line
+	@details Record a line change if the level differs
+*/
+static void set_line(bus_state_t *s, uint8_t bus, uint64_t ns, uint8_t var, uint8_t val)
+{
+	uint8_t *line = var ? &s->sda : &s->scl;
+
+	if (*line != val)
+	{
+		*line = val;
+		add_change(ns, bus, var, val);
+	}
+}
+
+/**
+	@brief Draw Byte
+	@details Lay out 8 data bits and the ninth ACK bit over [from, to]
+	@param[in] s Bus state
+	@param[in] bus Bus number
+	@param[in] from Window start, moved up to the cursor
+	@param[in] to Window end, stretched to fit 9 bits if too short
+	@param[in] byte Data bits, MSB first
+	@param[in] nack Level of the ninth bit
+*/
+static void draw_byte(bus_state_t *s, uint8_t bus, uint64_t from, uint64_t to, uint8_t byte, uint8_t nack)
+{
+	uint64_t bit;
+
+	if (from < s->cursor)
+	{
+		from = s->cursor;
+	}
+	if (to < from + 9 * 4)
+	{
+		to = from + 9 * 4;
+	}
+	bit = (to - from) / 9;
+
+	for (uint8_t i = 0; i < 9; i++)
+	{
+		uint64_t t = from + i * bit;
+		uint8_t level = (i < 8) ? ((byte >> (7 - i)) & 1) : nack;
+
+		set_line(s, bus, t, 1, level);			// SDA moves while SCL is low
+		set_line(s, bus, t + bit / 4, 0, 1);
+		set_line(s, bus, t + (bit * 3) / 4, 0, 0);
+	}
+	s->cursor = from + 9 * bit;
+}
+
+/**
+	@brief Draw Condition
+	@details START, RESTART or STOP at ns or the cursor, whichever is later.
+	A START on a bus that was never released is drawn as a RESTART.
+*/
+static void draw_condition(bus_state_t *s, uint8_t bus, uint64_t ns, uint8_t type)
+{
+	uint64_t t = (ns < s->cursor) ? s->cursor : ns;
+
+	if (type == EV_STOP)
+	{
+		set_line(s, bus, t, 1, 0);
+		set_line(s, bus, t + cond_ns, 0, 1);
+		set_line(s, bus, t + 2 * cond_ns, 1, 1);
+		s->cursor = t + 2 * cond_ns;
+		return;
+	}
+
+	if (!s->scl || !s->sda)
+	{
+		set_line(s, bus, t, 1, 1);
+		set_line(s, bus, t + cond_ns, 0, 1);
+		t += cond_ns;
+	}
+	set_line(s, bus, t + cond_ns, 1, 0);
+	set_line(s, bus, t + 2 * cond_ns, 0, 0);
+	s->cursor = t + 2 * cond_ns;
+}
+
+/**
+	@brief Next Event
+	@returns Index of the next event on the same bus after i, or count
+*/
+static size_t next_on_bus(const event_t *ev, size_t count, size_t i)
+{
+	for (size_t j = i + 1; j < count; j++)
+	{
+		if (ev[j].bus == ev[i].bus)
+		{
+			return j;
+		}
+	}
+	return count;
+}
+
+/**
+	@brief Print Transaction
+	@details One table line for the transaction open on a bus, then close it
+*/
+static void end_transaction(bus_state_t *s, uint8_t bus, const char *why)
+{
+	if (!s->open)
+	{
+		return;
+	}
+
+	printf("%12.3f  %3u  0x%02X  %c  %5u  %5u  %-10s %10.3f\n",
+		s->start / 1000.0, bus, s->addr >> 1, (s->addr & 1) ? 'R' : 'W',
+		s->wr, s->rd, why ? why : (s->result ? ev_name[s->result] : "OK"),
+		(s->last - s->start) / 1000.0);
+	s->open = 0;
+}
+
+/**
+	@brief Compare Changes
+	@details qsort order by time, then by the order they were made
+*/
+static int change_cmp(const void *a, const void *b)
+{
+	const change_t *x = a;
+	const change_t *y = b;
+
+	if (x->ns != y->ns)
+	{
+		return (x->ns < y->ns) ? -1 : 1;
+	}
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+/**
+	@brief Write VCD
+	@param[in] f Output file
+	@param[in] state Bus states, used flags pick the buses written
+*/
+static void write_vcd(FILE *f, const bus_state_t *state)
+{
+	uint64_t now = UINT64_MAX;
+
+	fprintf(f, "$version i2ctrace $end\n$timescale 1 ns $end\n$scope module i2c $end\n");
+	for (uint8_t b = 0; b < TRACE_BUSES; b++)
+	{
+		if (state[b].used)
+		{
+			fprintf(f, "$var wire 1 %c scl_%u $end\n", '!' + b * 3, b);
+			fprintf(f, "$var wire 1 %c sda_%u $end\n", '!' + b * 3 + 1, b);
+			fprintf(f, "$var wire 4 %c event_%u $end\n", '!' + b * 3 + 2, b);
+		}
+	}
+	fprintf(f, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+	for (uint8_t b = 0; b < TRACE_BUSES; b++)
+	{
+		if (state[b].used)
+		{
+			fprintf(f, "1%c\n1%c\nb0 %c\n", '!' + b * 3, '!' + b * 3 + 1, '!' + b * 3 + 2);
+		}
+	}
+	fprintf(f, "$end\n");
+
+	qsort(changes, change_count, sizeof(*changes), change_cmp);
+	for (size_t i = 0; i < change_count; i++)
+	{
+		const change_t *c = &changes[i];
+		char id = (char)('!' + c->bus * 3 + c->var);
+
+		if (c->ns != now)
+		{
+			now = c->ns;
+			fprintf(f, "#%llu\n", (unsigned long long)now);
+		}
+		if (c->var == 2)
+		{
+			fprintf(f, "b%u%u%u%u %c\n", (c->val >> 3) & 1, (c->val >> 2) & 1, (c->val >> 1) & 1, c->val & 1, id);
+		}
+		else
+		{
+			fprintf(f, "%u%c\n", c->val, id);
+		}
+	}
+}
+
+/**
+	@brief Read Little Endian
+*/
+static uint32_t get_le(const uint8_t *p, uint8_t bytes)
+{
+	uint32_t v = 0;
+
+	while (bytes--)
+	{
+		v = (v << 8) | p[bytes];
+	}
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	const char *vcd_name = 0;
+	const char *in_name = 0;
+	uint8_t hdr[TRACE_HDR_SIZE];
+	uint8_t raw[TRACE_ENTRY_SIZE];
+	bus_state_t state[TRACE_BUSES];
+	event_t *ev;
+	uint32_t tick_hz;
+	uint16_t count;
+	uint16_t n = 0;
+	uint8_t flags;
+	uint64_t ticks = 0;
+	uint16_t prev = 0;
+	unsigned transactions = 0;
+	FILE *f;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-v") && (i + 1 < argc))
+		{
+			vcd_name = argv[++i];
+		}
+		else if (argv[i][0] != '-' && !in_name)
+		{
+			in_name = argv[i];
+		}
+		else
+		{
+			in_name = 0;
+			break;
+		}
+	}
+	if (!in_name)
+	{
+		fprintf(stderr, "usage: i2ctrace [-v out.vcd] trace.bin\n");
+		return 2;
+	}
+
+	f = fopen(in_name, "rb");
+	if (!f || (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)))
+	{
+		fprintf(stderr, "i2ctrace: can not read %s\n", in_name);
+		return 1;
+	}
+	if ((get_le(hdr, 4) != TRACE_MAGIC) || (hdr[10] != TRACE_VERSION))
+	{
+		fprintf(stderr, "i2ctrace: %s is not a version %u trace dump\n", in_name, TRACE_VERSION);
+		return 1;
+	}
+	tick_hz = get_le(hdr + 4, 4);
+	count = (uint16_t)get_le(hdr + 8, 2);
+	flags = hdr[11];
+	if (!tick_hz)
+	{
+		fprintf(stderr, "i2ctrace: tick_hz is 0\n");
+		return 1;
+	}
+
+	// Unwrap the 16 bit stamps, a WRAP entry adds the whole wraps the gap after it took
+	ev = calloc(count ? count : 1, sizeof(*ev));
+	if (!ev)
+	{
+		fprintf(stderr, "i2ctrace: out of memory\n");
+		return 1;
+	}
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint16_t stamp;
+
+		if (fread(raw, 1, sizeof(raw), f) != sizeof(raw))
+		{
+			fprintf(stderr, "i2ctrace: %s is short, %u of %u entries\n", in_name, i, count);
+			break;
+		}
+		stamp = (uint16_t)get_le(raw, 2);
+		if (i)
+		{
+			ticks += (uint16_t)((flags & TRACE_DOWN) ? (prev - stamp) : (stamp - prev));
+		}
+		prev = stamp;
+		if ((raw[2] & 0x0F) == EV_WRAP)
+		{
+			ticks += (uint64_t)raw[3] << 16;
+			continue;
+		}
+		ev[n].ns = (ticks * 1000000000ULL) / tick_hz;
+		ev[n].bus = raw[2] >> 4;
+		ev[n].type = raw[2] & 0x0F;
+		ev[n].data = raw[3];
+		n++;
+	}
+	fclose(f);
+	count = n;
+
+	cond_ns = 500000000ULL / tick_hz;
+	if (cond_ns < 5)
+	{
+		cond_ns = 5;
+	}
+
+	memset(state, 0, sizeof(state));
+	for (uint8_t b = 0; b < TRACE_BUSES; b++)
+	{
+		state[b].scl = 1;
+		state[b].sda = 1;
+	}
+
+	printf("    start_us  bus  addr  rw  wr     rd     result        dur_us\n");
+	for (size_t i = 0; i < count; i++)
+	{
+		bus_state_t *s = &state[ev[i].bus];
+		uint8_t bus = ev[i].bus;
+		uint8_t type = ev[i].type;
+		size_t next = next_on_bus(ev, count, i);
+		uint64_t next_ns = (next < count) ? ev[next].ns : ev[i].ns;
+		uint8_t next_type = (next < count) ? ev[next].type : 0;
+
+		s->used = 1;
+		add_change(ev[i].ns, bus, 2, type);
+
+		switch (type)
+		{
+			case EV_START:
+			case EV_RESTART:
+				if (type == EV_START)
+				{
+					end_transaction(s, bus, s->open ? "NOSTOP" : 0);
+					transactions++;
+					s->open = 1;
+					s->start = ev[i].ns;
+					s->addr = 0;
+					s->result = 0;
+					s->wr = 0;
+					s->rd = 0;
+				}
+				s->addr_next = 1;
+				draw_condition(s, bus, ev[i].ns, type);
+				break;
+
+			case EV_STOP:
+				draw_condition(s, bus, ev[i].ns, type);
+				s->last = ev[i].ns;
+				end_transaction(s, bus, 0);
+				break;
+
+			case EV_TX:
+				if (s->addr_next)
+				{
+					// Keep the first address, a RESTART read of the same part shows as R
+					if (!s->addr || ((ev[i].data & 0xFE) == (s->addr & 0xFE)))
+					{
+						s->addr = ev[i].data;
+					}
+					s->addr_next = 0;
+				}
+				else
+				{
+					s->wr++;
+				}
+				draw_byte(s, bus, ev[i].ns, next_ns, ev[i].data, next_type == EV_NACK);
+				break;
+
+			case EV_RX:
+				s->rd++;
+				draw_byte(s, bus, s->last, (next_type == EV_ACK || next_type == EV_NACK) ? next_ns : ev[i].ns,
+					ev[i].data, next_type == EV_NACK);
+				break;
+
+			case EV_NACK:
+				// A NACK after a read byte is the master ending the read
+				if (s->open && !s->result && (s->prev != EV_RX))
+				{
+					s->result = EV_NACK;
+				}
+				break;
+
+			case EV_TIMEOUT:
+			case EV_ARBLOST:
+			case EV_BUSERR:
+				if (s->open && !s->result)
+				{
+					s->result = type;
+				}
+				break;
+
+			case EV_RESET:
+				s->last = ev[i].ns;
+				end_transaction(s, bus, s->result ? ev_name[s->result] : "RESET");
+				set_line(s, bus, (ev[i].ns < s->cursor) ? s->cursor : ev[i].ns, 0, 1);
+				set_line(s, bus, (ev[i].ns < s->cursor) ? s->cursor : ev[i].ns, 1, 1);
+				break;
+
+			default:
+				break;
+		}
+		s->last = ev[i].ns;
+		s->prev = type;
+	}
+	for (uint8_t b = 0; b < TRACE_BUSES; b++)
+	{
+		end_transaction(&state[b], b, "OPEN");
+	}
+	printf("%u transactions, %u events over %.3f us\n", transactions, count,
+		count ? ev[count - 1].ns / 1000.0 : 0.0);
+
+	if (vcd_name)
+	{
+		f = fopen(vcd_name, "w");
+		if (!f)
+		{
+			fprintf(stderr, "i2ctrace: can not write %s\n", vcd_name);
+			return 1;
+		}
+		write_vcd(f, state);
+		fclose(f);
+	}
+
+	free(changes);
+	free(ev);
+	return 0;
+}
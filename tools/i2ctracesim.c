@@ -0,0 +1,112 @@
+/**
+* @file i2ctracesim.c
+* @brief MSF I2C Library, i2c_trace stamps across an idle gap on the register simulator.
+* @note Builds i2c_trace.c with i2c_samd.c against tools/sim/samd, -DI2C_TRACE:
+*   i2ctracesim      default SysTick->VAL >> 4 stamps, 3MHz at 48MHz
+*   i2ctracesim-now  own I2C_TRACE_NOW on the whole SysTick, no shift
+* Sends a register write, leaves the bus idle for GAP_NS, then sends another.
+* Checks the dump header tick rate, that the gap and only the gap is
+* logged as I2C_TRACE_WRAP, and that unwrapping the stamps the way
+* tools/i2ctrace.c does gives back the gap. With a file name, also writes
+* the dump there for tools/i2ctrace.c. Exits non zero on the first wrong
+* result.
+*
+* Build: make -C tools i2ctracesim i2ctracesim-now
+* Usage: i2ctracesim [trace.bin]
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sam.h>
+#include "sim/sim.h"
+#include "../MSF_I2C.h"
+#include "../i2c_trace.h"
+
+#define DEV_ADDR	0x50
+#define GAP_NS		100000000ULL		// 100mS, several wraps of the 16 bit stamp either way
+#ifdef I2C_TRACE_NOW
+#define TICK_SHIFT	0
+#else
+#define TICK_SHIFT	4
+#endif
+
+static uint8_t regs[256];
+static sim_regs_t dev = SIM_REGS_INIT(DEV_ADDR, regs, sizeof(regs), 1);
+static i2c_trace_entry_t entries[I2C_TRACE_SIZE];
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", SIM_NAME, what);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t out[3] = { 0x20, 0x5A, 0xA5 };
+	i2c_trace_header_t hdr;
+	uint64_t ticks = 0, stop_ticks = 0, gap_ticks = 0;
+	uint16_t count, prev = 0;
+	uint8_t wraps = 0, markers = 0, starts = 0;
+	double gap_ns;
+	FILE *f;
+
+	sim_init();
+	sim_attach(0, &dev.dev);
+	init_i2c(&i2c_bus0);
+
+	check(i2c_send(&i2c_bus0, DEV_ADDR, out, sizeof(out)) == I2C_STATUS_OK, "first write failed");
+	sim_delay(GAP_NS);
+	check(i2c_send(&i2c_bus0, DEV_ADDR, out, sizeof(out)) == I2C_STATUS_OK, "second write failed");
+
+	count = i2c_trace_dump(&hdr, entries, I2C_TRACE_SIZE, sim_cpu_hz, 1);
+	check(hdr.tick_hz == (sim_cpu_hz >> TICK_SHIFT), "header tick rate is not the stamp rate");
+	check(hdr.flags == I2C_TRACE_DOWN, "SysTick stamps not flagged as counting down");
+
+	// Unwrap as tools/i2ctrace.c does, and time the STOP of the first write to the START of the second
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint8_t type = entries[i].type & 0x0F;
+
+		if (i)
+		{
+			ticks += (uint16_t)((hdr.flags & I2C_TRACE_DOWN) ? (prev - entries[i].stamp) : (entries[i].stamp - prev));
+		}
+		prev = entries[i].stamp;
+		if (type == I2C_TRACE_WRAP)
+		{
+			check(starts == 1, "stamp wrap logged inside a transaction");
+			ticks += (uint64_t)entries[i].data << 16;
+			wraps = entries[i].data;
+			markers++;
+		}
+		else if (type == I2C_TRACE_STOP)
+		{
+			stop_ticks = ticks;
+		}
+		else if ((type == I2C_TRACE_START) && (++starts == 2))
+		{
+			gap_ticks = ticks - stop_ticks;
+		}
+	}
+	check((starts == 2) && (markers == 1), "expected two writes and one stamp wrap");
+	gap_ns = gap_ticks * 1e9 / hdr.tick_hz;
+	check((gap_ns > GAP_NS) && (gap_ns < GAP_NS + 100000), "unwrapped gap does not match the idle time");
+
+	if (argc > 1)
+	{
+		f = fopen(argv[1], "wb");
+		check(f && (fwrite(&hdr, sizeof(hdr), 1, f) == 1) && (fwrite(entries, sizeof(entries[0]), count, f) == count), "dump not written");
+		fclose(f);
+	}
+
+	printf("%s: ok, %.0f mS idle read back as %.3f mS, %u stamp wraps at %u Hz\n", SIM_NAME,
+		GAP_NS / 1e6, gap_ns / 1e6, wraps, (unsigned)hdr.tick_hz);
+
+	return 0;
+}
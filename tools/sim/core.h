@@ -0,0 +1,48 @@
+/**
+* @file core.h
+* @brief MSF I2C Library, host stand in for the CMSIS core parts of sam.h.
+* @note NVIC, PRIMASK and SysTick for both stub sam.h, backed by sim.c.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_CORE_H_
+#define SIM_CORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sim.h"
+
+#define __I		volatile const
+#define __O		volatile
+#define __IO	volatile
+
+typedef enum
+{
+	DMAC_IRQn = SIM_DMAC_IRQ,
+	SERCOM0_IRQn = SIM_SERCOM_IRQ(0),
+	SERCOM1_IRQn = SIM_SERCOM_IRQ(1),
+	SERCOM2_IRQn = SIM_SERCOM_IRQ(2),
+	SERCOM3_IRQn = SIM_SERCOM_IRQ(3),
+	SERCOM4_IRQn = SIM_SERCOM_IRQ(4),
+	SERCOM5_IRQn = SIM_SERCOM_IRQ(5),
+	TC3_IRQn = SIM_TC_IRQ,
+} IRQn_Type;
+
+#define NVIC_EnableIRQ(irqn)	sim_nvic_enable((int)(irqn))
+#define __get_PRIMASK()			sim_get_primask()
+#define __set_PRIMASK(primask)	sim_set_primask(primask)
+#define __disable_irq()			sim_set_primask(1)
+#define __enable_irq()			sim_set_primask(0)
+#define __DMB()					__sync_synchronize()
+
+typedef struct
+{
+	__IO uint32_t CTRL;
+	__IO uint32_t LOAD;
+	__IO uint32_t VAL;		// 0xFFFFFF - core clocks, read from the simulated time
+	__I  uint32_t CALIB;
+} SysTick_Type;
+
+#define SysTick		((SysTick_Type *)SIM_SYSTICK_BASE)
+
+#endif /* SIM_CORE_H_ */
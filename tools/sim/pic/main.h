@@ -0,0 +1,21 @@
+/**
+* @file main.h
+* @brief MSF I2C Library, host stand in for the PIC18 application's main.h.
+* @note Oscillator and I2C pins as i2crxtx.c expects them, SCL on RC3 and
+* SDA on RC4.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_MAIN_H_
+#define SIM_MAIN_H_
+
+#include <xc.h>
+
+#define _XTAL_FREQ	SIM_PIC_FOSC
+
+#define SCL			PORTCbits.RC3
+#define SDA			PORTCbits.RC4
+#define SCL_TRIS	TRISCbits.TRISC3
+#define SDA_TRIS	TRISCbits.TRISC4
+
+#endif /* SIM_MAIN_H_ */
@@ -0,0 +1,6 @@
+/**
+* @file mcc.h
+* @brief MSF I2C Library, empty host stand in for the MCC system header.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
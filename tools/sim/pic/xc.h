@@ -0,0 +1,160 @@
+/**
+* @file xc.h
+* @brief MSF I2C Library, host stand in for the XC8 PIC18 device header.
+* @note Just what i2crxtx.c, i2c_queue.c and i2c_trace.c use: the MSSP,
+* interrupt and Timer1 registers as sim_pic_t, the bit names as bitfields
+* over them, CLRWDT, NOP and __delay_us on the simulated clock. Build with
+* -D__XC8 so the drivers take their PIC branches.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_XC_H_
+#define SIM_XC_H_
+
+#include <stdint.h>
+#include "../sim.h"
+
+typedef struct
+{
+	uint8_t SSPM:4;
+	uint8_t CKP:1;
+	uint8_t SSPEN:1;
+	uint8_t SSPOV:1;
+	uint8_t WCOL:1;
+} SSPCON1bits_t;
+
+typedef struct
+{
+	uint8_t SEN:1;
+	uint8_t RSEN:1;
+	uint8_t PEN:1;
+	uint8_t RCEN:1;
+	uint8_t ACKEN:1;
+	uint8_t ACKDT:1;
+	uint8_t ACKSTAT:1;
+	uint8_t GCEN:1;
+} SSPCON2bits_t;
+
+typedef struct
+{
+	uint8_t BF:1;
+	uint8_t UA:1;
+	uint8_t RW:1;
+	uint8_t START:1;
+	uint8_t STOP:1;
+	uint8_t DA:1;
+	uint8_t CKE:1;
+	uint8_t SMP:1;
+} SSPSTATbits_t;
+
+typedef struct
+{
+	uint8_t :3;
+	uint8_t SSPIF:1;
+	uint8_t :4;
+} PIR1bits_t;
+
+typedef struct
+{
+	uint8_t :3;
+	uint8_t BCLIF:1;
+	uint8_t :4;
+} PIR2bits_t;
+
+typedef struct
+{
+	uint8_t :3;
+	uint8_t SSPIE:1;
+	uint8_t :4;
+} PIE1bits_t;
+
+typedef struct
+{
+	uint8_t :3;
+	uint8_t BCLIE:1;
+	uint8_t :4;
+} PIE2bits_t;
+
+typedef struct
+{
+	uint8_t :6;
+	uint8_t PEIE:1;
+	uint8_t GIE:1;
+} INTCONbits_t;
+
+typedef struct
+{
+	uint8_t RC0:1;
+	uint8_t RC1:1;
+	uint8_t RC2:1;
+	uint8_t RC3:1;
+	uint8_t RC4:1;
+	uint8_t RC5:1;
+	uint8_t RC6:1;
+	uint8_t RC7:1;
+} PORTCbits_t;
+
+typedef struct
+{
+	uint8_t TRISC0:1;
+	uint8_t TRISC1:1;
+	uint8_t TRISC2:1;
+	uint8_t TRISC3:1;
+	uint8_t TRISC4:1;
+	uint8_t TRISC5:1;
+	uint8_t TRISC6:1;
+	uint8_t TRISC7:1;
+} TRISCbits_t;
+
+#define SSPCON1		(SIM_PIC->SSPCON1)
+#define SSPCON2		(SIM_PIC->SSPCON2)
+#define SSPSTAT		(SIM_PIC->SSPSTAT)
+#define SSPADD		(SIM_PIC->SSPADD)
+#define SSPBUF		(SIM_PIC->SSPBUF)
+#define PIR1		(SIM_PIC->PIR1)
+#define PIR2		(SIM_PIC->PIR2)
+#define PIE1		(SIM_PIC->PIE1)
+#define PIE2		(SIM_PIC->PIE2)
+#define INTCON		(SIM_PIC->INTCON)
+#define PORTC		(SIM_PIC->PORTC)
+#define TRISC		(SIM_PIC->TRISC)
+#define TMR1		(SIM_PIC->TMR1)
+
+#define SSPCON1bits	(*(volatile SSPCON1bits_t *)&SSPCON1)
+#define SSPCON2bits	(*(volatile SSPCON2bits_t *)&SSPCON2)
+#define SSPSTATbits	(*(volatile SSPSTATbits_t *)&SSPSTAT)
+#define PIR1bits	(*(volatile PIR1bits_t *)&PIR1)
+#define PIR2bits	(*(volatile PIR2bits_t *)&PIR2)
+#define PIE1bits	(*(volatile PIE1bits_t *)&PIE1)
+#define PIE2bits	(*(volatile PIE2bits_t *)&PIE2)
+#define INTCONbits	(*(volatile INTCONbits_t *)&INTCON)
+#define PORTCbits	(*(volatile PORTCbits_t *)&PORTC)
+#define TRISCbits	(*(volatile TRISCbits_t *)&TRISC)
+
+#define SSPEN		SSPCON1bits.SSPEN
+#define WCOL		SSPCON1bits.WCOL
+#define SSPOV		SSPCON1bits.SSPOV
+#define SEN			SSPCON2bits.SEN
+#define RSEN		SSPCON2bits.RSEN
+#define PEN			SSPCON2bits.PEN
+#define RCEN		SSPCON2bits.RCEN
+#define ACKEN		SSPCON2bits.ACKEN
+#define ACKDT		SSPCON2bits.ACKDT
+#define ACKSTAT		SSPCON2bits.ACKSTAT
+#define BF			SSPSTATbits.BF
+#define RW			SSPSTATbits.RW
+#define START		SSPSTATbits.START
+#define STOP		SSPSTATbits.STOP
+#define SSPIF		PIR1bits.SSPIF
+#define BCLIF		PIR2bits.BCLIF
+#define SSPIE		PIE1bits.SSPIE
+#define BCLIE		PIE2bits.BCLIE
+#define PEIE		INTCONbits.PEIE
+#define GIE			INTCONbits.GIE
+
+#define CLRWDT()		((void)0)
+#define NOP()			sim_delay(4000000000ULL / SIM_PIC_FOSC)
+#define __delay_us(x)	sim_delay((uint64_t)(x) * 1000ULL)
+#define __delay_ms(x)	sim_delay((uint64_t)(x) * 1000000ULL)
+
+#endif /* SIM_XC_H_ */
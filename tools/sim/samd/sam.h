@@ -0,0 +1,337 @@
+/**
+* @file sam.h
+* @brief MSF I2C Library, host stand in for the SAMD21 device pack header.
+* @note Just what i2c_samd.c, i2c_target.c, i2c_queue.c and i2c_trace.c use,
+* with the register layout and field macros of the DFP (sercom_registers_t,
+* SERCOM_I2CM_CTRLA_ENABLE(value), _Msk). The blocks sit where sim.c maps
+* them, see sim.h. The DMAC is here for I2C_DMA builds, descriptors hold 32
+* bit addresses so those link with -no-pie.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_SAM_H_
+#define SIM_SAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../core.h"
+
+//-----------------------------------------------------------------------------
+// SERCOM
+//-----------------------------------------------------------------------------
+
+typedef struct
+{
+	__IO uint32_t SERCOM_CTRLA;
+	__IO uint32_t SERCOM_CTRLB;
+	__I  uint8_t  Reserved1[0x4];
+	__IO uint32_t SERCOM_BAUD;
+	__I  uint8_t  Reserved2[0x4];
+	__IO uint8_t  SERCOM_INTENCLR;
+	__I  uint8_t  Reserved3[0x1];
+	__IO uint8_t  SERCOM_INTENSET;
+	__I  uint8_t  Reserved4[0x1];
+	__IO uint8_t  SERCOM_INTFLAG;
+	__I  uint8_t  Reserved5[0x1];
+	__IO uint16_t SERCOM_STATUS;
+	__I  uint32_t SERCOM_SYNCBUSY;
+	__I  uint8_t  Reserved6[0x4];
+	__IO uint32_t SERCOM_ADDR;
+	__IO uint8_t  SERCOM_DATA;
+	__I  uint8_t  Reserved7[0x7];
+	__IO uint8_t  SERCOM_DBGCTRL;
+} sercom_i2cm_registers_t;
+
+typedef struct
+{
+	__IO uint32_t SERCOM_CTRLA;
+	__IO uint32_t SERCOM_CTRLB;
+	__I  uint8_t  Reserved1[0xC];
+	__IO uint8_t  SERCOM_INTENCLR;
+	__I  uint8_t  Reserved2[0x1];
+	__IO uint8_t  SERCOM_INTENSET;
+	__I  uint8_t  Reserved3[0x1];
+	__IO uint8_t  SERCOM_INTFLAG;
+	__I  uint8_t  Reserved4[0x1];
+	__IO uint16_t SERCOM_STATUS;
+	__I  uint32_t SERCOM_SYNCBUSY;
+	__I  uint8_t  Reserved5[0x4];
+	__IO uint32_t SERCOM_ADDR;
+	__IO uint8_t  SERCOM_DATA;
+} sercom_i2cs_registers_t;
+
+typedef union
+{
+	sercom_i2cm_registers_t I2CM;
+	sercom_i2cs_registers_t I2CS;
+} sercom_registers_t;
+
+_Static_assert(offsetof(sercom_i2cm_registers_t, SERCOM_BAUD) == 0x0C, "BAUD offset");
+_Static_assert(offsetof(sercom_i2cm_registers_t, SERCOM_INTFLAG) == 0x18, "INTFLAG offset");
+_Static_assert(offsetof(sercom_i2cm_registers_t, SERCOM_STATUS) == 0x1A, "STATUS offset");
+_Static_assert(offsetof(sercom_i2cm_registers_t, SERCOM_ADDR) == 0x24, "ADDR offset");
+_Static_assert(offsetof(sercom_i2cm_registers_t, SERCOM_DATA) == 0x28, "DATA offset");
+_Static_assert(offsetof(sercom_i2cs_registers_t, SERCOM_ADDR) == 0x24, "I2CS ADDR offset");
+_Static_assert(offsetof(sercom_i2cs_registers_t, SERCOM_DATA) == 0x28, "I2CS DATA offset");
+
+#define SERCOM_INST_NUM		SIM_SERCOM_NUM
+#define SERCOM0_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (0 * SIM_SERCOM_SIZE)))
+#define SERCOM1_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (1 * SIM_SERCOM_SIZE)))
+#define SERCOM2_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (2 * SIM_SERCOM_SIZE)))
+#define SERCOM3_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (3 * SIM_SERCOM_SIZE)))
+#define SERCOM4_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (4 * SIM_SERCOM_SIZE)))
+#define SERCOM5_REGS		((sercom_registers_t *)(SIM_SERCOM_BASE + (5 * SIM_SERCOM_SIZE)))
+
+// I2CM
+#define SERCOM_I2CM_CTRLA_ENABLE(value)		(((uint32_t)(value) & 0x1UL) << 1)
+#define SERCOM_I2CM_CTRLA_MODE_I2C_MASTER	(0x5UL << 2)
+#define SERCOM_I2CM_CTRLA_SDAHOLD(value)	(((uint32_t)(value) & 0x3UL) << 20)
+#define SERCOM_I2CM_CTRLA_SPEED_Msk			(0x3UL << 24)
+#define SERCOM_I2CM_CTRLA_SPEED(value)		(((uint32_t)(value) & 0x3UL) << 24)
+#define SERCOM_I2CM_CTRLA_LOWTOUTEN(value)	(((uint32_t)(value) & 0x1UL) << 30)
+
+#define SERCOM_I2CM_CTRLB_SMEN(value)		(((uint32_t)(value) & 0x1UL) << 8)
+#define SERCOM_I2CM_CTRLB_QCEN(value)		(((uint32_t)(value) & 0x1UL) << 9)
+#define SERCOM_I2CM_CTRLB_CMD(value)		(((uint32_t)(value) & 0x3UL) << 16)
+#define SERCOM_I2CM_CTRLB_ACKACT(value)		(((uint32_t)(value) & 0x1UL) << 18)
+
+#define SERCOM_I2CM_INTFLAG_MB(value)		(((uint8_t)(value) & 0x1U) << 0)
+#define SERCOM_I2CM_INTFLAG_SB(value)		(((uint8_t)(value) & 0x1U) << 1)
+#define SERCOM_I2CM_INTFLAG_ERROR(value)	(((uint8_t)(value) & 0x1U) << 7)
+#define SERCOM_I2CM_INTENSET_MB(value)		SERCOM_I2CM_INTFLAG_MB(value)
+#define SERCOM_I2CM_INTENSET_SB(value)		SERCOM_I2CM_INTFLAG_SB(value)
+#define SERCOM_I2CM_INTENSET_ERROR(value)	SERCOM_I2CM_INTFLAG_ERROR(value)
+#define SERCOM_I2CM_INTENCLR_MB(value)		SERCOM_I2CM_INTFLAG_MB(value)
+#define SERCOM_I2CM_INTENCLR_SB(value)		SERCOM_I2CM_INTFLAG_SB(value)
+#define SERCOM_I2CM_INTENCLR_ERROR(value)	SERCOM_I2CM_INTFLAG_ERROR(value)
+
+#define SERCOM_I2CM_STATUS_BUSERR(value)	(((uint16_t)(value) & 0x1U) << 0)
+#define SERCOM_I2CM_STATUS_ARBLOST(value)	(((uint16_t)(value) & 0x1U) << 1)
+#define SERCOM_I2CM_STATUS_RXNACK(value)	(((uint16_t)(value) & 0x1U) << 2)
+#define SERCOM_I2CM_STATUS_BUSSTATE_Msk		(0x3U << 4)
+#define SERCOM_I2CM_STATUS_BUSSTATE(value)	(((uint16_t)(value) & 0x3U) << 4)
+#define SERCOM_I2CM_STATUS_LOWTOUT(value)	(((uint16_t)(value) & 0x1U) << 6)
+#define SERCOM_I2CM_STATUS_LENERR(value)	(((uint16_t)(value) & 0x1U) << 10)
+
+#define SERCOM_I2CM_SYNCBUSY_SWRST(value)	(((uint32_t)(value) & 0x1UL) << 0)
+#define SERCOM_I2CM_SYNCBUSY_ENABLE(value)	(((uint32_t)(value) & 0x1UL) << 1)
+#define SERCOM_I2CM_SYNCBUSY_SYSOP(value)	(((uint32_t)(value) & 0x1UL) << 2)
+
+#define SERCOM_I2CM_ADDR_ADDR(value)		((uint32_t)(value) & 0x7FFUL)
+#define SERCOM_I2CM_ADDR_LENEN(value)		(((uint32_t)(value) & 0x1UL) << 13)
+#define SERCOM_I2CM_ADDR_HS(value)			(((uint32_t)(value) & 0x1UL) << 14)
+#define SERCOM_I2CM_ADDR_LEN(value)			(((uint32_t)(value) & 0xFFUL) << 16)
+
+// I2CS
+#define SERCOM_I2CS_CTRLA_ENABLE(value)		(((uint32_t)(value) & 0x1UL) << 1)
+#define SERCOM_I2CS_CTRLA_MODE_I2C_SLAVE	(0x4UL << 2)
+#define SERCOM_I2CS_CTRLA_SDAHOLD(value)	(((uint32_t)(value) & 0x3UL) << 20)
+#define SERCOM_I2CS_CTRLA_SPEED(value)		(((uint32_t)(value) & 0x3UL) << 24)
+
+#define SERCOM_I2CS_CTRLB_SMEN(value)		(((uint32_t)(value) & 0x1UL) << 8)
+#define SERCOM_I2CS_CTRLB_CMD(value)		(((uint32_t)(value) & 0x3UL) << 16)
+#define SERCOM_I2CS_CTRLB_CMD_Msk			(0x3UL << 16)
+#define SERCOM_I2CS_CTRLB_ACKACT(value)		(((uint32_t)(value) & 0x1UL) << 18)
+
+#define SERCOM_I2CS_INTFLAG_PREC(value)		(((uint8_t)(value) & 0x1U) << 0)
+#define SERCOM_I2CS_INTFLAG_AMATCH(value)	(((uint8_t)(value) & 0x1U) << 1)
+#define SERCOM_I2CS_INTFLAG_DRDY(value)		(((uint8_t)(value) & 0x1U) << 2)
+#define SERCOM_I2CS_INTFLAG_ERROR(value)	(((uint8_t)(value) & 0x1U) << 7)
+#define SERCOM_I2CS_INTENSET_PREC(value)	SERCOM_I2CS_INTFLAG_PREC(value)
+#define SERCOM_I2CS_INTENSET_AMATCH(value)	SERCOM_I2CS_INTFLAG_AMATCH(value)
+#define SERCOM_I2CS_INTENSET_DRDY(value)	SERCOM_I2CS_INTFLAG_DRDY(value)
+#define SERCOM_I2CS_INTENSET_ERROR(value)	SERCOM_I2CS_INTFLAG_ERROR(value)
+
+#define SERCOM_I2CS_STATUS_BUSERR(value)	(((uint16_t)(value) & 0x1U) << 0)
+#define SERCOM_I2CS_STATUS_COLL(value)		(((uint16_t)(value) & 0x1U) << 1)
+#define SERCOM_I2CS_STATUS_RXNACK(value)	(((uint16_t)(value) & 0x1U) << 2)
+#define SERCOM_I2CS_STATUS_DIR(value)		(((uint16_t)(value) & 0x1U) << 3)
+#define SERCOM_I2CS_STATUS_SR(value)		(((uint16_t)(value) & 0x1U) << 4)
+
+#define SERCOM_I2CS_SYNCBUSY_ENABLE(value)	(((uint32_t)(value) & 0x1UL) << 1)
+
+#define SERCOM_I2CS_ADDR_ADDR(value)		(((uint32_t)(value) & 0x3FFUL) << 1)
+
+//-----------------------------------------------------------------------------
+// DMAC
+//-----------------------------------------------------------------------------
+
+typedef struct
+{
+	__IO uint16_t DMAC_BTCTRL;
+	__IO uint16_t DMAC_BTCNT;
+	__IO uint32_t DMAC_SRCADDR;
+	__IO uint32_t DMAC_DSTADDR;
+	__IO uint32_t DMAC_DESCADDR;
+} dmac_descriptor_registers_t;
+
+typedef struct
+{
+	__IO uint16_t DMAC_CTRL;
+	__IO uint16_t DMAC_CRCCTRL;
+	__IO uint32_t DMAC_CRCDATAIN;
+	__IO uint32_t DMAC_CRCCHKSUM;
+	__IO uint8_t  DMAC_CRCSTATUS;
+	__IO uint8_t  DMAC_DBGCTRL;
+	__IO uint8_t  DMAC_QOSCTRL;
+	__I  uint8_t  Reserved1[0x1];
+	__IO uint32_t DMAC_SWTRIGCTRL;
+	__IO uint32_t DMAC_PRICTRL0;
+	__I  uint8_t  Reserved2[0x8];
+	__IO uint16_t DMAC_INTPEND;
+	__I  uint8_t  Reserved3[0x2];
+	__I  uint32_t DMAC_INTSTATUS;
+	__I  uint32_t DMAC_BUSYCH;
+	__I  uint32_t DMAC_PENDCH;
+	__I  uint32_t DMAC_ACTIVE;
+	__IO uint32_t DMAC_BASEADDR;
+	__IO uint32_t DMAC_WRBADDR;
+	__I  uint8_t  Reserved4[0x3];
+	__IO uint8_t  DMAC_CHID;
+	__IO uint8_t  DMAC_CHCTRLA;
+	__I  uint8_t  Reserved5[0x3];
+	__IO uint32_t DMAC_CHCTRLB;
+	__I  uint8_t  Reserved6[0x4];
+	__IO uint8_t  DMAC_CHINTENCLR;
+	__IO uint8_t  DMAC_CHINTENSET;
+	__IO uint8_t  DMAC_CHINTFLAG;
+	__I  uint8_t  DMAC_CHSTATUS;
+} dmac_registers_t;
+
+_Static_assert(sizeof(dmac_descriptor_registers_t) == 16, "DMAC descriptor size");
+_Static_assert(offsetof(dmac_registers_t, DMAC_BASEADDR) == 0x34, "DMAC BASEADDR offset");
+_Static_assert(offsetof(dmac_registers_t, DMAC_CHID) == 0x3F, "DMAC CHID offset");
+_Static_assert(offsetof(dmac_registers_t, DMAC_CHCTRLB) == 0x44, "DMAC CHCTRLB offset");
+_Static_assert(offsetof(dmac_registers_t, DMAC_CHINTFLAG) == 0x4E, "DMAC CHINTFLAG offset");
+
+#define DMAC_REGS						((dmac_registers_t *)SIM_DMAC_BASE)
+#define DMAC_CTRL_DMAENABLE_Msk			(0x1U << 1)
+#define DMAC_CTRL_DMAENABLE(value)		(((uint16_t)(value) & 0x1U) << 1)
+#define DMAC_CTRL_LVLEN0(value)			(((uint16_t)(value) & 0x1U) << 8)
+#define DMAC_CHCTRLA_ENABLE(value)		(((uint8_t)(value) & 0x1U) << 1)
+#define DMAC_CHCTRLB_TRIGSRC(value)		(((uint32_t)(value) & 0x3FUL) << 8)
+#define DMAC_CHCTRLB_TRIGACT_BEAT		(0x2UL << 22)
+#define DMAC_CHINTFLAG_TERR(value)		(((uint8_t)(value) & 0x1U) << 0)
+#define DMAC_CHINTFLAG_TCMPL(value)		(((uint8_t)(value) & 0x1U) << 1)
+#define DMAC_CHINTENSET_TERR(value)		DMAC_CHINTFLAG_TERR(value)
+#define DMAC_CHINTENSET_TCMPL(value)	DMAC_CHINTFLAG_TCMPL(value)
+#define DMAC_BTCTRL_VALID(value)		(((uint16_t)(value) & 0x1U) << 0)
+#define DMAC_BTCTRL_BEATSIZE_BYTE		(0x0U << 8)
+#define DMAC_BTCTRL_SRCINC(value)		(((uint16_t)(value) & 0x1U) << 10)
+#define DMAC_BTCTRL_DSTINC(value)		(((uint16_t)(value) & 0x1U) << 11)
+
+#define SERCOM0_DMAC_ID_RX				0x01U	// SERCOMn is 0x01 + 2n, TX one above
+#define SERCOM0_DMAC_ID_TX				0x02U
+
+//-----------------------------------------------------------------------------
+// PORT, modelled by sim.c, then PM, GCLK and TC3, plain memory
+//-----------------------------------------------------------------------------
+
+typedef struct
+{
+	__IO uint32_t PORT_DIR;
+	__IO uint32_t PORT_DIRCLR;
+	__IO uint32_t PORT_DIRSET;
+	__IO uint32_t PORT_DIRTGL;
+	__IO uint32_t PORT_OUT;
+	__IO uint32_t PORT_OUTCLR;
+	__IO uint32_t PORT_OUTSET;
+	__IO uint32_t PORT_OUTTGL;
+	__I  uint32_t PORT_IN;
+	__IO uint32_t PORT_CTRL;
+	__O  uint32_t PORT_WRCONFIG;
+	__I  uint8_t  Reserved1[0x4];
+	__IO uint8_t  PORT_PMUX[16];
+	__IO uint8_t  PORT_PINCFG[32];
+	__I  uint8_t  Reserved2[0x20];
+} port_group_registers_t;
+
+typedef struct
+{
+	port_group_registers_t GROUP[2];
+} port_registers_t;
+
+_Static_assert(offsetof(port_group_registers_t, PORT_IN) == 0x20, "PORT IN offset");
+_Static_assert(offsetof(port_group_registers_t, PORT_PINCFG) == 0x40, "PORT PINCFG offset");
+_Static_assert(sizeof(port_group_registers_t) == 0x80, "PORT group size");
+
+#define PORT_REGS				((port_registers_t *)SIM_PORT_BASE)
+#define PORT_PMUX_PMUXE_Msk		(0xFU << 0)
+#define PORT_PMUX_PMUXE(value)	((uint8_t)(value) & 0xFU)
+#define PORT_PMUX_PMUXO_Msk		(0xFU << 4)
+#define PORT_PMUX_PMUXO(value)	(((uint8_t)(value) & 0xFU) << 4)
+#define PORT_PINCFG_PMUXEN(value)	((uint8_t)(value) & 0x1U)
+#define PORT_PINCFG_INEN(value)		(((uint8_t)(value) & 0x1U) << 1)
+
+typedef struct
+{
+	__IO uint8_t  PM_CTRL;
+	__I  uint8_t  Reserved1[0x13];
+	__IO uint32_t PM_AHBMASK;
+	__IO uint32_t PM_APBAMASK;
+	__IO uint32_t PM_APBBMASK;
+	__IO uint32_t PM_APBCMASK;
+} pm_registers_t;
+
+#define PM_REGS						((pm_registers_t *)SIM_PM_BASE)
+#define PM_AHBMASK_DMAC(value)		(((uint32_t)(value) & 0x1UL) << 5)
+#define PM_APBBMASK_DMAC(value)		(((uint32_t)(value) & 0x1UL) << 4)
+#define PM_APBCMASK_SERCOM0(value)	(((uint32_t)(value) & 0x1UL) << 2)
+#define PM_APBCMASK_TC3(value)		(((uint32_t)(value) & 0x1UL) << 11)
+
+typedef struct
+{
+	__IO uint8_t  GCLK_CTRL;
+	__I  uint8_t  GCLK_STATUS;
+	__IO uint16_t GCLK_CLKCTRL;
+	__IO uint32_t GCLK_GENCTRL;
+	__IO uint32_t GCLK_GENDIV;
+} gclk_registers_t;
+
+#define GCLK_REGS						((gclk_registers_t *)SIM_GCLK_BASE)
+#define GCLK_CLKCTRL_ID(value)			((uint16_t)(value) & 0x3FU)
+#define GCLK_CLKCTRL_ID_SERCOM0_CORE_Val	0x14U
+#define GCLK_CLKCTRL_GEN(value)			(((uint16_t)(value) & 0xFU) << 8)
+#define GCLK_CLKCTRL_CLKEN(value)		(((uint16_t)(value) & 0x1U) << 14)
+#define GCLK_CLKCTRL_ID_TCC2_TC3		GCLK_CLKCTRL_ID(0x1BU)
+#define GCLK_CLKCTRL_GEN_GCLK0			GCLK_CLKCTRL_GEN(0U)
+
+// TC3 counts nothing, sim_timer raises its interrupt
+typedef struct
+{
+	__IO uint16_t TC_CTRLA;
+	__IO uint16_t TC_READREQ;
+	__IO uint8_t  TC_CTRLBCLR;
+	__IO uint8_t  TC_CTRLBSET;
+	__IO uint8_t  TC_CTRLC;
+	__I  uint8_t  Reserved1[0x1];
+	__IO uint8_t  TC_DBGCTRL;
+	__I  uint8_t  Reserved2[0x1];
+	__IO uint16_t TC_EVCTRL;
+	__IO uint8_t  TC_INTENCLR;
+	__IO uint8_t  TC_INTENSET;
+	__IO uint8_t  TC_INTFLAG;
+	__I  uint8_t  TC_STATUS;
+	__IO uint16_t TC_COUNT;
+	__I  uint8_t  Reserved3[0x6];
+	__IO uint16_t TC_CC[2];
+} tc_count16_registers_t;
+
+typedef union
+{
+	tc_count16_registers_t COUNT16;
+} tc_registers_t;
+
+_Static_assert(offsetof(tc_count16_registers_t, TC_CC) == 0x18, "TC CC offset");
+
+#define TC3_REGS					((tc_registers_t *)SIM_TC_BASE)
+#define TC_CTRLA_ENABLE(value)		(((uint16_t)(value) & 0x1U) << 1)
+#define TC_CTRLA_MODE_COUNT16		(0x0U << 2)
+#define TC_CTRLA_WAVEGEN_MFRQ		(0x1U << 5)
+#define TC_CTRLA_PRESCALER(value)	(((uint16_t)(value) & 0x7U) << 8)
+#define TC_CTRLA_PRESCALER_Msk		(0x7U << 8)
+#define TC_INTENSET_MC0(value)		(((uint8_t)(value) & 0x1U) << 4)
+#define TC_INTFLAG_MC0(value)		(((uint8_t)(value) & 0x1U) << 4)
+#define TC_STATUS_SYNCBUSY(value)	(((uint8_t)(value) & 0x1U) << 7)
+
+#endif /* SIM_SAM_H_ */
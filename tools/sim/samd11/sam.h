@@ -0,0 +1,206 @@
+/**
+* @file sam.h
+* @brief MSF I2C Library, host stand in for the SAMD11 ASF/CMSIS header.
+* @note Just what MSF_SAMD11_I2C.c uses, in the older style: Sercom with
+* .reg/.bit unions, argumentless bit macros and PORT->Group[n]. SERCOM0 to
+* SERCOM2 sit where sim.c maps them, see sim.h.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_SAM_H_
+#define SIM_SAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../core.h"
+
+//-----------------------------------------------------------------------------
+// SERCOM I2CM
+//-----------------------------------------------------------------------------
+
+typedef union
+{
+	struct
+	{
+		uint32_t SWRST:1;
+		uint32_t ENABLE:1;
+		uint32_t MODE:3;
+		uint32_t :2;
+		uint32_t RUNSTDBY:1;
+		uint32_t :8;
+		uint32_t PINOUT:1;
+		uint32_t :3;
+		uint32_t SDAHOLD:2;
+		uint32_t MEXTTOEN:1;
+		uint32_t SEXTTOEN:1;
+		uint32_t SPEED:2;
+		uint32_t :1;
+		uint32_t SCLSM:1;
+		uint32_t INACTOUT:2;
+		uint32_t LOWTOUTEN:1;
+		uint32_t :1;
+	} bit;
+	uint32_t reg;
+} SERCOM_I2CM_CTRLA_Type;
+
+typedef union
+{
+	struct
+	{
+		uint16_t BUSERR:1;
+		uint16_t ARBLOST:1;
+		uint16_t RXNACK:1;
+		uint16_t :1;
+		uint16_t BUSSTATE:2;
+		uint16_t LOWTOUT:1;
+		uint16_t CLKHOLD:1;
+		uint16_t MEXTTOUT:1;
+		uint16_t SEXTTOUT:1;
+		uint16_t LENERR:1;
+		uint16_t :5;
+	} bit;
+	uint16_t reg;
+} SERCOM_I2CM_STATUS_Type;
+
+typedef union
+{
+	struct
+	{
+		uint8_t MB:1;
+		uint8_t SB:1;
+		uint8_t :5;
+		uint8_t ERROR:1;
+	} bit;
+	uint8_t reg;
+} SERCOM_I2CM_INTFLAG_Type;
+
+typedef union { uint32_t reg; } SERCOM_I2CM_CTRLB_Type;
+typedef union { uint32_t reg; } SERCOM_I2CM_BAUD_Type;
+typedef union { uint8_t reg; } SERCOM_I2CM_INTENCLR_Type;
+typedef union { uint8_t reg; } SERCOM_I2CM_INTENSET_Type;
+typedef union { uint32_t reg; } SERCOM_I2CM_SYNCBUSY_Type;
+typedef union { uint32_t reg; } SERCOM_I2CM_ADDR_Type;
+typedef union { uint8_t reg; } SERCOM_I2CM_DATA_Type;
+
+typedef struct
+{
+	__IO SERCOM_I2CM_CTRLA_Type    CTRLA;
+	__IO SERCOM_I2CM_CTRLB_Type    CTRLB;
+	uint8_t                        Reserved1[0x4];
+	__IO SERCOM_I2CM_BAUD_Type     BAUD;
+	uint8_t                        Reserved2[0x4];
+	__IO SERCOM_I2CM_INTENCLR_Type INTENCLR;
+	uint8_t                        Reserved3[0x1];
+	__IO SERCOM_I2CM_INTENSET_Type INTENSET;
+	uint8_t                        Reserved4[0x1];
+	__IO SERCOM_I2CM_INTFLAG_Type  INTFLAG;
+	uint8_t                        Reserved5[0x1];
+	__IO SERCOM_I2CM_STATUS_Type   STATUS;
+	__I  SERCOM_I2CM_SYNCBUSY_Type SYNCBUSY;
+	uint8_t                        Reserved6[0x4];
+	__IO SERCOM_I2CM_ADDR_Type     ADDR;
+	__IO SERCOM_I2CM_DATA_Type     DATA;
+} SercomI2cm;
+
+typedef union
+{
+	SercomI2cm I2CM;
+} Sercom;
+
+_Static_assert(offsetof(SercomI2cm, INTFLAG) == 0x18, "INTFLAG offset");
+_Static_assert(offsetof(SercomI2cm, STATUS) == 0x1A, "STATUS offset");
+_Static_assert(offsetof(SercomI2cm, ADDR) == 0x24, "ADDR offset");
+_Static_assert(offsetof(SercomI2cm, DATA) == 0x28, "DATA offset");
+
+#define SERCOM_INST_NUM		3
+#define SERCOM0				((Sercom *)(SIM_SERCOM_BASE + (0 * SIM_SERCOM_SIZE)))
+#define SERCOM1				((Sercom *)(SIM_SERCOM_BASE + (1 * SIM_SERCOM_SIZE)))
+#define SERCOM2				((Sercom *)(SIM_SERCOM_BASE + (2 * SIM_SERCOM_SIZE)))
+
+#define SERCOM_I2CM_CTRLA_MODE_I2C_MASTER	(0x5ul << 2)
+#define SERCOM_I2CM_CTRLA_SPEED(value)		(((uint32_t)(value) & 0x3ul) << 24)
+#define SERCOM_I2CM_CTRLB_SMEN				(0x1ul << 8)
+#define SERCOM_I2CM_CTRLB_QCEN				(0x1ul << 9)
+#define SERCOM_I2CM_CTRLB_CMD(value)		(((uint32_t)(value) & 0x3ul) << 16)
+#define SERCOM_I2CM_CTRLB_ACKACT			(0x1ul << 18)
+#define SERCOM_I2CM_INTFLAG_MB				(0x1ul << 0)
+#define SERCOM_I2CM_INTFLAG_SB				(0x1ul << 1)
+#define SERCOM_I2CM_INTFLAG_ERROR			(0x1ul << 7)
+#define SERCOM_I2CM_INTENSET_MB				(0x1ul << 0)
+#define SERCOM_I2CM_INTENSET_SB				(0x1ul << 1)
+#define SERCOM_I2CM_STATUS_BUSERR			(0x1ul << 0)
+#define SERCOM_I2CM_STATUS_ARBLOST			(0x1ul << 1)
+#define SERCOM_I2CM_STATUS_RXNACK			(0x1ul << 2)
+#define SERCOM_I2CM_SYNCBUSY_ENABLE			(0x1ul << 1)
+#define SERCOM_I2CM_SYNCBUSY_SYSOP			(0x1ul << 2)
+#define SERCOM_I2CM_ADDR_HS					(0x1ul << 14)
+
+//-----------------------------------------------------------------------------
+// PORT, modelled by sim.c, then PM and GCLK, plain memory
+//-----------------------------------------------------------------------------
+
+typedef union { uint32_t reg; } PORT_REG_Type;
+typedef union { uint8_t reg; } PORT_REG8_Type;
+
+typedef struct
+{
+	__IO PORT_REG_Type DIR;
+	__IO PORT_REG_Type DIRCLR;
+	__IO PORT_REG_Type DIRSET;
+	__IO PORT_REG_Type DIRTGL;
+	__IO PORT_REG_Type OUT;
+	__IO PORT_REG_Type OUTCLR;
+	__IO PORT_REG_Type OUTSET;
+	__IO PORT_REG_Type OUTTGL;
+	__I  PORT_REG_Type IN;
+	__IO PORT_REG_Type CTRL;
+	__O  PORT_REG_Type WRCONFIG;
+	uint8_t            Reserved1[0x4];
+	__IO PORT_REG8_Type PMUX[16];
+	__IO PORT_REG8_Type PINCFG[32];
+	uint8_t            Reserved2[0x20];
+} PortGroup;
+
+typedef struct
+{
+	PortGroup Group[2];
+} Port;
+
+_Static_assert(offsetof(PortGroup, IN) == 0x20, "PORT IN offset");
+_Static_assert(offsetof(PortGroup, PINCFG) == 0x40, "PORT PINCFG offset");
+_Static_assert(sizeof(PortGroup) == 0x80, "PORT group size");
+
+#define PORT						((Port *)SIM_PORT_BASE)
+#define PORT_WRCONFIG_PINMASK(value)	((uint32_t)(value) & 0xFFFFul)
+#define PORT_WRCONFIG_PMUXEN		(0x1ul << 16)
+#define PORT_WRCONFIG_PMUX(value)	(((uint32_t)(value) & 0xFul) << 24)
+#define PORT_WRCONFIG_WRPMUX		(0x1ul << 28)
+#define PORT_WRCONFIG_WRPINCFG		(0x1ul << 30)
+#define PORT_WRCONFIG_HWSEL			(0x1ul << 31)
+#define PORT_PINCFG_PMUXEN			(0x1u << 0)
+#define PORT_PINCFG_INEN			(0x1u << 1)
+
+typedef struct
+{
+	uint8_t              Reserved1[0x20];
+	__IO PORT_REG_Type   APBCMASK;
+} Pm;
+
+#define PM							((Pm *)SIM_PM_BASE)
+#define PM_APBCMASK_SERCOM0			(0x1ul << 2)
+
+typedef union { uint16_t reg; } GCLK_CLKCTRL_Type;
+
+typedef struct
+{
+	uint8_t                 Reserved1[0x2];
+	__IO GCLK_CLKCTRL_Type  CLKCTRL;
+} Gclk;
+
+#define GCLK						((Gclk *)SIM_GCLK_BASE)
+#define GCLK_CLKCTRL_ID(value)		((uint16_t)(value) & 0x3Fu)
+#define GCLK_CLKCTRL_ID_SERCOM0_CORE	0x0Eu
+#define GCLK_CLKCTRL_GEN(value)		(((uint16_t)(value) & 0xFu) << 8)
+#define GCLK_CLKCTRL_CLKEN			(0x1u << 14)
+
+#endif /* SIM_SAM_H_ */
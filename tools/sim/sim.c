@@ -0,0 +1,2028 @@
+/**
+* @file sim.c
+* @brief MSF I2C Library, host register simulator, see sim.h.
+* @note A driver access to a guarded page raises SIGSEGV. The handler runs
+* the model up to the access, opens the pages and sets the trap flag, so the
+* instruction completes and raises SIGTRAP, where the model sees what was
+* written or read and the pages are closed again. The model itself only runs
+* inside those handlers, sim_idle and the remote master calls, never while
+* a driver handler is running.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include "sim.h"
+
+#define SIM_EFLAGS_TF	0x100UL
+#define SIM_PF_WRITE	0x2UL		// Page fault error code, access was a write
+#define SIM_POLLS		8			// Status registers read since the last write
+
+// SERCOM register offsets, the same for I2CM and I2CS
+#define R_CTRLA		0x00
+#define R_CTRLB		0x04
+#define R_BAUD		0x0C
+#define R_INTENCLR	0x14
+#define R_INTENSET	0x16
+#define R_INTFLAG	0x18
+#define R_STATUS	0x1A
+#define R_SYNCBUSY	0x1C
+#define R_ADDR		0x24
+#define R_DATA		0x28
+
+#define CTRLA_ENABLE	(1UL << 1)
+#define CTRLA_MODE(v)	(((v) >> 2) & 0x7)
+#define MODE_SLAVE		4
+#define MODE_MASTER		5
+#define CTRLB_SMEN		(1UL << 8)
+#define CTRLB_QCEN		(1UL << 9)
+#define CTRLB_CMD(v)	(((v) >> 16) & 0x3)
+#define CTRLB_CMD_Msk	(0x3UL << 16)
+#define CTRLB_ACKACT	(1UL << 18)
+#define ADDR_LENEN		(1UL << 13)
+#define ADDR_HS			(1UL << 14)
+
+// I2CM flags and status
+#define M_MB			0x01
+#define M_SB			0x02
+#define M_ERROR			0x80
+#define M_BUSERR		0x0001
+#define M_ARBLOST		0x0002
+#define M_RXNACK		0x0004
+#define M_BUSSTATE		0x0030
+#define M_LOWTOUT		0x0040
+#define M_LENERR		0x0400
+#define BUS_UNKNOWN		0
+#define BUS_IDLE		1
+#define BUS_OWNER		2
+#define BUS_BUSY		3
+
+// I2CS flags and status
+#define S_PREC			0x01
+#define S_AMATCH		0x02
+#define S_DRDY			0x04
+#define S_ERROR			0x80
+#define S_BUSERR		0x0001
+#define S_COLL			0x0002
+#define S_RXNACK		0x0004
+#define S_DIR			0x0008
+#define S_SR			0x0010
+#define S_LOWTOUT		0x0040
+#define S_SEXTTOUT		0x0200
+
+// MSSP bits
+#define SSPCON1_WCOL	0x80
+#define SSPCON1_SSPOV	0x40
+#define SSPCON1_SSPEN	0x20
+#define SSPCON2_SEN		0x01
+#define SSPCON2_RSEN	0x02
+#define SSPCON2_PEN		0x04
+#define SSPCON2_RCEN	0x08
+#define SSPCON2_ACKEN	0x10
+#define SSPCON2_OPS		0x1F
+#define SSPCON2_ACKSTAT	0x40
+#define SSPSTAT_BF		0x01
+#define SSPSTAT_RW		0x04
+#define SSPSTAT_S		0x08
+#define SSPSTAT_P		0x10
+#define PIR_SSPIF		0x08	// PIR1, PIE1 SSPIE
+#define PIR_BCLIF		0x08	// PIR2, PIE2 BCLIE
+#define INTCON_GIE		0x80
+
+// DMAC register offsets and bits
+#define D_CTRL			0x00
+#define D_BASEADDR		0x34
+#define D_WRBADDR		0x38
+#define D_CHID			0x3F
+#define D_CHCTRLA		0x40
+#define D_CHCTRLB		0x44
+#define D_CHINTENCLR	0x4C
+#define D_CHINTENSET	0x4D
+#define D_CHINTFLAG		0x4E
+#define D_CHSTATUS		0x4F
+#define D_SIZE			0x50
+#define DMAENABLE		0x0002
+#define CH_ENABLE		0x02
+#define CH_TRIGSRC(v)	(((v) >> 8) & 0x3F)
+#define CH_TERR			0x01
+#define CH_TCMPL		0x02
+#define BT_VALID		0x0001
+#define BT_BLOCKACT(v)	(((v) >> 3) & 0x3)
+#define BT_BEATSIZE(v)	(((v) >> 8) & 0x3)
+#define BT_SRCINC		0x0400
+#define BT_DSTINC		0x0800
+#define TRIG_RX(n)		(0x01 + (2 * (n)))	// SERCOMn RX, TX is one above
+#define TRIG_TX(n)		(0x02 + (2 * (n)))
+
+// PORT group register offsets and bits
+#define P_DIR			0x00
+#define P_DIRCLR		0x04
+#define P_DIRSET		0x08
+#define P_DIRTGL		0x0C
+#define P_OUT			0x10
+#define P_OUTCLR		0x14
+#define P_OUTSET		0x18
+#define P_OUTTGL		0x1C
+#define P_IN			0x20
+#define P_WRCONFIG		0x28
+#define P_PMUX			0x30
+#define P_PINCFG		0x40
+#define P_GROUP			0x80
+#define P_GROUPS		2
+#define PINCFG_PMUXEN	0x01
+#define WR_PINMASK(v)	((v) & 0xFFFFUL)
+#define WR_PINCFG(v)	(((v) >> 16) & 0x47)
+#define WR_PMUX(v)		(((v) >> 24) & 0xF)
+#define WR_WRPMUX		(1UL << 28)
+#define WR_WRPINCFG		(1UL << 30)
+#define WR_HWSEL		(1UL << 31)
+
+// Operations in flight
+enum
+{
+	OP_NONE, OP_ADDR, OP_WRITE, OP_READ,					// SERCOM
+	OP_SEN, OP_RSEN, OP_PEN, OP_TX, OP_RCEN, OP_ACKEN		// MSSP
+};
+
+// SCL held by a target SERCOM
+enum
+{
+	HOLD_NONE, HOLD_ADDR, HOLD_RX, HOLD_TX
+};
+
+typedef struct
+{
+	uint8_t op;				// OP_* in flight
+	uint64_t done;			// When it finishes
+	uint8_t byte;			// Address or data byte on the wire
+	uint8_t reading;		// Last address had R/W set
+	uint8_t owner;			// START sent, the bus is ours
+	uint8_t ack_due;		// Received byte waiting for its ACK or NACK
+	uint8_t lost;			// This address loses arbitration
+	uint8_t buserr;			// SDA was held low for this START
+	uint8_t quick;			// Quick command, no data after the address
+	uint8_t hs;				// High speed address
+	uint8_t inten;			// INTENSET/INTENCLR
+	uint64_t hold_until;	// Another master has the bus until
+	sim_dev_t *dev;			// Addressed device
+	// Target mode
+	uint8_t hold;			// HOLD_*
+	uint8_t acked;			// ACKACT when SCL was let go
+	uint8_t tx;				// Byte loaded for the remote master
+	uint8_t remote;			// Remote master owns the bus, next address is a repeated start
+	uint64_t released;		// When SCL was let go
+} sim_sercom_t;
+
+// DMAC channel registers behind CHID
+typedef struct
+{
+	uint8_t ctrla;
+	uint32_t ctrlb;
+	uint8_t inten;
+	uint8_t intflag;
+} sim_dmach_t;
+
+// Descriptor and writeback layout
+typedef struct
+{
+	uint16_t btctrl;
+	uint16_t btcnt;
+	uint32_t srcaddr;		// End of the block on the incrementing side
+	uint32_t dstaddr;
+	uint32_t descaddr;
+} sim_desc_t;
+
+typedef struct
+{
+	uint8_t op;				// OP_* in flight
+	uint64_t done;
+	uint8_t byte;
+	uint8_t owner;
+	uint8_t addressing;		// Next SSPBUF byte is an address
+	uint8_t reading;
+	uint8_t lost;
+	uint64_t hold_until;
+	sim_dev_t *dev;
+} sim_mssp_t;
+
+sim_bus_t sim_bus[SIM_BUSES];
+sim_stats_t sim_stats;
+uint32_t sim_cpu_hz = 48000000UL;
+uint32_t sim_access_ns = 62;		// About 3 core cycles at 48MHz, one instruction at 16 MIPS
+uint32_t sim_irq_ns = 625;			// 30 cycles at 48MHz, Cortex-M0+ entry and exit
+uint32_t sim_dma_ns = 125;			// 6 cycles at 48MHz, arbitration, fetch and the bus write
+uint32_t sim_master_hz = 1000000UL;
+
+static uint64_t sim_time;
+static sim_sercom_t sim_sercom[SIM_SERCOM_NUM];
+static sim_mssp_t sim_mssp;
+static sim_dmach_t sim_dmach[SIM_DMAC_CHANNELS];
+static void (*sim_handler[SIM_IRQS])(void);
+static uint8_t sim_nvic[SIM_IRQS];
+static uint32_t sim_primask;
+static uintptr_t sim_polled[SIM_POLLS];
+static uint8_t sim_polled_count;
+static uint8_t sim_scl[SIM_SERCOM_NUM];		// SCL level last seen on the wired pins
+static struct
+{
+	int irqn;
+	uint64_t period;		// 0 = stopped
+	uint64_t at;			// Next tick
+	uint8_t pending;
+} sim_tick;
+static uint8_t sim_ready;
+
+static void sim_advance(uint64_t t);
+
+// Access in flight, between the fault and the trap
+static struct
+{
+	uintptr_t addr;			// Register base
+	uint8_t width;
+	uint8_t write;
+	uint32_t old;
+	uint8_t active;
+} sim_trap;
+
+#define SIM_R8(n, off)	(*(volatile uint8_t *)(SIM_SERCOM_BASE + ((n) * SIM_SERCOM_SIZE) + (off)))
+#define SIM_R16(n, off)	(*(volatile uint16_t *)(SIM_SERCOM_BASE + ((n) * SIM_SERCOM_SIZE) + (off)))
+#define SIM_R32(n, off)	(*(volatile uint32_t *)(SIM_SERCOM_BASE + ((n) * SIM_SERCOM_SIZE) + (off)))
+#define SIM_SYSTICK_VAL	(*(volatile uint32_t *)(SIM_SYSTICK_BASE + 0x08))
+#define SIM_D8(off)		(*(volatile uint8_t *)(SIM_DMAC_BASE + (off)))
+#define SIM_D16(off)	(*(volatile uint16_t *)(SIM_DMAC_BASE + (off)))
+#define SIM_D32(off)	(*(volatile uint32_t *)(SIM_DMAC_BASE + (off)))
+#define SIM_P8(g, off)	(*(volatile uint8_t *)(SIM_PORT_BASE + ((g) * P_GROUP) + (off)))
+#define SIM_P32(g, off)	(*(volatile uint32_t *)(SIM_PORT_BASE + ((g) * P_GROUP) + (off)))
+
+static void sim_open(void)
+{
+	mprotect((void *)SIM_GUARD_BASE, SIM_GUARD_SIZE, PROT_READ | PROT_WRITE);
+}
+
+static void sim_close(void)
+{
+	mprotect((void *)SIM_GUARD_BASE, SIM_GUARD_SIZE, PROT_NONE);
+}
+
+static void sim_fatal(const char *msg, unsigned n)
+{
+	fprintf(stderr, "sim: %s %u\n", msg, n);
+	exit(2);
+}
+
+/**
+	@brief Device Lookup
+	@param[in] bus Bus number
+	@param[in] addr 7 bit address
+	@returns First device answering addr, 0 if none
+*/
+static sim_dev_t *sim_find(uint8_t bus, uint8_t addr)
+{
+	for (sim_dev_t *dev = sim_bus[bus].devs; dev; dev = dev->next)
+	{
+		if ((addr & ~dev->mask) == (dev->addr & ~dev->mask))
+		{
+			return dev;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t sim_ns(uint64_t cycles, uint64_t hz)
+{
+	return (uint64_t)(((unsigned __int128)cycles * 1000000000ULL) / hz);
+}
+
+static uint8_t sim_busstate(uint8_t n)
+{
+	return (uint8_t)((SIM_R16(n, R_STATUS) & M_BUSSTATE) >> 4);
+}
+
+static void sim_set_busstate(uint8_t n, uint8_t state)
+{
+	SIM_R16(n, R_STATUS) = (uint16_t)((SIM_R16(n, R_STATUS) & ~M_BUSSTATE) | (state << 4));
+}
+
+/**
+	@brief SERCOM SCL Period
+	@details fSCL = fGCLK / (10 + 2 * BAUD), or BAUD + BAUDLOW when BAUDLOW
+	is set, rise time left out. High speed uses HSBAUD the same way with 2.
+*/
+static uint64_t sim_sercom_period(uint8_t n, uint8_t hs)
+{
+	uint32_t baud = SIM_R32(n, R_BAUD);
+	uint32_t high = hs ? ((baud >> 16) & 0xFF) : (baud & 0xFF);
+	uint32_t low = hs ? (baud >> 24) : ((baud >> 8) & 0xFF);
+	uint32_t cycles = (hs ? 2 : 10) + high + (low ? low : high);
+
+	return sim_ns(cycles, sim_cpu_hz);
+}
+
+static uint64_t sim_mssp_period(void)
+{
+	return sim_ns(4ULL * (SIM_PIC->SSPADD + 1u), SIM_PIC_FOSC);
+}
+
+static uint64_t sim_master_period(void)
+{
+	return sim_ns(1, sim_master_hz);
+}
+
+//-----------------------------------------------------------------------------
+// SERCOM controller
+//-----------------------------------------------------------------------------
+
+static void sim_m_stop(uint8_t n, uint64_t at)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	if (s->dev && s->dev->stop)
+	{
+		s->dev->stop(s->dev);
+	}
+	s->dev = 0;
+	s->owner = 0;
+	s->ack_due = 0;
+	s->op = OP_NONE;
+	sim_set_busstate(n, BUS_IDLE);
+	sim_bus[n].stops++;
+	sim_bus[n].free_at = at + (2 * sim_sercom_period(n, 0));	// STOP, then bus free time
+}
+
+/**
+	@brief SERCOM Address Written
+	@details START or repeated start and the address byte, held while the
+	bus state is unknown or another master has it
+*/
+static void sim_m_addr(uint8_t n, uint32_t value)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+	sim_bus_t *bus = &sim_bus[n];
+	uint64_t start = sim_time;
+
+	if (value & ADDR_LENEN)
+	{
+		sim_fatal("ADDR.LENEN needs the DMAC, not simulated, SERCOM", n);
+	}
+
+	// Writing ADDR clears MB, SB, BUSERR and ARBLOST
+	SIM_R8(n, R_INTFLAG) &= (uint8_t)~(M_MB | M_SB);
+	SIM_R16(n, R_STATUS) &= (uint16_t)~(M_BUSERR | M_ARBLOST);
+	s->ack_due = 0;
+	s->byte = (uint8_t)value;
+	s->reading = (uint8_t)(value & 1);
+	s->hs = (value & ADDR_HS) ? 1 : 0;
+	s->quick = (SIM_R32(n, R_CTRLB) & CTRLB_QCEN) ? 1 : 0;
+	s->op = OP_ADDR;
+
+	switch (sim_busstate(n))
+	{
+		case BUS_UNKNOWN:
+			s->done = SIM_NEVER;
+			return;
+		case BUS_BUSY:
+			start = (s->hold_until > start) ? s->hold_until : start;
+			break;
+		default:
+			break;
+	}
+	if (!s->owner && (bus->free_at > start))
+	{
+		start = bus->free_at;
+	}
+
+	s->lost = 0;
+	if (bus->lose)
+	{
+		bus->lose--;
+		s->lost = 1;
+	}
+	s->buserr = bus->stuck ? 1 : 0;
+	s->done = start + ((s->buserr ? 1 : 10) * sim_sercom_period(n, 0));	// START and 9 bits
+}
+
+static void sim_m_done(uint8_t n)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+	sim_bus_t *bus = &sim_bus[n];
+	uint8_t op = s->op;
+	uint8_t ack;
+
+	s->op = OP_NONE;
+	bus->bytes++;
+	switch (op)
+	{
+		case OP_ADDR:
+			bus->starts++;
+			if (s->buserr)
+			{
+				// A target has SDA low, the START is a bus error and the controller lets go
+				s->dev = 0;
+				s->owner = 0;
+				s->hold_until = sim_time;
+				sim_set_busstate(n, BUS_BUSY);
+				SIM_R16(n, R_STATUS) |= (M_BUSERR | M_ARBLOST);
+				SIM_R8(n, R_INTFLAG) |= (M_MB | M_ERROR);
+				bus->buserrs++;
+				return;
+			}
+			if (s->lost)
+			{
+				// The winner carries on, this controller let go of the bus
+				if (s->dev && s->dev->stop)
+				{
+					s->dev->stop(s->dev);
+				}
+				s->dev = 0;
+				s->owner = 0;
+				s->hold_until = sim_time + bus->hold_ns;
+				sim_set_busstate(n, BUS_BUSY);
+				SIM_R16(n, R_STATUS) |= M_ARBLOST;
+				SIM_R8(n, R_INTFLAG) |= (M_MB | M_ERROR);
+				bus->arblost++;
+				return;
+			}
+			s->owner = 1;
+			sim_set_busstate(n, BUS_OWNER);
+			s->dev = sim_find((uint8_t)n, s->byte >> 1);
+			ack = s->dev && s->dev->start(s->dev, s->byte >> 1, (s->byte & 1) && !s->quick);
+			if (!ack)
+			{
+				s->dev = 0;
+				bus->nacks++;
+				SIM_R16(n, R_STATUS) |= M_RXNACK;
+				SIM_R8(n, R_INTFLAG) |= M_MB;
+				return;
+			}
+			SIM_R16(n, R_STATUS) &= (uint16_t)~M_RXNACK;
+			if ((s->byte & 1) && !s->quick)
+			{
+				// First byte clocks in with no command
+				s->op = OP_READ;
+				s->done = sim_time + (8 * sim_sercom_period(n, s->hs)) + s->dev->stretch_ns;
+				return;
+			}
+			SIM_R8(n, R_INTFLAG) |= M_MB;
+			break;
+
+		case OP_WRITE:
+			ack = s->dev && s->dev->write(s->dev, s->byte);
+			if (!ack)
+			{
+				bus->nacks++;
+				SIM_R16(n, R_STATUS) |= M_RXNACK;
+			}
+			else
+			{
+				SIM_R16(n, R_STATUS) &= (uint16_t)~M_RXNACK;
+			}
+			SIM_R8(n, R_INTFLAG) |= M_MB;
+			break;
+
+		case OP_READ:
+			SIM_R8(n, R_DATA) = s->dev ? s->dev->read(s->dev) : 0xFF;
+			s->ack_due = 1;
+			SIM_R8(n, R_INTFLAG) |= M_SB;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+	@brief SERCOM Acknowledge Action
+	@details Send CTRLB.ACKACT for the byte in DATA, an ACK clocks the next
+	byte in when next is set
+	@returns End of the ACK bit
+*/
+static uint64_t sim_m_ack(uint8_t n, uint8_t next)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+	uint64_t period = sim_sercom_period(n, s->hs);
+
+	s->ack_due = 0;
+	SIM_R8(n, R_INTFLAG) &= (uint8_t)~M_SB;
+	if (!(SIM_R32(n, R_CTRLB) & CTRLB_ACKACT) && next)
+	{
+		s->op = OP_READ;
+		s->done = sim_time + (9 * period) + (s->dev ? s->dev->stretch_ns : 0);
+	}
+
+	return sim_time + period;
+}
+
+static void sim_m_write(uint8_t n, uint16_t reg, uint32_t old, uint32_t value)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+	uint8_t cmd;
+
+	switch (reg)
+	{
+		case R_CTRLA:
+			if ((old & CTRLA_ENABLE) && !(value & CTRLA_ENABLE))
+			{
+				if (s->owner && s->dev && s->dev->stop)
+				{
+					s->dev->stop(s->dev);
+				}
+				s->op = OP_NONE;
+				s->owner = 0;
+				s->dev = 0;
+				s->ack_due = 0;
+				sim_set_busstate(n, BUS_UNKNOWN);
+			}
+			else if (!(old & CTRLA_ENABLE) && (value & CTRLA_ENABLE))
+			{
+				sim_set_busstate(n, BUS_UNKNOWN);
+			}
+			break;
+
+		case R_CTRLB:
+			cmd = CTRLB_CMD(value);
+			SIM_R32(n, R_CTRLB) = value & ~CTRLB_CMD_Msk;
+			if (!cmd || !s->owner)
+			{
+				break;
+			}
+			if (cmd == 3)
+			{
+				sim_m_stop(n, s->ack_due ? sim_m_ack(n, 0) : sim_time);
+			}
+			else if (s->ack_due)
+			{
+				sim_m_ack(n, cmd == 2);
+			}
+			break;
+
+		case R_STATUS:
+			// Error bits clear on 1, BUSSTATE can only be forced to IDLE
+			value = (old & ~(value & (M_BUSERR | M_ARBLOST | M_LOWTOUT | M_LENERR))) | (value & M_BUSSTATE);
+			SIM_R16(n, R_STATUS) = (uint16_t)((value & ~M_BUSSTATE) | (old & M_BUSSTATE));
+			if ((((value & M_BUSSTATE) >> 4) == BUS_IDLE) && (SIM_R32(n, R_CTRLA) & CTRLA_ENABLE))
+			{
+				s->owner = 0;
+				s->dev = 0;
+				s->hold_until = 0;
+				sim_set_busstate(n, BUS_IDLE);
+			}
+			break;
+
+		case R_ADDR:
+			if (SIM_R32(n, R_CTRLA) & CTRLA_ENABLE)
+			{
+				sim_m_addr(n, value);
+			}
+			break;
+
+		case R_DATA:
+			if (s->owner && s->dev && !s->reading && (s->op == OP_NONE))
+			{
+				SIM_R8(n, R_INTFLAG) &= (uint8_t)~M_MB;
+				s->byte = (uint8_t)value;
+				s->op = OP_WRITE;
+				s->done = sim_time + (9 * sim_sercom_period(n, s->hs)) + s->dev->stretch_ns;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// SERCOM target
+//-----------------------------------------------------------------------------
+
+static void sim_s_release(uint8_t n)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	s->hold = HOLD_NONE;
+	s->acked = !(SIM_R32(n, R_CTRLB) & CTRLB_ACKACT);
+	s->released = sim_time;
+}
+
+static void sim_s_write(uint8_t n, uint16_t reg, uint32_t old, uint32_t value)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	switch (reg)
+	{
+		case R_CTRLB:
+			SIM_R32(n, R_CTRLB) = value & ~CTRLB_CMD_Msk;
+			if (CTRLB_CMD(value))
+			{
+				SIM_R8(n, R_INTFLAG) &= (uint8_t)~(S_AMATCH | S_DRDY);
+				if (s->hold == HOLD_TX)
+				{
+					s->tx = 0xFF;	// Nothing loaded, SDA left high
+				}
+				if (s->hold)
+				{
+					sim_s_release(n);
+				}
+			}
+			break;
+
+		case R_STATUS:
+			SIM_R16(n, R_STATUS) = (uint16_t)(old & ~(value & (S_BUSERR | S_COLL | S_LOWTOUT | S_SEXTTOUT)));
+			break;
+
+		case R_DATA:
+			SIM_R8(n, R_INTFLAG) &= (uint8_t)~S_DRDY;
+			if (s->hold == HOLD_TX)
+			{
+				s->tx = (uint8_t)value;
+				sim_s_release(n);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// SERCOM registers
+//-----------------------------------------------------------------------------
+
+static uint8_t sim_sercom_width(uint16_t off, uint16_t *reg)
+{
+	static const struct { uint16_t off; uint8_t width; } regs[] =
+	{
+		{ R_CTRLA, 4 }, { R_CTRLB, 4 }, { R_BAUD, 4 }, { R_INTENCLR, 1 }, { R_INTENSET, 1 },
+		{ R_INTFLAG, 1 }, { R_STATUS, 2 }, { R_SYNCBUSY, 4 }, { R_ADDR, 4 }, { R_DATA, 1 },
+	};
+
+	for (uint8_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+	{
+		if ((off >= regs[i].off) && (off < regs[i].off + regs[i].width))
+		{
+			*reg = regs[i].off;
+			return regs[i].width;
+		}
+	}
+	*reg = off;
+	return 1;
+}
+
+static uint8_t sim_slave(uint8_t n)
+{
+	return CTRLA_MODE(SIM_R32(n, R_CTRLA)) == MODE_SLAVE;
+}
+
+static void sim_sercom_after(uint8_t n, uint16_t reg, uint8_t write, uint32_t old, uint32_t value)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	if (!write)
+	{
+		if (reg != R_DATA)
+		{
+			return;
+		}
+		if (sim_slave(n))
+		{
+			// Smart Mode sends ACKACT when DATA is read
+			SIM_R8(n, R_INTFLAG) &= (uint8_t)~S_DRDY;
+			if (s->hold == HOLD_RX)
+			{
+				sim_s_release(n);
+			}
+		}
+		else if (s->ack_due && (SIM_R32(n, R_CTRLB) & CTRLB_SMEN))
+		{
+			sim_m_ack(n, 1);
+		}
+		return;
+	}
+
+	switch (reg)
+	{
+		case R_INTENCLR:
+		case R_INTENSET:
+			s->inten = (reg == R_INTENSET) ? (uint8_t)(s->inten | value) : (uint8_t)(s->inten & ~value);
+			SIM_R8(n, R_INTENCLR) = s->inten;
+			SIM_R8(n, R_INTENSET) = s->inten;
+			return;
+
+		case R_INTFLAG:
+			SIM_R8(n, R_INTFLAG) = (uint8_t)(old & ~value);
+			if (sim_slave(n) && s->hold && (value & ((s->hold == HOLD_ADDR) ? S_AMATCH : S_DRDY)))
+			{
+				sim_s_release(n);
+			}
+			return;
+
+		case R_SYNCBUSY:
+			SIM_R32(n, R_SYNCBUSY) = 0;	// Read only, every write synchronises at once
+			return;
+
+		default:
+			break;
+	}
+
+	if (sim_slave(n) && (reg != R_CTRLA))
+	{
+		sim_s_write(n, reg, old, value);
+	}
+	else
+	{
+		sim_m_write(n, reg, old, value);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// DMAC
+//-----------------------------------------------------------------------------
+
+static uint8_t sim_dmac_width(uint16_t off, uint16_t *reg)
+{
+	static const struct { uint16_t off; uint8_t width; } regs[] =
+	{
+		{ D_CTRL, 2 }, { 0x02, 2 }, { 0x04, 4 }, { 0x08, 4 }, { 0x10, 4 }, { 0x14, 4 }, { 0x20, 2 },
+		{ 0x24, 4 }, { 0x28, 4 }, { 0x2C, 4 }, { 0x30, 4 }, { D_BASEADDR, 4 }, { D_WRBADDR, 4 }, { D_CHCTRLB, 4 },
+	};
+
+	for (uint8_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+	{
+		if ((off >= regs[i].off) && (off < regs[i].off + regs[i].width))
+		{
+			*reg = regs[i].off;
+			return regs[i].width;
+		}
+	}
+	*reg = off;
+	return 1;
+}
+
+// Descriptors and writeback live in host memory, below 4GB with -no-pie
+static sim_desc_t *sim_dma_desc(uint32_t base, uint8_t ch)
+{
+	return (sim_desc_t *)(uintptr_t)(base + (16u * ch));
+}
+
+// Show the channel picked by CHID
+static void sim_dmac_show(void)
+{
+	uint8_t ch = SIM_D8(D_CHID) & 0xF;
+	sim_dmach_t *c = &sim_dmach[(ch < SIM_DMAC_CHANNELS) ? ch : 0];
+
+	SIM_D8(D_CHCTRLA) = c->ctrla;
+	SIM_D32(D_CHCTRLB) = c->ctrlb;
+	SIM_D8(D_CHINTENCLR) = c->inten;
+	SIM_D8(D_CHINTENSET) = c->inten;
+	SIM_D8(D_CHINTFLAG) = c->intflag;
+	SIM_D8(D_CHSTATUS) = 0;
+}
+
+static void sim_dmac_after(uint16_t reg, uint8_t write, uint32_t old, uint32_t value)
+{
+	uint8_t ch = SIM_D8(D_CHID) & 0xF;
+	sim_dmach_t *c;
+
+	if (!write)
+	{
+		return;
+	}
+	if (ch >= SIM_DMAC_CHANNELS)
+	{
+		sim_fatal("no such DMAC channel", ch);
+	}
+	c = &sim_dmach[ch];
+
+	switch (reg)
+	{
+		case D_CHCTRLA:
+			if ((value & CH_ENABLE) && !(c->ctrla & CH_ENABLE))
+			{
+				// Fetch the first descriptor into the writeback slot
+				*sim_dma_desc(SIM_D32(D_WRBADDR), ch) = *sim_dma_desc(SIM_D32(D_BASEADDR), ch);
+			}
+			c->ctrla = (uint8_t)value;
+			break;
+
+		case D_CHCTRLB:
+			c->ctrlb = value;
+			break;
+
+		case D_CHINTENCLR:
+		case D_CHINTENSET:
+			c->inten = (reg == D_CHINTENSET) ? (uint8_t)(c->inten | value) : (uint8_t)(c->inten & ~value);
+			break;
+
+		case D_CHINTFLAG:
+			c->intflag = (uint8_t)(old & ~value);
+			break;
+
+		default:
+			break;
+	}
+	sim_dmac_show();
+}
+
+/**
+	@brief DMA Beat
+	@details Move one byte for channel ch after sim_dma_ns. The working
+	descriptor is the writeback slot, the way the DMAC keeps it, so a driver
+	reading BTCNT there after a disable sees what is left. A finished block
+	fetches the next descriptor, or disables the channel and sets TCMPL.
+*/
+static void sim_dma_beat(uint8_t ch)
+{
+	sim_dmach_t *c = &sim_dmach[ch];
+	sim_desc_t *wb = sim_dma_desc(SIM_D32(D_WRBADDR), ch);
+	uintptr_t src;
+	uintptr_t dst;
+	uint8_t byte;
+
+	if (!(wb->btctrl & BT_VALID) || !wb->btcnt)
+	{
+		c->intflag |= CH_TERR;
+		c->ctrla &= (uint8_t)~CH_ENABLE;
+		sim_dmac_show();
+		return;
+	}
+	if (BT_BEATSIZE(wb->btctrl))
+	{
+		sim_fatal("only byte beats are simulated, DMAC channel", ch);
+	}
+
+	sim_advance(sim_time + sim_dma_ns);
+	sim_stats.dma_beats++;
+	src = (wb->btctrl & BT_SRCINC) ? (uintptr_t)(wb->srcaddr - wb->btcnt) : (uintptr_t)wb->srcaddr;
+	dst = (wb->btctrl & BT_DSTINC) ? (uintptr_t)(wb->dstaddr - wb->btcnt) : (uintptr_t)wb->dstaddr;
+	byte = *(volatile uint8_t *)src;
+	if ((src >= SIM_SERCOM_BASE) && (src < SIM_SERCOM_BASE + (SIM_SERCOM_NUM * SIM_SERCOM_SIZE)))
+	{
+		sim_sercom_after((uint8_t)((src - SIM_SERCOM_BASE) / SIM_SERCOM_SIZE), (uint16_t)((src - SIM_SERCOM_BASE) % SIM_SERCOM_SIZE), 0, byte, byte);
+	}
+	if ((dst >= SIM_SERCOM_BASE) && (dst < SIM_SERCOM_BASE + (SIM_SERCOM_NUM * SIM_SERCOM_SIZE)))
+	{
+		uint8_t old = *(volatile uint8_t *)dst;
+
+		*(volatile uint8_t *)dst = byte;
+		sim_sercom_after((uint8_t)((dst - SIM_SERCOM_BASE) / SIM_SERCOM_SIZE), (uint16_t)((dst - SIM_SERCOM_BASE) % SIM_SERCOM_SIZE), 1, old, byte);
+	}
+	else
+	{
+		*(volatile uint8_t *)dst = byte;
+	}
+
+	if (--wb->btcnt)
+	{
+		return;
+	}
+	if (BT_BLOCKACT(wb->btctrl) == 1)
+	{
+		c->intflag |= CH_TCMPL;
+	}
+	if (wb->descaddr)
+	{
+		*wb = *(sim_desc_t *)(uintptr_t)wb->descaddr;
+	}
+	else
+	{
+		// Last block, TCMPL whatever BLOCKACT says so the drivers' completion shows
+		c->intflag |= CH_TCMPL;
+		c->ctrla &= (uint8_t)~CH_ENABLE;
+	}
+	sim_dmac_show();
+}
+
+/**
+	@brief DMA Trigger
+	@details A SERCOM raised trigger source trig, the first enabled channel
+	waiting on it moves one beat
+*/
+static void sim_dma_trigger(uint8_t trig)
+{
+	if (!(SIM_D16(D_CTRL) & DMAENABLE))
+	{
+		return;
+	}
+	for (uint8_t ch = 0; ch < SIM_DMAC_CHANNELS; ch++)
+	{
+		if ((sim_dmach[ch].ctrla & CH_ENABLE) && (CH_TRIGSRC(sim_dmach[ch].ctrlb) == trig))
+		{
+			sim_dma_beat(ch);
+			return;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// PORT
+//-----------------------------------------------------------------------------
+
+static uint8_t sim_port_width(uint16_t off, uint16_t *reg)
+{
+	off %= P_GROUP;
+	if (off < P_PMUX)
+	{
+		*reg = (uint16_t)(off & ~3U);
+		return 4;
+	}
+	*reg = off;
+	return 1;
+}
+
+/**
+	@brief PORT Pin Levels
+	@details Work IN out from the pins: a pin with DIR set and OUT clear
+	drives low, anything else floats high on its pull up. Pins the SERCOM
+	has through PMUXEN read high, the controller side of the bus is not
+	modelled here. On a wired bus each SCL rising edge takes one pulse off
+	stuck, and SDA reads low until it runs out.
+*/
+static void sim_port_update(void)
+{
+	for (uint8_t g = 0; g < P_GROUPS; g++)
+	{
+		uint32_t low = SIM_P32(g, P_DIR) & ~SIM_P32(g, P_OUT);
+
+		for (uint8_t pin = 0; pin < 32; pin++)
+		{
+			if (SIM_P8(g, P_PINCFG + pin) & PINCFG_PMUXEN)
+			{
+				low &= ~(1UL << pin);
+			}
+		}
+		if (g == 0)
+		{
+			for (uint8_t n = 0; n < SIM_SERCOM_NUM; n++)
+			{
+				sim_bus_t *bus = &sim_bus[n];
+				uint8_t scl;
+
+				if (bus->sda_pin == bus->scl_pin)
+				{
+					continue;
+				}
+				scl = (low & (1UL << bus->scl_pin)) ? 0 : 1;
+				if (scl && !sim_scl[n] && bus->stuck)
+				{
+					bus->stuck--;
+				}
+				sim_scl[n] = scl;
+				if (bus->stuck)
+				{
+					low |= (1UL << bus->sda_pin);
+				}
+			}
+		}
+		SIM_P32(g, P_IN) = ~low;
+	}
+}
+
+static void sim_port_after(uint8_t g, uint16_t reg, uint8_t write, uint32_t old, uint32_t value)
+{
+	uint32_t dir = SIM_P32(g, P_DIR);
+	uint32_t out = SIM_P32(g, P_OUT);
+
+	if (!write)
+	{
+		return;
+	}
+	switch (reg)
+	{
+		case P_DIR:		dir = value; break;
+		case P_DIRCLR:	dir &= ~value; break;
+		case P_DIRSET:	dir |= value; break;
+		case P_DIRTGL:	dir ^= value; break;
+		case P_OUT:		out = value; break;
+		case P_OUTCLR:	out &= ~value; break;
+		case P_OUTSET:	out |= value; break;
+		case P_OUTTGL:	out ^= value; break;
+		case P_IN:		SIM_P32(g, P_IN) = old; return;
+		case P_WRCONFIG:
+			// Write only, PINCFG and PMUX of up to 16 pins in one go
+			for (uint8_t i = 0; i < 16; i++)
+			{
+				uint8_t pin = (uint8_t)(i + ((value & WR_HWSEL) ? 16 : 0));
+
+				if (!(WR_PINMASK(value) & (1UL << i)))
+				{
+					continue;
+				}
+				if (value & WR_WRPINCFG)
+				{
+					SIM_P8(g, P_PINCFG + pin) = (uint8_t)WR_PINCFG(value);
+				}
+				if (value & WR_WRPMUX)
+				{
+					uint8_t pmux = SIM_P8(g, P_PMUX + (pin >> 1));
+
+					SIM_P8(g, P_PMUX + (pin >> 1)) = (uint8_t)((pin & 1) ? ((pmux & 0x0F) | (WR_PMUX(value) << 4)) : ((pmux & 0xF0) | WR_PMUX(value)));
+				}
+			}
+			SIM_P32(g, P_WRCONFIG) = 0;
+			break;
+		default:
+			break;
+	}
+	// The set, clear and toggle registers read back DIR and OUT
+	SIM_P32(g, P_DIR) = SIM_P32(g, P_DIRCLR) = SIM_P32(g, P_DIRSET) = SIM_P32(g, P_DIRTGL) = dir;
+	SIM_P32(g, P_OUT) = SIM_P32(g, P_OUTCLR) = SIM_P32(g, P_OUTSET) = SIM_P32(g, P_OUTTGL) = out;
+	sim_port_update();
+}
+
+//-----------------------------------------------------------------------------
+// MSSP
+//-----------------------------------------------------------------------------
+
+static void sim_mssp_done(void)
+{
+	sim_mssp_t *m = &sim_mssp;
+	sim_bus_t *bus = &sim_bus[SIM_PIC_BUS];
+	sim_pic_t *pic = SIM_PIC;
+	uint8_t op = m->op;
+	uint8_t ack;
+
+	m->op = OP_NONE;
+	switch (op)
+	{
+		case OP_SEN:
+		case OP_RSEN:
+			pic->SSPCON2 &= (uint8_t)~(SSPCON2_SEN | SSPCON2_RSEN);
+			pic->SSPSTAT = (uint8_t)((pic->SSPSTAT & ~SSPSTAT_P) | SSPSTAT_S);
+			m->owner = 1;
+			m->addressing = 1;
+			bus->starts++;
+			break;
+
+		case OP_PEN:
+			pic->SSPCON2 &= (uint8_t)~SSPCON2_PEN;
+			pic->SSPSTAT = (uint8_t)((pic->SSPSTAT & ~SSPSTAT_S) | SSPSTAT_P);
+			if (m->dev && m->dev->stop)
+			{
+				m->dev->stop(m->dev);
+			}
+			m->dev = 0;
+			m->owner = 0;
+			bus->stops++;
+			bus->free_at = sim_time + sim_mssp_period();
+			break;
+
+		case OP_TX:
+			pic->SSPSTAT &= (uint8_t)~(SSPSTAT_RW | SSPSTAT_BF);
+			bus->bytes++;
+			if (m->addressing)
+			{
+				m->addressing = 0;
+				if (m->lost)
+				{
+					// Winner keeps S set until its STOP, no SSPIF
+					if (m->dev && m->dev->stop)
+					{
+						m->dev->stop(m->dev);
+					}
+					m->dev = 0;
+					m->owner = 0;
+					m->hold_until = sim_time + bus->hold_ns;
+					pic->PIR2 |= PIR_BCLIF;
+					bus->arblost++;
+					return;
+				}
+				m->reading = m->byte & 1;
+				m->dev = sim_find(SIM_PIC_BUS, m->byte >> 1);
+				ack = m->dev && m->dev->start(m->dev, m->byte >> 1, m->reading);
+				if (!ack)
+				{
+					m->dev = 0;
+				}
+			}
+			else
+			{
+				ack = m->dev && !m->reading && m->dev->write(m->dev, m->byte);
+			}
+			if (!ack)
+			{
+				bus->nacks++;
+				pic->SSPCON2 |= SSPCON2_ACKSTAT;
+			}
+			else
+			{
+				pic->SSPCON2 &= (uint8_t)~SSPCON2_ACKSTAT;
+			}
+			break;
+
+		case OP_RCEN:
+			pic->SSPCON2 &= (uint8_t)~SSPCON2_RCEN;
+			if (pic->SSPSTAT & SSPSTAT_BF)
+			{
+				pic->SSPCON1 |= SSPCON1_SSPOV;
+			}
+			pic->SSPBUF = (m->dev && m->reading) ? m->dev->read(m->dev) : 0xFF;
+			pic->SSPSTAT |= SSPSTAT_BF;
+			bus->bytes++;
+			break;
+
+		case OP_ACKEN:
+			pic->SSPCON2 &= (uint8_t)~SSPCON2_ACKEN;
+			break;
+
+		default:
+			return;
+	}
+	pic->PIR1 |= PIR_SSPIF;
+}
+
+static void sim_mssp_write(uintptr_t reg, uint32_t old, uint32_t value)
+{
+	sim_mssp_t *m = &sim_mssp;
+	sim_bus_t *bus = &sim_bus[SIM_PIC_BUS];
+	sim_pic_t *pic = SIM_PIC;
+	uint64_t period = sim_mssp_period();
+	uint8_t rising;
+
+	switch (reg - SIM_PIC_BASE)
+	{
+		case 0:		// SSPCON1
+			if ((old & SSPCON1_SSPEN) && !(value & SSPCON1_SSPEN))
+			{
+				if (m->dev && m->dev->stop)
+				{
+					m->dev->stop(m->dev);
+				}
+				m->op = OP_NONE;
+				m->dev = 0;
+				m->owner = 0;
+				pic->SSPCON2 &= (uint8_t)~SSPCON2_OPS;
+				pic->SSPSTAT &= (uint8_t)~(SSPSTAT_RW | SSPSTAT_BF);
+			}
+			break;
+
+		case 1:		// SSPCON2, one operation at a time, the rest are ignored
+			rising = (uint8_t)(value & ~old & SSPCON2_OPS);
+			if (!rising)
+			{
+				break;
+			}
+			if ((m->op != OP_NONE) || (old & SSPCON2_OPS) || (pic->SSPSTAT & SSPSTAT_RW) || !(pic->SSPCON1 & SSPCON1_SSPEN))
+			{
+				pic->SSPCON2 = (uint8_t)(value & ~rising);
+				break;
+			}
+			if (rising & SSPCON2_SEN)
+			{
+				if (sim_time < m->hold_until)
+				{
+					// Another master has the bus
+					pic->SSPCON2 &= (uint8_t)~SSPCON2_SEN;
+					pic->PIR2 |= PIR_BCLIF;
+					break;
+				}
+				m->op = OP_SEN;
+				m->done = ((bus->free_at > sim_time) ? bus->free_at : sim_time) + period;
+				pic->SSPCON2 = (uint8_t)(value & ~(rising & ~SSPCON2_SEN));
+			}
+			else if (rising & SSPCON2_RSEN)
+			{
+				m->op = OP_RSEN;
+				m->done = sim_time + period;
+				pic->SSPCON2 = (uint8_t)(value & ~(rising & ~SSPCON2_RSEN));
+			}
+			else if (rising & SSPCON2_PEN)
+			{
+				m->op = OP_PEN;
+				m->done = sim_time + period;
+				pic->SSPCON2 = (uint8_t)(value & ~(rising & ~SSPCON2_PEN));
+			}
+			else if (rising & SSPCON2_RCEN)
+			{
+				m->op = OP_RCEN;
+				m->done = sim_time + (8 * period) + (m->dev ? m->dev->stretch_ns : 0);
+				pic->SSPCON2 = (uint8_t)(value & ~(rising & ~SSPCON2_RCEN));
+			}
+			else
+			{
+				m->op = OP_ACKEN;
+				m->done = sim_time + period;
+			}
+			break;
+
+		case 2:		// SSPSTAT, only SMP and CKE are writable
+			pic->SSPSTAT = (uint8_t)((old & 0x3F) | (value & 0xC0));
+			break;
+
+		case 4:		// SSPBUF
+			if ((m->op != OP_NONE) || (pic->SSPCON2 & SSPCON2_OPS) || !m->owner)
+			{
+				pic->SSPCON1 |= SSPCON1_WCOL;
+				break;
+			}
+			m->byte = (uint8_t)value;
+			m->lost = 0;
+			if (m->addressing && bus->lose)
+			{
+				bus->lose--;
+				m->lost = 1;
+			}
+			m->op = OP_TX;
+			m->done = sim_time + (9 * period) + (m->dev ? m->dev->stretch_ns : 0);
+			pic->SSPSTAT |= (SSPSTAT_RW | SSPSTAT_BF);
+			break;
+
+		default:
+			break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Time
+//-----------------------------------------------------------------------------
+
+/**
+	@brief Next Event
+	@param[out] which 0..5 SERCOM operation, 6..11 SERCOM bus hold, 12 MSSP operation, 13 MSSP bus hold, 14 timer tick
+	@returns When it happens, SIM_NEVER if nothing is pending
+*/
+static uint64_t sim_next(uint8_t *which)
+{
+	uint64_t next = SIM_NEVER;
+
+	for (uint8_t n = 0; n < SIM_SERCOM_NUM; n++)
+	{
+		if ((sim_sercom[n].op != OP_NONE) && (sim_sercom[n].done < next))
+		{
+			next = sim_sercom[n].done;
+			*which = n;
+		}
+		if (sim_sercom[n].hold_until && (sim_sercom[n].hold_until < next))
+		{
+			next = sim_sercom[n].hold_until;
+			*which = (uint8_t)(SIM_SERCOM_NUM + n);
+		}
+	}
+	if ((sim_mssp.op != OP_NONE) && (sim_mssp.done < next))
+	{
+		next = sim_mssp.done;
+		*which = 12;
+	}
+	if (sim_mssp.hold_until && (sim_mssp.hold_until < next))
+	{
+		next = sim_mssp.hold_until;
+		*which = 13;
+	}
+	if (sim_tick.period && (sim_tick.at < next))
+	{
+		next = sim_tick.at;
+		*which = 14;
+	}
+
+	return next;
+}
+
+/**
+	@brief Advance
+	@details Run every event up to t in order, pages open
+*/
+static void sim_advance(uint64_t t)
+{
+	uint8_t which = 0;
+	uint64_t next;
+
+	while (((next = sim_next(&which)) != SIM_NEVER) && (next <= t))
+	{
+		if (next > sim_time)
+		{
+			sim_time = next;
+		}
+		if (which < SIM_SERCOM_NUM)
+		{
+			sim_m_done(which);
+		}
+		else if (which < 12)
+		{
+			which -= SIM_SERCOM_NUM;
+			sim_sercom[which].hold_until = 0;
+			if (sim_busstate(which) == BUS_BUSY)
+			{
+				sim_set_busstate(which, BUS_IDLE);
+			}
+		}
+		else if (which == 12)
+		{
+			sim_mssp_done();
+		}
+		else if (which == 14)
+		{
+			sim_tick.pending = 1;
+			sim_tick.at += sim_tick.period;
+		}
+		else
+		{
+			sim_mssp.hold_until = 0;
+			SIM_PIC->SSPSTAT = (uint8_t)((SIM_PIC->SSPSTAT & ~SSPSTAT_S) | SSPSTAT_P);
+		}
+	}
+	if (t > sim_time)
+	{
+		sim_time = t;
+	}
+}
+
+/**
+	@brief Poll
+	@details A status register read again with no write or delay since its
+	last read is a spin: skip ahead to the next bus event.
+*/
+static void sim_poll(uintptr_t reg)
+{
+	uint8_t which;
+	uint64_t next;
+
+	for (uint8_t i = 0; i < sim_polled_count; i++)
+	{
+		if (sim_polled[i] == reg)
+		{
+			next = sim_next(&which);
+			if ((next != SIM_NEVER) && (next > sim_time))
+			{
+				sim_stats.spin_ns += next - sim_time;
+				sim_advance(next);
+			}
+			return;
+		}
+	}
+	if (sim_polled_count < SIM_POLLS)
+	{
+		sim_polled[sim_polled_count++] = reg;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Trap
+//-----------------------------------------------------------------------------
+
+static uint32_t sim_load(uintptr_t addr, uint8_t width)
+{
+	switch (width)
+	{
+		case 4: return *(volatile uint32_t *)addr;
+		case 2: return *(volatile uint16_t *)addr;
+		default: return *(volatile uint8_t *)addr;
+	}
+}
+
+static void sim_before(uintptr_t addr, uint8_t write)
+{
+	uint16_t reg;
+
+	sim_stats.accesses++;
+	sim_advance(sim_time + sim_access_ns);
+	if (write)
+	{
+		sim_polled_count = 0;
+	}
+
+	if ((addr >= SIM_SERCOM_BASE) && (addr < SIM_SERCOM_BASE + (SIM_SERCOM_NUM * SIM_SERCOM_SIZE)))
+	{
+		uint8_t n = (uint8_t)((addr - SIM_SERCOM_BASE) / SIM_SERCOM_SIZE);
+
+		sim_trap.width = sim_sercom_width((uint16_t)((addr - SIM_SERCOM_BASE) % SIM_SERCOM_SIZE), &reg);
+		sim_trap.addr = SIM_SERCOM_BASE + (n * SIM_SERCOM_SIZE) + reg;
+		if (!write && ((reg == R_INTFLAG) || (reg == R_STATUS) || (reg == R_SYNCBUSY)))
+		{
+			sim_poll(sim_trap.addr);
+		}
+	}
+	else if ((addr >= SIM_DMAC_BASE) && (addr < SIM_DMAC_BASE + D_SIZE))
+	{
+		sim_trap.width = sim_dmac_width((uint16_t)(addr - SIM_DMAC_BASE), &reg);
+		sim_trap.addr = SIM_DMAC_BASE + reg;
+	}
+	else if ((addr >= SIM_PORT_BASE) && (addr < SIM_PORT_BASE + (P_GROUPS * P_GROUP)))
+	{
+		uint8_t g = (uint8_t)((addr - SIM_PORT_BASE) / P_GROUP);
+
+		sim_trap.width = sim_port_width((uint16_t)(addr - SIM_PORT_BASE), &reg);
+		sim_trap.addr = SIM_PORT_BASE + (g * P_GROUP) + reg;
+		sim_port_update();
+	}
+	else if ((addr >= SIM_PIC_BASE) && (addr < SIM_PIC_BASE + sizeof(sim_pic_t)))
+	{
+		sim_trap.width = (addr >= (uintptr_t)&SIM_PIC->TMR1) ? 2 : 1;
+		sim_trap.addr = (sim_trap.width == 2) ? (uintptr_t)&SIM_PIC->TMR1 : addr;
+		if (sim_trap.width == 2)
+		{
+			SIM_PIC->TMR1 = (uint16_t)(((unsigned __int128)sim_time * (SIM_PIC_FOSC / 4)) / 1000000000ULL);
+		}
+		else if (!write && ((addr == (uintptr_t)&SIM_PIC->SSPCON2) || (addr == (uintptr_t)&SIM_PIC->SSPSTAT) ||
+			(addr == (uintptr_t)&SIM_PIC->PIR1) || (addr == (uintptr_t)&SIM_PIC->PIR2)))
+		{
+			sim_poll(addr);
+		}
+	}
+	else
+	{
+		sim_trap.width = 4;
+		sim_trap.addr = addr & ~3UL;
+		if (sim_trap.addr == (SIM_SYSTICK_BASE + 0x08))
+		{
+			// SysTick counts down from LOAD = 0xFFFFFF at the core clock
+			SIM_SYSTICK_VAL = 0xFFFFFFUL - (uint32_t)((((unsigned __int128)sim_time * sim_cpu_hz) / 1000000000ULL) & 0xFFFFFFUL);
+		}
+	}
+	sim_trap.write = write;
+	sim_trap.old = sim_load(sim_trap.addr, sim_trap.width);
+}
+
+static void sim_after(void)
+{
+	uintptr_t addr = sim_trap.addr;
+	uint32_t value = sim_load(addr, sim_trap.width);
+
+	if ((addr >= SIM_SERCOM_BASE) && (addr < SIM_SERCOM_BASE + (SIM_SERCOM_NUM * SIM_SERCOM_SIZE)))
+	{
+		uint8_t n = (uint8_t)((addr - SIM_SERCOM_BASE) / SIM_SERCOM_SIZE);
+
+		sim_sercom_after(n, (uint16_t)((addr - SIM_SERCOM_BASE) % SIM_SERCOM_SIZE), sim_trap.write, sim_trap.old, value);
+	}
+	else if ((addr >= SIM_DMAC_BASE) && (addr < SIM_DMAC_BASE + D_SIZE))
+	{
+		sim_dmac_after((uint16_t)(addr - SIM_DMAC_BASE), sim_trap.write, sim_trap.old, value);
+	}
+	else if ((addr >= SIM_PORT_BASE) && (addr < SIM_PORT_BASE + (P_GROUPS * P_GROUP)))
+	{
+		uint8_t g = (uint8_t)((addr - SIM_PORT_BASE) / P_GROUP);
+
+		sim_port_after(g, (uint16_t)((addr - SIM_PORT_BASE) % P_GROUP), sim_trap.write, sim_trap.old, value);
+	}
+	else if ((addr >= SIM_PIC_BASE) && (addr < SIM_PIC_BASE + sizeof(sim_pic_t)))
+	{
+		if (sim_trap.write)
+		{
+			sim_mssp_write(addr, sim_trap.old, value);
+		}
+		else if (addr == (uintptr_t)&SIM_PIC->SSPBUF)
+		{
+			SIM_PIC->SSPSTAT &= (uint8_t)~SSPSTAT_BF;
+		}
+	}
+}
+
+static void sim_segv(int sig, siginfo_t *si, void *context)
+{
+	ucontext_t *uc = context;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+
+	(void)sig;
+	if ((addr < SIM_GUARD_BASE) || (addr >= SIM_GUARD_BASE + SIM_GUARD_SIZE) || sim_trap.active)
+	{
+		// Not a register, fault again with the default action
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	sim_open();
+	sim_trap.active = 1;
+	sim_before(addr, (uc->uc_mcontext.gregs[REG_ERR] & SIM_PF_WRITE) ? 1 : 0);
+	uc->uc_mcontext.gregs[REG_EFL] |= SIM_EFLAGS_TF;
+}
+
+static void sim_step(int sig, siginfo_t *si, void *context)
+{
+	ucontext_t *uc = context;
+
+	(void)sig;
+	(void)si;
+	uc->uc_mcontext.gregs[REG_EFL] &= ~SIM_EFLAGS_TF;
+	if (!sim_trap.active)
+	{
+		return;
+	}
+
+	sim_after();
+	sim_trap.active = 0;
+	sim_close();
+}
+
+//-----------------------------------------------------------------------------
+// Interrupts
+//-----------------------------------------------------------------------------
+
+static uint8_t sim_irq_pending(int irqn)
+{
+	sim_pic_t *pic = SIM_PIC;
+
+	if (!sim_handler[irqn] || sim_primask)
+	{
+		return 0;
+	}
+	if (irqn == SIM_PIC_IRQ)
+	{
+		return (pic->INTCON & INTCON_GIE) && (((pic->PIR1 & pic->PIE1) & PIR_SSPIF) || ((pic->PIR2 & pic->PIE2) & PIR_BCLIF));
+	}
+	if (sim_nvic[irqn] && (irqn == SIM_DMAC_IRQ))
+	{
+		for (uint8_t ch = 0; ch < SIM_DMAC_CHANNELS; ch++)
+		{
+			if (sim_dmach[ch].intflag & sim_dmach[ch].inten)
+			{
+				return 1;
+			}
+		}
+		return 0;
+	}
+	if (sim_nvic[irqn] && (irqn >= SIM_SERCOM_IRQ(0)) && (irqn < SIM_SERCOM_IRQ(SIM_SERCOM_NUM)))
+	{
+		uint8_t n = (uint8_t)(irqn - SIM_SERCOM_IRQ(0));
+
+		return (SIM_R8(n, R_INTFLAG) & sim_sercom[n].inten) != 0;
+	}
+	if (sim_nvic[irqn] && sim_tick.period && (irqn == sim_tick.irqn))
+	{
+		return sim_tick.pending;
+	}
+
+	return 0;
+}
+
+/**
+	@brief Take Interrupt
+	@details Run the lowest numbered pending handler, pages open before and after
+	@returns 1 if a handler ran
+*/
+static uint8_t sim_irq_run(void)
+{
+	for (int irqn = 0; irqn < SIM_IRQS; irqn++)
+	{
+		if (sim_irq_pending(irqn))
+		{
+			sim_advance(sim_time + sim_irq_ns);
+			sim_stats.irqs++;
+			if (irqn == sim_tick.irqn)
+			{
+				sim_tick.pending = 0;
+			}
+			sim_polled_count = 0;
+			sim_close();
+			sim_handler[irqn]();
+			sim_open();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Remote master
+//-----------------------------------------------------------------------------
+
+/**
+	@brief Target Hold
+	@details Raise flags on a target SERCOM at bus time t and hold SCL until
+	its ISR lets go, the stretch is the time in between
+	@returns ACK (1) or NACK (0) the target answered with, 0 if it never let go
+*/
+static uint8_t sim_s_hold(uint8_t n, uint8_t hold, uint8_t flags, uint64_t *t)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	sim_advance(*t);
+	s->hold = hold;
+	SIM_R8(n, R_INTFLAG) |= flags;
+	if (flags & S_DRDY)
+	{
+		sim_dma_trigger((hold == HOLD_TX) ? TRIG_TX(n) : TRIG_RX(n));
+	}
+	for (uint8_t i = 0; s->hold && (i < 8); i++)
+	{
+		if (!sim_irq_run())
+		{
+			break;
+		}
+	}
+	if (s->hold)
+	{
+		fprintf(stderr, "sim: SERCOM%u target never let go of SCL\n", n);
+		s->hold = HOLD_NONE;
+		return 0;
+	}
+
+	sim_bus[n].stretch_ns += s->released - *t;
+	*t = s->released;
+	return s->acked;
+}
+
+static void sim_s_flag(uint8_t n, uint8_t flags, uint64_t t)
+{
+	sim_advance(t);
+	SIM_R8(n, R_INTFLAG) |= flags;
+	if ((flags & S_DRDY) && (SIM_R16(n, R_STATUS) & S_DIR))
+	{
+		sim_dma_trigger(TRIG_TX(n));	// The DRDY after the NACK loads one more byte that is never sent
+	}
+	for (uint8_t i = 0; (i < 8) && sim_irq_run(); i++);
+}
+
+static uint8_t sim_s_address(uint8_t n, uint8_t addr, uint8_t read, uint64_t *t)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+	sim_bus_t *bus = &sim_bus[n];
+	uint64_t period = sim_master_period();
+	uint32_t own = SIM_R32(n, R_ADDR);
+	uint8_t ack;
+
+	*t = ((sim_time > bus->free_at) ? sim_time : bus->free_at);
+	if (s->remote)
+	{
+		SIM_R16(n, R_STATUS) |= S_SR;
+	}
+	else
+	{
+		SIM_R16(n, R_STATUS) &= (uint16_t)~S_SR;
+	}
+	s->remote = 1;
+	bus->starts++;
+	bus->bytes++;
+	*t += 9 * period;	// START and 8 bits
+
+	if (!(SIM_R32(n, R_CTRLA) & CTRLA_ENABLE) || !sim_slave(n) || (((own >> 1) & 0x7F) != addr))
+	{
+		*t += period;
+		bus->nacks++;
+		return 0;
+	}
+
+	SIM_R16(n, R_STATUS) = (uint16_t)((SIM_R16(n, R_STATUS) & ~(S_DIR | S_RXNACK)) | (read ? S_DIR : 0));
+	ack = sim_s_hold(n, HOLD_ADDR, S_AMATCH, t);
+	*t += period;
+	if (!ack)
+	{
+		bus->nacks++;
+	}
+
+	return ack;
+}
+
+static void sim_s_stop(uint8_t n, uint64_t t)
+{
+	sim_sercom_t *s = &sim_sercom[n];
+
+	t += sim_master_period();
+	s->remote = 0;
+	sim_bus[n].stops++;
+	sim_bus[n].free_at = t + sim_master_period();
+	SIM_R16(n, R_STATUS) &= (uint16_t)~S_SR;
+	sim_s_flag(n, S_PREC, t);
+}
+
+uint8_t sim_master_write(uint8_t sercom, uint8_t addr, const uint8_t *data, uint16_t len, uint8_t stop)
+{
+	uint64_t period = sim_master_period();
+	uint64_t t;
+	uint8_t acked;
+
+	sim_open();
+	acked = sim_s_address(sercom, addr, 0, &t);
+	for (uint16_t i = 0; acked && (i < len); i++)
+	{
+		t += 8 * period;
+		sim_advance(t);
+		SIM_R8(sercom, R_DATA) = data[i];
+		SIM_R16(sercom, R_STATUS) &= (uint16_t)~S_DIR;
+		acked = sim_s_hold(sercom, HOLD_RX, S_DRDY, &t);
+		t += period;
+		sim_bus[sercom].bytes++;
+		if (!acked)
+		{
+			sim_bus[sercom].nacks++;
+		}
+	}
+	if (stop)
+	{
+		sim_s_stop(sercom, t);
+	}
+	else
+	{
+		sim_advance(t);
+	}
+	sim_close();
+
+	return acked;
+}
+
+uint8_t sim_master_read(uint8_t sercom, uint8_t addr, uint8_t *data, uint16_t len, uint8_t stop)
+{
+	uint64_t period = sim_master_period();
+	uint64_t t;
+	uint8_t acked;
+
+	sim_open();
+	acked = sim_s_address(sercom, addr, 1, &t);
+	for (uint16_t i = 0; acked && (i < len); i++)
+	{
+		SIM_R16(sercom, R_STATUS) &= (uint16_t)~S_RXNACK;
+		sim_s_hold(sercom, HOLD_TX, S_DRDY, &t);
+		data[i] = sim_sercom[sercom].tx;
+		t += 9 * period;	// 8 bits and the master's ACK or NACK
+		sim_bus[sercom].bytes++;
+	}
+	if (acked && len)
+	{
+		// The NACK'd last byte still raises DRDY, SCL is not held for it
+		SIM_R16(sercom, R_STATUS) |= S_RXNACK;
+		sim_s_flag(sercom, S_DRDY, t);
+	}
+	if (stop)
+	{
+		sim_s_stop(sercom, t);
+	}
+	else
+	{
+		sim_advance(t);
+	}
+	sim_close();
+
+	return acked;
+}
+
+//-----------------------------------------------------------------------------
+// Devices
+//-----------------------------------------------------------------------------
+
+uint8_t sim_regs_start(sim_dev_t *dev, uint8_t addr, uint8_t read)
+{
+	sim_regs_t *r = (sim_regs_t *)dev;
+
+	(void)addr;
+	r->got = read ? r->ptr_bytes : 0;	// A read carries on from the pointer
+	return 1;
+}
+
+uint8_t sim_regs_write(sim_dev_t *dev, uint8_t byte)
+{
+	sim_regs_t *r = (sim_regs_t *)dev;
+
+	if (r->got < r->ptr_bytes)
+	{
+		r->ptr = (uint16_t)((r->got ? (r->ptr << 8) : 0) | byte);
+		if (++r->got == r->ptr_bytes)
+		{
+			r->ptr %= r->size;
+		}
+		return 1;
+	}
+
+	r->map[r->ptr] = byte;
+	r->ptr = (uint16_t)((r->ptr + 1u) % r->size);
+	r->writes++;
+	return 1;
+}
+
+uint8_t sim_regs_read(sim_dev_t *dev)
+{
+	sim_regs_t *r = (sim_regs_t *)dev;
+	uint8_t byte = r->map[r->ptr];
+
+	r->ptr = (uint16_t)((r->ptr + 1u) % r->size);
+	r->reads++;
+	return byte;
+}
+
+uint8_t sim_eeprom_start(sim_dev_t *dev, uint8_t addr, uint8_t read)
+{
+	sim_eeprom_t *e = (sim_eeprom_t *)dev;
+	uint32_t low = (1UL << (8 * e->addr_bytes)) - 1;
+
+	if (sim_time < e->busy_until)
+	{
+		e->polls++;
+		return 0;
+	}
+
+	// Block bits of the device address are the top of the memory address
+	e->ptr = ((((uint32_t)(addr & dev->mask)) << (8 * e->addr_bytes)) | (e->ptr & low)) & (e->size - 1);
+	if (!read)
+	{
+		e->got = 0;
+		e->loaded = 0;
+		memset(e->marked, 0, sizeof(e->marked));
+	}
+	return 1;
+}
+
+uint8_t sim_eeprom_write(sim_dev_t *dev, uint8_t byte)
+{
+	sim_eeprom_t *e = (sim_eeprom_t *)dev;
+	uint32_t low = (1UL << (8 * e->addr_bytes)) - 1;
+	uint16_t offset;
+
+	if (e->got < e->addr_bytes)
+	{
+		e->ptr = ((e->ptr & ~low) | (((e->ptr << 8) | byte) & low)) & (e->size - 1);
+		e->got++;
+		return 1;
+	}
+
+	// Latched for the write cycle, wraps within the page
+	offset = (uint16_t)(e->ptr & (e->page - 1u));
+	if (e->marked[offset])
+	{
+		e->wrapped++;
+	}
+	e->latch[offset] = byte;
+	e->marked[offset] = 1;
+	e->loaded++;
+	e->ptr = (e->ptr & ~(uint32_t)(e->page - 1u)) | ((e->ptr + 1u) & (e->page - 1u));
+	return 1;
+}
+
+uint8_t sim_eeprom_read(sim_dev_t *dev)
+{
+	sim_eeprom_t *e = (sim_eeprom_t *)dev;
+	uint8_t byte = e->mem[e->ptr];
+
+	e->ptr = (e->ptr + 1u) & (e->size - 1);
+	return byte;
+}
+
+void sim_eeprom_stop(sim_dev_t *dev)
+{
+	sim_eeprom_t *e = (sim_eeprom_t *)dev;
+	uint32_t base = e->ptr & ~(uint32_t)(e->page - 1u);
+
+	if (!e->loaded)
+	{
+		return;
+	}
+	for (uint16_t i = 0; i < e->page; i++)
+	{
+		if (e->marked[i])
+		{
+			e->mem[base + i] = e->latch[i];
+		}
+	}
+	e->loaded = 0;
+	e->cycles++;
+	e->busy_until = sim_time + e->cycle_ns;
+}
+
+//-----------------------------------------------------------------------------
+// Setup and main loop
+//-----------------------------------------------------------------------------
+
+static void sim_map(uintptr_t base, size_t size)
+{
+	void *page = mmap((void *)base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (page != (void *)base)
+	{
+		sim_fatal("can't map the register page at", (unsigned)base);
+	}
+}
+
+/**
+	@brief Init
+	@details Map the register pages, reset values, install the trap. Call
+	before the first driver call.
+*/
+void sim_init(void)
+{
+	struct sigaction sa;
+
+	if (sim_ready)
+	{
+		return;
+	}
+	sim_ready = 1;
+
+	sim_map(SIM_GUARD_BASE, SIM_GUARD_SIZE);
+	sim_map(SIM_PM_BASE & ~0xFFFUL, 0x1000);
+
+	// SERCOM0 on PA14 and PA15 as the drivers default, every pin pulled up
+	sim_bus[0].sda_pin = 14;
+	sim_bus[0].scl_pin = 15;
+	memset(sim_scl, 1, sizeof(sim_scl));
+	sim_port_update();
+	SIM_PIC->PORTC = 0x18;
+	SIM_PIC->TRISC = 0xFF;
+	SIM_PIC->SSPSTAT = SSPSTAT_P;
+	sim_close();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO;
+	sa.sa_sigaction = sim_segv;
+	sigaction(SIGSEGV, &sa, 0);
+	sa.sa_sigaction = sim_step;
+	sigaction(SIGTRAP, &sa, 0);
+}
+
+uint64_t sim_now(void)
+{
+	return sim_time;
+}
+
+/**
+	@brief Delay
+	@details CPU time that touches no register, e.g. __delay_us or other work
+	@param[in] ns Nanoseconds
+*/
+void sim_delay(uint64_t ns)
+{
+	sim_open();
+	sim_polled_count = 0;
+	sim_advance(sim_time + ns);
+	sim_close();
+}
+
+/**
+	@brief Idle
+	@details Stands in for WFI: take a pending interrupt, or skip to the next
+	bus event and take what it raises.
+	@returns 0 if nothing is pending and nothing will happen
+*/
+uint8_t sim_idle(void)
+{
+	uint8_t which;
+	uint64_t next;
+
+	sim_open();
+	sim_polled_count = 0;
+	if (!sim_irq_run())
+	{
+		next = sim_next(&which);
+		if (next == SIM_NEVER)
+		{
+			sim_close();
+			return 0;
+		}
+		sim_advance(next);
+		sim_irq_run();
+	}
+	sim_close();
+
+	return 1;
+}
+
+/**
+	@brief Interrupt Handler
+	@param[in] irqn SERCOMn_IRQn, DMAC_IRQn or SIM_PIC_IRQ
+	@param[in] handler Run by sim_idle and the remote master while its flags are pending
+*/
+void sim_irq(int irqn, void (*handler)(void))
+{
+	sim_handler[irqn] = handler;
+}
+
+/**
+	@brief Timer
+	@details Stub periodic interrupt, e.g. for a TC whose registers are
+	plain memory: raises irqn every period_ns from now once it is enabled
+	in the NVIC. A tick taken late is not repeated, a missed one is lost.
+	@param[in] irqn Interrupt to raise
+	@param[in] period_ns Time between ticks, 0 stops the timer
+*/
+void sim_timer(int irqn, uint64_t period_ns)
+{
+	sim_tick.irqn = irqn;
+	sim_tick.period = period_ns;
+	sim_tick.at = sim_time + period_ns;
+	sim_tick.pending = 0;
+}
+
+/**
+	@brief Attach Device
+	@param[in] bus SERCOM number or SIM_PIC_BUS
+	@param[in] dev Device, first one answering an address wins
+*/
+void sim_attach(uint8_t bus, sim_dev_t *dev)
+{
+	sim_dev_t **link = &sim_bus[bus].devs;
+
+	while (*link)
+	{
+		link = &(*link)->next;
+	}
+	dev->next = 0;
+	*link = dev;
+}
+
+void sim_nvic_enable(int irqn)
+{
+	if ((irqn >= 0) && (irqn < SIM_IRQS))
+	{
+		sim_nvic[irqn] = 1;
+	}
+}
+
+uint32_t sim_get_primask(void)
+{
+	return sim_primask;
+}
+
+void sim_set_primask(uint32_t primask)
+{
+	sim_primask = primask & 1;
+}
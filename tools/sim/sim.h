@@ -0,0 +1,219 @@
+/**
+* @file sim.h
+* @brief MSF I2C Library, host register simulator for the SAMD and PIC drivers.
+* @note The stub sam.h and xc.h put the SERCOM, MSSP and SysTick registers on
+* guard pages at fixed addresses. Every driver access faults, the simulator
+* runs the bus model around the one instruction and protects the page again,
+* so i2c_samd.c, MSF_SAMD11_I2C.c and i2crxtx.c build unchanged. Time is
+* virtual: bus operations take their SCL periods, each register access costs
+* sim_access_ns, and a status register polled again with nothing written in
+* between jumps to the next bus event instead of spinning. Interrupts are
+* taken by sim_idle, which stands in for the main loop's WFI, and by the
+* remote master driving a SERCOM in target mode. The DMAC moves one beat per
+* SERCOM trigger after sim_dma_ns, through descriptors in host memory, so
+* programs using it link with -no-pie to keep their addresses in 32 bits.
+* Only target mode raises the triggers, a master with ADDR.LENEN stops the
+* simulation. PORT works out IN from DIR and OUT with every pin pulled up,
+* and a target can hold SDA low on a bus wired to its pins, see sim_bus_t
+* stuck. PM, GCLK and a TC are plain memory, sim_timer raises a periodic
+* interrupt in place of the TC. SCL low timeouts are not simulated. x86-64
+* Linux only, the trap needs the page fault error code and the trap flag.
+* @company Mechanical Squid Factory
+* @project MSF_I2C
+*/
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+
+// Register blocks, SERCOMs, SysTick, the DMAC and PORT on one guarded range
+#define SIM_GUARD_BASE		0x42000000UL
+#define SIM_GUARD_SIZE		0x4000UL
+#define SIM_SERCOM_BASE		0x42000800UL	// SERCOMn at SIM_SERCOM_BASE + n * SIM_SERCOM_SIZE, as on the SAMD21
+#define SIM_SERCOM_SIZE		0x400UL
+#define SIM_SERCOM_NUM		6
+#define SIM_PIC_BASE		0x42002000UL
+#define SIM_SYSTICK_BASE	0x42002800UL
+#define SIM_DMAC_BASE		0x42003000UL
+#define SIM_DMAC_CHANNELS	12
+#define SIM_PORT_BASE		0x42003800UL	// Groups 0 and 1, 0x80 each
+// Plain memory
+#define SIM_PM_BASE			0x40000400UL
+#define SIM_GCLK_BASE		0x40000C00UL
+#define SIM_TC_BASE			0x40000800UL	// Stands in for TC3, ticks come from sim_timer
+
+#define SIM_DMAC_IRQ		6				// DMAC_IRQn
+#define SIM_SERCOM_IRQ(n)	(9 + (n))		// SERCOMn_IRQn
+#define SIM_TC_IRQ			18				// TC3_IRQn
+#define SIM_PIC_IRQ			31				// MSSP, SSPIF or BCLIF
+#define SIM_IRQS			32
+#define SIM_PIC_BUS			SIM_SERCOM_NUM	// Bus number of the MSSP
+#define SIM_BUSES			(SIM_SERCOM_NUM + 1)
+#define SIM_NEVER			UINT64_MAX
+
+/**
+	@brief MSSP and the PIC registers around it
+	@details Laid out by xc.h, bit names as in the PIC18 data sheet
+*/
+typedef struct
+{
+	volatile uint8_t SSPCON1;
+	volatile uint8_t SSPCON2;	// SEN 0, RSEN 1, PEN 2, RCEN 3, ACKEN 4, ACKDT 5, ACKSTAT 6
+	volatile uint8_t SSPSTAT;	// BF 0, R_W 2, S 3, P 4
+	volatile uint8_t SSPADD;
+	volatile uint8_t SSPBUF;
+	volatile uint8_t PIR1;		// SSPIF 3
+	volatile uint8_t PIR2;		// BCLIF 3
+	volatile uint8_t PIE1;		// SSPIE 3
+	volatile uint8_t PIE2;		// BCLIE 3
+	volatile uint8_t INTCON;	// GIE 7
+	volatile uint8_t PORTC;		// SCL RC3, SDA RC4
+	volatile uint8_t TRISC;
+	volatile uint16_t TMR1;		// Fosc / 4, free running
+} sim_pic_t;
+
+#define SIM_PIC				((sim_pic_t *)SIM_PIC_BASE)
+#define SIM_PIC_FOSC		64000000UL	// _XTAL_FREQ in the stub main.h
+
+typedef struct sim_dev sim_dev_t;
+
+/**
+	@brief Device on a simulated bus
+	@details start runs for START and repeated start with the 7 bit address
+	the master sent, returning 0 NACKs it. write returns 0 to NACK the byte.
+	stop runs when the master releases the bus.
+*/
+struct sim_dev
+{
+	uint8_t addr;								// 7 bit address
+	uint8_t mask;								// Address bits the device ignores, e.g. EEPROM block bits
+	uint8_t (*start)(sim_dev_t *, uint8_t, uint8_t);	// Address, 1 for a read
+	uint8_t (*write)(sim_dev_t *, uint8_t);
+	uint8_t (*read)(sim_dev_t *);
+	void (*stop)(sim_dev_t *);
+	uint32_t stretch_ns;						// SCL held low per byte
+	sim_dev_t *next;
+};
+
+/**
+	@brief Register device
+	@details ptr_bytes pointer bytes, most significant first, then data from
+	the pointer on. Reads come from the pointer on, which auto increments and
+	wraps at size.
+*/
+typedef struct
+{
+	sim_dev_t dev;
+	uint8_t *map;
+	uint16_t size;
+	uint8_t ptr_bytes;
+	// Model state
+	uint16_t ptr;
+	uint8_t got;		// Pointer bytes received in this write
+	uint32_t writes;	// Data bytes stored
+	uint32_t reads;		// Bytes read
+} sim_regs_t;
+
+#define SIM_REGS_INIT(addr, regs, regs_size, pointer_bytes) \
+	{ { (addr), 0, sim_regs_start, sim_regs_write, sim_regs_read, 0, 0, 0 }, (regs), (regs_size), (pointer_bytes) }
+
+/**
+	@brief 24Cxx EEPROM
+	@details Memory address bits above addr_bytes come from the low device
+	address bits. Data is latched per page and wraps within it, the STOP
+	starts a cycle_ns write cycle during which every address is NACKed.
+	Sequential reads roll over the whole part.
+*/
+typedef struct
+{
+	sim_dev_t dev;
+	uint8_t *mem;
+	uint32_t size;		// Bytes, power of two
+	uint16_t page;		// Page size, power of two, up to 256
+	uint8_t addr_bytes;
+	uint32_t cycle_ns;	// Write cycle
+	// Model state
+	uint64_t busy_until;
+	uint32_t ptr;
+	uint8_t got;		// Address bytes received in this write
+	uint16_t loaded;	// Data bytes latched in this write
+	uint8_t latch[256];
+	uint8_t marked[256];
+	uint32_t cycles;	// Write cycles run
+	uint32_t polls;		// Addresses NACKed during a write cycle
+	uint32_t wrapped;	// Data bytes that wrapped within their page
+} sim_eeprom_t;
+
+#define SIM_EEPROM_INIT(addr, memory, mem_size, page_size, address_bytes, write_ns) \
+	{ { (addr), (uint8_t)((((mem_size) >> (8 * (address_bytes))) > 1) ? (((mem_size) >> (8 * (address_bytes))) - 1) : 0), \
+	    sim_eeprom_start, sim_eeprom_write, sim_eeprom_read, sim_eeprom_stop, 0, 0 }, \
+	  (memory), (mem_size), (page_size), (address_bytes), (write_ns) }
+
+/**
+	@brief Bus counters and injected faults
+*/
+typedef struct
+{
+	sim_dev_t *devs;		// Devices, see sim_attach
+	uint64_t free_at;		// Bus free from, after a STOP or another master's transfer
+	uint8_t lose;			// Address bytes still to lose arbitration
+	uint32_t hold_ns;		// How long the winning master keeps the bus
+	uint8_t sda_pin;		// PORT group 0 pins of a SERCOM bus, equal pins leave it unwired,
+	uint8_t scl_pin;		// sim_init wires SERCOM0 to PA14 and PA15
+	uint8_t stuck;			// SCL pulses a target keeps SDA low for, a START meanwhile is a bus error
+	// Counters
+	uint32_t starts;		// START and repeated start
+	uint32_t stops;
+	uint32_t bytes;			// Address and data bytes on the wire
+	uint32_t nacks;
+	uint32_t arblost;
+	uint32_t buserrs;		// STARTs made while SDA was stuck
+	uint64_t stretch_ns;	// SCL held by a target SERCOM waiting on its ISR
+} sim_bus_t;
+
+/**
+	@brief Simulator counters
+*/
+typedef struct
+{
+	uint64_t accesses;		// Register accesses trapped
+	uint64_t spin_ns;		// Time skipped for polls with nothing else to do
+	uint32_t irqs;			// Interrupt handlers run
+	uint32_t dma_beats;		// DMAC beats moved
+} sim_stats_t;
+
+extern sim_bus_t sim_bus[SIM_BUSES];
+extern sim_stats_t sim_stats;
+extern uint32_t sim_cpu_hz;			// SysTick and SERCOM core clock, default 48MHz
+extern uint32_t sim_access_ns;		// Cost of one register access
+extern uint32_t sim_irq_ns;			// Interrupt entry and exit
+extern uint32_t sim_dma_ns;			// DMAC trigger to beat written
+extern uint32_t sim_master_hz;		// SCL of the remote master, see sim_master_write
+
+void sim_init(void);
+uint64_t sim_now(void);
+void sim_delay(uint64_t ns);
+uint8_t sim_idle(void);
+void sim_irq(int irqn, void (*handler)(void));
+void sim_timer(int irqn, uint64_t period_ns);
+void sim_attach(uint8_t bus, sim_dev_t *dev);
+
+// Remote master on a SERCOM in target mode, return 1 if every byte was ACKed
+uint8_t sim_master_write(uint8_t sercom, uint8_t addr, const uint8_t *data, uint16_t len, uint8_t stop);
+uint8_t sim_master_read(uint8_t sercom, uint8_t addr, uint8_t *data, uint16_t len, uint8_t stop);
+
+// Device models
+uint8_t sim_regs_start(sim_dev_t *dev, uint8_t addr, uint8_t read);
+uint8_t sim_regs_write(sim_dev_t *dev, uint8_t byte);
+uint8_t sim_regs_read(sim_dev_t *dev);
+uint8_t sim_eeprom_start(sim_dev_t *dev, uint8_t addr, uint8_t read);
+uint8_t sim_eeprom_write(sim_dev_t *dev, uint8_t byte);
+uint8_t sim_eeprom_read(sim_dev_t *dev);
+void sim_eeprom_stop(sim_dev_t *dev);
+
+// Core hooks behind the stub headers
+void sim_nvic_enable(int irqn);
+uint32_t sim_get_primask(void);
+void sim_set_primask(uint32_t primask);
+
+#endif /* SIM_H_ */